@@ -0,0 +1,144 @@
+#include "commands.h"
+
+#include "selection/formKernel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+
+namespace Tool
+{
+	namespace
+	{
+		// Keeps the timed matches from being optimized away.
+		volatile std::uint64_t matchSink = 0;
+
+		struct Kernel {
+			std::string name;
+			std::function<void(Selection::FormID, std::uint64_t*)> match;
+		};
+
+		// Nanoseconds per lookup, over every value a_iterations times.
+		double Measure(const Kernel& a_kernel, const std::vector<Selection::FormID>& a_values, std::size_t a_words, std::size_t a_iterations)
+		{
+			std::vector<std::uint64_t> mask(a_words);
+			std::uint64_t sink = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < a_iterations; ++i) {
+				for (const auto value : a_values) {
+					std::fill(mask.begin(), mask.end(), 0);
+					a_kernel.match(value, mask.data());
+					sink += mask.front();
+				}
+			}
+			const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			matchSink = sink;
+			return elapsed / static_cast<double>(a_iterations * a_values.size());
+		}
+	}
+
+	int Bench(const Arguments& a_arguments)
+	{
+		std::size_t lists = 2000;
+		std::size_t forms = 4;
+		std::size_t iterations = 2000;
+		std::uint32_t seed = 1;
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (i + 1 >= a_arguments.size()) {
+				lists = 0;
+				break;
+			}
+			if (argument == "--lists") {
+				lists = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--forms") {
+				forms = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--iterations") {
+				iterations = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else if (argument == "--seed") {
+				seed = static_cast<std::uint32_t>(std::stoul(a_arguments[++i]));
+			}
+			else {
+				lists = 0;
+				break;
+			}
+		}
+		if (lists == 0 || forms == 0) {
+			std::cerr << "Usage: CombatMusicTool bench [--lists <count>] [--forms <count>] [--iterations <count>] [--seed <number>]\n";
+			return 2;
+		}
+
+		// Lists of 1 to a_forms FormIDs, drawn from a pool a few times larger than all lists together, like the
+		// worldspace conditions of a large rule set. Half of the looked up values are in some list.
+		std::mt19937 random{ seed };
+		const auto universe = static_cast<std::uint32_t>(lists * forms * 4);
+		const auto draw = [&]() { return static_cast<Selection::FormID>(random() % universe + 1); };
+		std::vector<std::vector<Selection::FormID>> conditions(lists);
+		Selection::FormBlocks blocks{};
+		for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(lists); ++i) {
+			for (std::size_t count = random() % forms + 1; count > 0; --count) {
+				conditions[i].push_back(draw());
+			}
+			Selection::Context::Normalize(conditions[i]);
+			blocks.Add(i, conditions[i]);
+		}
+		std::vector<Selection::FormID> values(256);
+		for (auto& value : values) {
+			const auto& list = conditions[random() % lists];
+			value = random() % 2 == 0 ? list[random() % list.size()] : draw();
+		}
+
+		std::vector<Kernel> kernels{};
+		// What checking the conditions rule by rule costs, one search per list.
+		kernels.push_back(Kernel{ "rule loop", [&](Selection::FormID a_value, std::uint64_t* a_mask) {
+									 for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(conditions.size()); ++i) {
+										 if (std::find(conditions[i].begin(), conditions[i].end(), a_value) != conditions[i].end()) {
+											 a_mask[i / 64] |= std::uint64_t{ 1 } << (i % 64);
+										 }
+									 }
+								 } });
+		for (std::size_t i = 0; i < Selection::TOTAL_FORM_KERNELS; ++i) {
+			const auto kernel = static_cast<Selection::FormKernel>(i);
+			if (!Selection::IsFormKernelSupported(kernel)) {
+				std::cout << "The " << Selection::GetFormKernelName(kernel) << " kernel is not supported on this CPU.\n";
+				continue;
+			}
+			kernels.push_back(Kernel{ std::string(Selection::GetFormKernelName(kernel)), [&blocks, kernel](Selection::FormID a_value, std::uint64_t* a_mask) {
+										 blocks.Match(a_value, a_mask, kernel);
+									 } });
+		}
+
+		const auto words = blocks.GetMaskWords();
+		std::size_t mismatches = 0;
+		std::vector<std::uint64_t> expected(words);
+		std::vector<std::uint64_t> actual(words);
+		for (const auto value : values) {
+			std::fill(expected.begin(), expected.end(), 0);
+			kernels.front().match(value, expected.data());
+			for (std::size_t i = 1; i < kernels.size(); ++i) {
+				std::fill(actual.begin(), actual.end(), 0);
+				kernels[i].match(value, actual.data());
+				if (actual != expected) {
+					mismatches++;
+					std::cout << "mismatch: " << kernels[i].name << " disagrees with the rule loop for 0x" << std::hex << value << std::dec << "\n";
+				}
+			}
+		}
+
+		std::cout << lists << " lists, " << blocks.GetSize() << " FormIDs, best kernel " << Selection::GetFormKernelName(Selection::GetBestFormKernel())
+				  << ", " << mismatches << " mismatch(es).\n";
+		std::cout << "Time per lookup in ns (" << iterations << " iterations over " << values.size() << " values):\n";
+		const auto baseline = Measure(kernels.front(), values, words, iterations);
+		std::cout << "  " << kernels.front().name << ": " << baseline << "\n";
+		for (std::size_t i = 1; i < kernels.size(); ++i) {
+			const auto time = Measure(kernels[i], values, words, iterations);
+			std::cout << "  " << kernels[i].name << ": " << time << " (" << baseline / time << "x)\n";
+		}
+		return mismatches == 0 ? 0 : 1;
+	}
+}
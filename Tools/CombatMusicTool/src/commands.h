@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Tool
+{
+	using Arguments = std::vector<std::string>;
+
+	// Each command returns the process exit code: 0 on success, 1 if problems were found, 2 on bad usage.
+	int Validate(const Arguments& a_arguments);
+	int Compile(const Arguments& a_arguments);
+	int Replay(const Arguments& a_arguments);
+	int Bench(const Arguments& a_arguments);
+	int Scale(const Arguments& a_arguments);
+	int Diagram(const Arguments& a_arguments);
+	int Program(const Arguments& a_arguments);
+	int Expressions(const Arguments& a_arguments);
+	int Ranges(const Arguments& a_arguments);
+}
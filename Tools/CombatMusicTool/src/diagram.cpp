@@ -0,0 +1,179 @@
+#include "commands.h"
+#include "generated.h"
+
+#include "selection/decisionDiagram.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Tool
+{
+	namespace
+	{
+		// Same numbering as the generated rules, so a location or keyword under a_forms can be one a rule asks about.
+		Selection::FormID MakeForm(Selection::ConditionType a_type, std::uint32_t a_number)
+		{
+			return static_cast<Selection::FormID>(static_cast<std::uint32_t>(a_type) * 0x1000 + a_number);
+		}
+
+		/*
+		* Twice a_forms locations, each inside an earlier one or in none, with up to two keywords each. The chain
+		* starts at the location itself, like the plugin captures it. Only the first a_forms locations and
+		* keywords can appear in rules, so the diagram has to leave the others out of its switch.
+		*/
+		Selection::DecisionDiagram::LocationTable GenerateLocations(std::uint32_t a_forms, std::mt19937& a_random)
+		{
+			Selection::DecisionDiagram::LocationTable response{};
+			std::vector<Selection::FormID> parents{};
+			for (std::uint32_t i = 1; i <= a_forms * 2; ++i) {
+				const auto location = MakeForm(Selection::ConditionType::kLocation, i);
+				Selection::DecisionDiagram::LocationInfo info{};
+				info.chain.push_back(location);
+				if (!parents.empty() && a_random() % 2 == 0) {
+					const auto& parent = response.at(parents[a_random() % parents.size()]);
+					info.chain.insert(info.chain.end(), parent.chain.begin(), parent.chain.end());
+				}
+				for (auto count = a_random() % 3; count > 0; --count) {
+					info.keywords.push_back(MakeForm(Selection::ConditionType::kLocationKeyword, a_random() % (a_forms + 1) + 1));
+				}
+				Selection::Context::Normalize(info.keywords);
+				parents.push_back(location);
+				response.emplace(location, std::move(info));
+			}
+			return response;
+		}
+	}
+
+	int Diagram(const Arguments& a_arguments)
+	{
+		std::size_t rounds = 2000;
+		std::size_t contexts = 16;
+		std::uint32_t seed = 1;
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (i + 1 >= a_arguments.size()) {
+				rounds = 0;
+				break;
+			}
+			if (argument == "--rounds") {
+				rounds = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--contexts") {
+				contexts = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--seed") {
+				seed = static_cast<std::uint32_t>(std::stoul(a_arguments[++i]));
+			}
+			else {
+				rounds = 0;
+				break;
+			}
+		}
+		if (rounds == 0 || contexts == 0) {
+			std::cerr << "Usage: CombatMusicTool diagram [--rounds <count>] [--contexts <count>] [--seed <number>]\n";
+			return 2;
+		}
+
+		// Small rule sets over a few forms each, so most contexts match several rules and ties are common.
+		std::mt19937 random{ seed };
+		std::size_t mismatches = 0;
+		std::size_t checks = 0;
+		std::size_t nodes = 0;
+		std::size_t tooLarge = 0;
+		// The same rules built again with grouped ties, whose groups must hold every rule that ties the winner.
+		std::size_t tiedNodes = 0;
+		std::size_t tiedBuilt = 0;
+		std::size_t tieMismatches = 0;
+		std::vector<std::uint32_t> groups{};
+		std::vector<std::uint32_t> tied{};
+		std::vector<std::uint32_t> expectedTies{};
+		for (std::size_t round = 0; round < rounds; ++round) {
+			const auto forms = random() % 4 + 1;
+			const auto shapes = GenerateRules(random() % 64 + 1, forms, random);
+			const auto locations = GenerateLocations(forms, random);
+			std::vector<const Selection::DecisionDiagram::LocationTable::value_type*> tabled{};
+			for (const auto& entry : locations) {
+				tabled.push_back(std::addressof(entry));
+			}
+
+			// Contexts must agree with the table. A location outside it has nothing a rule asks about, like
+			// the locations the plugin leaves out, and an empty chain has to match no location condition.
+			auto samples = GenerateContexts(contexts, forms, random);
+			for (auto& context : samples) {
+				const auto pick = random() % 8;
+				if (pick == 0) {
+					context.locations.clear();
+					context.locationKeywords.clear();
+				}
+				else if (pick == 1) {
+					context.locations = { MakeForm(Selection::ConditionType::kLocation, 0x800 + random() % 16) };
+					context.locationKeywords.clear();
+				}
+				else {
+					const auto& [location, info] = *tabled[random() % tabled.size()];
+					context.locations = info.chain;
+					context.locationKeywords = info.keywords;
+				}
+			}
+			samples.front().target = 0;
+
+			Selection::DecisionDiagram diagram{};
+			if (!diagram.Build(shapes, std::addressof(locations))) {
+				tooLarge++;
+				continue;
+			}
+			nodes += diagram.GetNodeCount();
+			Selection::DecisionDiagram grouped{};
+			const bool hasGroups = grouped.Build(shapes, std::addressof(locations), Selection::DecisionDiagram::DEFAULT_MAX_NODES, true);
+			if (hasGroups) {
+				tiedBuilt++;
+				tiedNodes += grouped.GetNodeCount();
+			}
+			for (const auto& context : samples) {
+				const auto expected = Selection::SelectRule(shapes, context);
+				const auto result = diagram.Evaluate(context);
+				const auto match = expected >= 0 ? Selection::MatchRule(shapes[expected], context) : Selection::Match{};
+				checks++;
+				if (result.rule != expected || (expected >= 0 && (result.high != match.high || result.score != match.score))) {
+					mismatches++;
+					std::cout << "mismatch in round " << round << ": MatchDegree picked " << expected << " (" << match.score
+							  << (match.high ? ", high" : "") << "), the diagram " << result.rule << " (" << result.score
+							  << (result.high ? ", high" : "") << ") in " << context.Describe() << "\n";
+				}
+				if (!hasGroups) {
+					continue;
+				}
+
+				expectedTies.clear();
+				for (std::uint32_t i = 0; expected >= 0 && i < shapes.size(); ++i) {
+					const auto candidate = Selection::MatchRule(shapes[i], context);
+					if (candidate.score == match.score && candidate.high == match.high) {
+						expectedTies.push_back(i);
+					}
+				}
+				groups.clear();
+				tied.clear();
+				grouped.GetTies(context, match, groups);
+				for (const auto group : groups) {
+					const auto rules = grouped.GetTieGroups().Get(group);
+					tied.insert(tied.end(), rules.begin(), rules.end());
+				}
+				std::ranges::sort(tied);
+				if (grouped.Evaluate(context).rule != expected || tied != expectedTies) {
+					tieMismatches++;
+					std::cout << "tie mismatch in round " << round << ": " << expectedTies.size() << " rule(s) tie with " << expected
+							  << ", the grouped diagram found " << tied.size() << " in " << context.Describe() << "\n";
+				}
+			}
+		}
+		const auto built = rounds - tooLarge;
+		std::cout << checks << " fuzzed selections over " << built << " diagrams with location tables, "
+				  << (built > 0 ? static_cast<double>(nodes) / static_cast<double>(built) : 0.0) << " nodes on average, " << tooLarge
+				  << " too large to build. " << mismatches << " mismatch(es) against the MatchDegree loop.\n";
+		std::cout << tiedBuilt << " diagrams with grouped ties, "
+				  << (tiedBuilt > 0 ? static_cast<double>(tiedNodes) / static_cast<double>(tiedBuilt) : 0.0) << " nodes on average. "
+				  << tieMismatches << " tie mismatch(es) against the MatchDegree loop.\n";
+		mismatches += tieMismatches;
+		return mismatches == 0 ? 0 : 1;
+	}
+}
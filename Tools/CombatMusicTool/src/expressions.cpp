@@ -0,0 +1,243 @@
+#include "commands.h"
+#include "generated.h"
+
+#include "selection/expression.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace Tool
+{
+	namespace
+	{
+		// Keeps the timed evaluations from being optimized away.
+		volatile std::int64_t evaluationSink = 0;
+
+		using Kind = Selection::ExpressionNode::Kind;
+
+		// Preorder, so every child lands after its parent. Tests hold one to three of a_forms forms.
+		std::uint32_t Grow(Selection::ExpressionDefinition& a_definition, std::size_t a_depth, std::size_t a_budget, std::uint32_t a_forms, std::mt19937& a_random)
+		{
+			const auto position = static_cast<std::uint32_t>(a_definition.nodes.size());
+			a_definition.nodes.emplace_back();
+			const bool leaf = a_depth >= Selection::MAX_EXPRESSION_DEPTH || a_definition.nodes.size() + 4 >= a_budget || a_random() % 3 == 0;
+			if (leaf) {
+				auto& node = a_definition.nodes[position];
+				node.kind = Kind::kTest;
+				node.type = static_cast<Selection::ConditionType>(a_random() % Selection::TOTAL_CONDITION_TYPES);
+				for (auto count = a_random() % 3 + 1; count > 0; --count) {
+					node.forms.push_back(std::to_string(a_random() % a_forms + 1));
+				}
+				return position;
+			}
+
+			const auto kind = a_random() % 5 == 0 ? Kind::kNot : a_random() % 2 == 0 ? Kind::kAll : Kind::kAny;
+			a_definition.nodes[position].kind = kind;
+			const auto children = kind == Kind::kNot ? 1 : a_random() % 3 + 2;
+			for (std::size_t i = 0; i < children; ++i) {
+				const auto child = Grow(a_definition, a_depth + 1, a_budget, a_forms, a_random);
+				a_definition.nodes[position].children.push_back(child);
+			}
+			return position;
+		}
+
+		// The straightforward way to run an expression: walk the tree, short-circuiting "all" like the bytecode
+		// does, and score each node the way the rules it stands for would be scored.
+		struct TreeNode {
+			Kind kind{ Kind::kTest };
+			Selection::ConditionType type{ Selection::ConditionType::kWorldspace };
+			std::vector<Selection::FormID> forms{};
+			std::vector<std::unique_ptr<TreeNode>> children{};
+
+			std::optional<Selection::Match> Walk(const Selection::Context& a_context) const
+			{
+				switch (kind) {
+				case Kind::kAll:
+					{
+						Selection::Match response{};
+						for (const auto& child : children) {
+							const auto match = child->Walk(a_context);
+							if (!match) {
+								return std::nullopt;
+							}
+							response.high = response.high || match->high;
+							response.score += match->score;
+						}
+						return response;
+					}
+				case Kind::kAny:
+					{
+						std::optional<Selection::Match> response{};
+						for (const auto& child : children) {
+							const auto match = child->Walk(a_context);
+							if (match && (!response || std::make_pair(match->high, match->score) > std::make_pair(response->high, response->score))) {
+								response = match;
+							}
+						}
+						return response;
+					}
+				case Kind::kNot:
+					return children.front()->Walk(a_context) ? std::nullopt : std::optional{ Selection::Match{} };
+				case Kind::kTest:
+				default:
+					return a_context.HasAny(type, forms) ? std::optional{ Selection::Match{ Selection::IsHighPriority(type), 1 } } : std::nullopt;
+				}
+			}
+
+			// A true expression scores at least 1.
+			std::optional<Selection::Match> Evaluate(const Selection::Context& a_context) const
+			{
+				auto response = Walk(a_context);
+				if (response) {
+					response->score = std::max(response->score, 1);
+				}
+				return response;
+			}
+		};
+
+		bool operator==(const Selection::Match& a_left, const Selection::Match& a_right)
+		{
+			return a_left.high == a_right.high && a_left.score == a_right.score;
+		}
+
+		std::unique_ptr<TreeNode> BuildTree(const Selection::ExpressionDefinition& a_definition, std::uint32_t a_node)
+		{
+			const auto& node = a_definition.nodes[a_node];
+			auto response = std::make_unique<TreeNode>();
+			response->kind = node.kind;
+			response->type = node.type;
+			for (const auto& form : node.forms) {
+				response->forms.push_back(static_cast<Selection::FormID>(std::stoul(form)));
+			}
+			for (const auto child : node.children) {
+				response->children.push_back(BuildTree(a_definition, child));
+			}
+			return response;
+		}
+
+		// Nanoseconds per evaluation, of every expression on every context a_iterations times.
+		template <class F>
+		double Measure(F&& a_evaluate, std::size_t a_expressions, const std::vector<Selection::Context>& a_contexts, std::size_t a_iterations)
+		{
+			std::int64_t sink = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < a_iterations; ++i) {
+				for (const auto& context : a_contexts) {
+					for (std::size_t expression = 0; expression < a_expressions; ++expression) {
+						const auto match = a_evaluate(expression, context);
+						sink += match ? match->score : 0;
+					}
+				}
+			}
+			const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			evaluationSink = sink;
+			return elapsed / static_cast<double>(a_iterations * a_contexts.size() * a_expressions);
+		}
+	}
+
+	int Expressions(const Arguments& a_arguments)
+	{
+		std::size_t count = 1000;
+		std::size_t nodes = 32;
+		std::size_t contexts = 256;
+		std::size_t iterations = 20;
+		std::uint32_t seed = 1;
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (i + 1 >= a_arguments.size()) {
+				count = 0;
+				break;
+			}
+			if (argument == "--expressions") {
+				count = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--nodes") {
+				nodes = std::clamp<std::size_t>(std::stoull(a_arguments[++i]), 1, Selection::MAX_EXPRESSION_NODES);
+			}
+			else if (argument == "--contexts") {
+				contexts = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--iterations") {
+				iterations = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else if (argument == "--seed") {
+				seed = static_cast<std::uint32_t>(std::stoul(a_arguments[++i]));
+			}
+			else {
+				count = 0;
+				break;
+			}
+		}
+		if (count == 0 || contexts == 0) {
+			std::cerr << "Usage: CombatMusicTool expressions [--expressions <count>] [--nodes <count>] [--contexts <count>] [--iterations <count>] [--seed <number>]\n";
+			return 2;
+		}
+
+		// Few forms, so tests pass about as often as they fail and "all" often leaves early.
+		constexpr std::uint32_t forms = 8;
+		std::mt19937 random{ seed };
+		const auto resolve = [](Selection::ConditionType, const std::string& a_reference) -> std::optional<Selection::FormID> {
+			return static_cast<Selection::FormID>(std::stoul(a_reference));
+		};
+
+		std::vector<Selection::Expression> compiled(count);
+		std::vector<std::unique_ptr<TreeNode>> trees{};
+		std::size_t totalNodes = 0;
+		std::size_t totalInstructions = 0;
+		for (auto& expression : compiled) {
+			Selection::ExpressionDefinition definition{};
+			Grow(definition, 1, nodes, forms, random);
+			std::string error{};
+			if (!expression.Compile(definition, resolve, error)) {
+				std::cout << "Could not compile " << definition.Describe() << ": " << error << "\n";
+				return 1;
+			}
+			trees.push_back(BuildTree(definition, 0));
+			totalNodes += definition.nodes.size();
+			totalInstructions += expression.GetCode().size();
+		}
+		auto samples = GenerateContexts(contexts, forms, random);
+		// Missing values and an empty location chain have to match nothing.
+		samples.front().target = 0;
+		samples.back().locations.clear();
+
+		// Both the truth and the Match have to agree, and no Match may beat the expression's bound.
+		std::size_t mismatches = 0;
+		std::size_t scoreMismatches = 0;
+		std::size_t overBound = 0;
+		for (const auto& context : samples) {
+			for (std::size_t i = 0; i < count; ++i) {
+				const auto actual = compiled[i].Evaluate(context);
+				const auto expected = trees[i]->Evaluate(context);
+				if (actual.has_value() != expected.has_value()) {
+					mismatches++;
+				}
+				else if (actual && !(*actual == *expected)) {
+					scoreMismatches++;
+				}
+				const auto bound = compiled[i].GetBound();
+				if (actual && (actual->score > bound.score || (actual->high && !bound.high))) {
+					overBound++;
+				}
+			}
+		}
+		std::cout << count << " expressions, " << static_cast<double>(totalNodes) / static_cast<double>(count) << " nodes and "
+				  << static_cast<double>(totalInstructions) / static_cast<double>(count) << " instructions on average. "
+				  << count * samples.size() << " evaluations, " << mismatches << " truth and " << scoreMismatches
+				  << " score mismatch(es) against the tree walk, " << overBound << " over the bound.\n";
+		mismatches += scoreMismatches + overBound;
+
+		std::cout << "Time per evaluation in ns (" << iterations << " iterations):\n";
+		const auto walked = Measure([&](std::size_t a_expression, const Selection::Context& a_context) { return trees[a_expression]->Evaluate(a_context); },
+			count, samples, iterations);
+		std::cout << "  tree walk: " << walked << " (" << 1000.0 / walked << "M evaluations/s)\n";
+		const auto interpreted = Measure([&](std::size_t a_expression, const Selection::Context& a_context) { return compiled[a_expression].Evaluate(a_context); },
+			count, samples, iterations);
+		std::cout << "  bytecode: " << interpreted << " (" << 1000.0 / interpreted << "M evaluations/s, " << walked / interpreted << "x)\n";
+		return mismatches == 0 ? 0 : 1;
+	}
+}
@@ -0,0 +1,66 @@
+#include "generated.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace Tool
+{
+	namespace
+	{
+		constexpr Selection::ConditionType TYPES[] = {
+			Selection::ConditionType::kWorldspace,
+			Selection::ConditionType::kCell,
+			Selection::ConditionType::kLocation,
+			Selection::ConditionType::kLocationKeyword,
+			Selection::ConditionType::kCombatTarget,
+			Selection::ConditionType::kCombatTargetKeyword,
+			Selection::ConditionType::kCombatant
+		};
+
+		// Forms of different types never collide, so a form only ever matches its own type.
+		Selection::FormID Draw(Selection::ConditionType a_type, std::uint32_t a_forms, std::mt19937& a_random)
+		{
+			return static_cast<Selection::FormID>(static_cast<std::uint32_t>(a_type) * 0x1000 + a_random() % a_forms + 1);
+		}
+	}
+
+	std::vector<Selection::RuleShape> GenerateRules(std::size_t a_count, std::uint32_t a_forms, std::mt19937& a_random)
+	{
+		std::vector<Selection::RuleShape> shapes(a_count);
+		for (auto& shape : shapes) {
+			std::vector<Selection::ConditionType> picked(std::begin(TYPES), std::end(TYPES));
+			std::shuffle(picked.begin(), picked.end(), a_random);
+			picked.resize(a_random() % 3 + 1);
+			std::sort(picked.begin(), picked.end());
+			for (const auto type : picked) {
+				Selection::ConditionShape condition{ type, a_random() % 3 != 0, {} };
+				for (std::size_t count = a_random() % 3 + 1; count > 0; --count) {
+					condition.forms.push_back(Draw(type, a_forms, a_random));
+				}
+				Selection::Context::Normalize(condition.forms);
+				shape.push_back(std::move(condition));
+			}
+		}
+		return shapes;
+	}
+
+	std::vector<Selection::Context> GenerateContexts(std::size_t a_count, std::uint32_t a_forms, std::mt19937& a_random)
+	{
+		std::vector<Selection::Context> contexts(a_count);
+		for (auto& context : contexts) {
+			context.worldspace = Draw(Selection::ConditionType::kWorldspace, a_forms, a_random);
+			context.cell = Draw(Selection::ConditionType::kCell, a_forms, a_random);
+			context.target = Draw(Selection::ConditionType::kCombatTarget, a_forms, a_random);
+			for (std::size_t i = 0; i < 3; ++i) {
+				context.locations.push_back(Draw(Selection::ConditionType::kLocation, a_forms, a_random));
+				context.locationKeywords.push_back(Draw(Selection::ConditionType::kLocationKeyword, a_forms, a_random));
+				context.targetKeywords.push_back(Draw(Selection::ConditionType::kCombatTargetKeyword, a_forms, a_random));
+				context.combatants.push_back(Draw(Selection::ConditionType::kCombatant, a_forms, a_random));
+			}
+			Selection::Context::Normalize(context.locationKeywords);
+			Selection::Context::Normalize(context.targetKeywords);
+			Selection::Context::Normalize(context.combatants);
+		}
+		return contexts;
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "selection/ruleShape.h"
+
+#include <random>
+#include <vector>
+
+namespace Tool
+{
+	/*
+	* Rules like those of a large patch: one to three conditions each, AND or OR, over a_forms forms per
+	* type. With few forms many rules match and scores tie often.
+	*/
+	std::vector<Selection::RuleShape> GenerateRules(std::size_t a_count, std::uint32_t a_forms, std::mt19937& a_random);
+	// Contexts over the same forms, three of each set.
+	std::vector<Selection::Context> GenerateContexts(std::size_t a_count, std::uint32_t a_forms, std::mt19937& a_random);
+}
@@ -0,0 +1,84 @@
+#include "commands.h"
+
+#include <iostream>
+#include <string_view>
+
+namespace
+{
+	void PrintUsage()
+	{
+		std::cerr << "Usage: CombatMusicTool <command> [options]\n"
+					 "\n"
+					 "Commands:\n"
+					 "  validate <file or folder>... [--manifest <file>] [--startup-trace <file.json>]\n"
+					 "      Checks rule files the same way the plugin reads them, and reports every problem with\n"
+					 "      its file, rule number and field. With a manifest, form references are checked too.\n"
+					 "      --startup-trace writes how long each phase took as Chrome trace-event JSON.\n"
+					 "  compile <file or folder>... --output <file.cmrules> [--manifest <file>] [--startup-trace <file.json>]\n"
+					 "      Validates the rules and writes them as a compiled rule set the plugin loads without\n"
+					 "      parsing JSON. With a manifest, EditorIDs are rewritten to Plugin|0xID references.\n"
+					 "  replay <file.trace> [--iterations <count>] [--verbose]\n"
+					 "      Feeds a trace recorded by the plugin through every selection engine, checks that each\n"
+					 "      one picks the recorded rule, and reports their latency.\n"
+					 "  bench [--lists <count>] [--forms <count>] [--iterations <count>] [--seed <number>]\n"
+					 "      Times every FormID kernel this CPU supports against checking the lists one by one, on\n"
+					 "      random condition lists, and checks that they all find the same lists.\n"
+					 "  scale [--rules <count>] [--contexts <count>] [--iterations <count>] [--seed <number>] [--threads <count>]\n"
+					 "      Times parallel rule scoring on generated rules with 1, 2, 4... threads up to --threads,\n"
+					 "      every hardware thread by default, and checks that it always picks the rule the serial\n"
+					 "      loop picks.\n"
+					 "  diagram [--rounds <count>] [--contexts <count>] [--seed <number>]\n"
+					 "      Checks compiled decision diagrams against the MatchDegree loop on random rule sets, with\n"
+					 "      random location tables and contexts that agree with them.\n"
+					 "  program [--rules <count>] [--contexts <count>] [--iterations <count>] [--fuzz <rounds>] [--seed <number>]\n"
+					 "      Checks the rule program interpreter and its native code against the MatchDegree loop on\n"
+					 "      random rule sets, then times all three on generated rules.\n"
+					 "  expressions [--expressions <count>] [--nodes <count>] [--contexts <count>] [--iterations <count>] [--seed <number>]\n"
+					 "      Checks the expression bytecode against walking the expression tree on random nested\n"
+					 "      expressions, then times both.\n"
+					 "  ranges [--ranges <count>] [--width <fraction>] [--values <count>] [--iterations <count>] [--seed <number>]\n"
+					 "      Checks the interval tree against testing every range on many overlapping level ranges,\n"
+					 "      then times both for 100, 1000... ranges up to --ranges.\n";
+	}
+}
+
+int main(int a_argc, char* a_argv[])
+{
+	if (a_argc < 2) {
+		PrintUsage();
+		return 2;
+	}
+
+	const std::string_view command = a_argv[1];
+	const Tool::Arguments arguments(a_argv + 2, a_argv + a_argc);
+	if (command == "validate") {
+		return Tool::Validate(arguments);
+	}
+	if (command == "compile") {
+		return Tool::Compile(arguments);
+	}
+	if (command == "replay") {
+		return Tool::Replay(arguments);
+	}
+	if (command == "bench") {
+		return Tool::Bench(arguments);
+	}
+	if (command == "scale") {
+		return Tool::Scale(arguments);
+	}
+	if (command == "diagram") {
+		return Tool::Diagram(arguments);
+	}
+	if (command == "program") {
+		return Tool::Program(arguments);
+	}
+	if (command == "expressions") {
+		return Tool::Expressions(arguments);
+	}
+	if (command == "ranges") {
+		return Tool::Ranges(arguments);
+	}
+
+	PrintUsage();
+	return 2;
+}
@@ -0,0 +1,161 @@
+#include "manifest.h"
+
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+namespace Tool
+{
+	namespace
+	{
+		std::string ToLower(std::string_view a_value)
+		{
+			std::string response(a_value);
+			for (auto& character : response) {
+				character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+			}
+			return response;
+		}
+
+		std::string_view Trim(std::string_view a_value)
+		{
+			while (!a_value.empty() && std::isspace(static_cast<unsigned char>(a_value.front()))) {
+				a_value.remove_prefix(1);
+			}
+			while (!a_value.empty() && std::isspace(static_cast<unsigned char>(a_value.back()))) {
+				a_value.remove_suffix(1);
+			}
+			return a_value;
+		}
+	}
+
+	bool Manifest::Load(const std::string& a_path, std::string& a_error)
+	{
+		std::ifstream input(a_path);
+		if (!input) {
+			a_error = "Could not open manifest <" + a_path + ">.";
+			return false;
+		}
+
+		enum class Section {
+			kNone,
+			kPlugins,
+			kForms
+		};
+
+		auto section = Section::kNone;
+		std::string rawLine{};
+		std::size_t lineNumber = 0;
+		while (std::getline(input, rawLine)) {
+			++lineNumber;
+			const auto line = Trim(rawLine);
+			if (line.empty() || line.front() == ';' || line.front() == '#') {
+				continue;
+			}
+
+			const auto fail = [&](std::string_view a_message) {
+				a_error = "<" + a_path + "> line " + std::to_string(lineNumber) + ": " + std::string(a_message);
+				return false;
+			};
+
+			if (line.front() == '[') {
+				const auto name = ToLower(line);
+				if (name == "[plugins]") {
+					section = Section::kPlugins;
+				}
+				else if (name == "[forms]") {
+					section = Section::kForms;
+				}
+				else {
+					return fail("Unknown section.");
+				}
+				continue;
+			}
+
+			switch (section) {
+			case Section::kPlugins:
+				plugins.insert(ToLower(line));
+				break;
+			case Section::kForms:
+				{
+					std::istringstream stream{ std::string(line) };
+					Form form{};
+					std::string extra{};
+					if (!(stream >> form.signature >> form.editorID) || (stream >> form.reference && stream >> extra)) {
+						return fail("Expected <Signature> <EditorID or -> [Plugin|0xID].");
+					}
+					if (form.editorID == "-") {
+						form.editorID.clear();
+					}
+
+					const auto position = forms.size();
+					if (!form.reference.empty()) {
+						std::string_view plugin{};
+						Selection::FormID formID = 0;
+						if (!Selection::SplitFormReference(form.reference, plugin, formID)) {
+							return fail("Malformed form reference.");
+						}
+						if (!HasPlugin(plugin)) {
+							return fail("Form belongs to a plugin that is not listed in [Plugins].");
+						}
+						byReference[Key(plugin, formID)] = position;
+					}
+					else if (form.editorID.empty()) {
+						return fail("Form has neither an EditorID nor a reference.");
+					}
+					if (!form.editorID.empty()) {
+						byEditorID[ToLower(form.editorID)] = position;
+					}
+					forms.push_back(std::move(form));
+				}
+				break;
+			default:
+				return fail("Entry outside of a section.");
+			}
+		}
+		return true;
+	}
+
+	bool Manifest::HasPlugin(std::string_view a_plugin) const
+	{
+		return plugins.contains(ToLower(a_plugin));
+	}
+
+	const Manifest::Form* Manifest::FindByEditorID(std::string_view a_editorID) const
+	{
+		const auto it = byEditorID.find(ToLower(a_editorID));
+		return it != byEditorID.end() ? &forms[it->second] : nullptr;
+	}
+
+	const Manifest::Form* Manifest::FindByReference(std::string_view a_plugin, Selection::FormID a_formID) const
+	{
+		const auto it = byReference.find(Key(a_plugin, a_formID));
+		return it != byReference.end() ? &forms[it->second] : nullptr;
+	}
+
+	std::string Manifest::Key(std::string_view a_plugin, Selection::FormID a_formID)
+	{
+		return ToLower(a_plugin) + "|" + std::to_string(a_formID & 0x00FFFFFF);
+	}
+
+	std::string_view GetExpectedSignature(Selection::ConditionType a_type)
+	{
+		switch (a_type) {
+		case Selection::ConditionType::kWorldspace:
+			return "WRLD";
+		case Selection::ConditionType::kCell:
+			return "CELL";
+		case Selection::ConditionType::kLocation:
+			return "LCTN";
+		case Selection::ConditionType::kLocationKeyword:
+		case Selection::ConditionType::kCombatTargetKeyword:
+		case Selection::ConditionType::kCombatantKeyword:
+			return "KYWD";
+		case Selection::ConditionType::kCombatTarget:
+		case Selection::ConditionType::kCombatant:
+			return "NPC_";
+		default:
+			return "";
+		}
+	}
+}
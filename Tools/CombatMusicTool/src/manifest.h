@@ -0,0 +1,45 @@
+#pragma once
+
+#include "selection/ruleParser.h"
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Tool
+{
+	// Load order description used to check form references without the game. Text format:
+	//   [Plugins]
+	//   Skyrim.esm
+	//   [Forms]
+	//   <Signature> <EditorID or -> [Plugin|0xLocalID]
+	// Lines starting with ; or # are comments.
+	class Manifest
+	{
+	public:
+		struct Form {
+			std::string signature;
+			std::string editorID;
+			// "Plugin|0xID", empty if only the EditorID is known.
+			std::string reference;
+		};
+
+		bool Load(const std::string& a_path, std::string& a_error);
+
+		bool HasPlugin(std::string_view a_plugin) const;
+		const Form* FindByEditorID(std::string_view a_editorID) const;
+		const Form* FindByReference(std::string_view a_plugin, Selection::FormID a_formID) const;
+
+	private:
+		static std::string Key(std::string_view a_plugin, Selection::FormID a_formID);
+
+		std::unordered_set<std::string> plugins{};
+		std::vector<Form> forms{};
+		std::unordered_map<std::string, std::size_t> byEditorID{};
+		std::unordered_map<std::string, std::size_t> byReference{};
+	};
+
+	// Record signature a condition's forms must have, as used in the manifest.
+	std::string_view GetExpectedSignature(Selection::ConditionType a_type);
+	inline constexpr std::string_view MUSIC_SIGNATURE = "MUSC";
+}
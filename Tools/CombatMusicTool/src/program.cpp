@@ -0,0 +1,146 @@
+#include "commands.h"
+#include "generated.h"
+
+#include "selection/ruleJit.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace Tool
+{
+	namespace
+	{
+		// Keeps the timed selections from being optimized away.
+		volatile std::int64_t selectionSink = 0;
+
+		// Nanoseconds per selection, over every context a_iterations times.
+		template <class F>
+		double Measure(F&& a_select, const std::vector<Selection::Context>& a_contexts, std::size_t a_iterations)
+		{
+			std::int64_t sink = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < a_iterations; ++i) {
+				for (const auto& context : a_contexts) {
+					sink += a_select(context);
+				}
+			}
+			const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			selectionSink = sink;
+			return elapsed / static_cast<double>(a_iterations * a_contexts.size());
+		}
+	}
+
+	int Program(const Arguments& a_arguments)
+	{
+		std::size_t rules = 5000;
+		std::size_t contexts = 256;
+		std::size_t iterations = 50;
+		std::size_t rounds = 2000;
+		std::uint32_t seed = 1;
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (i + 1 >= a_arguments.size()) {
+				rules = 0;
+				break;
+			}
+			if (argument == "--rules") {
+				rules = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--contexts") {
+				contexts = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--iterations") {
+				iterations = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else if (argument == "--fuzz") {
+				rounds = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--seed") {
+				seed = static_cast<std::uint32_t>(std::stoul(a_arguments[++i]));
+			}
+			else {
+				rules = 0;
+				break;
+			}
+		}
+		if (rules == 0 || contexts == 0) {
+			std::cerr << "Usage: CombatMusicTool program [--rules <count>] [--contexts <count>] [--iterations <count>] [--fuzz <rounds>] [--seed <number>]\n";
+			return 2;
+		}
+
+		const bool native = Selection::RuleJit::IsSupported();
+		if (!native) {
+			std::cout << "This build has no native code generator, only the interpreter is checked.\n";
+		}
+
+		// Small rule sets over a few forms each, so most contexts match several rules and ties are common.
+		std::mt19937 random{ seed };
+		std::size_t mismatches = 0;
+		std::size_t checks = 0;
+		Selection::RuleProgram::Input input{};
+		for (std::size_t round = 0; round < rounds; ++round) {
+			const auto shapes = GenerateRules(random() % 64 + 1, random() % 4 + 1, random);
+			auto samples = GenerateContexts(16, 4, random);
+			// Missing values and an empty location chain have to match nothing.
+			samples.front().target = 0;
+			samples.back().locations.clear();
+
+			Selection::RuleProgram program{};
+			program.Build(shapes);
+			Selection::RuleJit jit{};
+			if (native && !jit.Build(program)) {
+				std::cout << "Could not generate native code for round " << round << ".\n";
+				mismatches++;
+			}
+			for (const auto& context : samples) {
+				const auto expected = Selection::SelectRule(shapes, context);
+				program.Prepare(context, input);
+				const auto interpreted = program.Run(input);
+				const auto compiled = jit.IsBuilt() ? jit.Run(input) : expected;
+				checks++;
+				if (interpreted != expected || compiled != expected) {
+					mismatches++;
+					std::cout << "mismatch in round " << round << ": MatchDegree picked " << expected << ", the interpreter " << interpreted
+							  << ", native code " << compiled << " in " << context.Describe() << "\n";
+				}
+			}
+		}
+		std::cout << checks << " fuzzed selections over " << rounds << " rule sets, " << mismatches << " mismatch(es).\n";
+
+		const auto shapes = GenerateRules(rules, 256, random);
+		const auto samples = GenerateContexts(contexts, 256, random);
+		Selection::RuleProgram program{};
+		program.Build(shapes);
+		Selection::RuleJit jit{};
+		if (native) {
+			jit.Build(program);
+		}
+		std::cout << rules << " rules: " << program.GetTests().size() << " tests over " << program.GetAtomCount() << " atoms, "
+				  << program.GetMemoryUsage() / 1024 << "KB program, " << jit.GetCodeSize() / 1024 << "KB native code.\n";
+		for (const auto& context : samples) {
+			program.Prepare(context, input);
+			const auto expected = Selection::SelectRule(shapes, context);
+			if (program.Run(input) != expected || (jit.IsBuilt() && jit.Run(input) != expected)) {
+				mismatches++;
+			}
+		}
+
+		std::cout << "Time per selection in us, preparing the context included (" << iterations << " iterations):\n";
+		const auto linear = Measure([&](const Selection::Context& a_context) { return Selection::SelectRule(shapes, a_context); }, samples, iterations);
+		std::cout << "  MatchDegree loop: " << linear / 1000.0 << "\n";
+		const auto interpreted = Measure([&](const Selection::Context& a_context) {
+			program.Prepare(a_context, input);
+			return program.Run(input);
+		}, samples, iterations);
+		std::cout << "  interpreter: " << interpreted / 1000.0 << " (" << linear / interpreted << "x)\n";
+		if (jit.IsBuilt()) {
+			const auto compiled = Measure([&](const Selection::Context& a_context) {
+				program.Prepare(a_context, input);
+				return jit.Run(input);
+			}, samples, iterations);
+			std::cout << "  native: " << compiled / 1000.0 << " (" << linear / compiled << "x)\n";
+		}
+		return mismatches == 0 ? 0 : 1;
+	}
+}
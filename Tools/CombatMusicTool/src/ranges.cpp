@@ -0,0 +1,139 @@
+#include "commands.h"
+
+#include "selection/intervalTree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace Tool
+{
+	namespace
+	{
+		// Keeps the timed lookups from being optimized away.
+		volatile std::int64_t lookupSink = 0;
+
+		// Nanoseconds per lookup, over every value a_iterations times.
+		template <class F>
+		double Measure(F&& a_lookup, const std::vector<float>& a_values, std::size_t a_iterations)
+		{
+			std::int64_t sink = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < a_iterations; ++i) {
+				for (const auto value : a_values) {
+					sink += a_lookup(value);
+				}
+			}
+			const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			lookupSink = sink;
+			return elapsed / static_cast<double>(a_iterations * a_values.size());
+		}
+	}
+
+	int Ranges(const Arguments& a_arguments)
+	{
+		std::size_t ranges = 100000;
+		double width = 0.2;
+		std::size_t values = 1024;
+		std::size_t iterations = 20;
+		std::uint32_t seed = 1;
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (i + 1 >= a_arguments.size()) {
+				ranges = 0;
+				break;
+			}
+			if (argument == "--ranges") {
+				ranges = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--width") {
+				width = std::clamp(std::stod(a_arguments[++i]), 0.0, 1.0);
+			}
+			else if (argument == "--values") {
+				values = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--iterations") {
+				iterations = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else if (argument == "--seed") {
+				seed = static_cast<std::uint32_t>(std::stoul(a_arguments[++i]));
+			}
+			else {
+				ranges = 0;
+				break;
+			}
+		}
+		if (ranges == 0 || values == 0) {
+			std::cerr << "Usage: CombatMusicTool ranges [--ranges <count>] [--width <fraction>] [--values <count>] [--iterations <count>] [--seed <number>]\n";
+			return 2;
+		}
+
+		// Levels from 1 to 100, with range widths spread evenly up to twice --width of that, so ranges overlap
+		// heavily. Ends on whole levels, like most rules would write them, so values often sit on an end.
+		constexpr float top = 100.0f;
+		std::mt19937 random{ seed };
+		std::uniform_real_distribution<float> position{ 1.0f, top };
+		std::uniform_real_distribution<float> spread{ 0.0f, static_cast<float>(2.0 * width) * top };
+		std::vector<Selection::IntervalTree::Entry> all{};
+		for (std::uint32_t i = 0; i < ranges; ++i) {
+			const auto low = std::floor(position(random));
+			all.push_back(Selection::IntervalTree::Entry{ Selection::Range{ low, std::min(top, std::floor(low + spread(random))) }, i });
+		}
+		std::vector<float> samples(values);
+		for (auto& value : samples) {
+			value = random() % 4 == 0 ? std::floor(position(random)) : position(random);
+		}
+
+		std::vector<std::size_t> counts{};
+		for (std::size_t count = 100; count < ranges; count *= 10) {
+			counts.push_back(count);
+		}
+		counts.push_back(ranges);
+
+		std::cout << ranges << " ranges of levels 1 to 100, widths up to " << 2.0 * width * 100.0 << "% of that, " << values << " values.\n";
+		std::cout << "Time per lookup in us (" << iterations << " iterations):\n";
+		std::size_t mismatches = 0;
+		for (const auto count : counts) {
+			const std::vector<Selection::IntervalTree::Entry> entries(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(count));
+			Selection::IntervalTree tree{};
+			tree.Build(entries);
+
+			// Every lookup has to find exactly the ranges checking each one finds.
+			std::size_t found = 0;
+			std::vector<std::uint32_t> expected{};
+			std::vector<std::uint32_t> actual{};
+			for (const auto value : samples) {
+				expected.clear();
+				actual.clear();
+				for (const auto& entry : entries) {
+					if (entry.range.Contains(value)) {
+						expected.push_back(entry.owner);
+					}
+				}
+				tree.Find(value, [&](std::uint32_t a_owner) { actual.push_back(a_owner); });
+				std::ranges::sort(actual);
+				mismatches += actual != expected ? 1 : 0;
+				found += expected.size();
+			}
+
+			const auto scanned = Measure([&](float a_value) {
+				std::int64_t hits = 0;
+				for (const auto& entry : entries) {
+					hits += entry.range.Contains(a_value) ? 1 : 0;
+				}
+				return hits;
+			}, samples, iterations);
+			const auto indexed = Measure([&](float a_value) {
+				std::int64_t hits = 0;
+				tree.Find(a_value, [&](std::uint32_t) { hits++; });
+				return hits;
+			}, samples, iterations);
+			std::cout << "  " << count << " ranges, " << static_cast<double>(found) / static_cast<double>(samples.size()) << " hits on average, "
+					  << tree.GetNodeCount() << " nodes, depth " << tree.GetDepth() << ": scan " << scanned / 1000.0
+					  << ", interval tree " << indexed / 1000.0 << " (" << scanned / indexed << "x)\n";
+		}
+		std::cout << mismatches << " mismatch(es) against checking every range.\n";
+		return mismatches == 0 ? 0 : 1;
+	}
+}
@@ -0,0 +1,299 @@
+#include "commands.h"
+
+#include "selection/boundedSelector.h"
+#include "selection/placeTable.h"
+#include "selection/ruleJit.h"
+#include "selection/decisionDiagram.h"
+#include "selection/trace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+namespace Tool
+{
+	namespace
+	{
+		constexpr std::size_t MAX_REPORTED_MISMATCHES = 20;
+
+		// Keeps the timed selections from being optimized away.
+		volatile std::int64_t selectionSink = 0;
+
+		struct Engine {
+			std::string name;
+			std::function<std::int32_t(const Selection::TraceRecord&)> select;
+		};
+
+		struct Latency {
+			double mean{ 0.0 };
+			double median{ 0.0 };
+			double p99{ 0.0 };
+			double max{ 0.0 };
+		};
+
+		// Average nanoseconds per call for every record, summarized.
+		Latency Measure(const Engine& a_engine, const std::vector<const Selection::TraceRecord*>& a_records, std::size_t a_iterations)
+		{
+			std::vector<double> samples{};
+			samples.reserve(a_records.size());
+			std::int64_t sink = 0;
+			for (const auto* record : a_records) {
+				const auto start = std::chrono::steady_clock::now();
+				for (std::size_t i = 0; i < a_iterations; ++i) {
+					sink += a_engine.select(*record);
+				}
+				const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+				samples.push_back(elapsed / static_cast<double>(a_iterations));
+			}
+			selectionSink = sink;
+			if (samples.empty()) {
+				return Latency{};
+			}
+
+			std::sort(samples.begin(), samples.end());
+			Latency response{};
+			for (const auto sample : samples) {
+				response.mean += sample;
+			}
+			response.mean /= static_cast<double>(samples.size());
+			response.median = samples[samples.size() / 2];
+			response.p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+			response.max = samples.back();
+			return response;
+		}
+
+		// The plugin tables every location relevant to the rules. Offline, the locations seen in the trace stand in
+		// for that table, which is exact for replaying the same trace. Returns false if a location was seen with
+		// two different chains, e.g. across a change of load order, since the table would then be wrong.
+		bool CollectLocations(const std::vector<Selection::TraceRecord>& a_records, Selection::DecisionDiagram::LocationTable& a_table)
+		{
+			for (const auto& record : a_records) {
+				const auto& context = record.context;
+				const auto current = context.GetCurrentLocation();
+				if (current == 0 || record.truncated) {
+					continue;
+				}
+				const auto [it, inserted] = a_table.try_emplace(current, Selection::DecisionDiagram::LocationInfo{ context.locations, context.locationKeywords });
+				if (!inserted && (it->second.chain != context.locations || it->second.keywords != context.locationKeywords)) {
+					a_table.clear();
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	int Replay(const Arguments& a_arguments)
+	{
+		std::string path{};
+		std::size_t iterations = 1000;
+		bool verbose = false;
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (argument == "--iterations" && i + 1 < a_arguments.size()) {
+				iterations = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else if (argument == "--verbose") {
+				verbose = true;
+			}
+			else if (path.empty() && !argument.starts_with("--")) {
+				path = argument;
+			}
+			else {
+				path.clear();
+				break;
+			}
+		}
+		if (path.empty()) {
+			std::cerr << "Usage: CombatMusicTool replay <file.trace> [--iterations <count>] [--verbose]\n";
+			return 2;
+		}
+
+		Selection::TraceHeader header{};
+		std::vector<Selection::TraceRecord> records{};
+		bool truncated = false;
+		std::string error{};
+		if (!Selection::ReadTrace(path, header, records, truncated, error)) {
+			std::cerr << "<" << path << ">: " << error << "\n";
+			return 1;
+		}
+
+		std::array<std::size_t, static_cast<std::size_t>(Selection::TraceHook::kTotal)> perHook{};
+		std::size_t truncatedContexts = 0;
+		for (const auto& record : records) {
+			perHook[static_cast<std::size_t>(record.hook)]++;
+			truncatedContexts += record.truncated;
+		}
+		std::cout << "<" << path << ">: ";
+		for (std::size_t category = 0; category < header.categories.size(); ++category) {
+			std::cout << header.categories[category].rules.size() << " " << Selection::GetCategoryName(static_cast<Selection::MusicCategory>(category)) << ", ";
+		}
+		std::cout << records.size() << " records.\n";
+		for (std::size_t hook = 0; hook < perHook.size(); ++hook) {
+			std::cout << "  " << Selection::GetTraceHookName(static_cast<Selection::TraceHook>(hook)) << ": " << perHook[hook] << "\n";
+		}
+		if (truncated) {
+			std::cout << "The last record was cut off and is ignored.\n";
+		}
+		if (truncatedContexts > 0) {
+			std::cout << truncatedContexts << " record(s) had contexts too large to record fully and are not checked.\n";
+		}
+
+		Selection::DecisionDiagram::LocationTable locations{};
+		const bool consistent = CollectLocations(records, locations);
+		if (!consistent) {
+			std::cout << "Locations in the trace are inconsistent, the decision diagram is built without a location table.\n";
+		}
+		const auto* table = consistent ? std::addressof(locations) : nullptr;
+		std::array<Selection::DecisionDiagram, Selection::TOTAL_MUSIC_CATEGORIES> diagrams{};
+		bool compiled = true;
+		for (std::size_t category = 0; compiled && category < diagrams.size(); ++category) {
+			compiled = diagrams[category].Build(header.categories[category].rules, table);
+		}
+		if (!compiled) {
+			std::cout << "The rules are too large to compile, the decision diagram is skipped.\n";
+		}
+
+		const auto categoryOf = [](const Selection::TraceRecord& a_record) {
+			return static_cast<std::size_t>(Selection::GetTraceCategory(a_record.hook));
+		};
+		const auto rulesFor = [&](const Selection::TraceRecord& a_record) -> const std::vector<Selection::RuleShape>& {
+			return header.categories[categoryOf(a_record)].rules;
+		};
+		const auto order = [](const std::vector<Selection::RuleShape>& a_rules) {
+			std::vector<Selection::RuleBound> response{};
+			for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(a_rules.size()); ++i) {
+				response.push_back(Selection::GetBound(a_rules[i], i));
+			}
+			Selection::SortBounds(response);
+			return response;
+		};
+		std::array<std::vector<Selection::RuleBound>, Selection::TOTAL_MUSIC_CATEGORIES> bounds{};
+		for (std::size_t category = 0; category < bounds.size(); ++category) {
+			bounds[category] = order(header.categories[category].rules);
+		}
+		std::size_t skipped = 0;
+		std::size_t scored = 0;
+
+		// The place table needs the same location table as the diagram.
+		std::array<Selection::PlaceTable, Selection::TOTAL_MUSIC_CATEGORIES> places{};
+		std::array<std::vector<Selection::RuleBound>, Selection::TOTAL_MUSIC_CATEGORIES> remaining{};
+		bool tabled = false;
+		for (std::size_t category = 0; consistent && category < places.size(); ++category) {
+			if (places[category].Build(header.categories[category].rules, locations)) {
+				remaining[category] = places[category].GetRemainingBounds(bounds[category]);
+				tabled = true;
+				std::cout << "Tabled " << places[category].GetRuleCount() << " " << Selection::GetCategoryName(static_cast<Selection::MusicCategory>(category))
+						  << " rules in " << places[category].GetRowCount() << "x" << places[category].GetColumnCount() << " answers, "
+						  << places[category].GetMemoryUsage() << " bytes.\n";
+			}
+			else {
+				remaining[category] = bounds[category];
+			}
+		}
+
+		std::vector<Engine> engines{};
+		engines.push_back(Engine{ "linear", [&](const Selection::TraceRecord& a_record) {
+									 return Selection::SelectRule(rulesFor(a_record), a_record.context);
+								 } });
+		engines.push_back(Engine{ "bounded", [&](const Selection::TraceRecord& a_record) {
+									 const auto& rules = rulesFor(a_record);
+									 std::size_t count = 0;
+									 const auto response = Selection::SelectBounded(bounds[categoryOf(a_record)], [&](std::uint32_t a_rule) {
+										 return Selection::MatchRule(rules[a_rule], a_record.context);
+									 }, count);
+									 skipped += count;
+									 scored += rules.size() - count;
+									 return response;
+								 } });
+		if (tabled) {
+			engines.push_back(Engine{ "table", [&](const Selection::TraceRecord& a_record) {
+										 const auto category = categoryOf(a_record);
+										 const auto& rules = rulesFor(a_record);
+										 Selection::PlaceTable::Answer placed{};
+										 if (places[category].IsBuilt()) {
+											 placed = places[category].Lookup(a_record.context);
+										 }
+										 std::size_t count = 0;
+										 return Selection::SelectBounded(remaining[category], [&](std::uint32_t a_rule) {
+											 return Selection::MatchRule(rules[a_rule], a_record.context);
+										 }, count, placed.rule, placed.match);
+									 } });
+		}
+		std::array<Selection::RuleProgram, Selection::TOTAL_MUSIC_CATEGORIES> programs{};
+		std::array<Selection::RuleJit, Selection::TOTAL_MUSIC_CATEGORIES> natives{};
+		bool native = Selection::RuleJit::IsSupported();
+		for (std::size_t category = 0; category < programs.size(); ++category) {
+			programs[category].Build(header.categories[category].rules);
+			native = native && natives[category].Build(programs[category]);
+		}
+		Selection::RuleProgram::Input input{};
+		engines.push_back(Engine{ "program", [&](const Selection::TraceRecord& a_record) {
+									 const auto& program = programs[categoryOf(a_record)];
+									 program.Prepare(a_record.context, input);
+									 return program.Run(input);
+								 } });
+		if (native) {
+			engines.push_back(Engine{ "native", [&](const Selection::TraceRecord& a_record) {
+										 const auto category = categoryOf(a_record);
+										 programs[category].Prepare(a_record.context, input);
+										 return natives[category].Run(input);
+									 } });
+		}
+		if (compiled) {
+			engines.push_back(Engine{ "diagram", [&](const Selection::TraceRecord& a_record) {
+										 return diagrams[categoryOf(a_record)].Evaluate(a_record.context).rule;
+									 } });
+		}
+
+		// Only calls that evaluated a rule set can be replayed.
+		std::vector<const Selection::TraceRecord*> selections{};
+		for (const auto& record : records) {
+			if (record.selected && !record.truncated) {
+				selections.push_back(std::addressof(record));
+			}
+		}
+
+		std::size_t mismatches = 0;
+		for (const auto& engine : engines) {
+			for (const auto* record : selections) {
+				const auto rule = engine.select(*record);
+				if (rule == record->rule) {
+					continue;
+				}
+				if (++mismatches <= MAX_REPORTED_MISMATCHES) {
+					std::cout << "mismatch: " << engine.name << " picked rule " << rule << ", the game picked rule " << record->rule << " in "
+							  << Selection::GetTraceHookName(record->hook) << " at " << record->timestamp / 1000000 << " ms\n"
+							  << "  " << record->context.Describe() << "\n";
+				}
+			}
+		}
+		std::cout << selections.size() << " selections replayed through " << engines.size() << " engine(s), " << mismatches << " mismatch(es).\n";
+		if (skipped + scored > 0) {
+			std::cout << "The bounded engine skipped " << skipped << " of " << skipped + scored << " rule evaluations ("
+					  << 100.0 * static_cast<double>(skipped) / static_cast<double>(skipped + scored) << "%).\n";
+		}
+		if (verbose) {
+			for (const auto* record : selections) {
+				const auto& set = header.categories[categoryOf(*record)];
+				std::cout << "  " << Selection::GetTraceHookName(record->hook) << " at " << record->timestamp / 1000000 << " ms: rule " << record->rule;
+				if (record->rule >= 0 && static_cast<std::size_t>(record->rule) < set.music.size()) {
+					std::cout << " (music 0x" << std::hex << set.music[record->rule] << std::dec << ")";
+				}
+				std::cout << "\n";
+			}
+		}
+
+		if (!selections.empty()) {
+			std::cout << "Latency per selection in ns (" << iterations << " iterations per record):\n";
+			for (const auto& engine : engines) {
+				const auto latency = Measure(engine, selections, iterations);
+				std::cout << "  " << engine.name << ": mean " << latency.mean << ", median " << latency.median << ", p99 " << latency.p99
+						  << ", max " << latency.max << "\n";
+			}
+		}
+		return mismatches == 0 ? 0 : 1;
+	}
+}
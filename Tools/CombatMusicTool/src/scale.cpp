@@ -0,0 +1,112 @@
+#include "commands.h"
+#include "generated.h"
+
+#include "selection/parallelSelector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace Tool
+{
+	namespace
+	{
+		// Keeps the timed selections from being optimized away.
+		volatile std::int64_t selectionSink = 0;
+
+		// Nanoseconds per selection, over every context a_iterations times.
+		template <class F>
+		double Measure(F&& a_select, const std::vector<Selection::Context>& a_contexts, std::size_t a_iterations)
+		{
+			std::int64_t sink = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (std::size_t i = 0; i < a_iterations; ++i) {
+				for (const auto& context : a_contexts) {
+					sink += a_select(context);
+				}
+			}
+			const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			selectionSink = sink;
+			return elapsed / static_cast<double>(a_iterations * a_contexts.size());
+		}
+	}
+
+	int Scale(const Arguments& a_arguments)
+	{
+		std::size_t rules = 50000;
+		std::size_t contexts = 64;
+		std::size_t iterations = 20;
+		std::uint32_t seed = 1;
+		std::size_t threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+		for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+			const auto& argument = a_arguments[i];
+			if (i + 1 >= a_arguments.size()) {
+				rules = 0;
+				break;
+			}
+			if (argument == "--rules") {
+				rules = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--contexts") {
+				contexts = std::stoull(a_arguments[++i]);
+			}
+			else if (argument == "--iterations") {
+				iterations = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else if (argument == "--seed") {
+				seed = static_cast<std::uint32_t>(std::stoul(a_arguments[++i]));
+			}
+			else if (argument == "--threads") {
+				threads = std::max<std::size_t>(1, std::stoull(a_arguments[++i]));
+			}
+			else {
+				rules = 0;
+				break;
+			}
+		}
+		if (rules == 0 || contexts == 0) {
+			std::cerr << "Usage: CombatMusicTool scale [--rules <count>] [--contexts <count>] [--iterations <count>] [--seed <number>] [--threads <count>]\n";
+			return 2;
+		}
+
+		std::mt19937 random{ seed };
+		const auto shapes = GenerateRules(rules, 256, random);
+		const auto samples = GenerateContexts(contexts, 256, random);
+
+		std::vector<std::int32_t> expected{};
+		for (const auto& context : samples) {
+			expected.push_back(Selection::SelectRule(shapes, context));
+		}
+
+		std::vector<std::size_t> counts{};
+		for (std::size_t count = 1; count < threads; count *= 2) {
+			counts.push_back(count);
+		}
+		counts.push_back(threads);
+
+		std::cout << rules << " rules, " << contexts << " contexts, " << std::thread::hardware_concurrency() << " hardware thread(s).\n";
+		std::cout << "Time per selection in us (" << iterations << " iterations):\n";
+		const auto serial = Measure([&](const Selection::Context& a_context) { return Selection::SelectRule(shapes, a_context); }, samples, iterations);
+		std::cout << "  serial: " << serial / 1000.0 << "\n";
+
+		std::size_t mismatches = 0;
+		for (const auto count : counts) {
+			Selection::WorkerPool pool(count - 1);
+			const auto select = [&](const Selection::Context& a_context) {
+				return Selection::SelectParallel(pool, shapes.size(), [&](std::uint32_t a_rule) {
+					return Selection::MatchRule(shapes[a_rule], a_context);
+				}).value_or(-2);
+			};
+			for (std::size_t i = 0; i < samples.size(); ++i) {
+				if (select(samples[i]) != expected[i]) {
+					mismatches++;
+				}
+			}
+			const auto time = Measure(select, samples, iterations);
+			std::cout << "  " << count << " thread(s): " << time / 1000.0 << " (" << serial / time << "x)\n";
+		}
+		std::cout << mismatches << " mismatch(es) against the serial loop.\n";
+		return mismatches == 0 ? 0 : 1;
+	}
+}
@@ -0,0 +1,329 @@
+#include "commands.h"
+#include "manifest.h"
+
+#include "selection/ruleSetIO.h"
+#include "selection/startupTrace.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <numeric>
+#include <optional>
+
+namespace Tool
+{
+	namespace
+	{
+		struct Options {
+			std::vector<std::string> inputs{};
+			std::optional<std::string> manifest{};
+			std::optional<std::string> output{};
+			std::optional<std::string> startupTrace{};
+		};
+
+		bool ParseOptions(const Arguments& a_arguments, Options& a_options)
+		{
+			for (std::size_t i = 0; i < a_arguments.size(); ++i) {
+				const auto& argument = a_arguments[i];
+				if (argument == "--manifest" || argument == "--output" || argument == "--startup-trace") {
+					if (i + 1 == a_arguments.size()) {
+						std::cerr << argument << " expects a path.\n";
+						return false;
+					}
+					auto& option = argument == "--manifest" ? a_options.manifest :
+						argument == "--output"              ? a_options.output :
+															  a_options.startupTrace;
+					option = a_arguments[++i];
+				}
+				else if (argument.starts_with("--")) {
+					std::cerr << "Unknown option " << argument << ".\n";
+					return false;
+				}
+				else {
+					a_options.inputs.push_back(argument);
+				}
+			}
+			if (a_options.inputs.empty()) {
+				std::cerr << "No rule files given.\n";
+				return false;
+			}
+			return true;
+		}
+
+		// Folders are read like the plugin reads its own: every .json and compiled file, sorted by name.
+		bool GatherFiles(const std::vector<std::string>& a_inputs, std::vector<std::string>& a_paths)
+		{
+			for (const auto& input : a_inputs) {
+				std::error_code error{};
+				if (std::filesystem::is_directory(input, error)) {
+					std::vector<std::string> found{};
+					for (const auto& entry : std::filesystem::directory_iterator(input, error)) {
+						const auto extension = entry.path().extension();
+						if (entry.is_regular_file() && (extension == ".json" || extension == Selection::COMPILED_RULES_EXTENSION)) {
+							found.push_back(entry.path().string());
+						}
+					}
+					std::sort(found.begin(), found.end());
+					a_paths.insert(a_paths.end(), found.begin(), found.end());
+				}
+				else if (std::filesystem::is_regular_file(input, error)) {
+					a_paths.push_back(input);
+				}
+				else {
+					std::cerr << "<" << input << "> does not exist.\n";
+					return false;
+				}
+			}
+			return true;
+		}
+
+		class Checker
+		{
+		public:
+			explicit Checker(const Manifest* a_manifest) :
+				manifest(a_manifest)
+			{}
+
+			// Checks and, where the manifest knows the form, rewrites a reference in place.
+			bool CheckReference(std::string& a_reference, std::string_view a_signature, const Selection::RuleFile& a_file, std::size_t a_rule, std::string_view a_field)
+			{
+				const auto report = [&](std::vector<Selection::ParseIssue>& a_list, std::string a_message) {
+					a_list.push_back(Selection::ParseIssue{ a_file.path, a_rule, std::string(a_field), std::move(a_message) });
+				};
+
+				std::string_view plugin{};
+				Selection::FormID formID = 0;
+				const bool isReference = Selection::SplitFormReference(a_reference, plugin, formID);
+				if (!isReference && a_reference.find('|') != std::string::npos) {
+					report(errors, "<" + a_reference + "> is not a valid Plugin|0xID reference.");
+					return false;
+				}
+				if (!manifest) {
+					if (!isReference && a_signature == GetExpectedSignature(Selection::ConditionType::kCombatTarget)) {
+						report(warnings, "<" + a_reference + "> is an NPC EditorID, which only resolves with po3's Tweaks installed.");
+					}
+					return true;
+				}
+
+				const Manifest::Form* form = nullptr;
+				if (isReference) {
+					if (!manifest->HasPlugin(plugin)) {
+						report(errors, "<" + a_reference + "> belongs to a plugin that is not in the load order.");
+						return false;
+					}
+					form = manifest->FindByReference(plugin, formID);
+					if (!form) {
+						// The manifest need not list every form of a plugin, so this cannot be checked further.
+						return true;
+					}
+				}
+				else {
+					form = manifest->FindByEditorID(a_reference);
+					if (!form) {
+						report(errors, "<" + a_reference + "> could not resolve form.");
+						return false;
+					}
+				}
+
+				if (form->signature != a_signature) {
+					report(errors, "<" + a_reference + "> is a " + form->signature + ", expected a " + std::string(a_signature) + ".");
+					return false;
+				}
+				if (!form->reference.empty()) {
+					a_reference = form->reference;
+				}
+				else if (a_signature == GetExpectedSignature(Selection::ConditionType::kCombatTarget)) {
+					report(warnings, "<" + a_reference + "> is an NPC EditorID, which only resolves with po3's Tweaks installed.");
+				}
+				return true;
+			}
+
+			// Returns false if the plugin would drop the rule.
+			bool CheckRule(Selection::RuleDefinition& a_rule, const Selection::RuleFile& a_file)
+			{
+				bool valid = true;
+				for (auto& music : a_rule.newMusic) {
+					valid &= CheckReference(music.form, MUSIC_SIGNATURE, a_file, a_rule.index, "newMusic");
+				}
+				for (auto& condition : a_rule.conditions) {
+					const auto field = Selection::GetConditionKey(condition.type);
+					const auto signature = GetExpectedSignature(condition.type);
+					// Intensity tiers are not forms, the parser already checked them.
+					for (auto& form : condition.forms) {
+						if (!signature.empty()) {
+							valid &= CheckReference(form, signature, a_file, a_rule.index, field);
+						}
+					}
+
+					auto sorted = condition.forms;
+					std::sort(sorted.begin(), sorted.end());
+					if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end()) {
+						warnings.push_back(Selection::ParseIssue{ a_file.path, a_rule.index, std::string(field), "Lists the same form more than once." });
+					}
+				}
+				for (const auto& range : a_rule.ranges) {
+					const auto& [low, high] = range.range;
+					const bool everything = range.quantity == Selection::Quantity::kHealth   ? low <= 0.0f && high >= 100.0f :
+					                        range.quantity == Selection::Quantity::kGameHour ? low <= 0.0f && high >= 24.0f :
+					                                                                           low <= 1.0f && std::isinf(high);
+					if (everything) {
+						warnings.push_back(Selection::ParseIssue{ a_file.path, a_rule.index, std::string(Selection::GetQuantityKey(range.quantity)), "Covers every value, so it is always true." });
+					}
+				}
+				for (const auto& extension : a_rule.extensions) {
+					warnings.push_back(Selection::ParseIssue{ a_file.path, a_rule.index, extension.key, "Not a built-in condition, it only applies if another plugin registers it." });
+				}
+				if (a_rule.expression) {
+					for (auto& node : a_rule.expression->nodes) {
+						const auto signature = node.kind == Selection::ExpressionNode::Kind::kTest ? GetExpectedSignature(node.type) : std::string_view{};
+						for (auto& form : node.forms) {
+							if (!signature.empty()) {
+								valid &= CheckReference(form, signature, a_file, a_rule.index, "expression");
+							}
+						}
+					}
+				}
+				return valid;
+			}
+
+			std::vector<Selection::ParseIssue> errors{};
+			std::vector<Selection::ParseIssue> warnings{};
+
+		private:
+			const Manifest* manifest;
+		};
+
+		struct Report {
+			std::vector<Selection::RuleFile> files{};
+			// By MusicCategory.
+			std::array<std::size_t, Selection::TOTAL_MUSIC_CATEGORIES> categoryRules{};
+			std::size_t errors{ 0 };
+		};
+
+		// Shared by validate and compile. Returns nullopt on bad usage.
+		std::optional<Report> Run(const Options& a_options)
+		{
+			Manifest manifest{};
+			if (a_options.manifest) {
+				std::string error{};
+				if (!manifest.Load(*a_options.manifest, error)) {
+					std::cerr << error << "\n";
+					return std::nullopt;
+				}
+			}
+
+			if (a_options.startupTrace) {
+				Selection::StartupTracer::Enable();
+				Selection::StartupTracer::NameThread("Main");
+			}
+			std::vector<std::string> paths{};
+			{
+				Selection::StartupSpan span{ "Scan rule folder" };
+				if (!GatherFiles(a_options.inputs, paths)) {
+					return std::nullopt;
+				}
+			}
+
+			const auto start = std::chrono::steady_clock::now();
+			Report report{};
+			Checker checker(a_options.manifest ? &manifest : nullptr);
+			for (const auto& path : paths) {
+				Selection::StartupSpan fileSpan{ "Read file", path };
+				std::vector<Selection::RuleFile> files{};
+				{
+					Selection::StartupSpan parseSpan{ "Parse" };
+					if (std::filesystem::path(path).extension() == Selection::COMPILED_RULES_EXTENSION) {
+						Selection::ReadCompiledRules(path, files, checker.errors);
+					}
+					else {
+						Selection::ParseRuleFile(path, files.emplace_back(), checker.errors);
+					}
+				}
+
+				Selection::StartupSpan checkSpan{ "Check rules" };
+				for (auto& file : files) {
+					std::erase_if(file.rules, [&](auto& a_rule) { return !checker.CheckRule(a_rule, file); });
+					for (const auto& rule : file.rules) {
+						report.categoryRules[static_cast<std::size_t>(rule.category)]++;
+					}
+					report.files.push_back(std::move(file));
+				}
+			}
+			const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (a_options.startupTrace) {
+				std::string error{};
+				if (!Selection::StartupTracer::Write(*a_options.startupTrace, error)) {
+					std::cerr << "<" << *a_options.startupTrace << ">: " << error << "\n";
+				}
+			}
+
+			for (const auto& issue : checker.errors) {
+				std::cout << "error: " << issue.ToString() << "\n";
+			}
+			for (const auto& issue : checker.warnings) {
+				std::cout << "warning: " << issue.ToString() << "\n";
+			}
+			report.errors = checker.errors.size();
+
+			const auto rules = std::accumulate(report.categoryRules.begin(), report.categoryRules.end(), std::size_t{ 0 });
+			std::cout << paths.size() << " file(s), " << rules << " valid rule(s) (";
+			for (std::size_t category = 0; category < report.categoryRules.size(); ++category) {
+				std::cout << (category > 0 ? ", " : "") << report.categoryRules[category] << " "
+						  << Selection::GetCategoryName(static_cast<Selection::MusicCategory>(category));
+			}
+			std::cout << "), " << checker.errors.size() << " error(s), " << checker.warnings.size() << " warning(s) in " << elapsed << " ms";
+			if (elapsed > 0.0) {
+				std::cout << " (" << static_cast<std::size_t>(rules / (elapsed / 1000.0)) << " rules/s)";
+			}
+			std::cout << ".\n";
+			if (!a_options.manifest) {
+				std::cout << "No manifest given, form references were not resolved.\n";
+			}
+			return report;
+		}
+	}
+
+	int Validate(const Arguments& a_arguments)
+	{
+		Options options{};
+		if (!ParseOptions(a_arguments, options) || options.output) {
+			std::cerr << "Usage: CombatMusicTool validate <file or folder>... [--manifest <file>] [--startup-trace <file.json>]\n";
+			return 2;
+		}
+
+		const auto report = Run(options);
+		if (!report) {
+			return 2;
+		}
+		return report->errors == 0 ? 0 : 1;
+	}
+
+	int Compile(const Arguments& a_arguments)
+	{
+		Options options{};
+		if (!ParseOptions(a_arguments, options) || !options.output) {
+			std::cerr << "Usage: CombatMusicTool compile <file or folder>... --output <file.cmrules> [--manifest <file>] [--startup-trace <file.json>]\n";
+			return 2;
+		}
+
+		const auto report = Run(options);
+		if (!report) {
+			return 2;
+		}
+		if (report->errors != 0) {
+			std::cout << "Not writing <" << *options.output << "> until all errors are fixed.\n";
+			return 1;
+		}
+
+		std::string error{};
+		if (!Selection::WriteCompiledRules(*options.output, report->files, error)) {
+			std::cerr << "<" << *options.output << ">: " << error << "\n";
+			return 1;
+		}
+		std::cout << "Wrote <" << *options.output << ">.\n";
+		return 0;
+	}
+}
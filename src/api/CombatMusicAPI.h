@@ -0,0 +1,196 @@
+#pragma once
+
+/*
+* Public interface of Combat Music for other SKSE plugins. Copy this header into your project; it only needs
+* the standard library and a CommonLibSSE style RE::BGSMusicType.
+*
+* Request the interface once the plugins are loaded, e.g. on kPostLoad or kPostPostLoad:
+*
+*     CombatMusicAPI::InterfaceRequest request{ CombatMusicAPI::InterfaceVersion::kV3, &OnInterface };
+*     SKSE::GetMessagingInterface()->Dispatch(CombatMusicAPI::REQUEST_MESSAGE, &request, sizeof(request), CombatMusicAPI::PLUGIN_NAME);
+*
+* OnInterface is called before Dispatch returns, with the interface cast to void*. If Combat Music is not
+* installed, or does not have the requested version, it is never called.
+*
+* Every call may be made from any thread, never allocates after the first call on a thread and never looks
+* anything up by name. Calls are cheap enough for every frame, except Evaluate, which costs one selection, and
+* RegisterConditionKind, which copies its key and belongs in startup code.
+*/
+
+#include <cstdint>
+
+namespace RE
+{
+	class BGSMusicType;
+}
+
+namespace CombatMusicAPI
+{
+	inline constexpr const char* PLUGIN_NAME = "CombatMusic";
+	inline constexpr std::uint32_t REQUEST_MESSAGE = 0x50414D43;  // "CMAP"
+
+	enum class InterfaceVersion : std::uint32_t
+	{
+		kV1 = 1,
+		// Adds condition kinds. Extends kV1, so a kV2 interface can also be used as an IVCombatMusic1.
+		kV2 = 2,
+		// Adds condition kinds whose evaluator sees the declared inputs. Extends kV2.
+		kV3 = 3
+	};
+
+	// Payload of REQUEST_MESSAGE.
+	struct InterfaceRequest {
+		InterfaceVersion version;
+		void (*callback)(void* a_interface, InterfaceVersion a_version);
+	};
+
+	// What the music replaces. Matches the "category" field of the rules.
+	enum class Category : std::uint32_t
+	{
+		kCombat,
+		kDungeonCleared
+	};
+
+	// Identifies the loaded rules. 0 until they are loaded on kDataLoaded.
+	using RuleSetHandle = std::uint64_t;
+	// Identifies a pushed override. 0 is never a valid handle.
+	using OverrideHandle = std::uint32_t;
+
+	// a_music is the music Combat Music started for the category, or nullptr when it stopped its music.
+	using ChangeCallback = void (*)(Category a_category, RE::BGSMusicType* a_music, void* a_user);
+
+	inline constexpr std::uint32_t MAX_OVERRIDES = 32;
+	inline constexpr std::uint32_t MAX_CHANGE_CALLBACKS = 16;
+	inline constexpr std::uint32_t MAX_CONDITION_KINDS = 32;
+
+	// What a condition kind's result depends on. A condition is only evaluated again once one of its inputs
+	// changed, so leaving out an input it reads makes it stale.
+	enum ConditionInput : std::uint32_t
+	{
+		// Worldspace, cell, location and their keywords.
+		kLocation = 1 << 0,
+		// Combat target, everyone in combat with the player and how hard the fight is.
+		kTarget = 1 << 1,
+		// The in-game time, to the minute.
+		kTime = 1 << 2,
+		// Anything else. Report changes with NotifyCustomInputChanged.
+		kCustom = 1 << 3
+	};
+
+	// A parsed condition. Whatever the kind needs to evaluate it, in a fixed size so it is stored without
+	// allocating. Conditions with equal payloads of the same kind are evaluated once per selection.
+	struct ConditionPayload {
+		std::uint8_t data[64];
+	};
+
+	/*
+	* The player's surroundings as the selection captured them. Form IDs are 0 where missing, and lists are
+	* sorted and unique unless noted. Only the parts of the declared inputs are kept up to date, and the
+	* arrays are only valid during the call.
+	*/
+	struct ConditionInputs {
+		// kLocation.
+		std::uint32_t worldspace;
+		std::uint32_t cell;
+		// The current location followed by its parents, in that order.
+		const std::uint32_t* locations;
+		std::uint32_t locationCount;
+		// Keywords on the current location or any of its parents.
+		const std::uint32_t* locationKeywords;
+		std::uint32_t locationKeywordCount;
+		// kTarget. The base of the combat target.
+		std::uint32_t target;
+		// Keywords on the target's base and race.
+		const std::uint32_t* targetKeywords;
+		std::uint32_t targetKeywordCount;
+		// Bases of everyone in combat with the player.
+		const std::uint32_t* combatants;
+		std::uint32_t combatantCount;
+		// How hard the fight is: 0 outside of combat, then 1 to 4 for low, medium, high and extreme.
+		std::uint32_t intensity;
+		// kTime. In-game minutes since the game started.
+		std::int64_t gameMinute;
+		// kCustom. Grows with every NotifyCustomInputChanged.
+		std::uint64_t customVersion;
+	};
+
+	// Reads the condition's JSON object, e.g. {"AND": true, "weather": ["SkyrimStormRain"]}, into a_payload,
+	// which starts zeroed. Return false to drop the rule. Called on the main thread once every plugin's
+	// forms are loaded.
+	using ConditionParser = bool (*)(const char* a_json, ConditionPayload* a_payload, void* a_user);
+	// True if the condition holds for a_inputs. Must only read the declared inputs and have no side effects.
+	// Called on the main thread.
+	using ConditionEvaluator = bool (*)(const ConditionPayload* a_payload, const ConditionInputs* a_inputs, void* a_user);
+
+	struct ConditionKind {
+		// Key of the condition in a rule. Must not be a built-in key. Copied on registration.
+		const char* key;
+		ConditionParser parse;
+		ConditionEvaluator evaluate;
+		// ConditionInput flags.
+		std::uint32_t inputs;
+		// Relative cost of one evaluation. 1 is about a built-in condition with a single form, and cheaper
+		// conditions are checked first.
+		float cost;
+		void* user;
+	};
+
+	// The kV2 evaluator, which only sees its payload and has to read the game itself. Called on the main thread.
+	using ConditionEvaluatorV2 = bool (*)(const ConditionPayload* a_payload, void* a_user);
+
+	// Same as ConditionKind, with a kV2 evaluator.
+	struct ConditionKindV2 {
+		const char* key;
+		ConditionParser parse;
+		ConditionEvaluatorV2 evaluate;
+		std::uint32_t inputs;
+		float cost;
+		void* user;
+	};
+
+	class IVCombatMusic1
+	{
+	public:
+		virtual RuleSetHandle GetRuleSet() const noexcept = 0;
+
+		// The music the rules would pick for the category right now, ignoring overrides. nullptr if no rule
+		// matches, if a_ruleSet is not the current rule set, or if the category's rules use registered
+		// condition kinds, whose evaluators only run on the main thread. Pools are sampled, so this can differ from the
+		// music the game would start. The rules see the player's surroundings as the main thread captured them
+		// on the last frame, or when music last started, so the answer can be a frame old. Frames only capture
+		// once Evaluate was called, so the first call may return nullptr until a frame has passed.
+		virtual RE::BGSMusicType* Evaluate(RuleSetHandle a_ruleSet, Category a_category) noexcept = 0;
+
+		// Plays a_music instead of the rules' pick the next time the category's music starts. Among the active
+		// overrides of a category the highest priority wins, and the latest pushed among equals. A positive
+		// a_seconds expires the override after that much real time, otherwise it lasts until it is popped.
+		// Music that already plays is not interrupted. Returns 0 if all MAX_OVERRIDES slots are taken, or if
+		// a_seconds is infinite or NaN.
+		virtual OverrideHandle PushOverride(Category a_category, RE::BGSMusicType* a_music, std::int32_t a_priority, float a_seconds) noexcept = 0;
+		// Returns false if the override already expired or was popped.
+		virtual bool PopOverride(OverrideHandle a_override) noexcept = 0;
+
+		// Called on the game's main thread whenever Combat Music starts or stops music. Returns false if all
+		// MAX_CHANGE_CALLBACKS slots are taken.
+		virtual bool AddChangeCallback(ChangeCallback a_callback, void* a_user) noexcept = 0;
+		virtual bool RemoveChangeCallback(ChangeCallback a_callback, void* a_user) noexcept = 0;
+	};
+
+	class IVCombatMusic2 : public IVCombatMusic1
+	{
+	public:
+		// Lets rules use conditions of a_kind. Register before kDataLoaded, when the rules are read. Returns
+		// false if that is too late, the key is taken or built in, or all MAX_CONDITION_KINDS are registered.
+		virtual bool RegisterConditionKind(const ConditionKindV2& a_kind) noexcept = 0;
+		// Evaluates the conditions that declared kCustom again the next time music is picked.
+		virtual void NotifyCustomInputChanged() noexcept = 0;
+	};
+
+	class IVCombatMusic3 : public IVCombatMusic2
+	{
+	public:
+		using IVCombatMusic2::RegisterConditionKind;
+		// Same as the kV2 registration, but the evaluator is handed the inputs it declared.
+		virtual bool RegisterConditionKind(const ConditionKind& a_kind) noexcept = 0;
+	};
+}
@@ -0,0 +1,270 @@
+#include "api/api.h"
+
+#include "hooks/hooks.h"
+#include "selection/ruleParser.h"
+
+namespace API
+{
+	namespace
+	{
+		static_assert(static_cast<std::uint32_t>(CombatMusicAPI::Category::kCombat) == static_cast<std::uint32_t>(Selection::MusicCategory::kCombat));
+		static_assert(static_cast<std::uint32_t>(CombatMusicAPI::Category::kDungeonCleared) == static_cast<std::uint32_t>(Selection::MusicCategory::kDungeonCleared));
+		static_assert(CombatMusicAPI::MAX_OVERRIDES < 256, "Handles keep the slot in their lowest byte.");
+		static_assert(CombatMusicAPI::kLocation == Selection::INPUT_LOCATION && CombatMusicAPI::kTarget == Selection::INPUT_TARGET);
+		static_assert(CombatMusicAPI::kTime == Selection::INPUT_TIME && CombatMusicAPI::kCustom == Selection::INPUT_CUSTOM);
+		constexpr std::uint32_t ALL_INPUTS = CombatMusicAPI::kLocation | CombatMusicAPI::kTarget | CombatMusicAPI::kTime | CombatMusicAPI::kCustom;
+
+		// Handles are the slot plus one in the lowest byte and the slot's generation above it, so 0 is never valid.
+		constexpr CombatMusicAPI::OverrideHandle MakeHandle(std::size_t a_slot, std::uint32_t a_generation)
+		{
+			return ((a_generation & 0xFFFFFF) << 8) | static_cast<std::uint32_t>(a_slot + 1);
+		}
+
+		void MessageCallback(SKSE::MessagingInterface::Message* a_message)
+		{
+			if (!a_message || a_message->type != CombatMusicAPI::REQUEST_MESSAGE ||
+				a_message->dataLen != sizeof(CombatMusicAPI::InterfaceRequest) || !a_message->data) {
+				return;
+			}
+
+			const auto* request = static_cast<const CombatMusicAPI::InterfaceRequest*>(a_message->data);
+			const auto sender = a_message->sender ? a_message->sender : "an unknown plugin";
+			const auto interface = Interface::GetSingleton();
+			void* response = nullptr;
+			switch (request->version) {
+			case CombatMusicAPI::InterfaceVersion::kV1:
+				response = static_cast<CombatMusicAPI::IVCombatMusic1*>(interface);
+				break;
+			case CombatMusicAPI::InterfaceVersion::kV2:
+				response = static_cast<CombatMusicAPI::IVCombatMusic2*>(interface);
+				break;
+			case CombatMusicAPI::InterfaceVersion::kV3:
+				response = static_cast<CombatMusicAPI::IVCombatMusic3*>(interface);
+				break;
+			default:
+				break;
+			}
+			if (!response || !request->callback) {
+				logger::warn("{} requested unsupported API version {}.", sender, static_cast<std::uint32_t>(request->version));
+				return;
+			}
+			logger::info("Handing API version {} to {}.", static_cast<std::uint32_t>(request->version), sender);
+			request->callback(response, request->version);
+		}
+	}
+
+	void Install()
+	{
+		// Requests are addressed to this plugin, but may come from any sender.
+		const auto messaging = SKSE::GetMessagingInterface();
+		if (!messaging || !messaging->RegisterListener(nullptr, &MessageCallback)) {
+			logger::warn("Could not listen for API requests, other plugins will not find the API.");
+		}
+	}
+
+	CombatMusicAPI::RuleSetHandle Interface::GetRuleSet() const noexcept
+	{
+		return ruleSet.load(std::memory_order_acquire);
+	}
+
+	RE::BGSMusicType* Interface::Evaluate(CombatMusicAPI::RuleSetHandle a_ruleSet, CombatMusicAPI::Category a_category) noexcept
+	{
+		const auto category = static_cast<std::size_t>(a_category);
+		if (a_ruleSet == 0 || a_ruleSet != GetRuleSet() || category >= Selection::TOTAL_MUSIC_CATEGORIES) {
+			return nullptr;
+		}
+		return Hooks::CombatMusicCalls::GetSingleton()->Evaluate(static_cast<Selection::MusicCategory>(category));
+	}
+
+	CombatMusicAPI::OverrideHandle Interface::PushOverride(CombatMusicAPI::Category a_category, RE::BGSMusicType* a_music, std::int32_t a_priority, float a_seconds) noexcept
+	{
+		const auto category = static_cast<std::size_t>(a_category);
+		if (!a_music || category >= Selection::TOTAL_MUSIC_CATEGORIES || !std::isfinite(a_seconds)) {
+			return 0;
+		}
+
+		// Lifetimes past what the clock can hold never expire, instead of overflowing it.
+		const auto now = Clock::now();
+		const std::chrono::duration<double> lifetime{ a_seconds };
+		const auto expiry = a_seconds <= 0.0f || lifetime >= Clock::time_point::max() - now ?
+			Clock::time_point::max() :
+			now + std::chrono::duration_cast<Clock::duration>(lifetime);
+		std::lock_guard lock{ overrideLock };
+		for (std::size_t i = 0; i < overrides.size(); ++i) {
+			auto& entry = overrides[i];
+			if (entry.active && entry.expiry > now) {
+				continue;
+			}
+			entry.music = a_music;
+			entry.category = static_cast<Selection::MusicCategory>(category);
+			entry.priority = a_priority;
+			entry.sequence = ++pushes;
+			entry.expiry = expiry;
+			entry.generation++;
+			entry.active = true;
+			return MakeHandle(i, entry.generation);
+		}
+		return 0;
+	}
+
+	bool Interface::PopOverride(CombatMusicAPI::OverrideHandle a_override) noexcept
+	{
+		const auto slot = static_cast<std::size_t>(a_override & 0xFF);
+		if (slot == 0 || slot > overrides.size()) {
+			return false;
+		}
+
+		std::lock_guard lock{ overrideLock };
+		auto& entry = overrides[slot - 1];
+		if (!entry.active || MakeHandle(slot - 1, entry.generation) != a_override) {
+			return false;
+		}
+		entry.active = false;
+		return entry.expiry > Clock::now();
+	}
+
+	bool Interface::AddChangeCallback(CombatMusicAPI::ChangeCallback a_callback, void* a_user) noexcept
+	{
+		if (!a_callback) {
+			return false;
+		}
+
+		std::lock_guard lock{ listenerLock };
+		for (auto& listener : listeners) {
+			if (!listener.callback) {
+				listener = Listener{ a_callback, a_user };
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Interface::RemoveChangeCallback(CombatMusicAPI::ChangeCallback a_callback, void* a_user) noexcept
+	{
+		std::lock_guard lock{ listenerLock };
+		for (auto& listener : listeners) {
+			if (listener.callback == a_callback && listener.user == a_user) {
+				listener = Listener{};
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Interface::RegisterConditionKind(const CombatMusicAPI::ConditionKindV2& a_kind) noexcept
+	{
+		if (!a_kind.key || !a_kind.evaluate) {
+			logger::warn("Rejected a condition kind with a missing key or function, unknown inputs or an invalid cost.");
+			return false;
+		}
+		try {
+			return AddConditionKind(ConditionKind{ a_kind.key, a_kind.parse, nullptr, a_kind.evaluate, a_kind.inputs, a_kind.cost, a_kind.user });
+		}
+		catch (const std::exception&) {
+			return false;
+		}
+	}
+
+	bool Interface::RegisterConditionKind(const CombatMusicAPI::ConditionKind& a_kind) noexcept
+	{
+		if (!a_kind.key || !a_kind.evaluate) {
+			logger::warn("Rejected a condition kind with a missing key or function, unknown inputs or an invalid cost.");
+			return false;
+		}
+		try {
+			return AddConditionKind(ConditionKind{ a_kind.key, a_kind.parse, a_kind.evaluate, nullptr, a_kind.inputs, a_kind.cost, a_kind.user });
+		}
+		catch (const std::exception&) {
+			return false;
+		}
+	}
+
+	bool Interface::AddConditionKind(ConditionKind&& a_kind)
+	{
+		if (!a_kind.parse || (a_kind.inputs & ~ALL_INPUTS) != 0 || !(a_kind.cost >= 0.0f) || !std::isfinite(a_kind.cost)) {
+			logger::warn("Rejected a condition kind with a missing key or function, unknown inputs or an invalid cost.");
+			return false;
+		}
+
+		const std::string_view key = a_kind.key;
+		std::lock_guard lock{ kindLock };
+		if (kindsClosed.load(std::memory_order_relaxed)) {
+			logger::warn("Condition kind <{}> was registered after the rules were read and is ignored.", key);
+			return false;
+		}
+		if (key.empty() || Selection::IsReservedKey(key) || kinds.size() >= CombatMusicAPI::MAX_CONDITION_KINDS ||
+			std::ranges::any_of(kinds, [&](const ConditionKind& a_entry) { return a_entry.key == key; })) {
+			logger::warn("Condition kind <{}> is built in, already registered, or one kind too many.", key);
+			return false;
+		}
+		a_kind.index = static_cast<std::uint32_t>(kinds.size());
+		const auto& added = kinds.emplace_back(std::move(a_kind));
+		logger::info("Registered condition kind <{}>, relative cost {:.1f}.", added.key, added.cost);
+		return true;
+	}
+
+	void Interface::NotifyCustomInputChanged() noexcept
+	{
+		customInputs.fetch_add(1, std::memory_order_release);
+	}
+
+	void Interface::CloseConditionKinds()
+	{
+		std::lock_guard lock{ kindLock };
+		kindsClosed.store(true, std::memory_order_release);
+	}
+
+	const ConditionKind* Interface::FindConditionKind(std::string_view a_key) const
+	{
+		if (!kindsClosed.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		const auto found = std::ranges::find(kinds, a_key, &ConditionKind::key);
+		return found != kinds.end() ? std::addressof(*found) : nullptr;
+	}
+
+	std::uint64_t Interface::GetCustomInputVersion() const
+	{
+		return customInputs.load(std::memory_order_acquire);
+	}
+
+	void Interface::PublishRuleSet(std::uint64_t a_ruleSet)
+	{
+		ruleSet.store(a_ruleSet, std::memory_order_release);
+	}
+
+	RE::BGSMusicType* Interface::GetOverride(Selection::MusicCategory a_category)
+	{
+		const auto now = Clock::now();
+		std::lock_guard lock{ overrideLock };
+		const Override* best = nullptr;
+		for (auto& entry : overrides) {
+			if (!entry.active || entry.category != a_category) {
+				continue;
+			}
+			if (entry.expiry <= now) {
+				entry.active = false;
+				continue;
+			}
+			if (!best || entry.priority > best->priority || (entry.priority == best->priority && entry.sequence > best->sequence)) {
+				best = std::addressof(entry);
+			}
+		}
+		return best ? best->music : nullptr;
+	}
+
+	void Interface::NotifyChange(Selection::MusicCategory a_category, RE::BGSMusicType* a_music)
+	{
+		// Copied first, so a listener can add or remove listeners without deadlocking.
+		std::array<Listener, CombatMusicAPI::MAX_CHANGE_CALLBACKS> current{};
+		{
+			std::lock_guard lock{ listenerLock };
+			current = listeners;
+		}
+		for (const auto& listener : current) {
+			if (listener.callback) {
+				listener.callback(static_cast<CombatMusicAPI::Category>(a_category), a_music, listener.user);
+			}
+		}
+	}
+}
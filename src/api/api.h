@@ -0,0 +1,90 @@
+#pragma once
+
+#include "api/CombatMusicAPI.h"
+#include "selection/dependencyCache.h"
+#include "selection/musicCategory.h"
+#include "utilities/utilities.h"
+
+namespace API
+{
+	// Answers interface requests from other plugins. Call on SKSEPlugin_Load.
+	void Install();
+
+	// A condition kind another plugin registered, with its key copied.
+	struct ConditionKind {
+		std::string key{};
+		CombatMusicAPI::ConditionParser parse{ nullptr };
+		// Exactly one of the two is set, depending on the interface version it was registered through.
+		CombatMusicAPI::ConditionEvaluator evaluate{ nullptr };
+		CombatMusicAPI::ConditionEvaluatorV2 evaluateV2{ nullptr };
+		Selection::InputMask inputs{ 0 };
+		float cost{ 1.0f };
+		void* user{ nullptr };
+		// Registration order.
+		std::uint32_t index{ 0 };
+	};
+
+	// The interface handed to other plugins, and the overrides, listeners and condition kinds they registered.
+	class Interface : public CombatMusicAPI::IVCombatMusic3,
+		public Utilities::Singleton::ISingleton<Interface>
+	{
+	public:
+		CombatMusicAPI::RuleSetHandle GetRuleSet() const noexcept override;
+		RE::BGSMusicType* Evaluate(CombatMusicAPI::RuleSetHandle a_ruleSet, CombatMusicAPI::Category a_category) noexcept override;
+		CombatMusicAPI::OverrideHandle PushOverride(CombatMusicAPI::Category a_category, RE::BGSMusicType* a_music, std::int32_t a_priority, float a_seconds) noexcept override;
+		bool PopOverride(CombatMusicAPI::OverrideHandle a_override) noexcept override;
+		bool AddChangeCallback(CombatMusicAPI::ChangeCallback a_callback, void* a_user) noexcept override;
+		bool RemoveChangeCallback(CombatMusicAPI::ChangeCallback a_callback, void* a_user) noexcept override;
+		bool RegisterConditionKind(const CombatMusicAPI::ConditionKindV2& a_kind) noexcept override;
+		bool RegisterConditionKind(const CombatMusicAPI::ConditionKind& a_kind) noexcept override;
+		void NotifyCustomInputChanged() noexcept override;
+
+		// Makes the rules available to Evaluate. Call once they are final.
+		void PublishRuleSet(std::uint64_t a_ruleSet);
+		// Music of the winning active override of the category, or nullptr.
+		RE::BGSMusicType* GetOverride(Selection::MusicCategory a_category);
+		// Calls every listener. a_music is nullptr when the music stopped.
+		void NotifyChange(Selection::MusicCategory a_category, RE::BGSMusicType* a_music);
+		// Ends condition kind registration, so the kinds stay put while the rules use them. Call before reading rules.
+		void CloseConditionKinds();
+		// The kind registered for a_key, or nullptr. Only valid once registration is closed.
+		const ConditionKind* FindConditionKind(std::string_view a_key) const;
+		// Grows whenever a plugin reports a change to custom inputs.
+		std::uint64_t GetCustomInputVersion() const;
+
+	private:
+		// Checks a_kind and adds it, unless registration is closed.
+		bool AddConditionKind(ConditionKind&& a_kind);
+
+		using Clock = std::chrono::steady_clock;
+
+		struct Override {
+			RE::BGSMusicType* music{ nullptr };
+			Selection::MusicCategory category{ Selection::MusicCategory::kCombat };
+			std::int32_t priority{ 0 };
+			// Pushes so far when this one was pushed, so the latest wins a tie.
+			std::uint64_t sequence{ 0 };
+			// Clock::time_point::max() if it never expires.
+			Clock::time_point expiry{};
+			// Bumped whenever the slot is reused, so handles to an earlier override stop working.
+			std::uint32_t generation{ 0 };
+			bool active{ false };
+		};
+
+		struct Listener {
+			CombatMusicAPI::ChangeCallback callback{ nullptr };
+			void* user{ nullptr };
+		};
+
+		std::atomic<std::uint64_t> ruleSet{ 0 };
+		std::mutex overrideLock;
+		std::array<Override, CombatMusicAPI::MAX_OVERRIDES> overrides{};
+		std::uint64_t pushes{ 0 };
+		std::mutex listenerLock;
+		std::array<Listener, CombatMusicAPI::MAX_CHANGE_CALLBACKS> listeners{};
+		std::mutex kindLock;
+		std::vector<ConditionKind> kinds{};
+		std::atomic<bool> kindsClosed{ false };
+		std::atomic<std::uint64_t> customInputs{ 0 };
+	};
+}
@@ -30,10 +30,86 @@ namespace Events
 		shouldWait = a_ShouldWait;
 	}
 
+	void CombatEvent::SetTrackedKeywords(std::vector<RE::FormID> a_keywords)
+	{
+		std::lock_guard lock{ combatantLock };
+		combatants.SetTrackedKeywords(std::move(a_keywords));
+	}
+
+	void CombatEvent::SetIntensitySettings(const Selection::IntensitySettings& a_settings)
+	{
+		std::lock_guard lock{ combatantLock };
+		combatants.SetIntensitySettings(a_settings);
+	}
+
+	void CombatEvent::ClearCombatants()
+	{
+		std::lock_guard lock{ combatantLock };
+		combatants.Clear();
+	}
+
+	void CombatEvent::FillCombatants(Selection::Context& a_context)
+	{
+		std::lock_guard lock{ combatantLock };
+		combatants.Fill(a_context);
+	}
+
+	bool CombatEvent::IsBoss(const RE::Actor* a_actor)
+	{
+		const auto defaultObjects = RE::BGSDefaultObjectManager::GetSingleton();
+		const auto bossType = defaultObjects ? defaultObjects->GetObject<RE::BGSLocationRefType>(RE::BGSDefaultObjectManager::DefaultObject::kLocRefTypeBoss) : nullptr;
+		const auto refType = a_actor->extraList.GetByType<RE::ExtraLocationRefType>();
+		return bossType && refType && refType->locRefType == bossType;
+	}
+
+	const RE::Actor* CombatEvent::TrackCombatant(const RE::TESCombatEvent* a_event)
+	{
+		const auto player = RE::PlayerCharacter::GetSingleton();
+		const auto actor = a_event->actor ? a_event->actor->As<RE::Actor>() : nullptr;
+		if (!player || !actor) {
+			return nullptr;
+		}
+
+		std::lock_guard lock{ combatantLock };
+		if (actor == player) {
+			if (a_event->newState == RE::ACTOR_COMBAT_STATE::kNone) {
+				combatants.Clear();
+			}
+			return nullptr;
+		}
+		if (actor->IsPlayerTeammate()) {
+			return nullptr;
+		}
+
+		// Searching for the player still counts, only dropping out of combat or turning on someone else leaves.
+		const auto target = a_event->targetActor ? a_event->targetActor->As<RE::Actor>() : nullptr;
+		const bool fightsPlayer = target && (target == player || target->IsPlayerTeammate());
+		if (a_event->newState == RE::ACTOR_COMBAT_STATE::kNone || !fightsPlayer) {
+			combatants.Leave(actor->GetFormID());
+			return nullptr;
+		}
+
+		const auto base = actor->GetActorBase();
+		if (!base) {
+			return nullptr;
+		}
+		std::vector<RE::FormID> keywords{};
+		Hooks::CombatMusicCalls::GetActorKeywords(actor, keywords);
+		const bool entered = combatants.Enter(actor->GetFormID(), base->GetFormID(), keywords, actor->GetLevel(), IsBoss(actor));
+		return entered ? actor : nullptr;
+	}
+
 	RE::BSEventNotifyControl CombatEvent::ProcessEvent(const RE::TESCombatEvent* event, RE::BSTEventSource<RE::TESCombatEvent>*)
 	{
 		using control = RE::BSEventNotifyControl;
-		if (!event || !shouldWait) {
+		if (!event) {
+			return control::kContinue;
+		}
+		// Speculated once the combatant lock is released, since capturing the context takes it again.
+		if (const auto entered = TrackCombatant(event)) {
+			Hooks::CombatMusicCalls::GetSingleton()->Speculate(entered);
+		}
+		if (!shouldWait) {
 			return control::kContinue;
 		}
 		if (event->newState != RE::ACTOR_COMBAT_STATE::kNone) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "selection/combatantTracker.h"
 #include "utilities/utilities.h"
 
 namespace Events
@@ -10,11 +11,26 @@ namespace Events
 		void RegisterListener();
 		void SetWaitTime(long a_timeSpanSeconds);
 		void SetShouldWait(bool a_ShouldWait);
+		// The keywords the combatant conditions test, sorted. Forgets the current combatants.
+		void SetTrackedKeywords(std::vector<RE::FormID> a_keywords);
+		void SetIntensitySettings(const Selection::IntensitySettings& a_settings);
+		// Forgets every combatant. Called on revert and whenever combat music ends, so actors whose leave event
+		// never arrived do not carry over into the next fight.
+		void ClearCombatants();
+		// Fills the context's combatant sets from the actors currently fighting the player.
+		void FillCombatants(Selection::Context& a_context);
 
 	private:
 		RE::BSEventNotifyControl ProcessEvent(const RE::TESCombatEvent* event, RE::BSTEventSource<RE::TESCombatEvent>*) override;
+		// Adds or removes the event's actor from the combatants, or clears them when the player leaves combat.
+		// Returns the actor if it just started fighting the player.
+		const RE::Actor* TrackCombatant(const RE::TESCombatEvent* a_event);
+		// Bosses are placed as a location's boss, like dungeon chiefs and dragon priests.
+		static bool IsBoss(const RE::Actor* a_actor);
 
 		bool shouldWait;
 		long combatMusicFixWait;
+		std::mutex combatantLock;
+		Selection::CombatantTracker combatants;
 	};
 }
\ No newline at end of file
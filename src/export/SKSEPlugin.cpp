@@ -1,5 +1,7 @@
+#include "api/api.h"
 #include "events/combatEvent.h"
 #include "hooks/hooks.h"
+#include "serialization/serialization.h"
 #include "settings/INISettings.h"
 #include "settings/JSONSettings.h"
 
@@ -67,8 +69,8 @@ static void MessageEventCallback(SKSE::MessagingInterface::Message* a_msg)
 	switch (a_msg->type) {
 	case SKSE::MessagingInterface::kDataLoaded:
 		Events::CombatEvent::GetSingleton()->RegisterListener();
-		JSONSettings::Read();
 		INISettings::Read();
+		JSONSettings::Load();
 		break;
 	default:
 		break;
@@ -78,6 +80,8 @@ static void MessageEventCallback(SKSE::MessagingInterface::Message* a_msg)
 extern "C" DLLEXPORT bool SKSEAPI SKSEPlugin_Load(const SKSE::LoadInterface* a_skse)
 {
 	InitializeLog();
+	INISettings::ReadEarly();
+	Selection::StartupSpan span{ "SKSEPlugin_Load" };
 	logger::info("Starting up {} v{}"sv, Plugin::NAME, Plugin::VERSION.string());
 	logger::info("Author: SeaSparrow");
 	logger::info("___________________________________________________");
@@ -95,5 +99,7 @@ extern "C" DLLEXPORT bool SKSEAPI SKSEPlugin_Load(const SKSE::LoadInterface* a_s
 	messaging->RegisterListener(&MessageEventCallback);
 
 	Hooks::Install();
+	Serialization::Install();
+	API::Install();
 	return true;
 }
\ No newline at end of file
@@ -1,8 +1,58 @@
 #include "Hooks/hooks.h"
 
+#include "api/api.h"
+#include "events/combatEvent.h"
+#include "hooks/ruleAnalysis.h"
+#include "preload/musicPreloader.h"
+#include "selection/hash.h"
+#include "trace/backgroundQueue.h"
+#include "trace/traceRecorder.h"
+
 namespace Hooks {
+	namespace
+	{
+		void AppendKeywords(const RE::BGSKeywordForm* a_form, std::vector<RE::FormID>& a_keywords)
+		{
+			for (std::uint32_t i = 0; i < a_form->numKeywords; ++i) {
+				if (const auto keyword = a_form->keywords[i]) {
+					a_keywords.push_back(keyword->GetFormID());
+				}
+			}
+		}
+
+		// The vanilla music each category replaces.
+		constexpr RE::DEFAULT_OBJECT GetDefaultObject(Selection::MusicCategory a_category)
+		{
+			switch (a_category) {
+			case Selection::MusicCategory::kDungeonCleared:
+				return RE::BGSDefaultObjectManager::DefaultObject::kDungeonClearedMusic;
+			case Selection::MusicCategory::kCombat:
+			default:
+				return RE::BGSDefaultObjectManager::DefaultObject::kBattleMusic;
+			}
+		}
+
+		bool IsVanillaMusic(Selection::MusicCategory a_category, const RE::BGSMusicType* a_music)
+		{
+			const auto defaultObjects = RE::BGSDefaultObjectManager::GetSingleton();
+			assert(defaultObjects);
+			const auto vanillaMusic = defaultObjects->GetObject<RE::BGSMusicType>(GetDefaultObject(a_category));
+			return a_music && vanillaMusic && a_music == vanillaMusic;
+		}
+
+		std::optional<std::filesystem::path> GetStatsPath()
+		{
+			auto path = logger::log_directory();
+			if (path) {
+				*path /= fmt::format("{}.stats"sv, Plugin::NAME);
+			}
+			return path;
+		}
+	}
+
 	void Install()
 	{
+		Selection::StartupSpan span{ "Hooks::Install" };
 		CombatMusicCalls::GetSingleton()->Install();
 		ActorUpdate::Install();
 	}
@@ -52,97 +102,1320 @@ namespace Hooks {
 		storedMusic = a_combatMusic;
 	}
 
-	void CombatMusicCalls::PushNewCombatMusic(ConditionalBattleMusic&& newMusic)
+	void CombatMusicCalls::PushNewMusic(Selection::MusicCategory a_category, ConditionalBattleMusic&& newMusic)
 	{
-		if (newMusic.conditions.empty()) {
+		if (newMusic.conditions.empty() && !newMusic.expression) {
 			return;
 		}
-		conditionalMusic.push_back(std::move(newMusic));
+		newMusic.InitializeStats();
+		categories[static_cast<std::size_t>(a_category)].rules.push_back(std::move(newMusic));
+	}
+
+	void CombatMusicCalls::PruneUnreachableRules()
+	{
+		const auto prune = [this](std::vector<ConditionalBattleMusic>& a_rules, std::string_view a_kind) {
+			auto pruned = RuleAnalysis::FindDominatedRules(a_rules);
+			if (poolTies) {
+				// Rules that tie share their music, so only identical rules can go. Their music joins the pool of
+				// the rule they duplicate, which picks exactly as the tie would have.
+				std::erase_if(pruned, [](const auto& a_entry) { return !a_entry.identical; });
+				for (const auto& entry : pruned) {
+					auto& dominator = a_rules[entry.dominator];
+					const auto& rule = a_rules[entry.position];
+					for (std::size_t i = 0; i < rule.music.size(); ++i) {
+						dominator.AddMusic(rule.music[i], rule.weights[i]);
+					}
+				}
+			}
+			if (pruned.empty()) {
+				return;
+			}
+
+			std::map<std::string, std::vector<const RuleAnalysis::PrunedRule*>> perFile{};
+			for (const auto& entry : pruned) {
+				perFile[a_rules[entry.position].source].push_back(std::addressof(entry));
+			}
+
+			if (poolTies) {
+				logger::info("Merged the music of {} identical {} music rules into the earlier rule's pool:", pruned.size(), a_kind);
+			}
+			else {
+				logger::info("Pruned {} {} music rules that can never be selected:", pruned.size(), a_kind);
+			}
+			for (const auto& [file, entries] : perFile) {
+				logger::info("  <{}>:", file);
+				for (const auto* entry : entries) {
+					const auto& rule = a_rules[entry->position];
+					const auto& dominator = a_rules[entry->dominator];
+					logger::info("    >Rule #{} is {} rule #{} in <{}>.",
+						rule.index,
+						entry->identical ? "identical to" : "dominated by",
+						dominator.index,
+						dominator.source);
+				}
+			}
+
+			std::vector<bool> remove(a_rules.size(), false);
+			for (const auto& entry : pruned) {
+				remove[entry.position] = true;
+			}
+
+			std::vector<ConditionalBattleMusic> kept{};
+			kept.reserve(a_rules.size() - pruned.size());
+			for (std::size_t i = 0; i < a_rules.size(); ++i) {
+				if (!remove[i]) {
+					kept.push_back(std::move(a_rules[i]));
+				}
+			}
+			a_rules = std::move(kept);
+		};
+
+		for (std::size_t i = 0; i < categories.size(); ++i) {
+			const auto category = static_cast<Selection::MusicCategory>(i);
+			prune(categories[i].rules, Selection::GetCategoryName(category));
+			logger::info("Evaluating {} {} music rules.", categories[i].rules.size(), Selection::GetCategoryName(category));
+		}
+		logger::info("___________________________________________________");
+	}
+
+	void CombatMusicCalls::SetCompileRules(bool a_compile)
+	{
+		compileRules = a_compile;
+	}
+
+	void CombatMusicCalls::SetShadowRate(float a_rate)
+	{
+		shadowRate = std::clamp(a_rate, 0.0f, 1.0f);
+	}
+
+	void CombatMusicCalls::SetPoolTies(bool a_poolTies)
+	{
+		poolTies = a_poolTies;
+	}
+
+	void CombatMusicCalls::SetMusicSeed(std::uint64_t a_seed)
+	{
+		musicRandom.seed(a_seed != 0 ? a_seed : std::random_device{}());
+	}
+
+	void CombatMusicCalls::SetRuleProgram(bool a_enabled, bool a_native)
+	{
+		ruleProgram = a_enabled;
+		nativeRules = a_native;
 	}
 
-	void CombatMusicCalls::PushNewClearedMusic(ConditionalBattleMusic&& newMusic)
+	void CombatMusicCalls::SetParallelScoring(std::size_t a_threshold, std::size_t a_threads)
 	{
-		if (newMusic.conditions.empty()) {
+		workers.reset();
+		parallelThreshold = a_threshold;
+		const auto threads = a_threads > 0 ? a_threads : std::thread::hardware_concurrency();
+		if (a_threshold == 0 || threads < 2) {
 			return;
 		}
-		conditionalClearedMusic.push_back(std::move(newMusic));
+		workers = std::make_unique<Selection::WorkerPool>(threads - 1);
+		logger::info("Categories with {} or more rules are scored on {} threads.", a_threshold, threads);
 	}
 
-	RE::BGSMusicType* CombatMusicCalls::GetAppropriateCombatMusic(RE::BGSMusicType* a_music)
+	void CombatMusicCalls::CompileRules()
 	{
-		if (!a_music) {
-			return a_music;
+		// Without a diagram, rules are scored best bound first so the loop can stop early. Equal conditions share
+		// one cached result per selection pass, across all categories.
+		// The hash covers everything that decides which music plays, so a save can tell if its music is still valid.
+		Selection::ConditionInterner interner{};
+		Selection::Hasher hasher{};
+		std::size_t conditionCount = 0;
+		std::vector<RE::FormID> combatantKeywords{};
+		for (auto& blocks : formBlocks) {
+			blocks.Clear();
+		}
+		blockedConditions.clear();
+		rangeConditions.clear();
+		extensionConditions.clear();
+		std::array<std::vector<Selection::IntervalTree::Entry>, Selection::TOTAL_QUANTITIES> ranges{};
+		for (std::size_t c = 0; c < categories.size(); ++c) {
+			auto& category = categories[c];
+			category.bounds.clear();
+			category.opaque.clear();
+			category.extended = false;
+			hasher.Add(category.rules.size());
+			for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(category.rules.size()); ++i) {
+				auto& rule = category.rules[i];
+				// Cheap conditions first, from the estimates and any declared costs, with or without adaptive
+				// ordering. The order never changes a rule's result.
+				rule.Reorder();
+				const auto shape = rule.GetShape();
+				auto bound = Selection::GetBound(shape, i);
+				if (rule.expression) {
+					const auto folded = rule.expression->GetBound();
+					bound.high = bound.high || folded.high;
+					bound.score += folded.score;
+					const auto keywords = rule.expression->GetForms(ConditionType::kCombatantKeyword);
+					combatantKeywords.insert(combatantKeywords.end(), keywords.begin(), keywords.end());
+				}
+				category.bounds.push_back(bound);
+				if (rule.IsOpaque()) {
+					category.opaque.push_back(bound);
+				}
+				rule.shared.clear();
+				for (const auto& condition : shape) {
+					const auto before = interner.GetSize();
+					const auto id = interner.Intern(condition.type, condition.forms);
+					rule.shared.push_back(id);
+					if (interner.GetSize() > before && condition.type == ConditionType::kRange) {
+						// Ranges past midnight go in as the evening and the morning.
+						const auto& ranged = static_cast<const RangeCondition&>(*rule.conditions[rule.shared.size() - 1]);
+						rangeConditions.push_back(id);
+						auto& entries = ranges[static_cast<std::size_t>(ranged.quantity)];
+						const auto [low, high] = ranged.range;
+						if (low > high) {
+							entries.push_back(Selection::IntervalTree::Entry{ Selection::Range{ low, 24.0f }, id });
+							entries.push_back(Selection::IntervalTree::Entry{ Selection::Range{ 0.0f, high }, id });
+						}
+						else {
+							entries.push_back(Selection::IntervalTree::Entry{ ranged.range, id });
+						}
+					}
+					if (condition.type == ConditionType::kExtension) {
+						category.extended = true;
+						const auto& extension = static_cast<const ExtensionCondition&>(*rule.conditions[rule.shared.size() - 1]);
+						extensionConditions.emplace_back(id, extension.inputs);
+					}
+					if (interner.GetSize() > before && Selection::IsSingleValued(condition.type)) {
+						formBlocks[static_cast<std::size_t>(condition.type)].Add(id, condition.forms);
+						blockedConditions.push_back(id);
+					}
+					if (condition.type == ConditionType::kCombatantKeyword) {
+						combatantKeywords.insert(combatantKeywords.end(), condition.forms.begin(), condition.forms.end());
+					}
+					hasher.Add(static_cast<std::uint64_t>(condition.type), 1);
+					hasher.Add(condition.AND ? 1 : 0, 1);
+					hasher.Add(condition.forms.size(), 4);
+					for (const auto form : condition.forms) {
+						hasher.Add(form, 4);
+					}
+				}
+				hasher.Add(rule.expression ? 1 : 0, 1);
+				if (rule.expression) {
+					rule.expression->Hash(hasher);
+				}
+				hasher.Add(rule.music.size(), 4);
+				for (std::size_t j = 0; j < rule.music.size(); ++j) {
+					hasher.Add(rule.music[j] ? rule.music[j]->GetFormID() : 0, 4);
+					hasher.Add(std::bit_cast<std::uint32_t>(rule.weights[j]), 4);
+				}
+				conditionCount += shape.size();
+			}
+			Selection::SortBounds(category.bounds);
+			Selection::SortBounds(category.opaque);
+			category.diagram.Clear();
+			category.places.Clear();
+			category.remaining.clear();
+		}
+		sharedConditions = interner.GetSize();
+		blockMask.assign((sharedConditions + 63) / 64, 0);
+		std::ranges::sort(extensionConditions);
+		extensionConditions.erase(std::unique(extensionConditions.begin(), extensionConditions.end()), extensionConditions.end());
+		extensionInputs = 0;
+		for (const auto& [id, inputs] : extensionConditions) {
+			extensionInputs |= inputs;
+		}
+		dependencyCache.Reset(sharedConditions);
+		testedQuantities = 0;
+		for (std::size_t i = 0; i < rangeTrees.size(); ++i) {
+			testedQuantities |= ranges[i].empty() ? 0 : 1u << i;
+			rangeTrees[i].Build(std::move(ranges[i]));
+		}
+		ruleSetHash = hasher.Get();
+		passValid = false;
+		// Combatants only keep the keywords some rule asks about.
+		Selection::Context::Normalize(combatantKeywords);
+		Events::CombatEvent::GetSingleton()->SetTrackedKeywords(std::move(combatantKeywords));
+		if (conditionCount > 0) {
+			logger::info("Rules share {} distinct conditions out of {}.", sharedConditions, conditionCount);
+		}
+		if (!blockedConditions.empty()) {
+			logger::info("  >{} single value conditions are checked together with the {} kernel.",
+				blockedConditions.size(), Selection::GetFormKernelName(Selection::GetBestFormKernel()));
+		}
+		if (!rangeConditions.empty()) {
+			logger::info("  >{} distinct ranges are looked up together, in one interval tree per quantity.", rangeConditions.size());
+		}
+		if (!extensionConditions.empty()) {
+			logger::info("  >{} conditions of registered kinds are evaluated again only when their inputs change.", extensionConditions.size());
 		}
 
-		const auto defaultObjects = RE::BGSDefaultObjectManager::GetSingleton();
-		assert(defaultObjects);
-		const auto MUSCombat = defaultObjects->GetObject<RE::BGSMusicType>(
-			RE::BGSDefaultObjectManager::DefaultObject::kBattleMusic);
-		if (!MUSCombat || a_music != MUSCombat) {
-			return a_music;
+		std::array<std::vector<Selection::RuleShape>, Selection::TOTAL_MUSIC_CATEGORIES> shapes{};
+		std::vector<RE::FormID> locationForms{};
+		std::vector<RE::FormID> keywordForms{};
+		const auto collect = [&](const std::vector<ConditionalBattleMusic>& a_rules, std::vector<Selection::RuleShape>& a_shapes) {
+			for (const auto& rule : a_rules) {
+				auto shape = rule.GetShape();
+				for (const auto& condition : shape) {
+					if (condition.type == ConditionType::kLocation) {
+						locationForms.insert(locationForms.end(), condition.forms.begin(), condition.forms.end());
+					}
+					else if (condition.type == ConditionType::kLocationKeyword) {
+						keywordForms.insert(keywordForms.end(), condition.forms.begin(), condition.forms.end());
+					}
+				}
+				if (rule.expression) {
+					const auto expressionLocations = rule.expression->GetForms(ConditionType::kLocation);
+					const auto expressionKeywords = rule.expression->GetForms(ConditionType::kLocationKeyword);
+					locationForms.insert(locationForms.end(), expressionLocations.begin(), expressionLocations.end());
+					keywordForms.insert(keywordForms.end(), expressionKeywords.begin(), expressionKeywords.end());
+				}
+				a_shapes.push_back(std::move(shape));
+			}
+		};
+		for (std::size_t i = 0; i < categories.size(); ++i) {
+			collect(categories[i].rules, shapes[i]);
+		}
+		Selection::TypeMask combatTypes = 0;
+		unpredictableCombat = false;
+		for (const auto& shape : shapes[static_cast<std::size_t>(Selection::MusicCategory::kCombat)]) {
+			for (const auto& condition : shape) {
+				if (condition.type >= ConditionType::kTotal) {
+					unpredictableCombat = true;
+					continue;
+				}
+				combatTypes |= 1u << static_cast<std::uint32_t>(condition.type);
+			}
+		}
+		if (unpredictableCombat && speculate) {
+			logger::info("Combat music rules use ranges or registered condition kinds, which cannot be answered ahead of time. Not speculating.");
 		}
+		for (const auto& rule : categories[static_cast<std::size_t>(Selection::MusicCategory::kCombat)].rules) {
+			combatTypes |= rule.expression ? rule.expression->GetTypes() : 0;
+		}
+		// The engines built from shapes see opaque rules as never matching, and leave them to the bounded loop.
+		for (std::size_t i = 0; i < categories.size(); ++i) {
+			for (const auto& bound : categories[i].opaque) {
+				shapes[i][bound.rule].clear();
+			}
+		}
+		{
+			std::lock_guard guard{ speculationLock };
+			speculations.SetTestedTypes(combatTypes);
+		}
+		Selection::Context::Normalize(locationForms);
+		Selection::Context::Normalize(keywordForms);
 
-		RE::BGSMusicType* newMusic = nullptr;
-		int bestMatch = 0;
-		PriorityLevel bestPriorityLevel = PriorityLevel::LOW;
-		for (const auto& candidate : conditionalMusic) {
-			const auto candidateMatch = candidate.MatchDegree();
-			if (candidateMatch.first == PriorityLevel::HIGH && bestPriorityLevel == PriorityLevel::LOW) {
-				bestPriorityLevel = PriorityLevel::HIGH;
-				bestMatch = candidateMatch.second;
-				newMusic = candidate.music;
+		// The location chain and its keywords only depend on the current location, so every location that can
+		// satisfy a condition is tabled. The diagrams switch on the current location directly, and the place
+		// tables get a column for it.
+		Selection::DecisionDiagram::LocationTable locations{};
+		Selection::Context scratch{};
+		for (const auto location : RE::TESDataHandler::GetSingleton()->GetFormArray<RE::BGSLocation>()) {
+			if (!location) {
+				continue;
 			}
-			else if (candidateMatch.first == PriorityLevel::LOW && bestPriorityLevel == PriorityLevel::HIGH) {
+			scratch.Clear();
+			CaptureLocation(location, scratch);
+			const auto touches = [](const std::vector<RE::FormID>& a_values, const std::vector<RE::FormID>& a_forms) {
+				return std::ranges::any_of(a_values, [&](RE::FormID a_value) { return std::ranges::binary_search(a_forms, a_value); });
+			};
+			if (touches(scratch.locations, locationForms) || touches(scratch.locationKeywords, keywordForms)) {
+				locations.emplace(location->GetFormID(), Selection::DecisionDiagram::LocationInfo{ scratch.locations, scratch.locationKeywords });
+			}
+		}
+
+		if (compileRules) {
+			logger::info("Compiling rules into decision diagrams...");
+			logger::info("  >Tabled {} relevant locations.", locations.size());
+			const auto compile = [&](CategoryRules& a_category, const std::vector<Selection::RuleShape>& a_shapes, std::string_view a_kind) {
+				auto& diagram = a_category.diagram;
+				if (!diagram.Build(a_shapes, std::addressof(locations), Selection::DecisionDiagram::DEFAULT_MAX_NODES, poolTies)) {
+					logger::warn("  >The {} music rules are too large to compile, falling back to evaluating them one by one.", a_kind);
+					return;
+				}
+
+				const auto mismatches = VerifySelection([&](const Selection::Context& a_context) {
+					std::size_t skipped = 0;
+					return SelectOptimized(a_category, a_context, false, nullptr, skipped);
+				}, a_category.rules, locations);
+				if (mismatches > 0) {
+					logger::error("  >The {} music diagram disagreed with the rules in {} checks, falling back to evaluating them one by one.", a_kind, mismatches);
+					diagram.Clear();
+					return;
+				}
+				logger::info("  >Compiled {} {} music rules into {} nodes in {} parts, depth {}.",
+					a_category.rules.size() - a_category.opaque.size(),
+					a_kind,
+					diagram.GetNodeCount(),
+					diagram.GetPartCount(),
+					diagram.GetDepth());
+				if (!a_category.opaque.empty()) {
+					logger::info("  >{} {} music rules use expressions, ranges or registered condition kinds, and are scored after the diagram.",
+						a_category.opaque.size(),
+						a_kind);
+				}
+			};
+			for (std::size_t i = 0; i < categories.size(); ++i) {
+				compile(categories[i], shapes[i], Selection::GetCategoryName(static_cast<Selection::MusicCategory>(i)));
+			}
+			logger::info("___________________________________________________");
+		}
+
+		// Rules that only look at where the player is are answered ahead of time for every place they can tell
+		// apart, so the bounded loop only scores the rules that depend on the fight.
+		const auto tabulate = [&](CategoryRules& a_category, const std::vector<Selection::RuleShape>& a_shapes, std::string_view a_kind) {
+			auto& places = a_category.places;
+			const auto start = std::chrono::steady_clock::now();
+			if (!places.Build(a_shapes, locations, Selection::PlaceTable::DEFAULT_MAX_ENTRIES, poolTies)) {
+				return;
+			}
+			const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			a_category.remaining = places.GetRemainingBounds(a_category.bounds);
+			const auto mismatches = VerifySelection([&](const Selection::Context& a_context) {
+				std::size_t skipped = 0;
+				return SelectOptimized(a_category, a_context, false, nullptr, skipped);
+			}, a_category.rules, locations);
+			if (mismatches > 0) {
+				logger::error("The {} music place table disagreed with the rules in {} checks, scoring every rule instead.", a_kind, mismatches);
+				places.Clear();
+				a_category.remaining.clear();
+				return;
+			}
+			logger::info("Tabled {} of {} {} music rules for {} worldspaces and {} locations in {:.2f}ms, using {:.1f}KB.",
+				places.GetRuleCount(),
+				a_category.rules.size(),
+				a_kind,
+				places.GetRowCount() - 1,
+				places.GetColumnCount() - 1,
+				elapsed,
+				static_cast<double>(places.GetMemoryUsage()) / 1024.0);
+		};
+
+		// The whole category as one flat program, optionally translated to native code, instead of the table.
+		const auto flatten = [&](CategoryRules& a_category, const std::vector<Selection::RuleShape>& a_shapes, std::string_view a_kind) {
+			auto& program = a_category.program;
+			auto& native = a_category.native;
+			const auto start = std::chrono::steady_clock::now();
+			program.Build(a_shapes);
+			if (nativeRules && !native.Build(program)) {
+				logger::warn("Could not generate native code for the {} music rules, interpreting them instead.", a_kind);
+			}
+			const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			const auto mismatches = VerifySelection([&](const Selection::Context& a_context) {
+				std::size_t skipped = 0;
+				return SelectOptimized(a_category, a_context, false, nullptr, skipped);
+			}, a_category.rules, locations);
+			if (mismatches > 0) {
+				logger::error("The {} music rule program disagreed with the rules in {} checks, scoring them one by one instead.", a_kind, mismatches);
+				native.Clear();
+				program.Clear();
+				return;
+			}
+			logger::info("Flattened {} {} music rules into {} tests over {} atoms in {:.2f}ms, {}.",
+				a_category.rules.size(),
+				a_kind,
+				program.GetTests().size(),
+				program.GetAtomCount(),
+				elapsed,
+				native.IsBuilt() ? fmt::format("running {:.1f}KB of native code", static_cast<double>(native.GetCodeSize()) / 1024.0) : "interpreted"s);
+		};
+		for (std::size_t i = 0; i < categories.size(); ++i) {
+			if (categories[i].diagram.IsBuilt()) {
 				continue;
 			}
-			else if (bestMatch < candidateMatch.second) {
-				bestMatch = candidateMatch.second;
-				newMusic = candidate.music;
+			const auto kind = Selection::GetCategoryName(static_cast<Selection::MusicCategory>(i));
+			if (ruleProgram) {
+				flatten(categories[i], shapes[i], kind);
+			}
+			if (!categories[i].program.IsBuilt()) {
+				tabulate(categories[i], shapes[i], kind);
 			}
 		}
 
-		if (newMusic) {
-			logger::debug("  Starting {}", Utilities::EDID::GetEditorID(newMusic));
-			storedMusic = newMusic;
-			return newMusic;
+		// Every group of rules the diagram or the place table can find tied gets its merged pool now, so picking
+		// from a tie they answer costs one draw.
+		for (auto& category : categories) {
+			category.tiedPools.clear();
+			const auto* groups = category.diagram.HasTieGroups() ? std::addressof(category.diagram.GetTieGroups()) :
+			                     category.places.HasTieGroups()  ? std::addressof(category.places.GetTieGroups()) :
+			                                                       nullptr;
+			if (!groups) {
+				continue;
+			}
+			category.tiedPools.resize(groups->GetCount());
+			std::vector<float> weights{};
+			for (std::uint32_t group = 0; group < groups->GetCount(); ++group) {
+				auto& pool = category.tiedPools[group];
+				weights.clear();
+				for (const auto rule : groups->Get(group)) {
+					const auto& tied = category.rules[rule];
+					pool.music.insert(pool.music.end(), tied.music.begin(), tied.music.end());
+					weights.insert(weights.end(), tied.weights.begin(), tied.weights.end());
+				}
+				pool.table.Build(weights);
+				pool.weight = std::accumulate(weights.begin(), weights.end(), 0.0f);
+			}
 		}
-		return a_music;
 	}
 
-	RE::BGSMusicType* CombatMusicCalls::GetAppropriateClearedMusic(RE::BGSMusicType* a_music)
+	void CombatMusicCalls::StartTrace()
+	{
+		// Traces hold no numbers and registered kinds need the plugin that evaluates them, so both are left out.
+		const auto describe = [](const std::vector<ConditionalBattleMusic>& a_rules, Selection::TraceRuleSet& a_set) {
+			for (const auto& rule : a_rules) {
+				auto shape = rule.GetShape();
+				std::erase_if(shape, [](const Selection::ConditionShape& a_condition) { return a_condition.type >= ConditionType::kTotal; });
+				a_set.rules.push_back(std::move(shape));
+				a_set.music.push_back(rule.music.front() ? rule.music.front()->GetFormID() : 0);
+			}
+		};
+
+		Selection::TraceHeader header{};
+		for (std::size_t i = 0; i < categories.size(); ++i) {
+			describe(categories[i].rules, header.categories[i]);
+		}
+		const auto recorder = Trace::Recorder::GetSingleton();
+		recorder->Start(header);
+
+		const auto opaque = std::ranges::any_of(categories, [](const CategoryRules& a_category) {
+			return std::ranges::any_of(a_category.rules, [](const ConditionalBattleMusic& a_rule) { return a_rule.IsOpaque(); });
+		});
+		if (recorder->IsRecording() && opaque) {
+			logger::warn("The trace only describes flat form conditions, so replaying it will not match selections of rules with expressions, ranges or registered condition kinds.");
+		}
+	}
+
+	void CombatMusicCalls::SetReadyTimeout(std::chrono::milliseconds a_timeout)
+	{
+		readyTimeout = std::max(a_timeout, std::chrono::milliseconds::zero());
+	}
+
+	void CombatMusicCalls::MarkReady()
+	{
+		{
+			std::lock_guard lock{ readyLock };
+			ready.store(true, std::memory_order_release);
+		}
+		readyCondition.notify_all();
+	}
+
+	void CombatMusicCalls::SetPendingLoad(std::function<void()> a_finish)
+	{
+		{
+			std::lock_guard lock{ readyLock };
+			pendingLoad = std::move(a_finish);
+		}
+		readyCondition.notify_all();
+	}
+
+	void CombatMusicCalls::RunPendingLoad()
+	{
+		std::function<void()> finish{};
+		{
+			std::lock_guard lock{ readyLock };
+			finish = std::exchange(pendingLoad, nullptr);
+		}
+		if (finish) {
+			finish();
+		}
+	}
+
+	bool CombatMusicCalls::WaitUntilReady()
+	{
+		if (ready.load(std::memory_order_acquire)) {
+			return true;
+		}
+		// The waiting is for the background parse. Whatever it handed over is finished here, since the queued task
+		// cannot run while the main thread waits.
+		if (readyTimeout > std::chrono::milliseconds::zero()) {
+			std::unique_lock lock{ readyLock };
+			readyCondition.wait_for(lock, readyTimeout, [this]() { return ready.load(std::memory_order_acquire) || pendingLoad != nullptr; });
+		}
+		RunPendingLoad();
+		return ready.load(std::memory_order_acquire);
+	}
+
+	std::uint64_t CombatMusicCalls::GetRuleSetHash() const
+	{
+		return ruleSetHash;
+	}
+
+	std::optional<CombatMusicCalls::StoredSelection> CombatMusicCalls::GetStoredSelection() const
+	{
+		if (!storedMusic) {
+			return std::nullopt;
+		}
+		return StoredSelection{ storedCategory, storedMusic };
+	}
+
+	void CombatMusicCalls::SetRestoredSelection(const StoredSelection& a_selection, std::uint64_t a_ruleSet)
+	{
+		restored = a_selection;
+		restoredRuleSet = a_ruleSet;
+	}
+
+	void CombatMusicCalls::ClearRestoredSelection()
+	{
+		restored.reset();
+	}
+
+	void CombatMusicCalls::SetAdaptiveOrder(bool a_adaptive)
+	{
+		adaptiveOrder = a_adaptive;
+	}
+
+	void CombatMusicCalls::LoadConditionStats()
+	{
+		if (!adaptiveOrder) {
+			return;
+		}
+		if (std::ranges::all_of(categories, [](const CategoryRules& a_category) { return a_category.diagram.IsBuilt(); })) {
+			logger::info("All rule sets are compiled, condition order is not learned.");
+			return;
+		}
+
+		const auto path = GetStatsPath();
+		if (!path || !std::filesystem::exists(*path)) {
+			logger::info("No condition statistics from earlier sessions, learning from scratch.");
+			return;
+		}
+		Selection::StatsTable table{};
+		std::string error{};
+		if (!Selection::ReadConditionStats(path->string(), table, error)) {
+			logger::warn("Could not read condition statistics from <{}>: {} Learning from scratch.", path->string(), error);
+			return;
+		}
+
+		std::size_t restored = 0;
+		std::size_t total = 0;
+		std::unique_lock lock{ ruleLock };
+		for (auto& category : categories) {
+			for (auto& rule : category.rules) {
+				for (std::size_t i = 0; i < rule.stats.size(); ++i) {
+					total++;
+					if (const auto it = table.find(rule.statsKeys[i]); it != table.end()) {
+						rule.stats[i] = it->second;
+						restored++;
+					}
+				}
+				rule.Reorder();
+			}
+		}
+		logger::info("Restored statistics for {} of {} conditions from <{}>.", restored, total, path->string());
+	}
+
+	void CombatMusicCalls::ReorderConditions()
+	{
+		sinceReorder = 0;
+		Selection::StatsTable table{};
+		std::unique_lock lock{ ruleLock };
+		for (auto& category : categories) {
+			for (auto& rule : category.rules) {
+				rule.Reorder();
+				for (std::size_t i = 0; i < rule.stats.size(); ++i) {
+					table[rule.statsKeys[i]] = rule.stats[i];
+				}
+			}
+		}
+		lock.unlock();
+
+		const auto path = GetStatsPath();
+		// A write that is still running means this snapshot is skipped, the next reorder saves again.
+		if (!path || savingStats.exchange(true)) {
+			return;
+		}
+		Trace::BackgroundQueue::GetSingleton()->Post([this, path = path->string(), table = std::move(table)]() {
+			std::string error{};
+			if (!Selection::WriteConditionStats(path, table, error)) {
+				logger::warn("Could not save condition statistics to <{}>: {}", path, error);
+			}
+			savingStats = false;
+		});
+	}
+
+	void CombatMusicCalls::RecordTrace(Selection::TraceHook a_hook, RE::BGSMusicType* a_original, RE::BGSMusicType* a_chosen)
+	{
+		const bool madeSelection = std::exchange(selected, false);
+		const auto recorder = Trace::Recorder::GetSingleton();
+		if (!recorder->IsRecording()) {
+			return;
+		}
+
+		if (!madeSelection) {
+			CaptureContext(context);
+		}
+		Selection::TraceRecord record{};
+		record.hook = a_hook;
+		record.selected = madeSelection;
+		record.rule = madeSelection ? selectedRule : -1;
+		record.original = a_original ? a_original->GetFormID() : 0;
+		record.chosen = a_chosen ? a_chosen->GetFormID() : 0;
+		record.context = context;
+		recorder->Record(record);
+	}
+
+	std::size_t CombatMusicCalls::VerifySelection(const std::function<std::int32_t(const Selection::Context&)>& a_select,
+		const std::vector<ConditionalBattleMusic>& a_rules,
+		const Selection::DecisionDiagram::LocationTable& a_locations)
+	{
+		constexpr std::size_t checks = 1024;
+
+		std::array<std::vector<RE::FormID>, Selection::TOTAL_CONDITION_TYPES> forms{};
+		for (const auto& rule : a_rules) {
+			for (const auto& condition : rule.conditions) {
+				if (condition->type >= ConditionType::kTotal) {
+					continue;
+				}
+				const auto ids = condition->GetFormIDs();
+				auto& known = forms[static_cast<std::size_t>(condition->type)];
+				known.insert(known.end(), ids.begin(), ids.end());
+			}
+			if (!rule.expression) {
+				continue;
+			}
+			for (std::size_t type = 0; type < forms.size(); ++type) {
+				const auto ids = rule.expression->GetForms(static_cast<ConditionType>(type));
+				forms[type].insert(forms[type].end(), ids.begin(), ids.end());
+			}
+		}
+		std::vector<const std::pair<const RE::FormID, Selection::DecisionDiagram::LocationInfo>*> locations{};
+		for (const auto& entry : a_locations) {
+			locations.push_back(std::addressof(entry));
+		}
+
+		// Values are drawn from the forms the rules mention, plus a chance of something unrelated.
+		std::mt19937 random{ static_cast<std::uint32_t>(a_rules.size()) };
+		const auto pick = [&](ConditionType a_type) -> RE::FormID {
+			const auto& known = forms[static_cast<std::size_t>(a_type)];
+			if (known.empty() || random() % 4 == 0) {
+				return 0;
+			}
+			return known[random() % known.size()];
+		};
+
+		std::size_t mismatches = 0;
+		Selection::Context sample{};
+		for (std::size_t i = 0; i < checks; ++i) {
+			sample.Clear();
+			sample.worldspace = pick(ConditionType::kWorldspace);
+			sample.cell = pick(ConditionType::kCell);
+			sample.target = pick(ConditionType::kCombatTarget);
+			sample.intensity = pick(ConditionType::kIntensity);
+			if (!locations.empty() && random() % 4 != 0) {
+				const auto* location = locations[random() % locations.size()];
+				sample.locations = location->second.chain;
+				sample.locationKeywords = location->second.keywords;
+			}
+			const auto fill = [&](ConditionType a_type, std::vector<RE::FormID>& a_values, std::size_t a_max) {
+				for (std::size_t value = random() % (a_max + 1); value > 0; --value) {
+					if (const auto form = pick(a_type)) {
+						a_values.push_back(form);
+					}
+				}
+				Selection::Context::Normalize(a_values);
+			};
+			fill(ConditionType::kCombatTargetKeyword, sample.targetKeywords, 2);
+			fill(ConditionType::kCombatant, sample.combatants, 3);
+			fill(ConditionType::kCombatantKeyword, sample.combatantKeywords, 3);
+
+			if (a_select(sample) != SelectRule(a_rules, sample)) {
+				mismatches++;
+			}
+		}
+		return mismatches;
+	}
+
+	std::int32_t CombatMusicCalls::SelectRule(const std::vector<ConditionalBattleMusic>& a_rules, const Selection::Context& a_context)
 	{
-		RE::BGSMusicType* newMusic = nullptr;
+		std::int32_t response = -1;
 		int bestMatch = 0;
 		PriorityLevel bestPriorityLevel = PriorityLevel::LOW;
-		for (const auto& candidate : conditionalClearedMusic) {
-			const auto candidateMatch = candidate.MatchDegree();
+		for (std::int32_t i = 0; i < static_cast<std::int32_t>(a_rules.size()); ++i) {
+			const auto candidateMatch = a_rules[i].MatchDegree(a_context);
 			if (candidateMatch.first == PriorityLevel::HIGH && bestPriorityLevel == PriorityLevel::LOW) {
 				bestPriorityLevel = PriorityLevel::HIGH;
 				bestMatch = candidateMatch.second;
-				newMusic = candidate.music;
+				response = i;
 			}
 			else if (candidateMatch.first == PriorityLevel::LOW && bestPriorityLevel == PriorityLevel::HIGH) {
 				continue;
 			}
 			else if (bestMatch < candidateMatch.second) {
 				bestMatch = candidateMatch.second;
-				newMusic = candidate.music;
+				response = i;
+			}
+		}
+		return response;
+	}
+
+	std::int32_t CombatMusicCalls::SelectOptimized(const CategoryRules& a_category,
+		const Selection::Context& a_context,
+		bool a_learn,
+		Selection::ConditionCache* a_cache,
+		std::size_t& a_skipped) const
+	{
+		const auto match = [&](std::uint32_t a_rule) {
+			const auto [priority, score] = a_category.rules[a_rule].MatchDegree(a_context, a_learn, a_cache);
+			return Selection::Match{ priority == PriorityLevel::HIGH, score };
+		};
+		// The diagram and the program answer every rule but the opaque ones, whose bounded loop starts from that
+		// answer. Rule order still breaks ties between the two.
+		if (a_category.diagram.IsBuilt()) {
+			a_skipped = 0;
+			const auto result = a_category.diagram.Evaluate(a_context);
+			return a_category.opaque.empty() ? result.rule :
+			                                   Selection::SelectBounded(a_category.opaque, match, a_skipped, result.rule, Selection::Match{ result.high, result.score });
+		}
+		if (a_category.program.IsBuilt()) {
+			// Reused per thread, so only the first call on a thread allocates.
+			thread_local Selection::RuleProgram::Input input{};
+			a_category.program.Prepare(a_context, input);
+			a_skipped = 0;
+			const auto rule = a_category.native.IsBuilt() ? a_category.native.Run(input) : a_category.program.Run(input);
+			if (a_category.opaque.empty()) {
+				return rule;
+			}
+			return Selection::SelectBounded(a_category.opaque, match, a_skipped, rule, rule >= 0 ? match(static_cast<std::uint32_t>(rule)) : Selection::Match{});
+		}
+		// Workers neither learn nor share the cache, since both are written while scoring. A busy pool, like
+		// during an Evaluate on another thread, scores on this thread instead. Registered kinds stay on this one.
+		if (workers && a_category.rules.size() >= parallelThreshold && !a_category.extended) {
+			const auto response = Selection::SelectParallel(*workers, a_category.rules.size(), [&](std::uint32_t a_rule) {
+				const auto [priority, score] = a_category.rules[a_rule].MatchDegree(a_context);
+				return Selection::Match{ priority == PriorityLevel::HIGH, score };
+			});
+			if (response) {
+				a_skipped = 0;
+				return *response;
+			}
+		}
+		if (!a_category.places.IsBuilt()) {
+			return Selection::SelectBounded(a_category.bounds, match, a_skipped);
+		}
+
+		// The tabled rules are answered by one lookup, and their answer seeds the loop over the rest.
+		const auto& placed = a_category.places.Lookup(a_context);
+		const auto response = Selection::SelectBounded(a_category.remaining, match, a_skipped, placed.rule, placed.match);
+		a_skipped += a_category.places.GetRuleCount();
+		return response;
+	}
+
+	std::int32_t CombatMusicCalls::Select(CategoryRules& a_category, const Selection::Context& a_context, std::string_view a_kind)
+	{
+		const auto& rules = a_category.rules;
+		if (shadowRate > 0.0f && std::uniform_real_distribution<float>{}(shadowRandom) < shadowRate) {
+			return ShadowSelect(a_category, a_context, a_kind);
+		}
+
+		std::size_t skipped = 0;
+		const bool learn = adaptiveOrder && (!a_category.diagram.IsBuilt() || !a_category.opaque.empty());
+		const auto response = SelectOptimized(a_category, a_context, learn, std::addressof(conditionCache), skipped);
+		if (!a_category.diagram.IsBuilt()) {
+			logger::debug("  Scored {} of {} {} music rules, skipped {}.", rules.size() - skipped, rules.size(), a_kind, skipped);
+		}
+		return response;
+	}
+
+	void CombatMusicCalls::SelectAll(const Selection::Context& a_context)
+	{
+		if (passValid && a_context == passContext) {
+			logger::debug("  Context is unchanged, reusing the last winners.");
+			return;
+		}
+
+		conditionCache.Begin(sharedConditions);
+		// Conditions of registered kinds whose inputs did not change since they were evaluated keep their result.
+		if (!extensionConditions.empty()) {
+			dependencyCache.Begin(a_context);
+			for (const auto& [id, inputs] : extensionConditions) {
+				if (const auto cached = dependencyCache.Find(id, inputs)) {
+					conditionCache.Set(id, *cached);
+				}
+			}
+		}
+		// Worldspace, cell, target and intensity conditions are answered for every rule before any rule is scored.
+		// Compiled diagrams never look at the cache, so this is skipped if every category has one and no opaque rules.
+		if (std::ranges::any_of(categories, [](const CategoryRules& a_category) {
+				return !a_category.diagram.IsBuilt() || !a_category.opaque.empty();
+			})) {
+			std::ranges::fill(blockMask, 0);
+			for (std::size_t type = 0; type < formBlocks.size(); ++type) {
+				formBlocks[type].Match(a_context.GetValue(static_cast<ConditionType>(type)), blockMask.data());
+			}
+			for (const auto id : blockedConditions) {
+				conditionCache.Set(id, ((blockMask[id / 64] >> (id % 64)) & 1) != 0);
+			}
+			// Every range fails until its tree finds that it holds the value, so no rule tests a range itself.
+			for (const auto id : rangeConditions) {
+				conditionCache.Set(id, false);
+			}
+			for (std::size_t i = 0; i < rangeTrees.size(); ++i) {
+				rangeTrees[i].Find(a_context.quantities[i], [&](std::uint32_t a_id) { conditionCache.Set(a_id, true); });
+			}
+		}
+		bool learned = false;
+		for (std::size_t i = 0; i < categories.size(); ++i) {
+			auto& category = categories[i];
+			category.winner = Select(category, a_context, Selection::GetCategoryName(static_cast<Selection::MusicCategory>(i)));
+			learned |= adaptiveOrder && (!category.diagram.IsBuilt() || !category.opaque.empty());
+		}
+		passContext = a_context;
+		passValid = true;
+		for (const auto& [id, inputs] : extensionConditions) {
+			if (const auto result = conditionCache.Find(id)) {
+				dependencyCache.Store(id, inputs, *result);
+			}
+		}
+
+		if (learned && ++sinceReorder >= 32) {
+			ReorderConditions();
+		}
+	}
+
+	std::int32_t CombatMusicCalls::ShadowSelect(CategoryRules& a_category, const Selection::Context& a_context, std::string_view a_kind) const
+	{
+		const auto& rules = a_category.rules;
+		auto& stats = a_category.shadow;
+
+		using Clock = std::chrono::steady_clock;
+		const auto microseconds = [](Clock::duration a_duration) {
+			return std::chrono::duration<double, std::micro>(a_duration).count();
+		};
+
+		// Alternate which path runs first, so neither always gets the warm cache.
+		std::int32_t legacy = -1;
+		std::int32_t optimized = -1;
+		std::size_t skipped = 0;
+		double legacyTime = 0.0;
+		double optimizedTime = 0.0;
+		const auto runLegacy = [&]() {
+			const auto start = Clock::now();
+			legacy = SelectRule(rules, a_context);
+			legacyTime = microseconds(Clock::now() - start);
+		};
+		const auto runOptimized = [&]() {
+			const auto start = Clock::now();
+			optimized = SelectOptimized(a_category, a_context, false, nullptr, skipped);
+			optimizedTime = microseconds(Clock::now() - start);
+		};
+		if (stats.samples % 2 == 0) {
+			runLegacy();
+			runOptimized();
+		}
+		else {
+			runOptimized();
+			runLegacy();
+		}
+
+		stats.samples++;
+		stats.skipped += skipped;
+		stats.legacyTotal += legacyTime;
+		stats.legacyMax = std::max(stats.legacyMax, legacyTime);
+		stats.optimizedTotal += optimizedTime;
+		stats.optimizedMax = std::max(stats.optimizedMax, optimizedTime);
+		logger::debug("Shadow {} selection: MatchDegree {:.2f}us, optimized {:.2f}us, skipped {} rules.", a_kind, legacyTime, optimizedTime, skipped);
+
+		if (legacy != optimized) {
+			stats.disagreements++;
+			const auto describe = [&](std::int32_t a_rule) {
+				if (a_rule < 0) {
+					return "no rule"s;
+				}
+				const auto& rule = rules[a_rule];
+				return fmt::format("rule #{} in <{}> ({})", rule.index, rule.source, Utilities::EDID::GetEditorID(rule.music.front()));
+			};
+			logger::error("Shadow evaluation disagreed on {} music: MatchDegree picked {}, the {} picked {}. Using the MatchDegree result.",
+				a_kind,
+				describe(legacy),
+				a_category.diagram.IsBuilt()                                 ? "compiled rules" :
+				a_category.native.IsBuilt()                                  ? "native rules" :
+				a_category.program.IsBuilt()                                 ? "rule program" :
+				workers && a_category.rules.size() >= parallelThreshold ? "parallel scoring" :
+				a_category.places.IsBuilt()                                  ? "place table" :
+																			   "bounded loop",
+				describe(optimized));
+			logger::error("  >Context: {}", a_context.Describe());
+		}
+
+		if (stats.samples % 64 == 0) {
+			const auto samples = static_cast<double>(stats.samples);
+			logger::info("Shadow evaluation of {} music: {} samples, {} disagreements. MatchDegree mean {:.2f}us (max {:.2f}us), optimized mean {:.2f}us (max {:.2f}us), {:.1f} of {} rules skipped on average.",
+				a_kind,
+				stats.samples,
+				stats.disagreements,
+				stats.legacyTotal / samples,
+				stats.legacyMax,
+				stats.optimizedTotal / samples,
+				stats.optimizedMax,
+				static_cast<double>(stats.skipped) / samples,
+				rules.size());
+		}
+		return legacy;
+	}
+
+	RE::BGSMusicType* CombatMusicCalls::PickMusic(const CategoryRules& a_category,
+		std::int32_t a_winner,
+		const Selection::Context& a_context,
+		std::mt19937_64& a_random) const
+	{
+		const auto& rules = a_category.rules;
+		const auto& winner = rules[a_winner];
+		if (!poolTies) {
+			return winner.PickMusic(a_random);
+		}
+
+		// Each tied rule is picked in proportion to its pool's total weight, which equals sampling from all pools
+		// merged. Groups the diagram or the place table found tied come merged already, so only the rules the
+		// bounded loop scores are matched again, and only while their bound can still reach the winner's match.
+		const auto degree = winner.MatchDegree(a_context);
+		const Selection::Match best{ degree.first == PriorityLevel::HIGH, degree.second };
+		const ConditionalBattleMusic* picked = std::addressof(winner);
+		const TiedPool* pooled = nullptr;
+		float total = 0.0f;
+		const auto offer = [&](float a_weight) {
+			total += a_weight;
+			return Selection::UnitRandom(a_random) * total < a_weight;
+		};
+
+		// Reused per thread, so only the first call on a thread allocates.
+		thread_local std::vector<std::uint32_t> groups{};
+		groups.clear();
+		const auto* scanned = std::addressof(a_category.bounds);
+		if (!a_category.tiedPools.empty() && a_category.diagram.IsBuilt()) {
+			a_category.diagram.GetTies(a_context, best, groups);
+			scanned = std::addressof(a_category.opaque);
+		}
+		else if (!a_category.tiedPools.empty()) {
+			const auto& placed = a_category.places.Lookup(a_context);
+			if (placed.rule >= 0 && placed.match.high == best.high && placed.match.score == best.score) {
+				groups.push_back(placed.ties);
+			}
+			scanned = std::addressof(a_category.remaining);
+		}
+		for (const auto group : groups) {
+			if (offer(a_category.tiedPools[group].weight)) {
+				pooled = std::addressof(a_category.tiedPools[group]);
 			}
 		}
+		for (const auto& bound : *scanned) {
+			if (bound.high != best.high ? best.high : bound.score < best.score) {
+				break;
+			}
+			const auto& rule = rules[bound.rule];
+			if (rule.MatchDegree(a_context) == degree && offer(rule.GetTotalWeight())) {
+				picked = std::addressof(rule);
+				pooled = nullptr;
+			}
+		}
+		return pooled ? pooled->music[pooled->table.Sample(a_random)] : picked->PickMusic(a_random);
+	}
+
+	RE::BGSMusicType* CombatMusicCalls::Evaluate(Selection::MusicCategory a_category)
+	{
+		const auto& category = categories[static_cast<std::size_t>(a_category)];
+		if (category.extended) {
+			return nullptr;
+		}
+		// Reused per thread, so only the first call on a thread allocates.
+		thread_local Selection::Context evaluated{};
+		thread_local std::mt19937_64 random{ std::random_device{}() };
+		snapshotWanted.store(true, std::memory_order_relaxed);
+		{
+			std::lock_guard guard{ snapshotLock };
+			if (!snapshotValid) {
+				return nullptr;
+			}
+			evaluated = snapshot;
+		}
+
+		std::shared_lock lock{ ruleLock };
+		std::size_t skipped = 0;
+		const auto winner = SelectOptimized(category, evaluated, false, nullptr, skipped);
+		return winner >= 0 ? PickMusic(category, winner, evaluated, random) : nullptr;
+	}
+
+	void CombatMusicCalls::PublishContext()
+	{
+		if (!snapshotWanted.load(std::memory_order_relaxed)) {
+			return;
+		}
+		// The swap keeps both buffers' capacity, so capturing stops allocating once the context stops growing.
+		CaptureContext(snapshotBack);
+		std::lock_guard guard{ snapshotLock };
+		std::swap(snapshot, snapshotBack);
+		snapshotValid = true;
+	}
 
-		if (newMusic) {
-			logger::debug("  Starting {}", Utilities::EDID::GetEditorID(newMusic));
-			storedMusic = newMusic;
-			return newMusic;
+	void CombatMusicCalls::PublishContext(const Selection::Context& a_context)
+	{
+		if (!snapshotWanted.load(std::memory_order_relaxed)) {
+			return;
 		}
+		std::lock_guard guard{ snapshotLock };
+		snapshot = a_context;
+		snapshotValid = true;
+	}
+
+	void CombatMusicCalls::PredictMusic()
+	{
+		const auto preloader = Preload::MusicPreloader::GetSingleton();
+		if (!preloader->IsEnabled() || !ready.load(std::memory_order_acquire)) {
+			return;
+		}
+
+		CaptureContext(predicted);
+		std::vector<RE::BGSMusicType*> music{};
+		std::shared_lock lock{ ruleLock };
+		for (const auto& category : categories) {
+			std::size_t skipped = 0;
+			const auto winner = SelectOptimized(category, predicted, false, nullptr, skipped);
+			if (winner >= 0) {
+				const auto& pool = category.rules[winner].music;
+				music.insert(music.end(), pool.begin(), pool.end());
+			}
+		}
+		lock.unlock();
+		preloader->Warm(music);
+	}
+
+	void CombatMusicCalls::SetSpeculation(bool a_enabled)
+	{
+		speculate = a_enabled;
+	}
+
+	void CombatMusicCalls::Speculate(const RE::Actor* a_actor)
+	{
+		if (!speculate || unpredictableCombat || storedMusic || !ready.load(std::memory_order_acquire)) {
+			return;
+		}
+		const auto base = a_actor->GetActorBase();
+		if (!base) {
+			return;
+		}
+
+		// The player only picks a target once the fight starts, so the actor that started it is expected to be it.
+		Selection::Context expected{};
+		CaptureContext(expected);
+		if (expected.target == 0) {
+			expected.target = base->GetFormID();
+			GetActorKeywords(a_actor, expected.targetKeywords);
+			Selection::Context::Normalize(expected.targetKeywords);
+		}
+
+		std::unique_lock guard{ speculationLock };
+		const auto queued = std::ranges::find(pendingSpeculations, expected.target, [](const auto& a_entry) { return a_entry.first; });
+		if (queued != pendingSpeculations.end()) {
+			queued->second = std::move(expected);
+		}
+		else {
+			pendingSpeculations.emplace_back(expected.target, std::move(expected));
+		}
+		if (!std::exchange(speculating, true)) {
+			Trace::BackgroundQueue::GetSingleton()->Post([this]() { ScorePendingSpeculations(); });
+		}
+	}
+
+	void CombatMusicCalls::ScorePendingSpeculations()
+	{
+		const auto& category = categories[static_cast<std::size_t>(Selection::MusicCategory::kCombat)];
+		for (;;) {
+			std::unique_lock guard{ speculationLock };
+			if (pendingSpeculations.empty()) {
+				speculating = false;
+				return;
+			}
+			auto [target, expected] = std::move(pendingSpeculations.front());
+			pendingSpeculations.pop_front();
+			guard.unlock();
+
+			std::size_t skipped = 0;
+			std::shared_lock lock{ ruleLock };
+			const auto winner = SelectOptimized(category, expected, false, nullptr, skipped);
+			lock.unlock();
+
+			guard.lock();
+			speculations.Store(target, expected, winner);
+		}
+	}
+
+	bool CombatMusicCalls::ConfirmSpeculation(Selection::MusicCategory a_category, const Selection::Context& a_context)
+	{
+		if (!speculate || unpredictableCombat || a_category != Selection::MusicCategory::kCombat) {
+			return false;
+		}
+
+		using Outcome = Selection::SpeculationTable::Outcome;
+		auto outcome = Outcome::kMissing;
+		std::unique_lock guard{ speculationLock };
+		const auto winner = speculations.Confirm(a_context, outcome);
+		const auto hits = speculations.GetCount(Outcome::kHit);
+		const auto total = hits + speculations.GetCount(Outcome::kMispredicted) + speculations.GetCount(Outcome::kMissing);
+		if (total % 16 == 0) {
+			logger::info("Speculated {} of {} combat music selections ({:.0f}%), {} mispredicted.",
+				hits,
+				total,
+				speculations.GetHitRate() * 100.0,
+				speculations.GetCount(Outcome::kMispredicted));
+		}
+		guard.unlock();
+
+		if (!winner) {
+			logger::debug("  {} speculation, selecting normally.", outcome == Outcome::kMispredicted ? "Mispredicted" : "No");
+			return false;
+		}
+		logger::debug("  Confirmed the speculated winner.");
+		categories[static_cast<std::size_t>(a_category)].winner = *winner;
+		// Only the combat winner is known for this context.
+		passValid = false;
+		return true;
+	}
+
+	RE::BGSMusicType* CombatMusicCalls::StartMusic(Selection::MusicCategory a_category, RE::BGSMusicType* a_music)
+	{
+		logger::debug("  Starting {}", Utilities::EDID::GetEditorID(a_music));
+		storedMusic = a_music;
+		storedCategory = a_category;
+		API::Interface::GetSingleton()->NotifyChange(a_category, a_music);
 		return a_music;
 	}
 
+	void CombatMusicCalls::CaptureLocation(const RE::BGSLocation* a_location, Selection::Context& a_context)
+	{
+		for (auto location = a_location; location; location = location->parentLoc) {
+			a_context.locations.push_back(location->GetFormID());
+			AppendKeywords(location, a_context.locationKeywords);
+		}
+		Selection::Context::Normalize(a_context.locationKeywords);
+	}
+
+	void CombatMusicCalls::CaptureContext(Selection::Context& a_context) const
+	{
+		a_context.Clear();
+		const auto player = RE::PlayerCharacter::GetSingleton();
+		if (!player) {
+			return;
+		}
+
+		if (const auto worldspace = player->GetWorldspace()) {
+			a_context.worldspace = worldspace->GetFormID();
+		}
+		if (const auto cell = player->GetParentCell()) {
+			a_context.cell = cell->GetFormID();
+		}
+		CaptureLocation(player->GetCurrentLocation(), a_context);
+		Events::CombatEvent::GetSingleton()->FillCombatants(a_context);
+		const auto combatTarget = player->currentCombatTarget.get().get();
+		CaptureQuantities(player, combatTarget, a_context);
+		// Conditions of registered kinds may also depend on the time and on inputs only their plugin knows.
+		if ((extensionInputs & Selection::INPUT_TIME) != 0) {
+			const auto calendar = RE::Calendar::GetSingleton();
+			a_context.gameMinute = calendar ? static_cast<std::int64_t>(std::floor(static_cast<double>(calendar->GetCurrentGameTime()) * 24.0 * 60.0)) : 0;
+		}
+		if ((extensionInputs & Selection::INPUT_CUSTOM) != 0) {
+			a_context.customInputs = API::Interface::GetSingleton()->GetCustomInputVersion();
+		}
+
+		const auto targetBase = combatTarget ? combatTarget->GetActorBase() : nullptr;
+		if (!targetBase) {
+			return;
+		}
+		a_context.target = targetBase->GetFormID();
+		GetActorKeywords(combatTarget, a_context.targetKeywords);
+		Selection::Context::Normalize(a_context.targetKeywords);
+	}
+
+	void CombatMusicCalls::CaptureQuantities(RE::PlayerCharacter* a_player, const RE::Actor* a_target, Selection::Context& a_context) const
+	{
+		// Rounded down to what the rules can tell apart, so a pass is only redone once a reading really changed.
+		const auto tested = [&](Selection::Quantity a_quantity) {
+			return (testedQuantities & (1u << static_cast<std::uint32_t>(a_quantity))) != 0;
+		};
+		auto& quantities = a_context.quantities;
+		if (tested(Selection::Quantity::kTargetLevel) && a_target) {
+			quantities[static_cast<std::size_t>(Selection::Quantity::kTargetLevel)] = static_cast<float>(a_target->GetLevel());
+		}
+		if (tested(Selection::Quantity::kPlayerLevel)) {
+			quantities[static_cast<std::size_t>(Selection::Quantity::kPlayerLevel)] = static_cast<float>(a_player->GetLevel());
+		}
+		if (tested(Selection::Quantity::kHealth)) {
+			const auto owner = a_player->AsActorValueOwner();
+			const auto maximum = owner->GetPermanentActorValue(RE::ActorValue::kHealth) +
+				a_player->GetActorValueModifier(RE::ACTOR_VALUE_MODIFIER::kTemporary, RE::ActorValue::kHealth);
+			const auto percent = maximum > 0.0f ? owner->GetActorValue(RE::ActorValue::kHealth) / maximum * 100.0f : 0.0f;
+			quantities[static_cast<std::size_t>(Selection::Quantity::kHealth)] = std::clamp(std::floor(percent), 0.0f, 100.0f);
+		}
+		if (tested(Selection::Quantity::kGameHour)) {
+			const auto calendar = RE::Calendar::GetSingleton();
+			const auto hour = calendar ? calendar->GetHour() : 0.0f;
+			quantities[static_cast<std::size_t>(Selection::Quantity::kGameHour)] = std::floor(hour * 60.0f) / 60.0f;
+		}
+	}
+
+	void CombatMusicCalls::GetActorKeywords(const RE::Actor* a_actor, std::vector<RE::FormID>& a_keywords)
+	{
+		const auto base = a_actor->GetActorBase();
+		const auto race = a_actor->GetRace();
+		if (!base || !race) {
+			return;
+		}
+		AppendKeywords(base, a_keywords);
+		AppendKeywords(race, a_keywords);
+	}
+
+	RE::BGSMusicType* CombatMusicCalls::GetAppropriateMusic(Selection::MusicCategory a_category, RE::BGSMusicType* a_music)
+	{
+		if (!IsVanillaMusic(a_category, a_music)) {
+			return a_music;
+		}
+		if (const auto forced = API::Interface::GetSingleton()->GetOverride(a_category)) {
+			logger::debug("  Overridden by another plugin.");
+			return StartMusic(a_category, forced);
+		}
+		if (!WaitUntilReady()) {
+			logger::info("Rules are still loading, keeping the vanilla {} music.", Selection::GetCategoryName(a_category));
+			return a_music;
+		}
+
+		CaptureContext(context);
+		PublishContext(context);
+		if (!ConfirmSpeculation(a_category, context)) {
+			SelectAll(context);
+		}
+		const auto& category = categories[static_cast<std::size_t>(a_category)];
+		selected = true;
+		selectedRule = category.winner;
+		if (category.winner >= 0) {
+			const auto music = PickMusic(category, category.winner, context, musicRandom);
+			Preload::MusicPreloader::GetSingleton()->RecordStart(music);
+			return StartMusic(a_category, music);
+		}
+		return a_music;
+	}
+
+	RE::BGSMusicType* CombatMusicCalls::RestoreMusic(Selection::MusicCategory a_category, RE::BGSMusicType* a_music)
+	{
+		const auto pending = std::exchange(restored, std::nullopt);
+		if (!pending || pending->category != a_category || !IsVanillaMusic(a_category, a_music)) {
+			return GetAppropriateMusic(a_category, a_music);
+		}
+		// The co-save may be read before the rules are, so the rule set is only compared now.
+		if (!WaitUntilReady()) {
+			logger::info("Rules are still loading, music will be picked again.");
+			return GetAppropriateMusic(a_category, a_music);
+		}
+		if (restoredRuleSet != ruleSetHash) {
+			logger::info("Rules changed since this game was saved, music will be picked again.");
+			return GetAppropriateMusic(a_category, a_music);
+		}
+
+		logger::debug("  Restored from the co-save.");
+		return StartMusic(pending->category, pending->music);
+	}
+
 	RE::BGSMusicType* CombatMusicCalls::ClearMusic()
 	{
 		const auto callsSingleton = CombatMusicCalls::GetSingleton();
 		const auto musicToStop = callsSingleton->storedMusic;
 		callsSingleton->storedMusic = nullptr;
+		// The fight is over, even for actors whose leave event never arrived, e.g. ones unloaded mid-fight.
+		Events::CombatEvent::GetSingleton()->ClearCombatants();
 
 		if (!musicToStop) {
 			const auto defaultObjects = RE::BGSDefaultObjectManager::GetSingleton();
@@ -154,6 +1427,7 @@ namespace Hooks {
 			return MUSCombat;
 		}
 		logger::debug("  Stopping {}", Utilities::EDID::GetEditorID(musicToStop));
+		API::Interface::GetSingleton()->NotifyChange(callsSingleton->storedCategory, nullptr);
 		return musicToStop;
 	}
 
@@ -182,7 +1456,10 @@ namespace Hooks {
 			return response;
 		}
 
-		return CombatMusicCalls::GetSingleton()->GetAppropriateCombatMusic(response);
+		const auto calls = CombatMusicCalls::GetSingleton();
+		const auto music = calls->GetAppropriateMusic(Selection::MusicCategory::kCombat, response);
+		calls->RecordTrace(Selection::TraceHook::kStartCombat, response, music);
+		return music;
 	}
 
 	RE::BGSMusicType* CombatMusicCalls::LoadCombatMusic(RE::DEFAULT_OBJECT a1)
@@ -196,7 +1473,10 @@ namespace Hooks {
 			return response;
 		}
 
-		return CombatMusicCalls::GetSingleton()->GetAppropriateCombatMusic(response);
+		const auto calls = CombatMusicCalls::GetSingleton();
+		const auto music = calls->RestoreMusic(Selection::MusicCategory::kCombat, response);
+		calls->RecordTrace(Selection::TraceHook::kLoadCombat, response, music);
+		return music;
 	}
 
 	RE::BGSMusicType* CombatMusicCalls::EndCombatMusic(RE::DEFAULT_OBJECT a1)
@@ -210,7 +1490,10 @@ namespace Hooks {
 			return response;
 		}
 
-		return CombatMusicCalls::GetSingleton()->ClearMusic();
+		const auto calls = CombatMusicCalls::GetSingleton();
+		const auto music = calls->ClearMusic();
+		calls->RecordTrace(Selection::TraceHook::kEndCombat, response, music);
+		return music;
 	}
 
 	RE::BGSMusicType* CombatMusicCalls::DiscoveryMusic(RE::DEFAULT_OBJECT a1)
@@ -219,13 +1502,15 @@ namespace Hooks {
 		const auto obj = RE::BGSDefaultObjectManager::GetSingleton()->GetObject(a1);
 		logger::debug("Discovery music hook ({})", obj ? Utilities::EDID::GetEditorID(obj) : "NULL");
 #endif
-		if (a1 == RE::BGSDefaultObjectManager::DefaultObject::kBattleMusic) {
-			const auto storedMusic = GetSingleton()->storedMusic;
-			if (storedMusic) {
-				return storedMusic;
-			}
+		if (a1 != RE::BGSDefaultObjectManager::DefaultObject::kBattleMusic) {
+			return _discoveryMusic(a1);
 		}
-		return _discoveryMusic(a1);
+
+		const auto calls = GetSingleton();
+		const auto storedMusic = calls->storedMusic;
+		const auto music = storedMusic ? storedMusic : _discoveryMusic(a1);
+		calls->RecordTrace(Selection::TraceHook::kDiscovery, storedMusic ? nullptr : music, music);
+		return music;
 	}
 
 	RE::BGSMusicType* CombatMusicCalls::ClearLocation(RE::DEFAULT_OBJECT a1)
@@ -239,6 +1524,9 @@ namespace Hooks {
 			return response;
 		}
 
-		return CombatMusicCalls::GetSingleton()->GetAppropriateClearedMusic(response);
+		const auto calls = CombatMusicCalls::GetSingleton();
+		const auto music = calls->GetAppropriateMusic(Selection::MusicCategory::kDungeonCleared, response);
+		calls->RecordTrace(Selection::TraceHook::kClearLocation, response, music);
+		return music;
 	}
 }
\ No newline at end of file
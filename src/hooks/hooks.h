@@ -1,7 +1,30 @@
 #pragma once
 
+#include "api/CombatMusicAPI.h"
+#include "selection/aliasTable.h"
+#include "selection/boundedSelector.h"
+#include "selection/conditionCache.h"
+#include "selection/conditionStats.h"
+#include "selection/decisionDiagram.h"
+#include "selection/dependencyCache.h"
+#include "selection/expression.h"
+#include "selection/formKernel.h"
+#include "selection/intervalTree.h"
+#include "selection/intensity.h"
+#include "selection/musicCategory.h"
+#include "selection/parallelSelector.h"
+#include "selection/placeTable.h"
+#include "selection/ruleJit.h"
+#include "selection/speculation.h"
+#include "selection/startupTrace.h"
+#include "selection/trace.h"
 #include "utilities/utilities.h"
 
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <shared_mutex>
+
 namespace Hooks {
 	void Install();
 
@@ -13,227 +36,597 @@ namespace Hooks {
 			HIGH
 		};
 
+		using ConditionType = Selection::ConditionType;
+
+		// Leaks the scoring workers at exit instead of joining them, which would run under the loader lock.
+		~CombatMusicCalls() { static_cast<void>(workers.release()); }
+
+		template <class T>
+		static std::vector<RE::FormID> SortedFormIDs(const std::vector<T*>& a_forms) {
+			std::vector<RE::FormID> response{};
+			response.reserve(a_forms.size());
+			for (const auto* form : a_forms) {
+				response.push_back(form->GetFormID());
+			}
+			std::sort(response.begin(), response.end());
+			response.erase(std::unique(response.begin(), response.end()), response.end());
+			return response;
+		}
+
 		struct Condition {
-			virtual bool IsTrue() const = 0;
+			virtual ~Condition() = default;
+			virtual bool IsTrue(const Selection::Context& a_context) const = 0;
+			// Sorted FormIDs this condition tests against. Used by the load-time analysis.
+			virtual std::vector<RE::FormID> GetFormIDs() const = 0;
+			// Cost until the condition is timed.
+			virtual double EstimateCost() const {
+				return Selection::EstimateCost(type, GetFormIDs().size());
+			}
+			ConditionType type;
 			PriorityLevel level;
 			bool AND;
 		};
 
 		struct CombatTargetCondition : public Condition {
-			bool IsTrue() const override {
-				const auto player = RE::PlayerCharacter::GetSingleton();
-				const auto combatTarget = player->currentCombatTarget.get().get();
-				if (!combatTarget) {
-					return false;
-				}
-				const auto targetBase = combatTarget->GetActorBase();
-				if (!targetBase) {
-					return false;
-				}
-
-				for (const auto target : targets) {
-					if (target == targetBase) {
+			bool IsTrue(const Selection::Context& a_context) const override {
+				for (const auto* target : targets) {
+					if (a_context.Has(type, target->GetFormID())) {
 						return true;
 					}
 				}
-
 				return false;
 			}
 
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(targets);
+			}
+
 			CombatTargetCondition() {
+				type = ConditionType::kCombatTarget;
 				level = PriorityLevel::HIGH;
 			}
 			std::vector<RE::TESNPC*> targets;
 		};
 
 		struct CombatTargetKeywordCondition : public  Condition {
-			bool IsTrue() const override {
-				const auto player = RE::PlayerCharacter::GetSingleton();
-				const auto combatTarget = player->currentCombatTarget.get().get();
-				if (!combatTarget) {
-					return false;
-				}
-				const auto targetBase = combatTarget->GetActorBase();
-				const auto targetRace = combatTarget->GetRace();
-				if (!targetBase || !targetRace) {
-					return false;
+			bool IsTrue(const Selection::Context& a_context) const override {
+				for (const auto* keyword : keywords) {
+					if (a_context.Has(type, keyword->GetFormID())) {
+						return true;
+					}
 				}
+				return false;
+			}
+
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(keywords);
+			}
+
+			CombatTargetKeywordCondition() {
+				type = ConditionType::kCombatTargetKeyword;
+				level = PriorityLevel::HIGH;
+			}
+			std::vector<RE::BGSKeyword*> keywords;
+		};
 
-				for (const auto keyword : keywords) {
-					if (targetBase->HasKeyword(keyword) || targetRace->HasKeyword(keyword)) {
+		struct CombatantCondition : public Condition {
+			bool IsTrue(const Selection::Context& a_context) const override {
+				for (const auto* combatant : combatants) {
+					if (a_context.Has(type, combatant->GetFormID())) {
 						return true;
 					}
 				}
+				return false;
+			}
+
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(combatants);
+			}
+
+			CombatantCondition() {
+				type = ConditionType::kCombatant;
+				level = PriorityLevel::HIGH;
+			}
+			std::vector<RE::TESNPC*> combatants;
+		};
 
+		struct CombatantKeywordCondition : public Condition {
+			bool IsTrue(const Selection::Context& a_context) const override {
+				for (const auto* keyword : keywords) {
+					if (a_context.Has(type, keyword->GetFormID())) {
+						return true;
+					}
+				}
 				return false;
 			}
 
-			CombatTargetKeywordCondition() {
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(keywords);
+			}
+
+			CombatantKeywordCondition() {
+				type = ConditionType::kCombatantKeyword;
 				level = PriorityLevel::HIGH;
 			}
 			std::vector<RE::BGSKeyword*> keywords;
 		};
 
-		struct WorldspaceCondition : public Condition {
-			bool IsTrue() const override {
-				const auto player = RE::PlayerCharacter::GetSingleton();
-				const auto playerWorldspace = player->GetWorldspace();
-				if (!playerWorldspace) {
-					return false;
+		struct IntensityCondition : public Condition {
+			bool IsTrue(const Selection::Context& a_context) const override {
+				for (const auto tier : tiers) {
+					if (a_context.Has(type, static_cast<RE::FormID>(tier))) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			std::vector<RE::FormID> GetFormIDs() const override {
+				std::vector<RE::FormID> response{};
+				for (const auto tier : tiers) {
+					response.push_back(static_cast<RE::FormID>(tier));
 				}
+				Selection::Context::Normalize(response);
+				return response;
+			}
+
+			IntensityCondition() {
+				type = ConditionType::kIntensity;
+				level = PriorityLevel::LOW;
+			}
+			std::vector<Selection::IntensityTier> tiers;
+		};
 
+		struct WorldspaceCondition : public Condition {
+			bool IsTrue(const Selection::Context& a_context) const override {
 				for (const auto* worldspace : worldspaces) {
-					if (worldspace == playerWorldspace) {
+					if (a_context.Has(type, worldspace->GetFormID())) {
 						return true;
 					}
 				}
-
 				return false;
 			}
 
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(worldspaces);
+			}
+
 			WorldspaceCondition() {
+				type = ConditionType::kWorldspace;
 				level = PriorityLevel::LOW;
 			}
 			std::vector<RE::TESWorldSpace*> worldspaces;
 		};
 
 		struct CellCondition : public Condition {
-			bool IsTrue() const override {
-				const auto player = RE::PlayerCharacter::GetSingleton();
-				const auto playerCell = player->GetParentCell();
-				if (!playerCell) {
-					return false;
-				}
-
+			bool IsTrue(const Selection::Context& a_context) const override {
 				for (const auto* cell : cells) {
-					if (cell == playerCell) {
+					if (a_context.Has(type, cell->GetFormID())) {
 						return true;
 					}
 				}
-
 				return false;
 			}
 
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(cells);
+			}
+
 			CellCondition() {
+				type = ConditionType::kCell;
 				level = PriorityLevel::LOW;
 			}
 			std::vector<RE::TESObjectCELL*> cells;
 		};
 
 		struct LocationCondition : public Condition {
-			bool IsTrue() const override {
-				const auto player = RE::PlayerCharacter::GetSingleton();
-				auto playerLocation = player->GetCurrentLocation();
-				if (!playerLocation) {
-					return false;
-				}
-
+			bool IsTrue(const Selection::Context& a_context) const override {
 				for (const auto* location : locations) {
-					if (location == playerLocation) {
+					if (a_context.Has(type, location->GetFormID())) {
 						return true;
 					}
 				}
-
-				while (playerLocation->parentLoc) {
-					playerLocation = playerLocation->parentLoc;
-					for (const auto* location : locations) {
-						if (location == playerLocation) {
-							return true;
-						}
-					}
-				}
-
 				return false;
 			}
 
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(locations);
+			}
+
 			LocationCondition() {
+				type = ConditionType::kLocation;
 				level = PriorityLevel::LOW;
 			}
 			std::vector<RE::BGSLocation*> locations;
 		};
 
 		struct LocationKeywordCondition : public Condition {
-			bool IsTrue() const override {
-				const auto player = RE::PlayerCharacter::GetSingleton();
-				auto playerLocation = player->GetCurrentLocation();
-				if (!playerLocation) {
-					return false;
-				}
-
+			bool IsTrue(const Selection::Context& a_context) const override {
 				for (const auto* keyword : keywords) {
-					if (playerLocation->HasKeyword(keyword)) {
+					if (a_context.Has(type, keyword->GetFormID())) {
 						return true;
 					}
 				}
-
-				while (playerLocation->parentLoc) {
-					playerLocation = playerLocation->parentLoc;
-					for (const auto* keyword : keywords) {
-						if (playerLocation->HasKeyword(keyword)) {
-							return true;
-						}
-					}
-				}
-
 				return false;
 			}
 
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return SortedFormIDs(keywords);
+			}
+
 			LocationKeywordCondition() {
+				type = ConditionType::kLocationKeyword;
 				level = PriorityLevel::LOW;
 			}
 			std::vector<RE::BGSKeyword*> keywords;
 		};
 
+		// A number from the context within a range. Every range on the same quantity is answered at once by an
+		// interval tree at the start of a selection pass, so this only runs for paths without the cache.
+		struct RangeCondition : public Condition {
+			bool IsTrue(const Selection::Context& a_context) const override {
+				return range.Contains(a_context.GetQuantity(quantity));
+			}
+
+			// Not forms, but the quantity and both ends, so equal ranges share a number in the condition cache.
+			std::vector<RE::FormID> GetFormIDs() const override {
+				return { static_cast<RE::FormID>(quantity), std::bit_cast<RE::FormID>(range.low), std::bit_cast<RE::FormID>(range.high) };
+			}
+
+			// Two comparisons, like a single value test against one form.
+			double EstimateCost() const override {
+				return Selection::EstimateCost(ConditionType::kWorldspace, 1);
+			}
+
+			RangeCondition() {
+				type = ConditionType::kRange;
+				level = PriorityLevel::LOW;
+			}
+			Selection::Quantity quantity{ Selection::Quantity::kTargetLevel };
+			Selection::Range range{};
+		};
+
+		// A condition of a kind another plugin registered, evaluated by that plugin from the payload it parsed and
+		// the captured context. kV2 evaluators only get the payload.
+		struct ExtensionCondition : public Condition {
+			bool IsTrue(const Selection::Context& a_context) const override {
+				if (!evaluate) {
+					return evaluateV2(std::addressof(payload), user);
+				}
+				const auto count = [](const std::vector<RE::FormID>& a_set) { return static_cast<std::uint32_t>(a_set.size()); };
+				const CombatMusicAPI::ConditionInputs view{
+					a_context.worldspace,
+					a_context.cell,
+					a_context.locations.data(),
+					count(a_context.locations),
+					a_context.locationKeywords.data(),
+					count(a_context.locationKeywords),
+					a_context.target,
+					a_context.targetKeywords.data(),
+					count(a_context.targetKeywords),
+					a_context.combatants.data(),
+					count(a_context.combatants),
+					a_context.intensity,
+					a_context.gameMinute,
+					a_context.customInputs
+				};
+				return evaluate(std::addressof(payload), std::addressof(view), user);
+			}
+
+			// Not forms, but the kind and the payload, so equal conditions share a number in the condition cache.
+			std::vector<RE::FormID> GetFormIDs() const override {
+				std::vector<RE::FormID> response(1 + sizeof(payload.data) / sizeof(RE::FormID));
+				response[0] = kind;
+				std::memcpy(response.data() + 1, payload.data, sizeof(payload.data));
+				return response;
+			}
+
+			// The registered cost is relative to a single location test.
+			double EstimateCost() const override {
+				return static_cast<double>(cost) * Selection::EstimateCost(ConditionType::kLocation, 1);
+			}
+
+			ExtensionCondition() {
+				type = ConditionType::kExtension;
+				level = PriorityLevel::LOW;
+			}
+			std::string key;
+			std::uint32_t kind{ 0 };
+			CombatMusicAPI::ConditionEvaluator evaluate{ nullptr };
+			CombatMusicAPI::ConditionEvaluatorV2 evaluateV2{ nullptr };
+			void* user{ nullptr };
+			CombatMusicAPI::ConditionPayload payload{};
+			Selection::InputMask inputs{ 0 };
+			float cost{ 1.0f };
+		};
+
 		struct ConditionalBattleMusic {
-			RE::BGSMusicType* music;
+			// Music pool and the weight of each entry. Most rules hold a single entry.
+			std::vector<RE::BGSMusicType*> music;
+			std::vector<float> weights;
+			Selection::AliasTable musicTable;
 			std::vector<std::unique_ptr<Condition>> conditions;
-
-			std::pair<PriorityLevel, int> MatchDegree() const {
-				int response = 0;
-				bool matchedOR = false;
-				bool hasOR = false;
-				auto priority = PriorityLevel::LOW;
-				for (const auto& condition : conditions) {
-					if (!hasOR && !condition->AND) {
-						hasOR = true;
-					}
-					if (condition->IsTrue()) {
-						if (!matchedOR && !condition->AND) {
-							matchedOR = true;
-							response++;
-						}
-						if (condition->level == PriorityLevel::HIGH && priority == PriorityLevel::LOW) {
-							priority = PriorityLevel::HIGH;
-						}
-						if (condition->AND) {
-							response++;
-						}
-					}
-					else if (condition->AND) {
+			// Must also be true for the rule to match. Adds its own Match to the flat conditions': its true tests
+			// score like conditions of their type, so it can make the rule high priority.
+			std::optional<Selection::Expression> expression;
+			// Where the rule was defined, for reporting.
+			std::string source;
+			std::size_t index{ 0 };
+
+			// Order MatchDegree evaluates the conditions in. Any order gives the same result.
+			std::vector<std::uint8_t> order;
+			// Learned pass rate and cost of each condition, parallel to conditions.
+			mutable std::vector<Selection::ConditionStats> stats;
+			// Cost of each condition until it is timed, and its key in the statistics file.
+			std::vector<double> estimates;
+			std::vector<std::uint64_t> statsKeys;
+			// Interned number of each condition, for the condition cache.
+			std::vector<std::uint32_t> shared;
+
+			// With a_learn, the evaluated conditions are counted towards their statistics. With a_cache, conditions
+			// already evaluated for this context by another rule are not evaluated again.
+			std::pair<PriorityLevel, int> MatchDegree(const Selection::Context& a_context,
+				bool a_learn = false,
+				Selection::ConditionCache* a_cache = nullptr) const {
+				const auto evaluate = [&](std::size_t a_position) {
+					return a_learn ? Learn(a_position, a_context) : conditions[a_position]->IsTrue(a_context);
+				};
+				auto match = Selection::MatchInOrder(conditions, order, [&](std::size_t a_position) {
+					return a_cache ? a_cache->Get(shared[a_position], [&]() { return evaluate(a_position); }) : evaluate(a_position);
+				});
+				// The expression is only run once the flat conditions matched, or if there are none.
+				if (expression && (match.score > 0 || conditions.empty())) {
+					const auto folded = expression->Evaluate(a_context);
+					if (!folded) {
 						return std::make_pair(PriorityLevel::LOW, 0);
 					}
+					match.high = match.high || folded->high;
+					match.score += folded->score;
 				}
-				if (hasOR && !matchedOR) {
-					return std::make_pair(PriorityLevel::LOW, 0);
+				return std::make_pair(match.high ? PriorityLevel::HIGH : PriorityLevel::LOW, match.score);
+			}
+
+			bool Learn(std::size_t a_position, const Selection::Context& a_context) const {
+				auto& entry = stats[a_position];
+				bool response = false;
+				if (entry.evaluations % Selection::STATS_TIMING_INTERVAL == 0) {
+					const auto start = std::chrono::steady_clock::now();
+					response = conditions[a_position]->IsTrue(a_context);
+					const auto elapsed = std::chrono::steady_clock::now() - start;
+					entry.RecordTime(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
 				}
-				return std::make_pair(priority, response);
+				else {
+					response = conditions[a_position]->IsTrue(a_context);
+				}
+				entry.Record(response);
+				return response;
+			}
+
+			// Sets up the statistics and the load order of the conditions. Call once the conditions are final.
+			void InitializeStats() {
+				order.clear();
+				stats.assign(conditions.size(), Selection::ConditionStats{});
+				estimates.clear();
+				statsKeys.clear();
+				for (std::uint8_t i = 0; i < static_cast<std::uint8_t>(conditions.size()); ++i) {
+					const auto forms = conditions[i]->GetFormIDs();
+					order.push_back(i);
+					estimates.push_back(conditions[i]->EstimateCost());
+					statsKeys.push_back(Selection::GetStatsKey(source, index, conditions[i]->type, forms));
+				}
+			}
+
+			void Reorder() {
+				Selection::OrderConditions(conditions, stats, estimates, order);
+			}
+
+			// True if the rule has parts a shape cannot describe: an expression, or conditions that test no forms.
+			bool IsOpaque() const {
+				return expression.has_value() || std::ranges::any_of(conditions, [](const auto& a_condition) {
+					return a_condition->type >= ConditionType::kTotal;
+				});
+			}
+
+			// Flat conditions only, one per condition. Engines built from shapes see opaque rules as never matching,
+			// and opaque rules are scored one by one after them.
+			Selection::RuleShape GetShape() const {
+				Selection::RuleShape response{};
+				for (const auto& condition : conditions) {
+					response.push_back(Selection::ConditionShape{ condition->type, condition->AND, condition->GetFormIDs() });
+				}
+				return response;
+			}
+
+			void AddMusic(RE::BGSMusicType* a_music, float a_weight) {
+				music.push_back(a_music);
+				weights.push_back(a_weight);
+				musicTable.Build(weights);
 			}
 
-			ConditionalBattleMusic(RE::BGSMusicType* a_music) {
-				this->music = a_music;
+			float GetTotalWeight() const {
+				return std::accumulate(weights.begin(), weights.end(), 0.0f);
+			}
+
+			template <class Engine>
+			RE::BGSMusicType* PickMusic(Engine& a_engine) const {
+				return music[musicTable.Sample(a_engine)];
+			}
+
+			ConditionalBattleMusic(RE::BGSMusicType* a_music, float a_weight = 1.0f) {
+				AddMusic(a_music, a_weight);
 				conditions = std::vector<std::unique_ptr<Condition>>();
 			}
 		};
 
+		// Music picked by a rule and the category it plays for, as kept in the co-save.
+		struct StoredSelection {
+			Selection::MusicCategory category{ Selection::MusicCategory::kCombat };
+			RE::BGSMusicType* music{ nullptr };
+		};
+
 		bool Install();
 		RE::BGSMusicType* GetCurrentCombatMusic();
 		void SetCurrentCombatMusic(RE::BGSMusicType* a_combatMusic);
-		void PushNewCombatMusic(ConditionalBattleMusic&& newMusic);
-		void PushNewClearedMusic(ConditionalBattleMusic&& newMusic);
+		void PushNewMusic(Selection::MusicCategory a_category, ConditionalBattleMusic&& newMusic);
+		// Drops rules that can never be selected. Call once all files are read.
+		void PruneUnreachableRules();
+		// Orders the rules for bounded evaluation, shares equal conditions between all rules, and compiles the rules
+		// into decision diagrams if enabled. Categories without a diagram table their place only rules. Call after pruning.
+		void CompileRules();
+		void SetCompileRules(bool a_compile);
+		// Fraction of selections that also run the MatchDegree loop to cross-check the optimized path.
+		void SetShadowRate(float a_rate);
+		// Lets every rule that ties with the winner contribute its music, instead of only the first one.
+		void SetPoolTies(bool a_poolTies);
+		// Fixed seed for picking music from pools, or 0 for a random one.
+		void SetMusicSeed(std::uint64_t a_seed);
+		// Categories with at least a_threshold rules and no diagram are scored on a_threads threads, counting the
+		// calling one. 0 threads uses every hardware thread. A threshold of 0 keeps scoring on the calling thread.
+		void SetParallelScoring(std::size_t a_threshold, std::size_t a_threads);
+		// Categories without a diagram are flattened into a rule program, run as native code with a_native if it
+		// can be generated, interpreted otherwise.
+		void SetRuleProgram(bool a_enabled, bool a_native);
+		// Starts recording hook calls, if enabled. Call once the rules are final.
+		void StartTrace();
+		// How long a hook that fires before the rules are ready waits for them. Zero passes the vanilla music
+		// through right away.
+		void SetReadyTimeout(std::chrono::milliseconds a_timeout);
+		// Lets the hooks use the rules, and wakes any hook waiting for them. Call once the rules are final.
+		void MarkReady();
+		// Hands over the part of loading that looks up forms, which only the main thread may do. It runs from
+		// RunPendingLoad, or from WaitUntilReady if a hook needs the rules first. Call from the background queue.
+		void SetPendingLoad(std::function<void()> a_finish);
+		// Finishes loading the rules if the background queue handed that over. Main thread only.
+		void RunPendingLoad();
+		// True once the rules are ready, waiting up to the ready timeout for the background parse and finishing
+		// what it handed over. Main thread only.
+		bool WaitUntilReady();
+		// Identifies the loaded rules. Only equal between sessions if every rule and its music pool is unchanged.
+		std::uint64_t GetRuleSetHash() const;
+		// The music picked by a rule that is still playing, if any.
+		std::optional<StoredSelection> GetStoredSelection() const;
+		// Hands a_selection back the next time a save is loaded with its category's music playing, instead of selecting again.
+		// a_ruleSet is the hash of the rules it was picked by, and is checked then, once the rules are ready.
+		void SetRestoredSelection(const StoredSelection& a_selection, std::uint64_t a_ruleSet);
+		void ClearRestoredSelection();
+		// Learns which conditions are cheapest to check first, and keeps what it learned between sessions.
+		void SetAdaptiveOrder(bool a_adaptive);
+		// Orders the conditions with the statistics of earlier sessions, if enabled. Call once the rules are final.
+		void LoadConditionStats();
+		// The music the rules would pick for the category in the surroundings the main thread last published, or
+		// nullptr. Safe to call from any thread once the rules are final, since it neither learns, touches the pass
+		// state of the hooks nor reads the game. Always nullptr for categories with registered condition kinds.
+		RE::BGSMusicType* Evaluate(Selection::MusicCategory a_category);
+		// Captures the player's surroundings for Evaluate. Called on the main thread every frame, and does nothing
+		// until Evaluate was first called.
+		void PublishContext();
+		// Picks the winners of every category for the player's current place, as if a fight started there, and
+		// warms their music. Called on the main thread when the player changes cell or location out of combat.
+		void PredictMusic();
+		// Picks the combat music rule in the background for the fight a_actor just started with the player, so the
+		// start combat hook only has to confirm it. Does nothing while combat music is playing.
+		void Speculate(const RE::Actor* a_actor);
+		void SetSpeculation(bool a_enabled);
+		// Appends the keywords on the actor's base and race, unsorted. Appends nothing if either is missing.
+		static void GetActorKeywords(const RE::Actor* a_actor, std::vector<RE::FormID>& a_keywords);
 
 	private:
-		RE::BGSMusicType* GetAppropriateCombatMusic(RE::BGSMusicType* a_music);
-		RE::BGSMusicType* GetAppropriateClearedMusic(RE::BGSMusicType* a_music);
+		// Index of the rule the MatchDegree loop picks, or -1 if none match.
+		static std::int32_t SelectRule(const std::vector<ConditionalBattleMusic>& a_rules, const Selection::Context& a_context);
+		// Uses the combat winner picked ahead of time if the context is still the expected one. Returns false, and
+		// leaves the selection to SelectAll, otherwise.
+		bool ConfirmSpeculation(Selection::MusicCategory a_category, const Selection::Context& a_context);
+		// Scores the queued expected contexts until none are left.
+		void ScorePendingSpeculations();
+		// Snapshots the player's surroundings for the conditions.
+		void CaptureContext(Selection::Context& a_context) const;
+		// Hands a context the main thread captured anyway to Evaluate.
+		void PublishContext(const Selection::Context& a_context);
+		// Reads the quantities some range tests. Levels stay 0 without someone to read them from.
+		void CaptureQuantities(RE::PlayerCharacter* a_player, const RE::Actor* a_target, Selection::Context& a_context) const;
+		// Appends a location's chain and chain keywords to the context.
+		static void CaptureLocation(const RE::BGSLocation* a_location, Selection::Context& a_context);
+		// Cross-checks a_select against SelectRule on randomized contexts. Returns the number of mismatches.
+		static std::size_t VerifySelection(const std::function<std::int32_t(const Selection::Context&)>& a_select,
+			const std::vector<ConditionalBattleMusic>& a_rules,
+			const Selection::DecisionDiagram::LocationTable& a_locations);
+
+		// Queues a trace record for a hook call, reusing the context if the call made a selection.
+		void RecordTrace(Selection::TraceHook a_hook, RE::BGSMusicType* a_original, RE::BGSMusicType* a_chosen);
+
+		// Running totals of the shadow evaluation of one rule set.
+		struct ShadowStats {
+			std::uint64_t samples{ 0 };
+			std::uint64_t disagreements{ 0 };
+			double legacyTotal{ 0.0 };
+			double legacyMax{ 0.0 };
+			double optimizedTotal{ 0.0 };
+			double optimizedMax{ 0.0 };
+			std::uint64_t skipped{ 0 };
+		};
+
+		// Music of every rule in a tie group, merged so one draw picks as the tie would.
+		struct TiedPool {
+			std::vector<RE::BGSMusicType*> music;
+			Selection::AliasTable table;
+			float weight{ 0.0f };
+		};
+
+		// The rules of one music category, and everything derived from them at load.
+		struct CategoryRules {
+			std::vector<ConditionalBattleMusic> rules;
+			// Rules in the order the bounded loop scores them.
+			std::vector<Selection::RuleBound> bounds;
+			// The opaque rules among them, scored after the diagram or the program.
+			std::vector<Selection::RuleBound> opaque;
+			Selection::DecisionDiagram diagram;
+			// Answers the place only rules when there is no diagram, leaving the remaining bounds to score.
+			Selection::PlaceTable places;
+			std::vector<Selection::RuleBound> remaining;
+			// Replaces the place table and the bounded loop when enabled.
+			Selection::RuleProgram program;
+			Selection::RuleJit native;
+			// By tie group of the diagram, or of the place table without one. Only built when ties are pooled.
+			std::vector<TiedPool> tiedPools;
+			ShadowStats shadow{};
+			// Set if a rule uses a registered condition kind. Their evaluators only run on the main thread.
+			bool extended{ false };
+			// Winner of the last selection pass, or -1.
+			std::int32_t winner{ -1 };
+		};
+
+		// The compiled diagram if there is one, then the rule program, each followed by the bounded loop over the opaque
+		// rules, then parallel scoring for large categories, otherwise the place table and the bounded loop over the
+		// remaining rules. a_skipped is the number of rules it did not score.
+		// With a_learn, the bounded loop feeds the condition statistics.
+		std::int32_t SelectOptimized(const CategoryRules& a_category,
+			const Selection::Context& a_context,
+			bool a_learn,
+			Selection::ConditionCache* a_cache,
+			std::size_t& a_skipped) const;
+		// Picks a rule with the optimized path, shadowed by the MatchDegree loop for sampled calls.
+		std::int32_t Select(CategoryRules& a_category, const Selection::Context& a_context, std::string_view a_kind);
+		// Picks the winner of every category for the context in one pass. Conditions shared between rules, in the
+		// same or different categories, are evaluated once. Repeated for the same context, the winners are reused.
+		void SelectAll(const Selection::Context& a_context);
+		// Runs both paths on the same context, logs disagreements and latency. Returns the MatchDegree result.
+		std::int32_t ShadowSelect(CategoryRules& a_category, const Selection::Context& a_context, std::string_view a_kind) const;
+
+		// Reorders every rule's conditions with what was learned so far, and saves the statistics in the background.
+		void ReorderConditions();
+
+		// Picks music for the winning rule, pooling it with the rules that tie with it if enabled.
+		RE::BGSMusicType* PickMusic(const CategoryRules& a_category,
+			std::int32_t a_winner,
+			const Selection::Context& a_context,
+			std::mt19937_64& a_random) const;
+		// Starts a_music for the category, and tells the API listeners.
+		RE::BGSMusicType* StartMusic(Selection::MusicCategory a_category, RE::BGSMusicType* a_music);
+
+		// Replaces the category's vanilla music with the music of its winning rule, if any rule matches.
+		RE::BGSMusicType* GetAppropriateMusic(Selection::MusicCategory a_category, RE::BGSMusicType* a_music);
+		// Hands back the music restored from the co-save if there is one for the category, otherwise selects again.
+		RE::BGSMusicType* RestoreMusic(Selection::MusicCategory a_category, RE::BGSMusicType* a_music);
 		RE::BGSMusicType* ClearMusic();
 
 		// Reverts the combat music, in cases like exiting back to the main menu.
@@ -250,8 +643,83 @@ namespace Hooks {
 		static RE::BGSMusicType* ClearLocation(RE::DEFAULT_OBJECT a1);
 
 		RE::BGSMusicType* storedMusic;
-		std::vector<ConditionalBattleMusic> conditionalMusic;
-		std::vector<ConditionalBattleMusic> conditionalClearedMusic;
+		Selection::MusicCategory storedCategory{ Selection::MusicCategory::kCombat };
+		// Read from the co-save, until the load hook takes it.
+		std::optional<StoredSelection> restored;
+		std::uint64_t restoredRuleSet{ 0 };
+		std::uint64_t ruleSetHash{ 0 };
+		// By MusicCategory.
+		std::array<CategoryRules, Selection::TOTAL_MUSIC_CATEGORIES> categories;
+
+		bool compileRules{ false };
+		bool ruleProgram{ false };
+		bool nativeRules{ false };
+		float shadowRate{ 0.0f };
+		std::minstd_rand shadowRandom{ std::random_device{}() };
+		bool poolTies{ false };
+		std::mt19937_64 musicRandom{ std::random_device{}() };
+		bool adaptiveOrder{ false };
+		// Only created if parallel scoring is enabled and there is more than one hardware thread.
+		std::unique_ptr<Selection::WorkerPool> workers;
+		std::size_t parallelThreshold{ 0 };
+		// Set once the rules are final. Until then they are being loaded on another thread.
+		std::atomic_bool ready{ false };
+		std::mutex readyLock;
+		std::condition_variable readyCondition;
+		// Guarded by readyLock. The rest of loading, once the background queue parsed the rules.
+		std::function<void()> pendingLoad;
+		std::chrono::milliseconds readyTimeout{ 0 };
+		// Held exclusively while conditions are reordered, and shared by Evaluate on other threads.
+		mutable std::shared_mutex ruleLock;
+		// Selections since the conditions were last reordered.
+		std::uint32_t sinceReorder{ 0 };
+		// Set while the statistics are written, so two writes never overlap.
+		std::atomic_bool savingStats{ false };
+		bool speculate{ false };
+		std::mutex speculationLock;
+		// Guarded by speculationLock. Expected contexts waiting to be scored, by the base they expect as target.
+		Selection::SpeculationTable speculations;
+		std::deque<std::pair<RE::FormID, Selection::Context>> pendingSpeculations;
+		// Set while ScorePendingSpeculations is queued or running.
+		bool speculating{ false };
+		// Number of distinct conditions over all categories, and their results for the current pass.
+		std::size_t sharedConditions{ 0 };
+		Selection::ConditionCache conditionCache;
+		// Distinct single valued conditions by type, packed so each pass answers all of them with one scan.
+		std::array<Selection::FormBlocks, Selection::TOTAL_CONDITION_TYPES> formBlocks;
+		// Interned numbers of the packed conditions, and the scan's result over them.
+		std::vector<std::uint32_t> blockedConditions;
+		std::vector<std::uint64_t> blockMask;
+		// Interned numbers of the range conditions, which the interval trees answer every pass.
+		std::vector<std::uint32_t> rangeConditions;
+		// Interned conditions of registered kinds with their inputs, every input any of them declared, and
+		// their results kept while those inputs stay the same.
+		std::vector<std::pair<std::uint32_t, Selection::InputMask>> extensionConditions;
+		Selection::InputMask extensionInputs{ 0 };
+		Selection::DependencyCache dependencyCache;
+		// Set if combat rules use registered kinds or ranges, which speculation cannot evaluate off the main
+		// thread or predict before the fight.
+		bool unpredictableCombat{ false };
+		// Every range condition of a quantity, by the quantity, and the quantities some rule tests.
+		std::array<Selection::IntervalTree, Selection::TOTAL_QUANTITIES> rangeTrees;
+		std::uint32_t testedQuantities{ 0 };
+		// Context the winners of the categories were picked for.
+		Selection::Context passContext;
+		bool passValid{ false };
+		Selection::Context context;
+		// Surroundings for Evaluate on other threads. The main thread captures into the back buffer and swaps it in
+		// under snapshotLock, so readers copy a whole frame's context and never the game's state mid-update.
+		std::mutex snapshotLock;
+		Selection::Context snapshot;
+		bool snapshotValid{ false };
+		Selection::Context snapshotBack;
+		// Set by the first Evaluate, so frames only capture once someone asks.
+		std::atomic_bool snapshotWanted{ false };
+		// Context of the last prediction. Only the place is known, no one is fighting yet.
+		Selection::Context predicted;
+		// Outcome of the selection made during the current hook call, for the trace.
+		bool selected{ false };
+		std::int32_t selectedRule{ -1 };
 
 		inline static REL::Relocation<decltype(&RevertCombatMusic)> _revertCombatMusic;
 		inline static REL::Relocation<decltype(&StartCombatMusic)>  _startCombatMusic;
@@ -275,8 +743,24 @@ namespace Hooks {
 			isCounting = true;
 		}
 
+		// Predicts the music of a new cell or location before a fight can start there.
+		static void WatchPlace(RE::PlayerCharacter* a_this) {
+			const auto cell = a_this->GetParentCell();
+			const auto location = a_this->GetCurrentLocation();
+			if (cell == lastCell && location == lastLocation) {
+				return;
+			}
+			lastCell = cell;
+			lastLocation = location;
+			if (cell && !a_this->IsInCombat()) {
+				CombatMusicCalls::GetSingleton()->PredictMusic();
+			}
+		}
+
 		static void thunk(RE::PlayerCharacter* a_this, float a_delta) {
 			func(a_this, a_delta);
+			WatchPlace(a_this);
+			CombatMusicCalls::GetSingleton()->PublishContext();
 			if (!isCounting) {
 				return;
 			}
@@ -309,5 +793,7 @@ namespace Hooks {
 
 		inline static bool isCounting{ false };
 		inline static float remainingTime{ 0.0f };
+		inline static const RE::TESObjectCELL* lastCell{ nullptr };
+		inline static const RE::BGSLocation* lastLocation{ nullptr };
 	};
 }
\ No newline at end of file
@@ -0,0 +1,188 @@
+#include "hooks/ruleAnalysis.h"
+
+namespace Hooks::RuleAnalysis
+{
+	namespace
+	{
+		using ConditionType = CombatMusicCalls::ConditionType;
+
+		constexpr auto TOTAL_TYPES = static_cast<std::size_t>(ConditionType::kTotal);
+
+		struct Shape {
+			struct Entry {
+				bool present{ false };
+				bool AND{ false };
+				bool high{ false };
+				std::vector<RE::FormID> forms{};
+			};
+
+			std::array<Entry, TOTAL_TYPES> entries{};
+			std::size_t andCount{ 0 };
+			std::size_t orCount{ 0 };
+			bool canBeHigh{ false };
+
+			int MaxScore() const {
+				return static_cast<int>(andCount) + (orCount > 0 ? 1 : 0);
+			}
+
+			// A condition is guaranteed true whenever the rule matches if it is an AND, or the only OR.
+			bool Guarantees(std::size_t a_type) const {
+				const auto& entry = entries[a_type];
+				return entry.present && (entry.AND || orCount == 1);
+			}
+		};
+
+		Shape MakeShape(const CombatMusicCalls::ConditionalBattleMusic& a_rule)
+		{
+			Shape response{};
+			for (const auto& condition : a_rule.conditions) {
+				// Registered kinds make the rule opaque, and opaque rules are never compared.
+				if (condition->type >= Selection::ConditionType::kTotal) {
+					continue;
+				}
+				auto& entry = response.entries[static_cast<std::size_t>(condition->type)];
+				entry.present = true;
+				entry.AND = condition->AND;
+				entry.high = condition->level == CombatMusicCalls::PriorityLevel::HIGH;
+				entry.forms = condition->GetFormIDs();
+
+				condition->AND ? response.andCount++ : response.orCount++;
+				if (entry.high) {
+					response.canBeHigh = true;
+				}
+			}
+			return response;
+		}
+
+		// True if "any of a_subset" being present implies "any of a_superset" being present.
+		bool Implies(const std::vector<RE::FormID>& a_subset, const std::vector<RE::FormID>& a_superset)
+		{
+			return std::includes(a_superset.begin(), a_superset.end(), a_subset.begin(), a_subset.end());
+		}
+
+		bool IsIdentical(const Shape& a_first, const Shape& a_second)
+		{
+			for (std::size_t i = 0; i < TOTAL_TYPES; ++i) {
+				const auto& first = a_first.entries[i];
+				const auto& second = a_second.entries[i];
+				if (first.present != second.present) {
+					return false;
+				}
+				if (first.present && (first.AND != second.AND || first.forms != second.forms)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// True if a_earlier matches in every context a_later matches in.
+		bool MatchesWhenever(const Shape& a_earlier, const Shape& a_later)
+		{
+			bool orSatisfied = a_earlier.orCount == 0;
+			for (std::size_t i = 0; i < TOTAL_TYPES; ++i) {
+				const auto& entry = a_earlier.entries[i];
+				if (!entry.present) {
+					continue;
+				}
+
+				const bool guaranteed = a_later.Guarantees(i) && Implies(a_later.entries[i].forms, entry.forms);
+				if (entry.AND && !guaranteed) {
+					return false;
+				}
+				if (!entry.AND && guaranteed) {
+					orSatisfied = true;
+				}
+			}
+			if (orSatisfied) {
+				return true;
+			}
+
+			// Otherwise, every OR of the later rule has to imply an OR of the earlier rule.
+			if (a_later.orCount == 0) {
+				return false;
+			}
+			for (std::size_t i = 0; i < TOTAL_TYPES; ++i) {
+				const auto& entry = a_later.entries[i];
+				if (!entry.present || entry.AND) {
+					continue;
+				}
+
+				const auto& earlierEntry = a_earlier.entries[i];
+				if (!earlierEntry.present || earlierEntry.AND || !Implies(entry.forms, earlierEntry.forms)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool Dominates(const Shape& a_earlier, const Shape& a_later)
+		{
+			if (!MatchesWhenever(a_earlier, a_later)) {
+				return false;
+			}
+
+			bool alwaysHigh = false;
+			bool highWhenLaterHigh = true;
+			for (std::size_t i = 0; i < TOTAL_TYPES; ++i) {
+				const auto& entry = a_earlier.entries[i];
+				const auto& laterEntry = a_later.entries[i];
+				if (entry.present && entry.high) {
+					if (a_earlier.Guarantees(i)) {
+						alwaysHigh = true;
+					}
+					else if (a_later.Guarantees(i) && Implies(laterEntry.forms, entry.forms)) {
+						alwaysHigh = true;
+					}
+				}
+
+				if (laterEntry.present && laterEntry.high) {
+					if (!entry.present || !Implies(laterEntry.forms, entry.forms)) {
+						highWhenLaterHigh = false;
+					}
+				}
+			}
+
+			if (alwaysHigh && !a_later.canBeHigh) {
+				return true;
+			}
+			return (alwaysHigh || highWhenLaterHigh) && a_earlier.MaxScore() >= a_later.MaxScore();
+		}
+	}
+
+	std::vector<PrunedRule> FindDominatedRules(const std::vector<CombatMusicCalls::ConditionalBattleMusic>& a_rules)
+	{
+		std::vector<Shape> shapes{};
+		shapes.reserve(a_rules.size());
+		for (const auto& rule : a_rules) {
+			shapes.push_back(MakeShape(rule));
+		}
+
+		// Only kept rules are compared against. Dominance is transitive, so a rule dominated by a
+		// pruned rule is also dominated by whatever pruned that one.
+		std::vector<std::size_t> kept{};
+		std::vector<PrunedRule> response{};
+		for (std::size_t later = 0; later < shapes.size(); ++later) {
+			// Opaque rules are not compared, so they neither get pruned nor prune others.
+			if (a_rules[later].IsOpaque()) {
+				continue;
+			}
+			bool pruned = false;
+			for (const auto earlier : kept) {
+				if (IsIdentical(shapes[earlier], shapes[later])) {
+					response.push_back(PrunedRule{ later, earlier, true });
+					pruned = true;
+					break;
+				}
+				if (Dominates(shapes[earlier], shapes[later])) {
+					response.push_back(PrunedRule{ later, earlier, false });
+					pruned = true;
+					break;
+				}
+			}
+			if (!pruned) {
+				kept.push_back(later);
+			}
+		}
+		return response;
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "hooks/hooks.h"
+
+namespace Hooks::RuleAnalysis
+{
+	struct PrunedRule {
+		// Position of the pruned rule in the analysed vector.
+		std::size_t position;
+		// Position of the earlier rule that always beats or ties it.
+		std::size_t dominator;
+		// True if both rules have exactly the same conditions.
+		bool identical;
+	};
+
+	/*
+	* Finds rules that can never be returned by the selection loop.
+	* 
+	* Selection picks the first rule with the highest (priority, score) pair. A matched rule always
+	* scores its AND count plus one if it has ORs, so a later rule can never win if an earlier rule
+	* is guaranteed to match whenever it does, with at least the same priority and score.
+	*/
+	std::vector<PrunedRule> FindDominatedRules(const std::vector<CombatMusicCalls::ConditionalBattleMusic>& a_rules);
+}
@@ -0,0 +1,136 @@
+#include "preload/musicPreloader.h"
+
+#include "trace/backgroundQueue.h"
+
+namespace Preload
+{
+	void MusicPreloader::SetEnabled(bool a_enabled)
+	{
+		enabled = a_enabled;
+	}
+
+	void MusicPreloader::SetLimits(std::size_t a_tracks, std::size_t a_bytes)
+	{
+		std::lock_guard guard{ lock };
+		warm.SetCapacity(a_tracks);
+		readBytes = std::max<std::size_t>(a_bytes, 4096);
+	}
+
+	void MusicPreloader::Warm(const std::vector<RE::BGSMusicType*>& a_music)
+	{
+		if (!enabled) {
+			return;
+		}
+
+		std::unique_lock guard{ lock };
+		// Touched last to first, so the first music ends up most recent.
+		for (auto it = a_music.rbegin(); it != a_music.rend(); ++it) {
+			const auto music = *it;
+			if (!music || !warm.Touch(music->GetFormID())) {
+				continue;
+			}
+			auto path = GetFirstTrackPath(music);
+			if (!path.empty()) {
+				logger::debug("  Warming {} from <{}>.", Utilities::EDID::GetEditorID(music), path);
+				pending.push_back(std::move(path));
+			}
+		}
+		if (pending.empty()) {
+			return;
+		}
+		if (!std::exchange(reading, true)) {
+			Trace::BackgroundQueue::GetSingleton()->Post([this]() { ReadPending(); });
+		}
+	}
+
+	void MusicPreloader::RecordStart(const RE::BGSMusicType* a_music)
+	{
+		if (!enabled || !a_music) {
+			return;
+		}
+
+		std::lock_guard guard{ lock };
+		const bool hit = warm.RecordStart(a_music->GetFormID());
+		logger::debug("  {} was {}predicted.", Utilities::EDID::GetEditorID(a_music), hit ? "" : "not ");
+		if (warm.GetStarts() % 16 == 0) {
+			logger::info("Predicted {} of {} music starts ({:.0f}%).", warm.GetHits(), warm.GetStarts(), warm.GetHitRate() * 100.0);
+		}
+	}
+
+	void MusicPreloader::ReadPending()
+	{
+		for (;;) {
+			std::unique_lock guard{ lock };
+			if (pending.empty()) {
+				reading = false;
+				return;
+			}
+			const auto path = std::move(pending.front());
+			pending.pop_front();
+			const auto bytes = readBytes;
+			guard.unlock();
+
+			const auto start = std::chrono::steady_clock::now();
+			const auto read = ReadHead(path, bytes);
+			const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			if (read == 0) {
+				logger::debug("Could not read <{}> ahead of time.", path);
+				continue;
+			}
+			logger::debug("Read {} KB of <{}> ahead of time in {:.1f}ms.", read / 1024, path, elapsed);
+		}
+	}
+
+	std::string MusicPreloader::GetFirstTrackPath(const RE::BGSMusicType* a_music)
+	{
+		for (const auto track : a_music->tracks) {
+			const auto wrapper = track ? skyrim_cast<RE::BGSMusicTrackFormWrapper*>(track) : nullptr;
+			const auto single = wrapper && wrapper->track ? skyrim_cast<RE::BGSMusicSingleTrack*>(wrapper->track) : nullptr;
+			if (!single || single->trackFileName.empty()) {
+				continue;
+			}
+
+			// Tracks are written as "Data\Music\...", the resource system wants them relative to Data.
+			std::string path{ single->trackFileName.c_str() };
+			if (path.size() > 5 && _strnicmp(path.c_str(), "data\\", 5) == 0) {
+				path.erase(0, 5);
+			}
+			return path;
+		}
+		return {};
+	}
+
+	std::size_t MusicPreloader::ReadHead(const std::string& a_path, std::size_t a_bytes)
+	{
+		const auto read = [a_bytes](const std::string& a_candidate) -> std::size_t {
+			RE::BSResourceNiBinaryStream stream{ a_candidate };
+			if (!stream.good()) {
+				return 0;
+			}
+			constexpr std::size_t chunk = 64 * 1024;
+			std::vector<char> buffer(chunk);
+			// The stream's position counts what it delivered, which falls short of the request at the end of the file.
+			const std::size_t start = stream.tell();
+			std::size_t total = 0;
+			while (total < a_bytes && stream.good()) {
+				const auto size = static_cast<std::uint32_t>(std::min(chunk, a_bytes - total));
+				stream.read(buffer.data(), size);
+				const auto delivered = static_cast<std::size_t>(stream.tell()) - start - total;
+				total += delivered;
+				if (delivered < size) {
+					break;
+				}
+			}
+			return total;
+		};
+
+		if (const auto bytes = read(a_path); bytes > 0) {
+			return bytes;
+		}
+		// Like the game, a track written as .wav may ship as .xwm.
+		if (a_path.size() > 4 && _stricmp(a_path.c_str() + a_path.size() - 4, ".wav") == 0) {
+			return read(a_path.substr(0, a_path.size() - 4) + ".xwm");
+		}
+		return 0;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "selection/warmSet.h"
+#include "utilities/utilities.h"
+
+#include <deque>
+
+namespace Preload
+{
+	/*
+	* Reads the start of the first track of music the rules are likely to pick, before combat starts, so
+	* the file is in the OS cache by the time the game streams it. Reading happens on the background queue.
+	*/
+	class MusicPreloader : public Utilities::Singleton::ISingleton<MusicPreloader>
+	{
+	public:
+		void SetEnabled(bool a_enabled);
+		// How many music types are kept warm, and how much of each first track is read.
+		void SetLimits(std::size_t a_tracks, std::size_t a_bytes);
+		bool IsEnabled() const { return enabled; }
+
+		// Warms the first track of every music type not already warm. Music earlier in the list is kept
+		// longer if the set overflows.
+		void Warm(const std::vector<RE::BGSMusicType*>& a_music);
+		// Counts whether music the rules just started was warmed beforehand.
+		void RecordStart(const RE::BGSMusicType* a_music);
+
+	private:
+		// Reads the queued tracks until none are left.
+		void ReadPending();
+		// Path of the first single track in the music, relative to the Data folder, or empty.
+		static std::string GetFirstTrackPath(const RE::BGSMusicType* a_music);
+		// Reads up to a_bytes from the start of the file, loose or archived. Returns the bytes read.
+		static std::size_t ReadHead(const std::string& a_path, std::size_t a_bytes);
+
+		bool enabled{ false };
+		std::size_t readBytes{ 512 * 1024 };
+		std::mutex lock;
+		// Guarded by lock. reading is set while ReadPending is queued or running.
+		Selection::WarmSet warm;
+		std::deque<std::string> pending;
+		bool reading{ false };
+	};
+}
@@ -0,0 +1,51 @@
+#include "selection/aliasTable.h"
+
+#include <cmath>
+
+namespace Selection
+{
+	void AliasTable::Build(const std::vector<float>& a_weights)
+	{
+		const auto count = a_weights.size();
+		columns.assign(count, Column{ 1ull << 32, 0 });
+		if (count <= 1) {
+			return;
+		}
+
+		double total = 0.0;
+		for (const auto weight : a_weights) {
+			total += weight;
+		}
+
+		// Scale so the average column holds exactly 1, then pair every underfull column with an overfull one.
+		std::vector<double> scaled(count);
+		std::vector<std::uint32_t> small{};
+		std::vector<std::uint32_t> large{};
+		for (std::size_t i = 0; i < count; ++i) {
+			scaled[i] = a_weights[i] * static_cast<double>(count) / total;
+			(scaled[i] < 1.0 ? small : large).push_back(static_cast<std::uint32_t>(i));
+		}
+
+		while (!small.empty() && !large.empty()) {
+			const auto less = small.back();
+			small.pop_back();
+			const auto more = large.back();
+
+			columns[less].threshold = static_cast<std::uint64_t>(std::ldexp(scaled[less], 32));
+			columns[less].alias = more;
+			scaled[more] -= 1.0 - scaled[less];
+			if (scaled[more] < 1.0) {
+				large.pop_back();
+				small.push_back(more);
+			}
+		}
+
+		// Whatever is left is 1 up to rounding error.
+		for (const auto index : small) {
+			columns[index] = Column{ 1ull << 32, index };
+		}
+		for (const auto index : large) {
+			columns[index] = Column{ 1ull << 32, index };
+		}
+	}
+}
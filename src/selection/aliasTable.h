@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+namespace Selection
+{
+	// Uniform double in [0, 1) from the top 53 bits of a 64 bit engine. Same sequence on every platform,
+	// unlike the standard distributions.
+	template <class Engine>
+	double UnitRandom(Engine& a_engine)
+	{
+		static_assert(std::numeric_limits<typename Engine::result_type>::digits == 64, "UnitRandom needs a 64 bit engine.");
+		return static_cast<double>(a_engine() >> 11) * 0x1.0p-53;
+	}
+
+	/*
+	* Walker's alias method, built with Vose's algorithm.
+	* 
+	* Building is linear in the number of weights, after which every sample costs one draw from the
+	* engine and one table lookup, however many entries there are.
+	*/
+	class AliasTable
+	{
+	public:
+		// Weights must be positive.
+		void Build(const std::vector<float>& a_weights);
+
+		// Tables with a single entry do not draw from the engine.
+		template <class Engine>
+		std::size_t Sample(Engine& a_engine) const
+		{
+			static_assert(std::numeric_limits<typename Engine::result_type>::digits == 64, "AliasTable needs a 64 bit engine.");
+			if (columns.size() <= 1) {
+				return 0;
+			}
+
+			const std::uint64_t bits = a_engine();
+			const auto column = static_cast<std::size_t>(((bits >> 32) * columns.size()) >> 32);
+			const auto& entry = columns[column];
+			return (bits & 0xFFFFFFFF) < entry.threshold ? column : entry.alias;
+		}
+
+		std::size_t GetSize() const { return columns.size(); }
+
+	private:
+		struct Column {
+			// Chance to keep this column, scaled to 2^32.
+			std::uint64_t threshold;
+			std::uint32_t alias;
+		};
+
+		std::vector<Column> columns{};
+	};
+}
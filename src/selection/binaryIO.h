@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace Selection
+{
+	// Little endian encoding shared by the compiled rule set and trace formats.
+	class BinaryWriter
+	{
+	public:
+		void Write(std::uint32_t a_value)
+		{
+			for (int shift = 0; shift < 32; shift += 8) {
+				buffer.push_back(static_cast<char>((a_value >> shift) & 0xFF));
+			}
+		}
+
+		void Write(std::uint64_t a_value)
+		{
+			Write(static_cast<std::uint32_t>(a_value));
+			Write(static_cast<std::uint32_t>(a_value >> 32));
+		}
+
+		void Write(const std::string& a_value)
+		{
+			Write(static_cast<std::uint32_t>(a_value.size()));
+			buffer.append(a_value);
+		}
+
+		std::string buffer{};
+	};
+
+	class BinaryReader
+	{
+	public:
+		explicit BinaryReader(std::string_view a_data) :
+			data(a_data)
+		{}
+
+		bool Read(std::uint32_t& a_value)
+		{
+			if (data.size() - position < 4) {
+				return false;
+			}
+			a_value = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				a_value |= static_cast<std::uint32_t>(static_cast<unsigned char>(data[position++])) << shift;
+			}
+			return true;
+		}
+
+		bool Read(std::uint64_t& a_value)
+		{
+			std::uint32_t low = 0;
+			std::uint32_t high = 0;
+			if (!Read(low) || !Read(high)) {
+				return false;
+			}
+			a_value = (static_cast<std::uint64_t>(high) << 32) | low;
+			return true;
+		}
+
+		bool Read(std::string& a_value)
+		{
+			std::uint32_t size = 0;
+			if (!Read(size) || data.size() - position < size) {
+				return false;
+			}
+			a_value.assign(data.substr(position, size));
+			position += size;
+			return true;
+		}
+
+		bool AtEnd() const { return position == data.size(); }
+		std::size_t GetPosition() const { return position; }
+
+		// Every element takes at least 4 bytes, so a count larger than this is corrupt.
+		bool Plausible(std::uint32_t a_count) const { return a_count <= (data.size() - position) / 4; }
+
+	private:
+		std::string_view data;
+		std::size_t position{ 0 };
+	};
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "selection/ruleShape.h"
+
+namespace Selection
+{
+	// Best (priority, score) a rule could ever reach.
+	struct RuleBound {
+		std::uint32_t rule;
+		bool high;
+		int score;
+	};
+
+	// A matched rule scores its AND count plus one if it has ORs, and is high priority at most if it has a
+	// high priority condition.
+	inline RuleBound GetBound(const RuleShape& a_rule, std::uint32_t a_position)
+	{
+		RuleBound response{ a_position, false, 0 };
+		bool hasOR = false;
+		for (const auto& condition : a_rule) {
+			if (condition.AND) {
+				response.score++;
+			}
+			else {
+				hasOR = true;
+			}
+			response.high |= IsHighPriority(condition.type);
+		}
+		response.score += hasOR ? 1 : 0;
+		return response;
+	}
+
+	// Best bound first, rule order among equal bounds.
+	inline void SortBounds(std::vector<RuleBound>& a_bounds)
+	{
+		std::stable_sort(a_bounds.begin(), a_bounds.end(), [](const RuleBound& a_left, const RuleBound& a_right) {
+			if (a_left.high != a_right.high) {
+				return a_left.high;
+			}
+			return a_left.score > a_right.score;
+		});
+	}
+
+	/*
+	* Same result as the MatchDegree loop, scoring rules in bound order and stopping once no remaining
+	* rule can beat the best match. A rule that could at most tie it is skipped too, unless it comes
+	* first in load order. a_match(rule) returns the rule's Match.
+	* 
+	* a_seedRule and a_seed are the best match among rules left out of a_bounds, if any were answered
+	* another way. The loop starts from it, so a seed that is already good enough skips every bound.
+	*/
+	template <class F>
+	std::int32_t SelectBounded(const std::vector<RuleBound>& a_bounds,
+		F&& a_match,
+		std::size_t& a_skipped,
+		std::int32_t a_seedRule = -1,
+		Match a_seed = {})
+	{
+		std::int32_t response = a_seed.score > 0 ? a_seedRule : -1;
+		Match best = response >= 0 ? a_seed : Match{};
+		std::size_t scored = 0;
+		for (const auto& bound : a_bounds) {
+			if (response >= 0) {
+				if (bound.high != best.high ? best.high : bound.score < best.score) {
+					break;
+				}
+				if (bound.high == best.high && bound.score == best.score && static_cast<std::int32_t>(bound.rule) > response) {
+					continue;
+				}
+			}
+
+			scored++;
+			const Match candidate = a_match(bound.rule);
+			if (candidate.score == 0) {
+				continue;
+			}
+			const bool better = response < 0 ||
+				(candidate.high != best.high ? candidate.high : candidate.score > best.score) ||
+				(candidate.high == best.high && candidate.score == best.score && static_cast<std::int32_t>(bound.rule) < response);
+			if (better) {
+				best = candidate;
+				response = static_cast<std::int32_t>(bound.rule);
+			}
+		}
+		a_skipped = a_bounds.size() - scored;
+		return response;
+	}
+}
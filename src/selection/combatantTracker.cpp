@@ -0,0 +1,113 @@
+#include "selection/combatantTracker.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace Selection
+{
+	void CombatantTracker::SetTrackedKeywords(std::vector<FormID> a_keywords)
+	{
+		Clear();
+		trackedKeywords = std::move(a_keywords);
+		keywordCounts.assign(trackedKeywords.size(), 0);
+	}
+
+	void CombatantTracker::SetIntensitySettings(const IntensitySettings& a_settings)
+	{
+		intensity = a_settings;
+	}
+
+	bool CombatantTracker::Enter(FormID a_actor, FormID a_base, const std::vector<FormID>& a_keywords, std::uint32_t a_level, bool a_boss)
+	{
+		const auto [entry, inserted] = combatants.try_emplace(a_actor);
+		if (!inserted) {
+			return false;
+		}
+
+		auto& combatant = entry->second;
+		combatant.base = a_base;
+		combatant.threat = static_cast<std::uint64_t>(a_level) * (a_boss ? intensity.bossWeight : 1);
+		threat += combatant.threat;
+		bases[a_base]++;
+		if (trackedKeywords.empty()) {
+			return true;
+		}
+
+		combatant.keywords.assign((trackedKeywords.size() + 63) / 64, 0);
+		for (const auto keyword : a_keywords) {
+			const auto found = std::ranges::lower_bound(trackedKeywords, keyword);
+			if (found == trackedKeywords.end() || *found != keyword) {
+				continue;
+			}
+			const auto bit = static_cast<std::size_t>(found - trackedKeywords.begin());
+			auto& word = combatant.keywords[bit / 64];
+			const auto mask = std::uint64_t{ 1 } << (bit % 64);
+			// The base and the race can both carry a keyword, it counts once.
+			if ((word & mask) == 0) {
+				word |= mask;
+				keywordCounts[bit]++;
+			}
+		}
+		return true;
+	}
+
+	bool CombatantTracker::Leave(FormID a_actor)
+	{
+		const auto entry = combatants.find(a_actor);
+		if (entry == combatants.end()) {
+			return false;
+		}
+
+		const auto& combatant = entry->second;
+		threat -= combatant.threat;
+		const auto base = bases.find(combatant.base);
+		if (--base->second == 0) {
+			bases.erase(base);
+		}
+		for (std::size_t i = 0; i < combatant.keywords.size(); ++i) {
+			for (auto word = combatant.keywords[i]; word != 0; word &= word - 1) {
+				keywordCounts[i * 64 + static_cast<std::size_t>(std::countr_zero(word))]--;
+			}
+		}
+		combatants.erase(entry);
+		return true;
+	}
+
+	void CombatantTracker::Clear()
+	{
+		combatants.clear();
+		bases.clear();
+		std::ranges::fill(keywordCounts, 0);
+		threat = 0;
+	}
+
+	void CombatantTracker::Fill(Context& a_context) const
+	{
+		a_context.combatants.clear();
+		a_context.combatantKeywords.clear();
+		for (const auto& [base, count] : bases) {
+			a_context.combatants.push_back(base);
+		}
+		for (std::size_t i = 0; i < trackedKeywords.size(); ++i) {
+			if (keywordCounts[i] > 0) {
+				a_context.combatantKeywords.push_back(trackedKeywords[i]);
+			}
+		}
+		a_context.intensity = static_cast<FormID>(GetIntensity());
+	}
+
+	std::size_t CombatantTracker::GetSize() const
+	{
+		return combatants.size();
+	}
+
+	std::uint64_t CombatantTracker::GetThreat() const
+	{
+		return threat;
+	}
+
+	IntensityTier CombatantTracker::GetIntensity() const
+	{
+		return GetIntensityTier(threat, combatants.size(), intensity);
+	}
+}
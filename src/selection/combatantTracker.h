@@ -0,0 +1,54 @@
+#pragma once
+
+#include "selection/context.h"
+#include "selection/intensity.h"
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace Selection
+{
+	/*
+	* The actors in combat with the player, kept up to date from combat state changes instead of scanning
+	* the process lists when music is picked. Each actor's base and the tracked keywords it carries are
+	* resolved once on entry, so filling a context only walks the distinct bases and tracked keywords.
+	* The threat of the fight is kept as a running total, so its tier is known without looking at anyone.
+	*/
+	class CombatantTracker {
+	public:
+		// The keywords conditions test, sorted and unique. Other keywords are not kept. Forgets every combatant.
+		void SetTrackedKeywords(std::vector<FormID> a_keywords);
+		// Applies to actors entering from now on.
+		void SetIntensitySettings(const IntensitySettings& a_settings);
+		// a_keywords are on the actor's base or race, in any order. Returns false if the actor was already tracked.
+		bool Enter(FormID a_actor, FormID a_base, const std::vector<FormID>& a_keywords, std::uint32_t a_level, bool a_boss);
+		// Returns false if the actor was not tracked.
+		bool Leave(FormID a_actor);
+		void Clear();
+		// Replaces the combatant sets and the intensity of the context.
+		void Fill(Context& a_context) const;
+		std::size_t GetSize() const;
+		std::uint64_t GetThreat() const;
+		IntensityTier GetIntensity() const;
+
+	private:
+		struct Combatant {
+			FormID base{ 0 };
+			// What the actor added to the threat on entry.
+			std::uint64_t threat{ 0 };
+			// Bit i is set if the actor carries trackedKeywords[i].
+			std::vector<std::uint64_t> keywords{};
+		};
+
+		std::unordered_map<FormID, Combatant> combatants;
+		// Combatants per base. Ordered, so the context set comes out sorted.
+		std::map<FormID, std::uint32_t> bases;
+		std::vector<FormID> trackedKeywords;
+		// Combatants carrying each tracked keyword.
+		std::vector<std::uint32_t> keywordCounts;
+		IntensitySettings intensity;
+		std::uint64_t threat{ 0 };
+	};
+}
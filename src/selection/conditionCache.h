@@ -0,0 +1,84 @@
+#pragma once
+
+#include "selection/context.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace Selection
+{
+	// Numbers conditions so that equal conditions, in any rule of any category, share a number.
+	class ConditionInterner
+	{
+	public:
+		// a_forms must be sorted and unique.
+		std::uint32_t Intern(ConditionType a_type, const std::vector<FormID>& a_forms)
+		{
+			const auto [it, inserted] = ids.try_emplace(std::make_pair(a_type, a_forms), static_cast<std::uint32_t>(ids.size()));
+			return it->second;
+		}
+
+		std::size_t GetSize() const { return ids.size(); }
+
+	private:
+		std::map<std::pair<ConditionType, std::vector<FormID>>, std::uint32_t> ids{};
+	};
+
+	/*
+	* Results of interned conditions for one context, so a condition shared by several rules is evaluated
+	* once per selection pass. Starting a pass is constant time: results are stamped with the pass they
+	* belong to instead of being cleared.
+	*/
+	class ConditionCache
+	{
+	public:
+		void Begin(std::size_t a_count)
+		{
+			if (stamps.size() != a_count) {
+				stamps.assign(a_count, 0);
+				values.assign(a_count, 0);
+				pass = 0;
+			}
+			if (++pass == 0) {
+				std::fill(stamps.begin(), stamps.end(), 0);
+				pass = 1;
+			}
+		}
+
+		// a_evaluate() computes the result if this pass has not seen the condition yet.
+		template <class F>
+		bool Get(std::uint32_t a_id, F&& a_evaluate)
+		{
+			if (stamps[a_id] != pass) {
+				values[a_id] = a_evaluate() ? 1 : 0;
+				stamps[a_id] = pass;
+			}
+			return values[a_id] != 0;
+		}
+
+		// The result of this pass, if the condition was evaluated.
+		std::optional<bool> Find(std::uint32_t a_id) const
+		{
+			if (stamps[a_id] != pass) {
+				return std::nullopt;
+			}
+			return values[a_id] != 0;
+		}
+
+		// Stores a result computed ahead of the rules, e.g. by a batch kernel.
+		void Set(std::uint32_t a_id, bool a_value)
+		{
+			values[a_id] = a_value ? 1 : 0;
+			stamps[a_id] = pass;
+		}
+
+	private:
+		std::vector<std::uint32_t> stamps{};
+		std::vector<std::uint8_t> values{};
+		std::uint32_t pass{ 0 };
+	};
+}
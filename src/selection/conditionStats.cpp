@@ -0,0 +1,156 @@
+#include "selection/conditionStats.h"
+
+#include "selection/binaryIO.h"
+#include "selection/hash.h"
+
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace Selection
+{
+	namespace
+	{
+		constexpr std::uint32_t STATS_MAGIC = 0x54534D43;  // "CMST"
+		constexpr std::uint32_t STATS_VERSION = 1;
+	}
+
+	void ConditionStats::Record(bool a_passed)
+	{
+		evaluations++;
+		passes += a_passed ? 1 : 0;
+		if (evaluations >= STATS_HISTORY) {
+			evaluations /= 2;
+			passes /= 2;
+			timed /= 2;
+			nanoseconds /= 2;
+		}
+	}
+
+	void ConditionStats::RecordTime(std::uint64_t a_nanoseconds)
+	{
+		timed++;
+		nanoseconds += a_nanoseconds;
+	}
+
+	double ConditionStats::GetPassRate() const
+	{
+		return (static_cast<double>(passes) + 1.0) / (static_cast<double>(evaluations) + 2.0);
+	}
+
+	double ConditionStats::GetCost(double a_estimate) const
+	{
+		return timed > 0 ? static_cast<double>(nanoseconds) / static_cast<double>(timed) : a_estimate;
+	}
+
+	std::uint64_t GetStatsKey(std::string_view a_source, std::size_t a_index, ConditionType a_type, const std::vector<FormID>& a_forms)
+	{
+		Hasher hasher{};
+		hasher.Add(a_source);
+		hasher.Add(a_index, 4);
+		hasher.Add(static_cast<std::uint64_t>(a_type), 1);
+		for (const auto form : a_forms) {
+			hasher.Add(form, 4);
+		}
+		return hasher.Get();
+	}
+
+	double EstimateCost(ConditionType a_type, std::size_t a_formCount)
+	{
+		// Single valued types compare each form once, the others binary search the context for it.
+		return 2.0 + static_cast<double>(a_formCount) * (IsSingleValued(a_type) ? 1.0 : 4.0);
+	}
+
+	bool ReadConditionStats(const std::string& a_path, StatsTable& a_table, std::string& a_error)
+	{
+		std::string data{};
+		try {
+			std::ifstream input(a_path, std::ios::binary);
+			if (!input) {
+				a_error = "Could not open file.";
+				return false;
+			}
+			data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		}
+		catch (const std::exception& e) {
+			a_error = std::string("Caught ") + e.what() + " while reading file.";
+			return false;
+		}
+
+		BinaryReader reader(data);
+		std::uint32_t magic = 0;
+		std::uint32_t version = 0;
+		std::uint32_t count = 0;
+		if (!reader.Read(magic) || magic != STATS_MAGIC || !reader.Read(version)) {
+			a_error = "Not a statistics file.";
+			return false;
+		}
+		if (version != STATS_VERSION) {
+			a_error = "Written by an unsupported version (" + std::to_string(version) + ").";
+			return false;
+		}
+		if (!reader.Read(count) || !reader.Plausible(count)) {
+			a_error = "File is truncated or damaged.";
+			return false;
+		}
+
+		StatsTable table{};
+		table.reserve(count);
+		for (std::uint32_t i = 0; i < count; ++i) {
+			std::uint64_t key = 0;
+			ConditionStats stats{};
+			if (!reader.Read(key) || !reader.Read(stats.evaluations) || !reader.Read(stats.passes) ||
+				!reader.Read(stats.timed) || !reader.Read(stats.nanoseconds) || stats.passes > stats.evaluations) {
+				a_error = "File is truncated or damaged.";
+				return false;
+			}
+			table[key] = stats;
+		}
+		if (!reader.AtEnd()) {
+			a_error = "File is truncated or damaged.";
+			return false;
+		}
+		a_table = std::move(table);
+		return true;
+	}
+
+	bool WriteConditionStats(const std::string& a_path, const StatsTable& a_table, std::string& a_error)
+	{
+		BinaryWriter writer{};
+		writer.Write(STATS_MAGIC);
+		writer.Write(STATS_VERSION);
+		writer.Write(static_cast<std::uint32_t>(a_table.size()));
+		for (const auto& [key, stats] : a_table) {
+			writer.Write(key);
+			writer.Write(stats.evaluations);
+			writer.Write(stats.passes);
+			writer.Write(stats.timed);
+			writer.Write(stats.nanoseconds);
+		}
+
+		const auto temporary = a_path + ".tmp";
+		{
+			std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+			if (!output) {
+				a_error = "Could not open file for writing.";
+				return false;
+			}
+			output.write(writer.buffer.data(), static_cast<std::streamsize>(writer.buffer.size()));
+			if (!output) {
+				a_error = "Failed to write file.";
+				return false;
+			}
+		}
+
+		std::error_code error{};
+		std::filesystem::rename(temporary, a_path, error);
+		if (error) {
+			a_error = "Failed to replace file: " + error.message();
+			std::remove(temporary.c_str());
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "selection/ruleShape.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Selection
+{
+	// How often a condition passed and what it cost, learned during play.
+	struct ConditionStats {
+		std::uint64_t evaluations{ 0 };
+		std::uint64_t passes{ 0 };
+		// Evaluations that were timed, and their total duration.
+		std::uint64_t timed{ 0 };
+		std::uint64_t nanoseconds{ 0 };
+
+		void Record(bool a_passed);
+		void RecordTime(std::uint64_t a_nanoseconds);
+		// Counts one pass and one failure that never happened, so an unseen condition starts at one half.
+		double GetPassRate() const;
+		// Mean timed cost in nanoseconds, or a_estimate until an evaluation was timed.
+		double GetCost(double a_estimate) const;
+	};
+
+	// One in this many evaluations is timed. Reading the clock costs about as much as a condition.
+	inline constexpr std::uint64_t STATS_TIMING_INTERVAL = 16;
+	// Counts are halved past this many evaluations, so old sessions fade out as habits change.
+	inline constexpr std::uint64_t STATS_HISTORY = 1ull << 16;
+
+	// Learned statistics by GetStatsKey.
+	using StatsTable = std::unordered_map<std::uint64_t, ConditionStats>;
+
+	// Identifies a condition across sessions. Editing the rule or moving it in its file gives it a new key.
+	std::uint64_t GetStatsKey(std::string_view a_source, std::size_t a_index, ConditionType a_type, const std::vector<FormID>& a_forms);
+	// Nanoseconds a condition is assumed to cost before it was timed. Grows with the forms it checks.
+	double EstimateCost(ConditionType a_type, std::size_t a_formCount);
+
+	bool ReadConditionStats(const std::string& a_path, StatsTable& a_table, std::string& a_error);
+	// Writes to a temporary file first, so a crash never leaves a half written file behind.
+	bool WriteConditionStats(const std::string& a_path, const StatsTable& a_table, std::string& a_error);
+
+	template <class T>
+	const T& Unwrap(const T& a_value)
+	{
+		return a_value;
+	}
+
+	template <class T>
+	const T& Unwrap(const std::unique_ptr<T>& a_value)
+	{
+		return *a_value;
+	}
+
+	/*
+	* Same result as MatchRule, evaluating the conditions in a_order. The result never depends on the order:
+	* a failed AND rejects the rule wherever it comes, and the rest is a count. An OR is skipped once another
+	* OR matched, unless it could still raise the priority.
+	*
+	* a_conditions holds ConditionShapes or pointers to anything with the same AND and type members.
+	* a_isTrue(position) evaluates the condition at that position.
+	*/
+	template <class Conditions, class F>
+	Match MatchInOrder(const Conditions& a_conditions, const std::vector<std::uint8_t>& a_order, F&& a_isTrue)
+	{
+		Match response{};
+		bool hasOR = false;
+		bool matchedOR = false;
+		for (const auto position : a_order) {
+			const auto& condition = Unwrap(a_conditions[position]);
+			const bool high = IsHighPriority(condition.type);
+			if (!condition.AND) {
+				hasOR = true;
+				if (matchedOR && (!high || response.high)) {
+					continue;
+				}
+			}
+			if (!a_isTrue(position)) {
+				if (condition.AND) {
+					return Match{};
+				}
+				continue;
+			}
+			if (condition.AND) {
+				response.score++;
+			}
+			else if (!matchedOR) {
+				matchedOR = true;
+				response.score++;
+			}
+			response.high |= high;
+		}
+		if (hasOR && !matchedOR) {
+			return Match{};
+		}
+		return response;
+	}
+
+	/*
+	* Orders a rule's conditions for MatchInOrder. ANDs come first, the one with the lowest expected cost
+	* per rejection (cost over fail rate) leading, since the first failure ends the rule. ORs follow, the
+	* one with the lowest expected cost per match leading, since a match lets most of the others be skipped.
+	* a_estimates are the costs of conditions that were never timed.
+	*/
+	template <class Conditions>
+	void OrderConditions(const Conditions& a_conditions,
+		const std::vector<ConditionStats>& a_stats,
+		const std::vector<double>& a_estimates,
+		std::vector<std::uint8_t>& a_order)
+	{
+		std::vector<double> ranks(a_conditions.size());
+		for (std::size_t i = 0; i < a_conditions.size(); ++i) {
+			const auto cost = a_stats[i].GetCost(a_estimates[i]);
+			const auto passRate = a_stats[i].GetPassRate();
+			ranks[i] = Unwrap(a_conditions[i]).AND ? cost / (1.0 - passRate) : cost / passRate;
+		}
+
+		a_order.resize(a_conditions.size());
+		std::iota(a_order.begin(), a_order.end(), std::uint8_t{ 0 });
+		std::stable_sort(a_order.begin(), a_order.end(), [&](std::uint8_t a_left, std::uint8_t a_right) {
+			const bool leftAND = Unwrap(a_conditions[a_left]).AND;
+			const bool rightAND = Unwrap(a_conditions[a_right]).AND;
+			if (leftAND != rightAND) {
+				return leftAND;
+			}
+			return ranks[a_left] < ranks[a_right];
+		});
+	}
+}
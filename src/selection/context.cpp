@@ -0,0 +1,48 @@
+#include "selection/context.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace Selection
+{
+	namespace
+	{
+		void AppendForm(std::ostringstream& a_stream, FormID a_form)
+		{
+			a_stream << "0x" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << a_form << std::dec;
+		}
+
+		void AppendSet(std::ostringstream& a_stream, std::string_view a_name, const std::vector<FormID>& a_set)
+		{
+			a_stream << ", " << a_name << " [";
+			for (std::size_t i = 0; i < a_set.size(); ++i) {
+				if (i > 0) {
+					a_stream << " ";
+				}
+				AppendForm(a_stream, a_set[i]);
+			}
+			a_stream << "]";
+		}
+	}
+
+	std::string Context::Describe() const
+	{
+		std::ostringstream stream{};
+		stream << "worldspace ";
+		AppendForm(stream, worldspace);
+		stream << ", cell ";
+		AppendForm(stream, cell);
+		stream << ", target ";
+		AppendForm(stream, target);
+		stream << ", intensity " << intensity;
+		AppendSet(stream, "locations", locations);
+		AppendSet(stream, "location keywords", locationKeywords);
+		AppendSet(stream, "target keywords", targetKeywords);
+		AppendSet(stream, "combatants", combatants);
+		AppendSet(stream, "combatant keywords", combatantKeywords);
+		stream << ", target level " << GetQuantity(Quantity::kTargetLevel) << ", player level " << GetQuantity(Quantity::kPlayerLevel)
+			   << ", health " << GetQuantity(Quantity::kHealth) << "%, hour " << GetQuantity(Quantity::kGameHour)
+			   << ", minute " << gameMinute << ", custom inputs " << customInputs;
+		return stream.str();
+	}
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Game independent selection code. Nothing in this folder may include the game headers, so the
+// same code can be compiled by the offline tools.
+namespace Selection
+{
+	using FormID = std::uint32_t;
+
+	enum class ConditionType {
+		kWorldspace,
+		kCell,
+		kLocation,
+		kLocationKeyword,
+		kCombatTarget,
+		kCombatTargetKeyword,
+		kCombatant,
+		kCombatantKeyword,
+		kIntensity,
+
+		kTotal,
+
+		// Conditions past kTotal test no forms, so they have no place in tables by type.
+		// A number from the context within a range.
+		kRange = 0xFE,
+		// Kinds other plugins register.
+		kExtension = 0xFF
+	};
+
+	inline constexpr auto TOTAL_CONDITION_TYPES = static_cast<std::size_t>(ConditionType::kTotal);
+
+	// Numbers range conditions test.
+	enum class Quantity : std::uint8_t {
+		kTargetLevel,
+		kPlayerLevel,
+		// The player's health, in whole percent of its maximum.
+		kHealth,
+		// In-game hour of the day, to the minute, from 0 up to 24.
+		kGameHour,
+
+		kTotal
+	};
+
+	inline constexpr auto TOTAL_QUANTITIES = static_cast<std::size_t>(Quantity::kTotal);
+
+	// Inclusive on both ends. Game hours may run past midnight, with low above high.
+	struct Range {
+		float low{ 0.0f };
+		float high{ 0.0f };
+
+		bool operator==(const Range&) const = default;
+
+		bool Contains(float a_value) const
+		{
+			return low <= high ? a_value >= low && a_value <= high : a_value >= low || a_value <= high;
+		}
+	};
+
+	// Conditions that test a single context value. Everything else tests a set.
+	constexpr bool IsSingleValued(ConditionType a_type)
+	{
+		return a_type == ConditionType::kWorldspace ||
+			a_type == ConditionType::kCell ||
+			a_type == ConditionType::kCombatTarget ||
+			a_type == ConditionType::kIntensity;
+	}
+
+	// Conditions that make a rule high priority when they are true.
+	constexpr bool IsHighPriority(ConditionType a_type)
+	{
+		return a_type == ConditionType::kCombatTarget ||
+			a_type == ConditionType::kCombatTargetKeyword ||
+			a_type == ConditionType::kCombatant ||
+			a_type == ConditionType::kCombatantKeyword;
+	}
+
+	/*
+	* Snapshot of everything the conditions look at, captured once per selection.
+	* Missing values are 0. Keyword lists are sorted and unique.
+	*/
+	struct Context {
+		FormID worldspace{ 0 };
+		FormID cell{ 0 };
+		FormID target{ 0 };
+		// IntensityTier of the fight, kNone outside of combat.
+		FormID intensity{ 0 };
+		// The current location followed by its parents.
+		std::vector<FormID> locations{};
+		// Keywords on the current location or any of its parents.
+		std::vector<FormID> locationKeywords{};
+		// Keywords on the target's base and race. Empty if either is missing.
+		std::vector<FormID> targetKeywords{};
+		// Bases of every actor in combat with the player, sorted and unique.
+		std::vector<FormID> combatants{};
+		// Keywords on any combatant's base or race that some rule tests, sorted and unique.
+		std::vector<FormID> combatantKeywords{};
+		// By Quantity, only captured if some rule tests it. Levels are 0 if there is no one to read them from.
+		std::array<float, TOTAL_QUANTITIES> quantities{};
+		// In-game minutes since the game started, and how often plugins reported custom inputs as changed.
+		// Only captured if a registered condition kind declared that input.
+		std::int64_t gameMinute{ 0 };
+		std::uint64_t customInputs{ 0 };
+
+		void Clear()
+		{
+			worldspace = 0;
+			cell = 0;
+			target = 0;
+			intensity = 0;
+			locations.clear();
+			locationKeywords.clear();
+			targetKeywords.clear();
+			combatants.clear();
+			combatantKeywords.clear();
+			quantities.fill(0.0f);
+			gameMinute = 0;
+			customInputs = 0;
+		}
+
+		bool operator==(const Context&) const = default;
+
+		FormID GetValue(ConditionType a_type) const
+		{
+			switch (a_type) {
+			case ConditionType::kWorldspace:
+				return worldspace;
+			case ConditionType::kCell:
+				return cell;
+			case ConditionType::kCombatTarget:
+				return target;
+			case ConditionType::kIntensity:
+				return intensity;
+			default:
+				return 0;
+			}
+		}
+
+		float GetQuantity(Quantity a_quantity) const
+		{
+			return quantities[static_cast<std::size_t>(a_quantity)];
+		}
+
+		FormID GetCurrentLocation() const
+		{
+			return locations.empty() ? 0 : locations.front();
+		}
+
+		const std::vector<FormID>& GetSet(ConditionType a_type) const
+		{
+			static const std::vector<FormID> empty{};
+			switch (a_type) {
+			case ConditionType::kLocation:
+				return locations;
+			case ConditionType::kLocationKeyword:
+				return locationKeywords;
+			case ConditionType::kCombatTargetKeyword:
+				return targetKeywords;
+			case ConditionType::kCombatant:
+				return combatants;
+			case ConditionType::kCombatantKeyword:
+				return combatantKeywords;
+			default:
+				return empty;
+			}
+		}
+
+		bool Has(ConditionType a_type, FormID a_form) const
+		{
+			if (IsSingleValued(a_type)) {
+				return a_form != 0 && GetValue(a_type) == a_form;
+			}
+			const auto& set = GetSet(a_type);
+			return std::find(set.begin(), set.end(), a_form) != set.end();
+		}
+
+		// True if any of a_forms is present for this condition type.
+		bool HasAny(ConditionType a_type, const std::vector<FormID>& a_forms) const
+		{
+			if (IsSingleValued(a_type)) {
+				const auto value = GetValue(a_type);
+				return value != 0 && std::find(a_forms.begin(), a_forms.end(), value) != a_forms.end();
+			}
+			for (const auto form : GetSet(a_type)) {
+				if (std::find(a_forms.begin(), a_forms.end(), form) != a_forms.end()) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Every value in hex, for logs and reports.
+		std::string Describe() const;
+
+		static void Normalize(std::vector<FormID>& a_set)
+		{
+			std::sort(a_set.begin(), a_set.end());
+			a_set.erase(std::unique(a_set.begin(), a_set.end()), a_set.end());
+		}
+	};
+}
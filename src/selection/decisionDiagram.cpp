@@ -0,0 +1,663 @@
+#include "selection/decisionDiagram.h"
+
+#include <array>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <string>
+
+namespace Selection
+{
+	namespace
+	{
+		enum Flags : std::uint8_t {
+			kOrMatched = 1 << 0,
+			kHigh = 1 << 1,
+			// The rule's condition on the type currently being decided is already true.
+			kTypeTrue = 1 << 2,
+			// The rule's condition on the type currently being decided has been applied.
+			kTypeDone = 1 << 3
+		};
+
+		struct PreparedRule {
+			std::array<const ConditionShape*, TOTAL_CONDITION_TYPES> conditions{};
+			std::size_t lastType{ 0 };
+			std::size_t lastORType{ 0 };
+			bool hasOR{ false };
+			int maxScore{ 0 };
+			// True at index t if the rule has a high priority condition at type t or later.
+			std::array<bool, TOTAL_CONDITION_TYPES + 1> highFrom{};
+			// True if the rule is high priority whenever it matches.
+			bool alwaysHigh{ false };
+		};
+
+		struct Pending {
+			std::uint32_t rule;
+			std::uint8_t flags;
+		};
+
+		struct State {
+			std::uint32_t type{ 0 };
+			// Index into the sorted forms of the current type. Only used by set valued types.
+			std::uint32_t cursor{ 0 };
+			std::int32_t best{ -1 };
+			bool bestHigh{ false };
+			int bestScore{ 0 };
+			std::vector<Pending> pending{};
+			// Resolved rules after best that match as well, sorted. Only kept with grouped ties.
+			std::vector<std::uint32_t> ties{};
+		};
+
+		int Rank(bool a_high, int a_score)
+		{
+			return (a_high ? 1 << 16 : 0) + a_score;
+		}
+
+		bool Contains(const std::vector<FormID>& a_sorted, FormID a_form)
+		{
+			return std::binary_search(a_sorted.begin(), a_sorted.end(), a_form);
+		}
+
+		bool Intersects(const std::vector<FormID>& a_values, const std::vector<FormID>& a_sorted)
+		{
+			return std::any_of(a_values.begin(), a_values.end(), [&](FormID a_value) { return Contains(a_sorted, a_value); });
+		}
+
+		void InsertSorted(std::vector<std::uint32_t>& a_sorted, std::uint32_t a_value)
+		{
+			a_sorted.insert(std::upper_bound(a_sorted.begin(), a_sorted.end(), a_value), a_value);
+		}
+
+		template <class T>
+		void Append(std::string& a_key, const T& a_value)
+		{
+			char buffer[sizeof(T)];
+			std::memcpy(buffer, std::addressof(a_value), sizeof(T));
+			a_key.append(buffer, sizeof(T));
+		}
+
+		constexpr auto LOCATION = static_cast<std::uint32_t>(ConditionType::kLocation);
+		constexpr auto LOCATION_KEYWORD = static_cast<std::uint32_t>(ConditionType::kLocationKeyword);
+
+		class Builder
+		{
+		public:
+			Builder(const std::vector<RuleShape>& a_rules,
+				std::uint32_t a_begin,
+				std::uint32_t a_end,
+				const DecisionDiagram::LocationTable* a_locations,
+				bool a_groupTies) :
+				offset(a_begin),
+				locationTable(a_locations),
+				groupTies(a_groupTies)
+			{
+				rules.resize(a_end - a_begin);
+				for (std::uint32_t i = a_begin; i < a_end; ++i) {
+					auto& rule = rules[i - a_begin];
+					for (const auto& condition : a_rules[i]) {
+						const auto type = static_cast<std::size_t>(condition.type);
+						rule.conditions[type] = std::addressof(condition);
+						rule.lastType = std::max(rule.lastType, type);
+						if (condition.AND) {
+							rule.maxScore++;
+						}
+						else {
+							rule.hasOR = true;
+							rule.lastORType = std::max(rule.lastORType, type);
+						}
+
+						auto& forms = formsByType[type];
+						forms.insert(forms.end(), condition.forms.begin(), condition.forms.end());
+					}
+					if (rule.hasOR) {
+						rule.maxScore++;
+					}
+					for (std::size_t type = TOTAL_CONDITION_TYPES; type-- > 0;) {
+						const auto* condition = rule.conditions[type];
+						const bool high = condition && IsHighPriority(static_cast<ConditionType>(type));
+						rule.highFrom[type] = rule.highFrom[type + 1] || high;
+						if (high && condition->AND) {
+							rule.alwaysHigh = true;
+						}
+					}
+				}
+				for (auto& forms : formsByType) {
+					Context::Normalize(forms);
+				}
+
+				if (locationTable) {
+					for (const auto& [location, info] : *locationTable) {
+						if (Intersects(info.chain, formsByType[LOCATION]) || Intersects(info.keywords, formsByType[LOCATION_KEYWORD])) {
+							locations.emplace_back(location, std::addressof(info));
+						}
+					}
+					std::sort(locations.begin(), locations.end(), [](const auto& a_left, const auto& a_right) {
+						return a_left.first < a_right.first;
+					});
+				}
+			}
+
+			// Rules of this part, indexed by position minus offset.
+			std::vector<PreparedRule> rules{};
+			std::uint32_t offset;
+			std::array<std::vector<FormID>, TOTAL_CONDITION_TYPES> formsByType{};
+			const DecisionDiagram::LocationTable* locationTable;
+			std::vector<std::pair<FormID, const DecisionDiagram::LocationInfo*>> locations{};
+			bool groupTies;
+
+			const PreparedRule& GetRule(std::uint32_t a_rule) const
+			{
+				return rules[a_rule - offset];
+			}
+
+			const ConditionShape* GetCondition(std::uint32_t a_rule, std::uint32_t a_type) const
+			{
+				return GetRule(a_rule).conditions[a_type];
+			}
+
+			// Location and location keyword conditions are decided together when a location table is given.
+			bool IsSwitch(std::uint32_t a_type) const
+			{
+				return IsSingleValued(static_cast<ConditionType>(a_type)) || (locationTable && a_type == LOCATION);
+			}
+
+			// Applies the outcome of a rule's condition on the current type. Returns false if the rule is no
+			// longer pending, either because it failed or because it was resolved.
+			bool FinishEntry(State& a_state, Pending& a_entry, bool a_isTrue) const
+			{
+				const auto type = a_state.type;
+				const auto& rule = GetRule(a_entry.rule);
+				a_entry.flags &= ~(kTypeTrue | kTypeDone);
+				if (rule.conditions[type]->AND && !a_isTrue) {
+					return false;
+				}
+				// Flags that can no longer change the outcome are dropped so equivalent states are shared.
+				if (rule.hasOR && rule.lastORType == type) {
+					if (!(a_entry.flags & kOrMatched)) {
+						return false;
+					}
+					a_entry.flags &= ~kOrMatched;
+				}
+				if (rule.alwaysHigh) {
+					a_entry.flags &= ~kHigh;
+				}
+				if (rule.lastType != type) {
+					return true;
+				}
+
+				const bool high = rule.alwaysHigh || (a_entry.flags & kHigh);
+				const auto rank = Rank(high, rule.maxScore);
+				const auto bestRank = a_state.best < 0 ? 0 : Rank(a_state.bestHigh, a_state.bestScore);
+				if (rank > bestRank || (rank == bestRank && static_cast<std::int32_t>(a_entry.rule) < a_state.best)) {
+					if (groupTies && rank == bestRank && a_state.best >= 0) {
+						InsertSorted(a_state.ties, static_cast<std::uint32_t>(a_state.best));
+					}
+					else {
+						a_state.ties.clear();
+					}
+					a_state.best = static_cast<std::int32_t>(a_entry.rule);
+					a_state.bestHigh = high;
+					a_state.bestScore = rule.maxScore;
+				}
+				else if (groupTies && rank == bestRank) {
+					InsertSorted(a_state.ties, a_entry.rule);
+				}
+				return false;
+			}
+
+			// Finishes every pending rule that has a condition on the current type and moves to the next type.
+			void FinishType(State& a_state) const
+			{
+				const auto type = a_state.type;
+				auto& pending = a_state.pending;
+				std::size_t kept = 0;
+				for (auto entry : pending) {
+					if (GetCondition(entry.rule, type)) {
+						if (entry.flags & kTypeDone) {
+							entry.flags &= ~kTypeDone;
+						}
+						else if (!FinishEntry(a_state, entry, entry.flags & kTypeTrue)) {
+							continue;
+						}
+					}
+					pending[kept++] = entry;
+				}
+				pending.resize(kept);
+				a_state.type++;
+				a_state.cursor = 0;
+			}
+
+			// Marks a condition of the current type as true for a pending rule.
+			void MarkTrue(Pending& a_entry, std::uint32_t a_type) const
+			{
+				a_entry.flags |= kTypeTrue;
+				if (!GetCondition(a_entry.rule, a_type)->AND) {
+					a_entry.flags |= kOrMatched;
+				}
+				if (IsHighPriority(static_cast<ConditionType>(a_type))) {
+					a_entry.flags |= kHigh;
+				}
+			}
+
+			// Marks every pending rule whose condition on the current type is satisfied by a_present.
+			template <class Predicate>
+			void MarkWhere(State& a_state, Predicate a_present) const
+			{
+				for (auto& entry : a_state.pending) {
+					const auto* condition = GetCondition(entry.rule, a_state.type);
+					if (condition && !(entry.flags & (kTypeTrue | kTypeDone)) && a_present(condition->forms)) {
+						MarkTrue(entry, a_state.type);
+					}
+				}
+			}
+
+			// Drops pending rules that can no longer beat the best resolved rule, or tie it with grouped ties.
+			void Bound(State& a_state) const
+			{
+				if (a_state.best < 0) {
+					return;
+				}
+				const auto bestRank = Rank(a_state.bestHigh, a_state.bestScore);
+				std::erase_if(a_state.pending, [&](const Pending& a_entry) {
+					const auto& rule = GetRule(a_entry.rule);
+					const bool couldBeHigh = rule.alwaysHigh || (a_entry.flags & kHigh) || rule.highFrom[a_state.type];
+					const auto rank = Rank(couldBeHigh, rule.maxScore);
+					return rank < bestRank || (!groupTies && rank == bestRank && static_cast<std::int32_t>(a_entry.rule) > a_state.best);
+				});
+			}
+
+			/*
+			* Brings a state to the next decision. Rules whose condition on the current type is already
+			* decided are finished right away, and types no pending rule cares about are skipped. Afterwards
+			* the state is either a leaf, a switch, or a test of forms[cursor].
+			*/
+			void Settle(State& a_state) const
+			{
+				while (true) {
+					Bound(a_state);
+					if (a_state.pending.empty() || a_state.type >= TOTAL_CONDITION_TYPES) {
+						return;
+					}
+
+					const auto type = a_state.type;
+					if (IsSwitch(type)) {
+						const bool relevant = std::any_of(a_state.pending.begin(), a_state.pending.end(), [&](const Pending& a_entry) {
+							return GetCondition(a_entry.rule, type) != nullptr ||
+								(type == LOCATION && GetCondition(a_entry.rule, LOCATION_KEYWORD) != nullptr);
+						});
+						if (relevant) {
+							return;
+						}
+						FinishType(a_state);
+						continue;
+					}
+
+					const auto& forms = formsByType[type];
+					const auto previousBest = a_state.best;
+					auto next = static_cast<std::uint32_t>(forms.size());
+					auto& pending = a_state.pending;
+					std::size_t kept = 0;
+					for (auto entry : pending) {
+						const auto* condition = GetCondition(entry.rule, type);
+						if (!condition || (entry.flags & kTypeDone)) {
+							pending[kept++] = entry;
+							continue;
+						}
+
+						const bool isTrue = entry.flags & kTypeTrue;
+						if (!isTrue && a_state.cursor < forms.size()) {
+							const auto it = std::lower_bound(condition->forms.begin(), condition->forms.end(), forms[a_state.cursor]);
+							if (it != condition->forms.end()) {
+								const auto index = static_cast<std::uint32_t>(std::lower_bound(forms.begin(), forms.end(), *it) - forms.begin());
+								next = std::min(next, index);
+								pending[kept++] = entry;
+								continue;
+							}
+						}
+
+						// Either true already, or none of its forms are left to test.
+						if (FinishEntry(a_state, entry, isTrue)) {
+							entry.flags |= kTypeDone;
+							pending[kept++] = entry;
+						}
+					}
+					pending.resize(kept);
+
+					if (a_state.best != previousBest) {
+						continue;
+					}
+					if (next < forms.size()) {
+						a_state.cursor = next;
+						return;
+					}
+					FinishType(a_state);
+				}
+			}
+
+			// Values a switch on the state's type has to tell apart.
+			std::vector<FormID> GetSwitchValues(const State& a_state) const
+			{
+				std::vector<FormID> values{};
+				if (a_state.type == LOCATION && locationTable) {
+					values.reserve(locations.size());
+					for (const auto& entry : locations) {
+						values.push_back(entry.first);
+					}
+					return values;
+				}
+
+				for (const auto& entry : a_state.pending) {
+					if (const auto* condition = GetCondition(entry.rule, a_state.type)) {
+						values.insert(values.end(), condition->forms.begin(), condition->forms.end());
+					}
+				}
+				Context::Normalize(values);
+				return values;
+			}
+
+			// State after the switch on the state's type sees a_value, or nothing if a_value is 0.
+			State Switch(const State& a_state, FormID a_value) const
+			{
+				auto child = a_state;
+				if (child.type == LOCATION && locationTable) {
+					const auto it = std::lower_bound(locations.begin(), locations.end(), a_value, [](const auto& a_entry, FormID a_id) {
+						return a_entry.first < a_id;
+					});
+					const auto* info = (a_value != 0 && it != locations.end() && it->first == a_value) ? it->second : nullptr;
+					if (info) {
+						MarkWhere(child, [&](const std::vector<FormID>& a_forms) { return Intersects(info->chain, a_forms); });
+					}
+					FinishType(child);
+					if (info) {
+						MarkWhere(child, [&](const std::vector<FormID>& a_forms) { return Intersects(info->keywords, a_forms); });
+					}
+					FinishType(child);
+					return child;
+				}
+
+				if (a_value != 0) {
+					MarkWhere(child, [&](const std::vector<FormID>& a_forms) { return Contains(a_forms, a_value); });
+				}
+				FinishType(child);
+				return child;
+			}
+
+			static std::string MakeKey(const State& a_state)
+			{
+				std::string key{};
+				key.reserve(16 + a_state.pending.size() * 5 + a_state.ties.size() * 4);
+				if (a_state.pending.empty()) {
+					key.push_back('L');
+					Append(key, a_state.best);
+					key.push_back(a_state.bestHigh ? 1 : 0);
+					for (const auto rule : a_state.ties) {
+						Append(key, rule);
+					}
+					return key;
+				}
+
+				key.push_back('N');
+				Append(key, a_state.type);
+				Append(key, a_state.cursor);
+				Append(key, a_state.best);
+				key.push_back(a_state.bestHigh ? 1 : 0);
+				for (const auto& entry : a_state.pending) {
+					Append(key, entry.rule);
+					key.push_back(static_cast<char>(entry.flags));
+				}
+				// Pending and tied rules are told apart by the count.
+				Append(key, static_cast<std::uint32_t>(a_state.ties.size()));
+				for (const auto rule : a_state.ties) {
+					Append(key, rule);
+				}
+				return key;
+			}
+		};
+	}
+
+	bool DecisionDiagram::Build(const std::vector<RuleShape>& a_rules,
+		const LocationTable* a_locations,
+		std::size_t a_maxNodes,
+		bool a_groupTies)
+	{
+		Clear();
+		groupTies = a_groupTies;
+
+		// Ranges that still need a diagram, in rule order. A range that does not fit is split in half.
+		std::deque<std::pair<std::uint32_t, std::uint32_t>> ranges{};
+		ranges.emplace_back(0, static_cast<std::uint32_t>(a_rules.size()));
+		while (!ranges.empty()) {
+			const auto [begin, end] = ranges.front();
+			ranges.pop_front();
+
+			const auto remaining = a_maxNodes - std::min(a_maxNodes, nodes.size());
+			const auto budget = end - begin > 1 ? std::min(remaining, MAX_PART_NODES) : remaining;
+			if (BuildPart(a_rules, begin, end, a_locations, budget)) {
+				continue;
+			}
+			if (end - begin <= 1 || remaining <= MAX_PART_NODES) {
+				Clear();
+				return false;
+			}
+
+			const auto middle = begin + (end - begin) / 2;
+			ranges.emplace_front(middle, end);
+			ranges.emplace_front(begin, middle);
+		}
+
+		ComputeDepth();
+		return true;
+	}
+
+	bool DecisionDiagram::BuildPart(const std::vector<RuleShape>& a_rules, std::uint32_t a_begin, std::uint32_t a_end, const LocationTable* a_locations, std::size_t a_maxNodes)
+	{
+		const Builder builder{ a_rules, a_begin, a_end, a_locations, groupTies };
+		const auto firstNode = nodes.size();
+		const auto firstCase = cases.size();
+
+		std::unordered_map<std::uint32_t, State> states{};
+		std::unordered_map<std::string, std::uint32_t> known{};
+		std::deque<std::uint32_t> queue{};
+		bool overflow = false;
+
+		const auto getOrCreate = [&](State&& a_state) -> std::uint32_t {
+			builder.Settle(a_state);
+			auto key = Builder::MakeKey(a_state);
+			if (const auto it = known.find(key); it != known.end()) {
+				return it->second;
+			}
+			if (nodes.size() - firstNode >= a_maxNodes) {
+				overflow = true;
+				return 0;
+			}
+
+			const auto index = static_cast<std::uint32_t>(nodes.size());
+			auto& node = nodes.emplace_back();
+			if (a_state.pending.empty()) {
+				node.kind = NodeKind::kLeaf;
+				node.result = Result{ a_state.best, a_state.bestHigh, a_state.bestScore };
+				if (groupTies && a_state.best >= 0) {
+					a_state.ties.insert(a_state.ties.begin(), static_cast<std::uint32_t>(a_state.best));
+					node.result.ties = tieGroups.Intern(a_state.ties);
+				}
+			}
+			else {
+				node.type = static_cast<ConditionType>(a_state.type);
+				node.kind = builder.IsSwitch(a_state.type) ? NodeKind::kSwitch : NodeKind::kTest;
+				states.emplace(index, std::move(a_state));
+				queue.push_back(index);
+			}
+			known.emplace(std::move(key), index);
+			return index;
+		};
+
+		State root{};
+		root.pending.reserve(a_end - a_begin);
+		for (auto i = a_begin; i < a_end; ++i) {
+			if (!a_rules[i].empty()) {
+				root.pending.push_back(Pending{ i, 0 });
+			}
+		}
+		const auto rootIndex = getOrCreate(std::move(root));
+
+		while (!queue.empty() && !overflow) {
+			const auto index = queue.front();
+			queue.pop_front();
+			const auto state = std::move(states.at(index));
+			states.erase(index);
+
+			if (nodes[index].kind == NodeKind::kTest) {
+				const auto form = builder.formsByType[state.type][state.cursor];
+				auto pass = state;
+				builder.MarkWhere(pass, [&](const std::vector<FormID>& a_forms) { return Contains(a_forms, form); });
+				pass.cursor++;
+				auto fail = state;
+				fail.cursor++;
+
+				const auto passChild = getOrCreate(std::move(pass));
+				const auto failChild = getOrCreate(std::move(fail));
+				nodes[index].form = form;
+				nodes[index].pass = passChild;
+				nodes[index].fail = failChild;
+				continue;
+			}
+
+			// Values that lead to the same place as the fallback do not need a case.
+			const auto failChild = getOrCreate(builder.Switch(state, 0));
+			std::vector<Case> switchCases{};
+			for (const auto value : builder.GetSwitchValues(state)) {
+				const auto child = getOrCreate(builder.Switch(state, value));
+				if (child != failChild) {
+					switchCases.push_back(Case{ value, child });
+				}
+			}
+
+			nodes[index].firstCase = static_cast<std::uint32_t>(cases.size());
+			nodes[index].caseCount = static_cast<std::uint32_t>(switchCases.size());
+			nodes[index].fail = failChild;
+			cases.insert(cases.end(), switchCases.begin(), switchCases.end());
+		}
+
+		// Groups interned by a part that did not fit stay unused, which costs memory but nothing else.
+		if (overflow) {
+			nodes.resize(firstNode);
+			cases.resize(firstCase);
+			return false;
+		}
+		roots.push_back(rootIndex);
+		return true;
+	}
+
+	void DecisionDiagram::ComputeDepth()
+	{
+		// Longest path to a leaf for every node, computed with an explicit stack.
+		constexpr auto unknown = std::numeric_limits<std::size_t>::max();
+		std::vector<std::size_t> nodeDepth(nodes.size(), unknown);
+		const auto forEachChild = [&](const Node& a_node, auto&& a_func) {
+			switch (a_node.kind) {
+			case NodeKind::kLeaf:
+				break;
+			case NodeKind::kTest:
+				a_func(a_node.pass);
+				a_func(a_node.fail);
+				break;
+			case NodeKind::kSwitch:
+				a_func(a_node.fail);
+				for (std::uint32_t i = 0; i < a_node.caseCount; ++i) {
+					a_func(cases[a_node.firstCase + i].child);
+				}
+				break;
+			}
+		};
+
+		depth = 0;
+		for (const auto root : roots) {
+			std::vector<std::uint32_t> stack{ root };
+			while (!stack.empty()) {
+				const auto index = stack.back();
+				if (nodeDepth[index] != unknown) {
+					stack.pop_back();
+					continue;
+				}
+
+				bool ready = true;
+				std::size_t deepest = 0;
+				forEachChild(nodes[index], [&](std::uint32_t a_child) {
+					if (nodeDepth[a_child] == unknown) {
+						ready = false;
+						stack.push_back(a_child);
+					}
+					else {
+						deepest = std::max(deepest, nodeDepth[a_child] + 1);
+					}
+				});
+				if (ready) {
+					nodeDepth[index] = deepest;
+					stack.pop_back();
+				}
+			}
+			depth += nodeDepth[root];
+		}
+	}
+
+	const DecisionDiagram::Result& DecisionDiagram::Walk(std::uint32_t a_root, const Context& a_context) const
+	{
+		auto index = a_root;
+		while (nodes[index].kind != NodeKind::kLeaf) {
+			const auto& node = nodes[index];
+			if (node.kind == NodeKind::kTest) {
+				index = a_context.Has(node.type, node.form) ? node.pass : node.fail;
+				continue;
+			}
+
+			const auto value = node.type == ConditionType::kLocation ? a_context.GetCurrentLocation() : a_context.GetValue(node.type);
+			const auto begin = cases.begin() + node.firstCase;
+			const auto end = begin + node.caseCount;
+			const auto it = std::lower_bound(begin, end, value, [](const Case& a_case, FormID a_value) {
+				return a_case.value < a_value;
+			});
+			index = (it != end && it->value == value) ? it->child : node.fail;
+		}
+		return nodes[index].result;
+	}
+
+	DecisionDiagram::Result DecisionDiagram::Evaluate(const Context& a_context) const
+	{
+		Result best{};
+		for (const auto root : roots) {
+			const auto& result = Walk(root, a_context);
+			if (result.rule < 0) {
+				continue;
+			}
+			const auto rank = Rank(result.high, result.score);
+			const auto bestRank = Rank(best.high, best.score);
+			if (best.rule < 0 || rank > bestRank || (rank == bestRank && result.rule < best.rule)) {
+				best = result;
+			}
+		}
+		return best;
+	}
+
+	void DecisionDiagram::GetTies(const Context& a_context, Match a_match, std::vector<std::uint32_t>& a_groups) const
+	{
+		if (!groupTies || a_match.score == 0) {
+			return;
+		}
+		for (const auto root : roots) {
+			const auto& result = Walk(root, a_context);
+			if (result.rule >= 0 && result.high == a_match.high && result.score == a_match.score) {
+				a_groups.push_back(result.ties);
+			}
+		}
+	}
+
+	void DecisionDiagram::Clear()
+	{
+		nodes.clear();
+		cases.clear();
+		roots.clear();
+		depth = 0;
+		groupTies = false;
+		tieGroups.Clear();
+	}
+}
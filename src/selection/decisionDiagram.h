@@ -0,0 +1,110 @@
+#pragma once
+
+#include "selection/ruleShape.h"
+#include "selection/tieGroups.h"
+
+#include <unordered_map>
+
+namespace Selection
+{
+	/*
+	* Rule set compiled into shared decision diagrams.
+	* 
+	* Single valued predicates (worldspace, cell, combat target) become switch nodes, set valued ones
+	* (location chain, keywords) become one test per form. Identical partial states are shared, so the
+	* cost of a selection is bounded by the depth of the diagram instead of the number of rules.
+	* Leaves hold the rule the legacy MatchDegree loop would pick, with its priority and score.
+	* 
+	* Rule sets that would exceed the node budget are split into consecutive parts with a diagram each,
+	* and the part results are merged with the same first-wins ordering.
+	* 
+	* Built with grouped ties, leaves also name every rule of their part that matches as well as the winner.
+	* Rules that could only tie are then kept around longer, so the diagram grows.
+	*/
+	class DecisionDiagram
+	{
+	public:
+		static constexpr std::size_t DEFAULT_MAX_NODES{ 1 << 20 };
+		static constexpr std::size_t MAX_PART_NODES{ 1 << 14 };
+
+		struct Result {
+			// Position of the winning rule, or -1 if no rule matched.
+			std::int32_t rule{ -1 };
+			bool high{ false };
+			int score{ 0 };
+			// Tie group of the rule and the later rules of its part that match equally. Only set with grouped ties.
+			std::uint32_t ties{ 0 };
+		};
+
+		// Chain and chain keywords of a location, as they would appear in a context.
+		struct LocationInfo {
+			std::vector<FormID> chain;
+			std::vector<FormID> keywords;
+		};
+
+		/*
+		* Optional table of every location whose chain or keywords matter to the rules. When given, the
+		* location and location keyword conditions are decided by a single switch on the current
+		* location, and contexts must be consistent with the table.
+		*/
+		using LocationTable = std::unordered_map<FormID, LocationInfo>;
+
+		// Returns false if the diagrams would exceed a_maxNodes. The diagram is left empty in that case.
+		bool Build(const std::vector<RuleShape>& a_rules,
+			const LocationTable* a_locations = nullptr,
+			std::size_t a_maxNodes = DEFAULT_MAX_NODES,
+			bool a_groupTies = false);
+		Result Evaluate(const Context& a_context) const;
+		// Appends the tie group of every part whose answer is a_match, in part order. Together they hold every
+		// rule that matches as well. Appends nothing unless built with grouped ties.
+		void GetTies(const Context& a_context, Match a_match, std::vector<std::uint32_t>& a_groups) const;
+		const TieGroups& GetTieGroups() const { return tieGroups; }
+		void Clear();
+
+		bool IsBuilt() const { return !roots.empty(); }
+		bool HasTieGroups() const { return groupTies; }
+		std::size_t GetNodeCount() const { return nodes.size(); }
+		std::size_t GetPartCount() const { return roots.size(); }
+		// Longest path, summed over all parts.
+		std::size_t GetDepth() const { return depth; }
+
+	private:
+		enum class NodeKind : std::uint8_t {
+			kLeaf,
+			kSwitch,
+			kTest
+		};
+
+		struct Case {
+			FormID value;
+			std::uint32_t child;
+		};
+
+		struct Node {
+			NodeKind kind{ NodeKind::kLeaf };
+			ConditionType type{ ConditionType::kWorldspace };
+			// Tested form for test nodes.
+			FormID form{ 0 };
+			// Child if the test passes. Unused by switches.
+			std::uint32_t pass{ 0 };
+			// Child if the test fails, or the switch value has no case.
+			std::uint32_t fail{ 0 };
+			// Switch cases, sorted by value.
+			std::uint32_t firstCase{ 0 };
+			std::uint32_t caseCount{ 0 };
+			Result result{};
+		};
+
+		bool BuildPart(const std::vector<RuleShape>& a_rules, std::uint32_t a_begin, std::uint32_t a_end, const LocationTable* a_locations, std::size_t a_maxNodes);
+		void ComputeDepth();
+		// Leaf a part's root leads to for the context.
+		const Result& Walk(std::uint32_t a_root, const Context& a_context) const;
+
+		std::vector<Node> nodes{};
+		std::vector<Case> cases{};
+		std::vector<std::uint32_t> roots{};
+		std::size_t depth{ 0 };
+		bool groupTies{ false };
+		TieGroups tieGroups{};
+	};
+}
@@ -0,0 +1,77 @@
+#include "selection/dependencyCache.h"
+
+namespace Selection
+{
+	InputMask GetChangedInputs(const Context& a_before, const Context& a_after)
+	{
+		InputMask response = 0;
+		if (a_before.worldspace != a_after.worldspace ||
+			a_before.cell != a_after.cell ||
+			a_before.locations != a_after.locations ||
+			a_before.locationKeywords != a_after.locationKeywords) {
+			response |= INPUT_LOCATION;
+		}
+		if (a_before.target != a_after.target ||
+			a_before.intensity != a_after.intensity ||
+			a_before.targetKeywords != a_after.targetKeywords ||
+			a_before.combatants != a_after.combatants ||
+			a_before.combatantKeywords != a_after.combatantKeywords) {
+			response |= INPUT_TARGET;
+		}
+		if (a_before.gameMinute != a_after.gameMinute) {
+			response |= INPUT_TIME;
+		}
+		if (a_before.customInputs != a_after.customInputs) {
+			response |= INPUT_CUSTOM;
+		}
+		return response;
+	}
+
+	void DependencyCache::Reset(std::size_t a_count)
+	{
+		stamps.assign(a_count, 0);
+		values.assign(a_count, 0);
+		started = false;
+	}
+
+	void DependencyCache::Begin(const Context& a_context)
+	{
+		// Nothing is known about the inputs before the first selection.
+		const auto changed = started ? GetChangedInputs(last, a_context) : ~InputMask{ 0 };
+		for (std::size_t i = 0; i < versions.size(); ++i) {
+			if (changed & (1u << i)) {
+				versions[i]++;
+			}
+		}
+		last = a_context;
+		started = true;
+	}
+
+	std::optional<bool> DependencyCache::Find(std::uint32_t a_id, InputMask a_inputs) const
+	{
+		if (a_id >= stamps.size() || stamps[a_id] != GetStamp(a_inputs) + 1) {
+			return std::nullopt;
+		}
+		return values[a_id] != 0;
+	}
+
+	void DependencyCache::Store(std::uint32_t a_id, InputMask a_inputs, bool a_value)
+	{
+		if (a_id >= stamps.size()) {
+			return;
+		}
+		stamps[a_id] = GetStamp(a_inputs) + 1;
+		values[a_id] = a_value ? 1 : 0;
+	}
+
+	std::uint64_t DependencyCache::GetStamp(InputMask a_inputs) const
+	{
+		std::uint64_t response = 0;
+		for (std::size_t i = 0; i < versions.size(); ++i) {
+			if (a_inputs & (1u << i)) {
+				response += versions[i];
+			}
+		}
+		return response;
+	}
+}
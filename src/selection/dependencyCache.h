@@ -0,0 +1,48 @@
+#pragma once
+
+#include "selection/context.h"
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace Selection
+{
+	// What a condition's result depends on, as bits. Same values as CombatMusicAPI::ConditionInput.
+	using InputMask = std::uint32_t;
+	inline constexpr InputMask INPUT_LOCATION{ 1u << 0 };
+	inline constexpr InputMask INPUT_TARGET{ 1u << 1 };
+	inline constexpr InputMask INPUT_TIME{ 1u << 2 };
+	inline constexpr InputMask INPUT_CUSTOM{ 1u << 3 };
+	inline constexpr std::size_t TOTAL_INPUTS{ 4 };
+
+	// Inputs that differ between the two contexts.
+	InputMask GetChangedInputs(const Context& a_before, const Context& a_after);
+
+	/*
+	* Results of conditions that declared their inputs, kept across selections until one of those inputs
+	* changes in the context the conditions are evaluated with. Every input has a version that grows when
+	* it changes, and a result stays valid while the sum of its inputs' versions is the one it was stored with.
+	*/
+	class DependencyCache
+	{
+	public:
+		// Forgets every result and sizes the cache for a_count interned conditions.
+		void Reset(std::size_t a_count);
+		// Call before each selection, with the context the conditions will see.
+		void Begin(const Context& a_context);
+		std::optional<bool> Find(std::uint32_t a_id, InputMask a_inputs) const;
+		void Store(std::uint32_t a_id, InputMask a_inputs, bool a_value);
+
+	private:
+		std::uint64_t GetStamp(InputMask a_inputs) const;
+
+		std::array<std::uint64_t, TOTAL_INPUTS> versions{};
+		// Stamp plus one of each stored result, 0 if there is none.
+		std::vector<std::uint64_t> stamps;
+		std::vector<std::uint8_t> values;
+		Context last{};
+		bool started{ false };
+	};
+}
@@ -0,0 +1,324 @@
+#include "selection/expression.h"
+
+#include "selection/ruleParser.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+namespace Selection
+{
+	namespace
+	{
+		bool Test(const Context& a_context, ConditionType a_type, const FormID* a_first, const FormID* a_last)
+		{
+			if (IsSingleValued(a_type)) {
+				const auto value = a_context.GetValue(a_type);
+				return value != 0 && std::binary_search(a_first, a_last, value);
+			}
+			for (const auto form : a_context.GetSet(a_type)) {
+				if (std::binary_search(a_first, a_last, form)) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Better priority first, then the higher score.
+		bool IsBetter(const Match& a_left, const Match& a_right)
+		{
+			return a_left.high != a_right.high ? a_left.high : a_left.score > a_right.score;
+		}
+
+		Match GetBound(const ExpressionDefinition& a_definition, std::uint32_t a_node)
+		{
+			const auto& node = a_definition.nodes[a_node];
+			switch (node.kind) {
+			case ExpressionNode::Kind::kTest:
+				return Match{ IsHighPriority(node.type), 1 };
+			case ExpressionNode::Kind::kNot:
+				return Match{};
+			default:
+				break;
+			}
+
+			// An "any" can be high through one child and reach its best score through another.
+			Match response{};
+			for (const auto child : node.children) {
+				const auto bound = GetBound(a_definition, child);
+				response.high |= bound.high;
+				response.score = node.kind == ExpressionNode::Kind::kAll ? response.score + bound.score : std::max(response.score, bound.score);
+			}
+			return response;
+		}
+
+		void Describe(const ExpressionDefinition& a_definition, std::uint32_t a_node, std::string& a_out)
+		{
+			const auto& node = a_definition.nodes[a_node];
+			switch (node.kind) {
+			case ExpressionNode::Kind::kTest:
+				a_out += GetConditionKey(node.type);
+				a_out += " [";
+				for (std::size_t i = 0; i < node.forms.size(); ++i) {
+					a_out += i > 0 ? ", " : "";
+					a_out += node.forms[i];
+				}
+				a_out += "]";
+				return;
+			case ExpressionNode::Kind::kNot:
+				a_out += "not ";
+				Describe(a_definition, node.children.front(), a_out);
+				return;
+			default:
+				break;
+			}
+
+			a_out += "(";
+			for (std::size_t i = 0; i < node.children.size(); ++i) {
+				if (i > 0) {
+					a_out += node.kind == ExpressionNode::Kind::kAll ? " and " : " or ";
+				}
+				Describe(a_definition, node.children[i], a_out);
+			}
+			a_out += ")";
+		}
+	}
+
+	bool ExpressionDefinition::IsValid() const
+	{
+		if (nodes.empty() || nodes.size() > MAX_EXPRESSION_NODES) {
+			return false;
+		}
+
+		// Children come after their parent, so depths are known by the time a node is reached.
+		std::vector<std::size_t> depths(nodes.size(), 0);
+		depths[0] = 1;
+		for (std::size_t i = 0; i < nodes.size(); ++i) {
+			const auto& node = nodes[i];
+			if (depths[i] == 0 || depths[i] > MAX_EXPRESSION_DEPTH) {
+				return false;
+			}
+			switch (node.kind) {
+			case ExpressionNode::Kind::kTest:
+				if (node.type >= ConditionType::kTotal || node.forms.empty() || !node.children.empty()) {
+					return false;
+				}
+				break;
+			case ExpressionNode::Kind::kNot:
+				if (node.children.size() != 1 || !node.forms.empty()) {
+					return false;
+				}
+				break;
+			case ExpressionNode::Kind::kAll:
+			case ExpressionNode::Kind::kAny:
+				if (node.children.empty() || !node.forms.empty()) {
+					return false;
+				}
+				break;
+			default:
+				return false;
+			}
+			for (const auto child : node.children) {
+				if (child <= i || child >= nodes.size() || depths[child] != 0) {
+					return false;
+				}
+				depths[child] = depths[i] + 1;
+			}
+		}
+		return true;
+	}
+
+	std::string ExpressionDefinition::Describe() const
+	{
+		std::string response{};
+		if (IsValid()) {
+			Selection::Describe(*this, 0, response);
+		}
+		return response;
+	}
+
+	bool Expression::Compile(const ExpressionDefinition& a_definition, const Resolver& a_resolve, std::string& a_error)
+	{
+		code.clear();
+		forms.clear();
+		types = 0;
+		bound = Match{};
+		if (!a_definition.IsValid()) {
+			a_error = "Expression is malformed.";
+			return false;
+		}
+		if (!Emit(a_definition, 0, a_resolve, a_error)) {
+			code.clear();
+			forms.clear();
+			types = 0;
+			return false;
+		}
+		code.push_back(Instruction{ Op::kReturn, ConditionType::kWorldspace, 0, 0 });
+		Thread();
+		bound = Selection::GetBound(a_definition, 0);
+		bound.score = std::max(bound.score, 1);
+		return true;
+	}
+
+	bool Expression::Emit(const ExpressionDefinition& a_definition, std::uint32_t a_node, const Resolver& a_resolve, std::string& a_error)
+	{
+		const auto& node = a_definition.nodes[a_node];
+		switch (node.kind) {
+		case ExpressionNode::Kind::kTest:
+			{
+				const auto first = forms.size();
+				for (const auto& reference : node.forms) {
+					const auto form = a_resolve(node.type, reference);
+					if (!form) {
+						a_error = "<" + reference + "> could not resolve form.";
+						return false;
+					}
+					forms.push_back(*form);
+				}
+				std::sort(forms.begin() + first, forms.end());
+				forms.erase(std::unique(forms.begin() + first, forms.end()), forms.end());
+				const auto count = forms.size() - first;
+				if (count > std::numeric_limits<std::uint16_t>::max()) {
+					a_error = "A test lists too many forms.";
+					return false;
+				}
+				code.push_back(Instruction{ Op::kTest, node.type, static_cast<std::uint16_t>(count), static_cast<std::uint32_t>(first) });
+				types |= 1u << static_cast<std::uint32_t>(node.type);
+				return true;
+			}
+		case ExpressionNode::Kind::kNot:
+			if (!Emit(a_definition, node.children.front(), a_resolve, a_error)) {
+				return false;
+			}
+			code.push_back(Instruction{ Op::kNot, ConditionType::kWorldspace, 0, 0 });
+			return true;
+		default:
+			break;
+		}
+
+		// Each child is folded into the ones before it. "all" leaves early once the fold is false, with the false
+		// value as the node's result. "any" has to see every child to know the best one.
+		const bool all = node.kind == ExpressionNode::Kind::kAll;
+		std::vector<std::size_t> exits{};
+		for (std::size_t i = 0; i < node.children.size(); ++i) {
+			if (i > 0 && all) {
+				exits.push_back(code.size());
+				code.push_back(Instruction{ Op::kJumpIfFalse, ConditionType::kWorldspace, 0, 0 });
+			}
+			if (!Emit(a_definition, node.children[i], a_resolve, a_error)) {
+				return false;
+			}
+			if (i > 0) {
+				code.push_back(Instruction{ all ? Op::kAll : Op::kAny, ConditionType::kWorldspace, 0, 0 });
+			}
+		}
+		for (const auto exit : exits) {
+			code[exit].operand = static_cast<std::uint32_t>(code.size());
+		}
+		return true;
+	}
+
+	void Expression::Thread()
+	{
+		// A jump landing on another jump keeps the same false value on top, so it takes that one too. Jumps only
+		// go forward, so this ends.
+		for (auto& instruction : code) {
+			if (instruction.op != Op::kJumpIfFalse) {
+				continue;
+			}
+			while (code[instruction.operand].op == Op::kJumpIfFalse) {
+				instruction.operand = code[instruction.operand].operand;
+			}
+		}
+	}
+
+	std::optional<Match> Expression::Evaluate(const Context& a_context) const
+	{
+		if (code.empty()) {
+			return std::nullopt;
+		}
+
+		struct Value {
+			bool truth;
+			Match match;
+		};
+
+		// A node holds one value while its next child runs, so a tree never needs more than its depth.
+		std::array<Value, MAX_EXPRESSION_DEPTH + 1> stack;
+		std::size_t top = 0;
+		const auto* instruction = code.data();
+		for (;;) {
+			switch (instruction->op) {
+			case Op::kTest:
+				{
+					const auto* first = forms.data() + instruction->operand;
+					const bool truth = Test(a_context, instruction->type, first, first + instruction->count);
+					stack[top++] = Value{ truth, truth ? Match{ IsHighPriority(instruction->type), 1 } : Match{} };
+					++instruction;
+					break;
+				}
+			case Op::kJumpIfFalse:
+				instruction = stack[top - 1].truth ? instruction + 1 : code.data() + instruction->operand;
+				break;
+			case Op::kAll:
+				{
+					auto& left = stack[top - 2];
+					const auto& right = stack[--top];
+					left.truth = left.truth && right.truth;
+					left.match.high |= right.match.high;
+					left.match.score += right.match.score;
+					++instruction;
+					break;
+				}
+			case Op::kAny:
+				{
+					auto& left = stack[top - 2];
+					const auto& right = stack[--top];
+					if (right.truth && (!left.truth || IsBetter(right.match, left.match))) {
+						left = right;
+					}
+					++instruction;
+					break;
+				}
+			case Op::kNot:
+				stack[top - 1] = Value{ !stack[top - 1].truth, Match{} };
+				++instruction;
+				break;
+			case Op::kReturn:
+			default:
+				if (!stack[0].truth) {
+					return std::nullopt;
+				}
+				return Match{ stack[0].match.high, std::max(stack[0].match.score, 1) };
+			}
+		}
+	}
+
+	std::vector<FormID> Expression::GetForms(ConditionType a_type) const
+	{
+		std::vector<FormID> response{};
+		for (const auto& instruction : code) {
+			if (instruction.op == Op::kTest && instruction.type == a_type) {
+				const auto first = forms.begin() + instruction.operand;
+				response.insert(response.end(), first, first + instruction.count);
+			}
+		}
+		Context::Normalize(response);
+		return response;
+	}
+
+	void Expression::Hash(Hasher& a_hasher) const
+	{
+		a_hasher.Add(code.size(), 4);
+		for (const auto& instruction : code) {
+			a_hasher.Add(static_cast<std::uint64_t>(instruction.op), 1);
+			a_hasher.Add(static_cast<std::uint64_t>(instruction.type), 1);
+			a_hasher.Add(instruction.count, 2);
+			a_hasher.Add(instruction.operand, 4);
+		}
+		a_hasher.Add(forms.size(), 4);
+		for (const auto form : forms) {
+			a_hasher.Add(form, 4);
+		}
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "selection/context.h"
+#include "selection/hash.h"
+#include "selection/ruleShape.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace Selection
+{
+	// Limits on a rule's expression, so a malformed file cannot make the compiler recurse or allocate without end.
+	inline constexpr std::size_t MAX_EXPRESSION_NODES{ 256 };
+	inline constexpr std::size_t MAX_EXPRESSION_DEPTH{ 16 };
+
+	// One node of an expression as written in the configuration.
+	struct ExpressionNode {
+		enum class Kind : std::uint8_t {
+			kAll,
+			kAny,
+			kNot,
+			kTest
+		};
+
+		Kind kind{ Kind::kTest };
+		// Tests only. True if any of the forms is present, like a condition of this type.
+		ConditionType type{ ConditionType::kWorldspace };
+		std::vector<std::string> forms{};
+		// Positions of the children in the definition's nodes. Always after the node itself.
+		std::vector<std::uint32_t> children{};
+
+		bool operator==(const ExpressionNode&) const = default;
+	};
+
+	// A nested AND/OR/NOT over the condition types. Forms are unresolved references.
+	struct ExpressionDefinition {
+		// The first node is the root. Every other node is the child of exactly one node.
+		std::vector<ExpressionNode> nodes{};
+
+		bool operator==(const ExpressionDefinition&) const = default;
+
+		// True if the nodes form a single tree within the limits, with every node well formed.
+		bool IsValid() const;
+		// Readable form, e.g. (worldspaces [DLC2SolstheimWorld] and not cells [...]), for logs and reports.
+		std::string Describe() const;
+	};
+
+	/*
+	* An expression compiled into bytecode for a small stack, where every node leaves its truth and its Match.
+	* A true test scores 1 and is high priority like a condition of its type, "all" adds up its children,
+	* "any" takes its best true child and "not" scores nothing, so an expression scores what the rules it
+	* folds together would. "all" jumps past its remaining children as soon as one fails, and jumps that land
+	* on another jump are threaded through it, so a failed subtree costs one jump.
+	*/
+	class Expression
+	{
+	public:
+		enum class Op : std::uint8_t {
+			// Pushes whether any of forms[operand, operand + count) is present for type.
+			kTest,
+			// Jumps to operand if the top is false, keeping it.
+			kJumpIfFalse,
+			// Replaces the top two with their "all": true if both are, with the scores added up.
+			kAll,
+			// Replaces the top two with their "any": the better true one, the first on a tie.
+			kAny,
+			// Flips the top's truth and drops its score.
+			kNot,
+			// Ends with the top as the result.
+			kReturn
+		};
+
+		struct Instruction {
+			Op op{ Op::kReturn };
+			ConditionType type{ ConditionType::kWorldspace };
+			std::uint16_t count{ 0 };
+			std::uint32_t operand{ 0 };
+		};
+
+		// Resolves a reference of the given type to a FormID, or returns empty if it does not resolve.
+		using Resolver = std::function<std::optional<FormID>(ConditionType, const std::string&)>;
+
+		// Returns false and describes the problem in a_error if a_definition is not valid or a form does not resolve.
+		bool Compile(const ExpressionDefinition& a_definition, const Resolver& a_resolve, std::string& a_error);
+		// The expression's Match if it is true. A true expression scores at least 1, even if it only says what
+		// must not be present.
+		std::optional<Match> Evaluate(const Context& a_context) const;
+		// The best Match Evaluate can return.
+		Match GetBound() const { return bound; }
+
+		const std::vector<Instruction>& GetCode() const { return code; }
+		// Sorted and unique forms of every test, in the order of the tests.
+		const std::vector<FormID>& GetForms() const { return forms; }
+		// Forms the expression tests for a_type, sorted and unique.
+		std::vector<FormID> GetForms(ConditionType a_type) const;
+		// Bit per ConditionType the expression tests.
+		std::uint32_t GetTypes() const { return types; }
+		void Hash(Hasher& a_hasher) const;
+
+	private:
+		bool Emit(const ExpressionDefinition& a_definition, std::uint32_t a_node, const Resolver& a_resolve, std::string& a_error);
+		void Thread();
+
+		std::vector<Instruction> code;
+		std::vector<FormID> forms;
+		std::uint32_t types{ 0 };
+		Match bound{};
+	};
+}
@@ -0,0 +1,210 @@
+#include "selection/formKernel.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#	define SELECTION_X86 1
+#	include <immintrin.h>
+#	ifdef _MSC_VER
+#		include <intrin.h>
+#	endif
+#else
+#	define SELECTION_X86 0
+#endif
+
+// MSVC compiles any intrinsic anywhere, GCC and Clang need the functions using AVX2 marked.
+#if SELECTION_X86 && (defined(__GNUC__) || defined(__clang__))
+#	define SELECTION_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#	define SELECTION_TARGET_AVX2
+#endif
+
+namespace Selection
+{
+	namespace
+	{
+		constexpr std::size_t BLOCK_SIZE = 8;
+
+		void SetOwner(std::uint64_t* a_mask, std::uint32_t a_owner)
+		{
+			a_mask[a_owner / 64] |= std::uint64_t{ 1 } << (a_owner % 64);
+		}
+
+		void MatchScalar(const FormID* a_ids, const std::uint32_t* a_owners, std::size_t a_count, FormID a_value, std::uint64_t* a_mask)
+		{
+			for (std::size_t i = 0; i < a_count; ++i) {
+				if (a_ids[i] == a_value) {
+					SetOwner(a_mask, a_owners[i]);
+				}
+			}
+		}
+
+#if SELECTION_X86
+		// SSE2 is part of x64, so this kernel needs no check.
+		void MatchSSE2(const FormID* a_ids, const std::uint32_t* a_owners, std::size_t a_count, FormID a_value, std::uint64_t* a_mask)
+		{
+			const auto value = _mm_set1_epi32(static_cast<int>(a_value));
+			for (std::size_t i = 0; i < a_count; i += 4) {
+				const auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a_ids + i));
+				auto hits = static_cast<std::uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(block, value))));
+				for (; hits != 0; hits &= hits - 1) {
+					SetOwner(a_mask, a_owners[i + static_cast<std::size_t>(std::countr_zero(hits))]);
+				}
+			}
+		}
+
+		SELECTION_TARGET_AVX2 void MatchAVX2(const FormID* a_ids, const std::uint32_t* a_owners, std::size_t a_count, FormID a_value, std::uint64_t* a_mask)
+		{
+			const auto value = _mm256_set1_epi32(static_cast<int>(a_value));
+			for (std::size_t i = 0; i < a_count; i += 8) {
+				const auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a_ids + i));
+				auto hits = static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(block, value))));
+				for (; hits != 0; hits &= hits - 1) {
+					SetOwner(a_mask, a_owners[i + static_cast<std::size_t>(std::countr_zero(hits))]);
+				}
+			}
+		}
+
+		// AVX2 also needs the OS to save the upper halves of the registers on a context switch.
+		bool DetectAVX2()
+		{
+#	ifdef _MSC_VER
+			std::array<int, 4> info{};
+			__cpuid(info.data(), 0);
+			if (info[0] < 7) {
+				return false;
+			}
+			__cpuid(info.data(), 1);
+			const bool osxsave = (info[2] & (1 << 27)) != 0;
+			const bool avx = (info[2] & (1 << 28)) != 0;
+			if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+				return false;
+			}
+			__cpuidex(info.data(), 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#	else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#	endif
+		}
+#endif
+
+		std::array<bool, TOTAL_FORM_KERNELS> DetectKernels()
+		{
+			std::array<bool, TOTAL_FORM_KERNELS> response{};
+			response[static_cast<std::size_t>(FormKernel::kScalar)] = true;
+#if SELECTION_X86
+			response[static_cast<std::size_t>(FormKernel::kSSE2)] = true;
+			response[static_cast<std::size_t>(FormKernel::kAVX2)] = DetectAVX2();
+#endif
+			return response;
+		}
+
+		const std::array<bool, TOTAL_FORM_KERNELS>& GetSupportedKernels()
+		{
+			static const auto supported = DetectKernels();
+			return supported;
+		}
+	}
+
+	std::string_view GetFormKernelName(FormKernel a_kernel)
+	{
+		switch (a_kernel) {
+		case FormKernel::kScalar:
+			return "scalar";
+		case FormKernel::kSSE2:
+			return "sse2";
+		case FormKernel::kAVX2:
+			return "avx2";
+		default:
+			return "";
+		}
+	}
+
+	bool IsFormKernelSupported(FormKernel a_kernel)
+	{
+		const auto index = static_cast<std::size_t>(a_kernel);
+		return index < TOTAL_FORM_KERNELS && GetSupportedKernels()[index];
+	}
+
+	FormKernel GetBestFormKernel()
+	{
+		static const auto best = []() {
+			auto response = FormKernel::kScalar;
+			for (std::size_t i = 0; i < TOTAL_FORM_KERNELS; ++i) {
+				if (GetSupportedKernels()[i]) {
+					response = static_cast<FormKernel>(i);
+				}
+			}
+			return response;
+		}();
+		return best;
+	}
+
+	void FormBlocks::Clear()
+	{
+		ids.clear();
+		owners.clear();
+		size = 0;
+		maskWords = 0;
+	}
+
+	void FormBlocks::Add(std::uint32_t a_owner, const std::vector<FormID>& a_forms)
+	{
+		ids.resize(size);
+		owners.resize(size);
+		for (const auto form : a_forms) {
+			if (form != 0) {
+				ids.push_back(form);
+				owners.push_back(a_owner);
+			}
+		}
+		size = ids.size();
+		maskWords = std::max<std::size_t>(maskWords, a_owner / 64 + 1);
+
+		// Padding never matches, since 0 is never looked up.
+		const auto padded = (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+		ids.resize(padded, 0);
+		owners.resize(padded, 0);
+	}
+
+	void FormBlocks::Match(FormID a_value, std::uint64_t* a_mask) const
+	{
+		Match(a_value, a_mask, GetBestFormKernel());
+	}
+
+	void FormBlocks::Match(FormID a_value, std::uint64_t* a_mask, FormKernel a_kernel) const
+	{
+		if (a_value == 0 || ids.empty()) {
+			return;
+		}
+		switch (a_kernel) {
+#if SELECTION_X86
+		case FormKernel::kAVX2:
+			if (IsFormKernelSupported(FormKernel::kAVX2)) {
+				MatchAVX2(ids.data(), owners.data(), ids.size(), a_value, a_mask);
+				return;
+			}
+			[[fallthrough]];
+		case FormKernel::kSSE2:
+			MatchSSE2(ids.data(), owners.data(), ids.size(), a_value, a_mask);
+			return;
+#endif
+		default:
+			MatchScalar(ids.data(), owners.data(), size, a_value, a_mask);
+			return;
+		}
+	}
+
+	std::size_t FormBlocks::GetMaskWords() const
+	{
+		return maskWords;
+	}
+
+	std::size_t FormBlocks::GetSize() const
+	{
+		return size;
+	}
+}
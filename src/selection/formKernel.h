@@ -0,0 +1,58 @@
+#pragma once
+
+#include "selection/context.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace Selection
+{
+	// Ways to scan a FormID array for one value. Wider kernels compare more FormIDs per instruction.
+	enum class FormKernel : std::uint32_t
+	{
+		kScalar,
+		kSSE2,
+		kAVX2,
+
+		kTotal
+	};
+
+	inline constexpr auto TOTAL_FORM_KERNELS = static_cast<std::size_t>(FormKernel::kTotal);
+
+	std::string_view GetFormKernelName(FormKernel a_kernel);
+	// Checked against the CPU and the OS once, at the first call.
+	bool IsFormKernelSupported(FormKernel a_kernel);
+	// The widest supported kernel.
+	FormKernel GetBestFormKernel();
+
+	/*
+	* The FormID lists of many conditions packed into one flat array, so a single scan over it tells which of
+	* them contain a value. Conditions on the same single value, e.g. every worldspace condition of every
+	* rule, are answered at once instead of rule by rule.
+	*/
+	class FormBlocks
+	{
+	public:
+		void Clear();
+		// a_owner is the bit set for this list in the masks, e.g. an interned condition number.
+		void Add(std::uint32_t a_owner, const std::vector<FormID>& a_forms);
+		// Sets bit a_owner of a_mask for every list that contains a_value, with the best kernel. a_mask must hold
+		// GetMaskWords() words and is not cleared first. A value of 0 is in no list.
+		void Match(FormID a_value, std::uint64_t* a_mask) const;
+		void Match(FormID a_value, std::uint64_t* a_mask, FormKernel a_kernel) const;
+
+		std::size_t GetMaskWords() const;
+		// FormIDs over all lists.
+		std::size_t GetSize() const;
+
+	private:
+		// Padded with 0 to a whole number of the widest kernel's blocks.
+		std::vector<FormID> ids{};
+		// Owner of each entry of ids.
+		std::vector<std::uint32_t> owners{};
+		std::size_t size{ 0 };
+		std::size_t maskWords{ 0 };
+	};
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace Selection
+{
+	// FNV-1a over little endian values. Only needs to be stable across sessions and platforms, not secure.
+	class Hasher
+	{
+	public:
+		void Add(std::uint64_t a_value, int a_bytes = 8)
+		{
+			for (int i = 0; i < a_bytes; ++i) {
+				hash ^= (a_value >> (i * 8)) & 0xFF;
+				hash *= 0x100000001B3ull;
+			}
+		}
+
+		void Add(std::string_view a_value)
+		{
+			Add(a_value.size(), 4);
+			for (const auto character : a_value) {
+				Add(static_cast<unsigned char>(character), 1);
+			}
+		}
+
+		std::uint64_t Get() const { return hash; }
+
+	private:
+		std::uint64_t hash{ 0xCBF29CE484222325ull };
+	};
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace Selection
+{
+	// How hard the current fight is. Stored in the context as a FormID like value, so 0 means no fight at all.
+	enum class IntensityTier : std::uint32_t
+	{
+		kNone,
+		kLow,
+		kMedium,
+		kHigh,
+		kExtreme,
+
+		kTotal
+	};
+
+	inline constexpr auto TOTAL_INTENSITY_TIERS = static_cast<std::size_t>(IntensityTier::kTotal);
+
+	// Threat is the summed level of every combatant, with bosses counted bossWeight times.
+	struct IntensitySettings {
+		// Least threat for medium, high and extreme. Anything below medium is low.
+		std::array<std::uint32_t, 3> thresholds{ 40, 100, 200 };
+		std::uint32_t bossWeight{ 3 };
+	};
+
+	constexpr IntensityTier GetIntensityTier(std::uint64_t a_threat, std::size_t a_combatants, const IntensitySettings& a_settings)
+	{
+		if (a_combatants == 0) {
+			return IntensityTier::kNone;
+		}
+		auto tier = IntensityTier::kLow;
+		for (std::size_t i = 0; i < a_settings.thresholds.size(); ++i) {
+			if (a_threat >= a_settings.thresholds[i]) {
+				tier = static_cast<IntensityTier>(static_cast<std::uint32_t>(IntensityTier::kMedium) + i);
+			}
+		}
+		return tier;
+	}
+
+	// JSON name of a tier in an intensity condition, e.g. "high".
+	constexpr std::string_view GetIntensityTierName(IntensityTier a_tier)
+	{
+		switch (a_tier) {
+		case IntensityTier::kLow:
+			return "low";
+		case IntensityTier::kMedium:
+			return "medium";
+		case IntensityTier::kHigh:
+			return "high";
+		case IntensityTier::kExtreme:
+			return "extreme";
+		default:
+			return "";
+		}
+	}
+
+	// kNone cannot be named, a rule asking for it would match outside of combat only.
+	constexpr std::optional<IntensityTier> FindIntensityTier(std::string_view a_name)
+	{
+		for (std::size_t i = 1; i < TOTAL_INTENSITY_TIERS; ++i) {
+			const auto tier = static_cast<IntensityTier>(i);
+			if (GetIntensityTierName(tier) == a_name) {
+				return tier;
+			}
+		}
+		return std::nullopt;
+	}
+}
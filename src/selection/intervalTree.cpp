@@ -0,0 +1,75 @@
+#include "selection/intervalTree.h"
+
+#include <algorithm>
+
+namespace Selection
+{
+	void IntervalTree::Clear()
+	{
+		nodes.clear();
+		byLow.clear();
+		byHigh.clear();
+		depth = 0;
+	}
+
+	void IntervalTree::Build(std::vector<Entry> a_entries)
+	{
+		Clear();
+		std::erase_if(a_entries, [](const Entry& a_entry) {
+			return std::isnan(a_entry.range.low) || std::isnan(a_entry.range.high) || a_entry.range.low > a_entry.range.high;
+		});
+		byLow.reserve(a_entries.size());
+		byHigh.reserve(a_entries.size());
+		Grow(a_entries, 1);
+	}
+
+	std::uint32_t IntervalTree::Grow(std::vector<Entry>& a_entries, std::size_t a_depth)
+	{
+		if (a_entries.empty()) {
+			return NONE;
+		}
+		depth = std::max(depth, a_depth);
+
+		// The median endpoint leaves at most half of the ranges entirely on either side, so the tree stays
+		// O(log n) deep. It is an endpoint of some range, which then holds it, so no node is empty.
+		std::vector<float> endpoints{};
+		endpoints.reserve(a_entries.size() * 2);
+		for (const auto& entry : a_entries) {
+			endpoints.push_back(entry.range.low);
+			endpoints.push_back(entry.range.high);
+		}
+		const auto middle = endpoints.begin() + static_cast<std::ptrdiff_t>(endpoints.size() / 2);
+		std::nth_element(endpoints.begin(), middle, endpoints.end());
+		const auto center = *middle;
+
+		std::vector<Entry> left{};
+		std::vector<Entry> right{};
+		std::vector<Entry> held{};
+		for (const auto& entry : a_entries) {
+			if (entry.range.high < center) {
+				left.push_back(entry);
+			}
+			else if (entry.range.low > center) {
+				right.push_back(entry);
+			}
+			else {
+				held.push_back(entry);
+			}
+		}
+		a_entries.clear();
+		a_entries.shrink_to_fit();
+
+		const auto position = static_cast<std::uint32_t>(nodes.size());
+		nodes.push_back(Node{ center, NONE, NONE, static_cast<std::uint32_t>(byLow.size()), static_cast<std::uint32_t>(held.size()) });
+		std::ranges::sort(held, {}, [](const Entry& a_entry) { return a_entry.range.low; });
+		byLow.insert(byLow.end(), held.begin(), held.end());
+		std::ranges::sort(held, std::ranges::greater{}, [](const Entry& a_entry) { return a_entry.range.high; });
+		byHigh.insert(byHigh.end(), held.begin(), held.end());
+
+		const auto leftChild = Grow(left, a_depth + 1);
+		const auto rightChild = Grow(right, a_depth + 1);
+		nodes[position].left = leftChild;
+		nodes[position].right = rightChild;
+		return position;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "selection/context.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace Selection
+{
+	/*
+	* Ranges of many conditions on the same quantity, indexed so that every range holding a value is found in
+	* O(log n + k) instead of testing each range. Every node keeps the ranges that hold its center, sorted by
+	* both ends: left of the center only ranges starting early enough can hold the value, right of it only
+	* ranges ending late enough, so each scan stops at the first range that does not.
+	*/
+	class IntervalTree
+	{
+	public:
+		struct Entry {
+			// low must not be above high. Ranges past midnight are added as their two pieces.
+			Range range{};
+			std::uint32_t owner{ 0 };
+		};
+
+		void Clear();
+		void Build(std::vector<Entry> a_entries);
+
+		// Calls a_visit(owner) once for every entry whose range holds a_value. NaN is in no range.
+		template <class F>
+		void Find(float a_value, F&& a_visit) const
+		{
+			if (std::isnan(a_value)) {
+				return;
+			}
+			auto position = nodes.empty() ? NONE : 0u;
+			while (position != NONE) {
+				const auto& node = nodes[position];
+				const auto first = static_cast<std::size_t>(node.first);
+				const auto last = first + node.count;
+				if (a_value < node.center) {
+					for (auto i = first; i < last && byLow[i].range.low <= a_value; ++i) {
+						a_visit(byLow[i].owner);
+					}
+					position = node.left;
+				}
+				else if (a_value > node.center) {
+					for (auto i = first; i < last && byHigh[i].range.high >= a_value; ++i) {
+						a_visit(byHigh[i].owner);
+					}
+					position = node.right;
+				}
+				else {
+					for (auto i = first; i < last; ++i) {
+						a_visit(byLow[i].owner);
+					}
+					return;
+				}
+			}
+		}
+
+		bool IsBuilt() const { return !nodes.empty(); }
+		std::size_t GetSize() const { return byLow.size(); }
+		std::size_t GetNodeCount() const { return nodes.size(); }
+		std::size_t GetDepth() const { return depth; }
+
+	private:
+		static constexpr std::uint32_t NONE{ std::numeric_limits<std::uint32_t>::max() };
+
+		struct Node {
+			float center{ 0.0f };
+			std::uint32_t left{ NONE };
+			std::uint32_t right{ NONE };
+			// The node's ranges are [first, first + count) of both byLow and byHigh.
+			std::uint32_t first{ 0 };
+			std::uint32_t count{ 0 };
+		};
+
+		std::uint32_t Grow(std::vector<Entry>& a_entries, std::size_t a_depth);
+
+		std::vector<Node> nodes{};
+		// Each node's ranges by ascending low, and by descending high.
+		std::vector<Entry> byLow{};
+		std::vector<Entry> byHigh{};
+		std::size_t depth{ 0 };
+	};
+}
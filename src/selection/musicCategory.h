@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace Selection
+{
+	// What a rule's music replaces. Each category stands for one DEFAULT_OBJECT the hooks intercept.
+	enum class MusicCategory : std::uint32_t
+	{
+		kCombat,
+		kDungeonCleared,
+
+		kTotal
+	};
+
+	inline constexpr auto TOTAL_MUSIC_CATEGORIES = static_cast<std::size_t>(MusicCategory::kTotal);
+
+	// JSON value of a category's "category" field, e.g. "dungeonCleared".
+	constexpr std::string_view GetCategoryKey(MusicCategory a_category)
+	{
+		switch (a_category) {
+		case MusicCategory::kCombat:
+			return "combat";
+		case MusicCategory::kDungeonCleared:
+			return "dungeonCleared";
+		default:
+			return "";
+		}
+	}
+
+	// Category name for the log, e.g. "dungeon cleared".
+	constexpr std::string_view GetCategoryName(MusicCategory a_category)
+	{
+		switch (a_category) {
+		case MusicCategory::kCombat:
+			return "combat";
+		case MusicCategory::kDungeonCleared:
+			return "dungeon cleared";
+		default:
+			return "";
+		}
+	}
+
+	constexpr std::optional<MusicCategory> FindCategory(std::string_view a_key)
+	{
+		for (std::size_t i = 0; i < TOTAL_MUSIC_CATEGORIES; ++i) {
+			const auto category = static_cast<MusicCategory>(i);
+			if (GetCategoryKey(category) == a_key) {
+				return category;
+			}
+		}
+		return std::nullopt;
+	}
+}
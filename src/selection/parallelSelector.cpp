@@ -0,0 +1,98 @@
+#include "selection/parallelSelector.h"
+
+namespace Selection
+{
+	WorkerPool::WorkerPool(std::size_t a_workers)
+	{
+		threads.reserve(a_workers);
+		for (std::size_t i = 0; i < a_workers; ++i) {
+			threads.emplace_back([this]() { WorkerLoop(); });
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard guard{ lock };
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	bool WorkerPool::TryRun(std::size_t a_tasks, TaskRef a_task)
+	{
+		std::unique_lock job{ jobLock, std::try_to_lock };
+		if (!job) {
+			return false;
+		}
+		if (a_tasks == 0) {
+			return true;
+		}
+
+		{
+			std::lock_guard guard{ lock };
+			task = std::addressof(a_task);
+			taskCount = a_tasks;
+			next.store(0, std::memory_order_relaxed);
+			completed = 0;
+			generation++;
+		}
+		wake.notify_all();
+		Drain(a_task, a_tasks);
+
+		// Workers that picked the job up are waited for too, so none still holds a_task once this returns.
+		std::unique_lock guard{ lock };
+		done.wait(guard, [&]() { return completed == taskCount && active == 0; });
+		task = nullptr;
+		return true;
+	}
+
+	void WorkerPool::WorkerLoop()
+	{
+		std::uint64_t seen = 0;
+		for (;;) {
+			const TaskRef* current = nullptr;
+			std::size_t count = 0;
+			{
+				std::unique_lock guard{ lock };
+				wake.wait(guard, [&]() { return stopping || generation != seen; });
+				if (stopping) {
+					return;
+				}
+				seen = generation;
+				if (!task) {
+					continue;
+				}
+				current = task;
+				count = taskCount;
+				active++;
+			}
+			Drain(*current, count);
+			{
+				std::lock_guard guard{ lock };
+				active--;
+			}
+			done.notify_all();
+		}
+	}
+
+	void WorkerPool::Drain(const TaskRef& a_task, std::size_t a_tasks)
+	{
+		std::size_t ran = 0;
+		for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < a_tasks; i = next.fetch_add(1, std::memory_order_relaxed)) {
+			a_task(i);
+			ran++;
+		}
+		if (ran == 0) {
+			return;
+		}
+		{
+			std::lock_guard guard{ lock };
+			completed += ran;
+		}
+		done.notify_all();
+	}
+}
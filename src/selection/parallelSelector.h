@@ -0,0 +1,138 @@
+#pragma once
+
+#include "selection/ruleShape.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Selection
+{
+	// Refers to a callable taking a task number without owning or copying it, so handing a capturing lambda to
+	// the pool never allocates. The callable must outlive the reference.
+	class TaskRef
+	{
+	public:
+		template <class F>
+			requires(!std::is_same_v<std::remove_cvref_t<F>, TaskRef>)
+		TaskRef(const F& a_task) :
+			object(std::addressof(a_task)),
+			call([](const void* a_object, std::size_t a_index) { (*static_cast<const F*>(a_object))(a_index); })
+		{}
+
+		void operator()(std::size_t a_index) const { call(object, a_index); }
+
+	private:
+		const void* object;
+		void (*call)(const void*, std::size_t);
+	};
+
+	/*
+	* Threads that stay alive between jobs, so splitting a selection does not pay for starting threads.
+	* The calling thread works on its own job too. One job runs at a time.
+	*/
+	class WorkerPool
+	{
+	public:
+		// a_workers threads besides the callers.
+		explicit WorkerPool(std::size_t a_workers);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		// Workers plus the calling thread.
+		std::size_t GetThreadCount() const { return threads.size() + 1; }
+
+		// Calls a_task(i) once for every i below a_tasks, spread over the workers and the calling thread, and
+		// returns once all calls are done. Returns false without calling anything if another job is running.
+		bool TryRun(std::size_t a_tasks, TaskRef a_task);
+
+	private:
+		void WorkerLoop();
+		// Claims and runs tasks until none are left, then reports how many it ran.
+		void Drain(const TaskRef& a_task, std::size_t a_tasks);
+
+		std::vector<std::thread> threads;
+		std::mutex jobLock;
+		std::mutex lock;
+		std::condition_variable wake;
+		std::condition_variable done;
+		const TaskRef* task{ nullptr };
+		std::size_t taskCount{ 0 };
+		std::atomic<std::size_t> next{ 0 };
+		// Guarded by lock. Tasks finished, and workers still holding the current task.
+		std::size_t completed{ 0 };
+		std::size_t active{ 0 };
+		std::uint64_t generation{ 0 };
+		bool stopping{ false };
+	};
+
+	// Each chunk's best on its own cache line, so threads finishing chunks never share a line.
+	struct alignas(64) ChunkBest {
+		std::int32_t rule{ -1 };
+		Match match{};
+	};
+
+	// Chunks cover a multiple of this many rules.
+	inline constexpr std::size_t PARALLEL_CHUNK_RULES{ 64 };
+
+	/*
+	* Same result as the MatchDegree loop, scoring consecutive chunks of rules on a_pool. Every chunk
+	* keeps its first best rule, and the chunks are merged in rule order, so the first rule with the
+	* best match wins exactly as in the loop. a_match(rule) returns the rule's Match and must be safe to
+	* call from several threads. Empty if a_pool was busy with another job.
+	*/
+	template <class F>
+	std::optional<std::int32_t> SelectParallel(WorkerPool& a_pool, std::size_t a_ruleCount, F&& a_match)
+	{
+		// A few chunks per thread, so a thread that finishes early takes over the rest.
+		const auto target = a_pool.GetThreadCount() * 4;
+		auto chunkRules = (a_ruleCount + target - 1) / target;
+		chunkRules = std::max(PARALLEL_CHUNK_RULES, (chunkRules + PARALLEL_CHUNK_RULES - 1) / PARALLEL_CHUNK_RULES * PARALLEL_CHUNK_RULES);
+		const auto chunks = (a_ruleCount + chunkRules - 1) / chunkRules;
+
+		// Reused per calling thread, so only the first call on a thread allocates. Workers get the caller's
+		// buffer through the capture, naming the thread_local there would give them their own.
+		thread_local std::vector<ChunkBest> buffer{};
+		buffer.assign(chunks, ChunkBest{});
+		auto& results = buffer;
+		const bool ran = a_pool.TryRun(chunks, [&](std::size_t a_chunk) {
+			ChunkBest best{};
+			const auto end = std::min(a_ruleCount, (a_chunk + 1) * chunkRules);
+			for (auto i = a_chunk * chunkRules; i < end; ++i) {
+				const Match candidate = a_match(static_cast<std::uint32_t>(i));
+				if (candidate.score == 0 || (best.match.high && !candidate.high)) {
+					continue;
+				}
+				if ((candidate.high && !best.match.high) || candidate.score > best.match.score) {
+					best.match = candidate;
+					best.rule = static_cast<std::int32_t>(i);
+				}
+			}
+			results[a_chunk] = best;
+		});
+		if (!ran) {
+			return std::nullopt;
+		}
+
+		// A later chunk only wins with a strictly better match, like a later rule in the loop.
+		ChunkBest best{};
+		for (const auto& result : results) {
+			if (result.rule < 0 || (best.match.high && !result.match.high)) {
+				continue;
+			}
+			if ((result.match.high && !best.match.high) || result.match.score > best.match.score) {
+				best = result;
+			}
+		}
+		return best.rule;
+	}
+}
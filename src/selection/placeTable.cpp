@@ -0,0 +1,167 @@
+#include "selection/placeTable.h"
+
+#include <algorithm>
+
+namespace Selection
+{
+	bool PlaceTable::IsPlaceOnly(const RuleShape& a_rule)
+	{
+		return !a_rule.empty() && std::ranges::all_of(a_rule, [](const ConditionShape& a_condition) {
+			return a_condition.type == ConditionType::kWorldspace ||
+				a_condition.type == ConditionType::kLocation ||
+				a_condition.type == ConditionType::kLocationKeyword;
+		});
+	}
+
+	bool PlaceTable::Build(const std::vector<RuleShape>& a_rules,
+		const DecisionDiagram::LocationTable& a_locations,
+		std::size_t a_maxEntries,
+		bool a_groupTies)
+	{
+		Clear();
+		tabled.assign(a_rules.size(), false);
+		std::vector<std::uint32_t> placeRules{};
+		std::vector<FormID> worldspaces{};
+		std::vector<FormID> locationForms{};
+		std::vector<FormID> keywordForms{};
+		for (std::uint32_t i = 0; i < static_cast<std::uint32_t>(a_rules.size()); ++i) {
+			if (!IsPlaceOnly(a_rules[i])) {
+				continue;
+			}
+			tabled[i] = true;
+			placeRules.push_back(i);
+			for (const auto& condition : a_rules[i]) {
+				auto& forms = condition.type == ConditionType::kWorldspace ? worldspaces :
+					condition.type == ConditionType::kLocation             ? locationForms :
+																			 keywordForms;
+				forms.insert(forms.end(), condition.forms.begin(), condition.forms.end());
+			}
+		}
+		Context::Normalize(worldspaces);
+		Context::Normalize(locationForms);
+		Context::Normalize(keywordForms);
+
+		// Locations that touch no place only condition answer like no location at all, so they share column 0.
+		const auto touches = [](const std::vector<FormID>& a_values, const std::vector<FormID>& a_forms) {
+			return std::ranges::any_of(a_values, [&](FormID a_value) { return std::ranges::binary_search(a_forms, a_value); });
+		};
+		std::vector<const std::pair<const FormID, DecisionDiagram::LocationInfo>*> locations{};
+		for (const auto& entry : a_locations) {
+			if (touches(entry.second.chain, locationForms) || touches(entry.second.keywords, keywordForms)) {
+				locations.push_back(std::addressof(entry));
+			}
+		}
+		std::ranges::sort(locations, {}, [](const auto* a_entry) { return a_entry->first; });
+
+		const auto rowCount = worldspaces.size() + 1;
+		const auto columnCount = locations.size() + 1;
+		if (placeRules.empty() || rowCount * columnCount > a_maxEntries) {
+			tabled.clear();
+			return false;
+		}
+
+		// Rules without a worldspace condition answer the same in every row, so they are matched once per column.
+		// Rules are offered in order, so the first one with the best match stays the answer and ties follow it.
+		std::vector<Answer> built(rowCount * columnCount);
+		std::vector<std::vector<std::uint32_t>> ties(a_groupTies ? built.size() : 0);
+		Context context{};
+		const auto offer = [&](std::size_t a_cell, std::uint32_t a_rule, Match a_match) {
+			auto& answer = built[a_cell];
+			if (a_match.score == 0 || (answer.match.high && !a_match.high)) {
+				return;
+			}
+			if ((a_match.high && !answer.match.high) || a_match.score > answer.match.score) {
+				answer = Answer{ static_cast<std::int32_t>(a_rule), a_match };
+				if (a_groupTies) {
+					ties[a_cell].assign(1, a_rule);
+				}
+			}
+			else if (a_groupTies && a_match.high == answer.match.high && a_match.score == answer.match.score) {
+				ties[a_cell].push_back(a_rule);
+			}
+		};
+		for (std::size_t column = 0; column < columnCount; ++column) {
+			context.Clear();
+			if (column > 0) {
+				context.locations = locations[column - 1]->second.chain;
+				context.locationKeywords = locations[column - 1]->second.keywords;
+			}
+			for (const auto rule : placeRules) {
+				const auto& shape = a_rules[rule];
+				const bool perRow = std::ranges::any_of(shape, [](const ConditionShape& a_condition) {
+					return a_condition.type == ConditionType::kWorldspace;
+				});
+				if (!perRow) {
+					context.worldspace = 0;
+					const auto match = MatchRule(shape, context);
+					for (std::size_t row = 0; row < rowCount; ++row) {
+						offer(row * columnCount + column, rule, match);
+					}
+					continue;
+				}
+				for (std::size_t row = 0; row < rowCount; ++row) {
+					context.worldspace = row > 0 ? worldspaces[row - 1] : 0;
+					offer(row * columnCount + column, rule, MatchRule(shape, context));
+				}
+			}
+		}
+
+		for (std::size_t row = 1; row < rowCount; ++row) {
+			rows.emplace(worldspaces[row - 1], static_cast<std::uint32_t>(row));
+		}
+		for (std::size_t column = 1; column < columnCount; ++column) {
+			columns.emplace(locations[column - 1]->first, static_cast<std::uint32_t>(column));
+		}
+		for (std::size_t cell = 0; cell < ties.size(); ++cell) {
+			if (built[cell].rule >= 0) {
+				built[cell].ties = tieGroups.Intern(ties[cell]);
+			}
+		}
+		answers = std::move(built);
+		ruleCount = placeRules.size();
+		groupTies = a_groupTies;
+		return true;
+	}
+
+	const PlaceTable::Answer& PlaceTable::Lookup(const Context& a_context) const
+	{
+		const auto find = [](const std::unordered_map<FormID, std::uint32_t>& a_index, FormID a_value) -> std::size_t {
+			const auto it = a_index.find(a_value);
+			return it != a_index.end() ? it->second : 0;
+		};
+		return answers[find(rows, a_context.worldspace) * GetColumnCount() + find(columns, a_context.GetCurrentLocation())];
+	}
+
+	std::vector<RuleBound> PlaceTable::GetRemainingBounds(const std::vector<RuleBound>& a_bounds) const
+	{
+		std::vector<RuleBound> response{};
+		for (const auto& bound : a_bounds) {
+			if (bound.rule >= tabled.size() || !tabled[bound.rule]) {
+				response.push_back(bound);
+			}
+		}
+		return response;
+	}
+
+	void PlaceTable::Clear()
+	{
+		rows.clear();
+		columns.clear();
+		answers.clear();
+		answers.shrink_to_fit();
+		tabled.clear();
+		ruleCount = 0;
+		groupTies = false;
+		tieGroups.Clear();
+	}
+
+	std::size_t PlaceTable::GetMemoryUsage() const
+	{
+		// Each index entry is a node with the pair and a next pointer, plus its bucket.
+		constexpr auto node = sizeof(std::pair<const FormID, std::uint32_t>) + 2 * sizeof(void*);
+		const auto index = [&](const std::unordered_map<FormID, std::uint32_t>& a_index) {
+			return a_index.size() * node + a_index.bucket_count() * sizeof(void*);
+		};
+		return answers.capacity() * sizeof(Answer) + index(rows) + index(columns) + tabled.capacity() / 8 + tieGroups.GetMemoryUsage();
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "selection/boundedSelector.h"
+#include "selection/decisionDiagram.h"
+#include "selection/tieGroups.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Selection
+{
+	/*
+	* Answer of the place only rules, materialized for every worldspace and location they can tell apart.
+	*
+	* A place only rule tests nothing but the worldspace, the location chain and its keywords, all of which
+	* follow from the worldspace and the current location. Every worldspace such a rule names gets a row,
+	* every location whose chain or keywords touch such a rule gets a column, and one extra row and column
+	* stand for everything else. The cell holds the rule the MatchDegree loop would pick among the place
+	* only rules, so only the remaining rules need scoring at selection time. With grouped ties, it also
+	* names every place only rule that matches as well.
+	*/
+	class PlaceTable
+	{
+	public:
+		static constexpr std::size_t DEFAULT_MAX_ENTRIES{ 1 << 18 };
+
+		struct Answer {
+			// Position of the winning place only rule, or -1 if none match.
+			std::int32_t rule{ -1 };
+			Match match{};
+			// Tie group of the rule and the later place only rules that match equally. Only set with grouped ties.
+			std::uint32_t ties{ 0 };
+		};
+
+		static bool IsPlaceOnly(const RuleShape& a_rule);
+
+		// Contexts must be consistent with a_locations. Returns false and stays empty if no rule is place
+		// only, or if the table would exceed a_maxEntries.
+		bool Build(const std::vector<RuleShape>& a_rules,
+			const DecisionDiagram::LocationTable& a_locations,
+			std::size_t a_maxEntries = DEFAULT_MAX_ENTRIES,
+			bool a_groupTies = false);
+		const Answer& Lookup(const Context& a_context) const;
+		// a_bounds without the tabled rules, in the same order.
+		std::vector<RuleBound> GetRemainingBounds(const std::vector<RuleBound>& a_bounds) const;
+		void Clear();
+
+		bool IsBuilt() const { return !answers.empty(); }
+		bool HasTieGroups() const { return groupTies; }
+		const TieGroups& GetTieGroups() const { return tieGroups; }
+		std::size_t GetRuleCount() const { return ruleCount; }
+		std::size_t GetRowCount() const { return rows.size() + 1; }
+		std::size_t GetColumnCount() const { return columns.size() + 1; }
+		// Bytes held by the answers and both indexes, estimated for the indexes.
+		std::size_t GetMemoryUsage() const;
+
+	private:
+		// Worldspace and location to their row and column. 0 is everything else.
+		std::unordered_map<FormID, std::uint32_t> rows;
+		std::unordered_map<FormID, std::uint32_t> columns;
+		// Row major, GetColumnCount() answers per row.
+		std::vector<Answer> answers;
+		std::vector<bool> tabled;
+		std::size_t ruleCount{ 0 };
+		bool groupTies{ false };
+		TieGroups tieGroups;
+	};
+}
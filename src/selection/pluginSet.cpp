@@ -0,0 +1,77 @@
+#include "selection/pluginSet.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace Selection
+{
+	namespace
+	{
+		// Plugin names are ASCII, so folding them does not need the locale.
+		constexpr char Fold(char a_character)
+		{
+			return a_character >= 'A' && a_character <= 'Z' ? static_cast<char>(a_character - 'A' + 'a') : a_character;
+		}
+	}
+
+	std::size_t PluginSet::FoldedHash::operator()(std::string_view a_value) const
+	{
+		std::uint64_t hash = 0xCBF29CE484222325;
+		for (const auto character : a_value) {
+			hash = (hash ^ static_cast<unsigned char>(Fold(character))) * 0x100000001B3;
+		}
+		return static_cast<std::size_t>(hash);
+	}
+
+	bool PluginSet::FoldedEqual::operator()(std::string_view a_left, std::string_view a_right) const
+	{
+		return std::ranges::equal(a_left, a_right, [](char a_first, char a_second) { return Fold(a_first) == Fold(a_second); });
+	}
+
+	void PluginSet::Add(std::string_view a_plugin)
+	{
+		if (!a_plugin.empty()) {
+			plugins.emplace(a_plugin);
+		}
+	}
+
+	bool PluginSet::Contains(std::string_view a_plugin) const
+	{
+		return plugins.find(a_plugin) != plugins.end();
+	}
+
+	std::string_view PluginSet::FindMissing(const RuleDefinition& a_rule) const
+	{
+		const auto missing = [this](std::string_view a_reference) -> std::string_view {
+			std::string_view plugin{};
+			FormID formID = 0;
+			if (SplitFormReference(a_reference, plugin, formID) && !Contains(plugin)) {
+				return plugin;
+			}
+			return {};
+		};
+
+		for (const auto& music : a_rule.newMusic) {
+			if (const auto plugin = missing(music.form); !plugin.empty()) {
+				return plugin;
+			}
+		}
+		for (const auto& condition : a_rule.conditions) {
+			for (const auto& form : condition.forms) {
+				if (const auto plugin = missing(form); !plugin.empty()) {
+					return plugin;
+				}
+			}
+		}
+		if (a_rule.expression) {
+			for (const auto& node : a_rule.expression->nodes) {
+				for (const auto& form : node.forms) {
+					if (const auto plugin = missing(form); !plugin.empty()) {
+						return plugin;
+					}
+				}
+			}
+		}
+		return {};
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "selection/ruleParser.h"
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace Selection
+{
+	/*
+	* Names of the active plugins, compared without case like the game compares them. Lets rules that
+	* reference a missing plugin be dropped from their "Plugin|0xID" references alone, before any of
+	* their forms are looked up.
+	*/
+	class PluginSet
+	{
+	public:
+		void Add(std::string_view a_plugin);
+		bool Contains(std::string_view a_plugin) const;
+		std::size_t GetSize() const { return plugins.size(); }
+
+		// Plugin of the first reference in the rule's music, conditions or expression that is not in the set, or empty
+		// if every referenced plugin is. EditorIDs name no plugin and are never missing here.
+		std::string_view FindMissing(const RuleDefinition& a_rule) const;
+
+	private:
+		struct FoldedHash {
+			using is_transparent = void;
+			std::size_t operator()(std::string_view a_value) const;
+		};
+
+		struct FoldedEqual {
+			using is_transparent = void;
+			bool operator()(std::string_view a_left, std::string_view a_right) const;
+		};
+
+		std::unordered_set<std::string, FoldedHash, FoldedEqual> plugins;
+	};
+}
@@ -0,0 +1,172 @@
+#include "selection/ruleJit.h"
+
+#if (defined(_M_X64) || defined(__x86_64__)) && __has_include(<xbyak/xbyak.h>)
+#	define SELECTION_JIT 1
+#	include <xbyak/xbyak.h>
+#	include <xbyak/xbyak_util.h>
+#else
+#	define SELECTION_JIT 0
+#endif
+
+namespace Selection
+{
+#if SELECTION_JIT
+	namespace
+	{
+		// Generous upper bounds of the bytes each part of the program becomes.
+		constexpr std::size_t TEST_BYTES = 24;
+		constexpr std::size_t CONDITION_BYTES = 40;
+		constexpr std::size_t RULE_BYTES = 96;
+		constexpr std::size_t FRAME_BYTES = 256;
+	}
+
+	/*
+	* Scores the rules in order like RuleProgram::Run. The best match so far lives in registers, and each
+	* rule jumps to the next one as soon as an AND condition fails.
+	*/
+	struct RuleJit::Generator : Xbyak::CodeGenerator
+	{
+		Generator(const RuleProgram& a_program, std::size_t a_size) :
+			Xbyak::CodeGenerator(a_size)
+		{
+			using namespace Xbyak;
+			const auto& tests = a_program.GetTests();
+			const auto& conditions = a_program.GetConditions();
+			const auto& rules = a_program.GetRules();
+			{
+				// Saves whatever callee saved registers the temporaries need, and returns on leaving the scope.
+				util::StackFrame frame{ this, 2, 6 };
+				const auto& values = frame.p[0];
+				const auto& atoms = frame.p[1];
+				const auto winner = frame.t[0].cvt32();
+				const auto bestHigh = frame.t[1].cvt32();
+				const auto bestScore = frame.t[2].cvt32();
+				const auto score = frame.t[3].cvt32();
+				const auto high = frame.t[4].cvt32();
+				const auto matchedOR = frame.t[5].cvt32();
+
+				mov(winner, -1);
+				xor_(bestHigh, bestHigh);
+				xor_(bestScore, bestScore);
+				for (std::size_t i = 0; i < rules.size(); ++i) {
+					const auto& rule = rules[i];
+					if (rule.conditionCount == 0) {
+						continue;
+					}
+					Label next;
+					xor_(score, score);
+					xor_(high, high);
+					xor_(matchedOR, matchedOR);
+					for (auto c = rule.firstCondition; c < rule.firstCondition + rule.conditionCount; ++c) {
+						const auto& condition = conditions[c];
+						Label hit;
+						Label done;
+						for (auto t = condition.firstTest; t < condition.firstTest + condition.testCount; ++t) {
+							const auto& entry = tests[t];
+							if (entry.set) {
+								bt(qword[atoms + (entry.operand / 64) * 8], static_cast<std::uint8_t>(entry.operand % 64));
+								jc(hit, T_NEAR);
+							}
+							else {
+								cmp(dword[values + entry.operand * 4], entry.form);
+								je(hit, T_NEAR);
+							}
+						}
+						jmp(condition.AND ? next : done, T_NEAR);
+
+						L(hit);
+						if (condition.AND) {
+							inc(score);
+						}
+						else {
+							Label counted;
+							test(matchedOR, matchedOR);
+							jnz(counted);
+							mov(matchedOR, 1);
+							inc(score);
+							L(counted);
+						}
+						if (condition.high) {
+							mov(high, 1);
+						}
+						L(done);
+					}
+					if (rule.hasOR) {
+						test(matchedOR, matchedOR);
+						jz(next, T_NEAR);
+					}
+					// A high match beats any low one, otherwise only a strictly greater score wins.
+					Label take;
+					test(score, score);
+					jz(next, T_NEAR);
+					cmp(high, bestHigh);
+					jb(next, T_NEAR);
+					ja(take, T_NEAR);
+					cmp(score, bestScore);
+					jle(next, T_NEAR);
+					L(take);
+					mov(bestHigh, high);
+					mov(bestScore, score);
+					mov(winner, static_cast<std::uint32_t>(i));
+					L(next);
+				}
+				mov(eax, winner);
+			}
+			setProtectModeRE();
+		}
+	};
+#else
+	struct RuleJit::Generator
+	{};
+#endif
+
+	RuleJit::RuleJit() = default;
+	RuleJit::~RuleJit() = default;
+	RuleJit::RuleJit(RuleJit&&) noexcept = default;
+	RuleJit& RuleJit::operator=(RuleJit&&) noexcept = default;
+
+	bool RuleJit::IsSupported()
+	{
+		return SELECTION_JIT != 0;
+	}
+
+	bool RuleJit::Build(const RuleProgram& a_program, std::size_t a_maxBytes)
+	{
+		Clear();
+#if SELECTION_JIT
+		const auto size = a_program.GetTests().size() * TEST_BYTES +
+			a_program.GetConditions().size() * CONDITION_BYTES +
+			a_program.GetRules().size() * RULE_BYTES +
+			FRAME_BYTES;
+		if (!a_program.IsBuilt() || size > a_maxBytes) {
+			return false;
+		}
+		try {
+			generator = std::make_unique<Generator>(a_program, size);
+		}
+		catch (const std::exception&) {
+			generator.reset();
+			return false;
+		}
+		function = generator->getCode<Function>();
+		codeSize = generator->getSize();
+		return true;
+#else
+		(void)a_program;
+		(void)a_maxBytes;
+		return false;
+#endif
+	}
+
+	std::int32_t RuleJit::Run(const RuleProgram::Input& a_input) const
+	{
+		return function(a_input.values.data(), a_input.atoms.data());
+	}
+
+	void RuleJit::Clear()
+	{
+		function = nullptr;
+		codeSize = 0;
+		generator.reset();
+	}
+}
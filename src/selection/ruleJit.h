@@ -0,0 +1,42 @@
+#pragma once
+
+#include "selection/ruleProgram.h"
+
+#include <memory>
+
+namespace Selection
+{
+	/*
+	* A RuleProgram translated to x64 code: every test becomes a compare against an immediate or a bit
+	* test, followed by a jump, with no loop or table left at run time. Only available on x64 builds with
+	* xbyak, which the plugin always has.
+	*/
+	class RuleJit
+	{
+	public:
+		RuleJit();
+		~RuleJit();
+		RuleJit(RuleJit&&) noexcept;
+		RuleJit& operator=(RuleJit&&) noexcept;
+
+		static bool IsSupported();
+
+		// Returns false, leaving nothing built, if native code is not supported or the program would need more
+		// than a_maxBytes of it.
+		bool Build(const RuleProgram& a_program, std::size_t a_maxBytes = 64 << 20);
+		// Same result as RuleProgram::Run. Must be built.
+		std::int32_t Run(const RuleProgram::Input& a_input) const;
+		void Clear();
+
+		bool IsBuilt() const { return function != nullptr; }
+		std::size_t GetCodeSize() const { return codeSize; }
+
+	private:
+		using Function = std::int32_t (*)(const FormID* a_values, const std::uint64_t* a_atoms);
+		struct Generator;
+
+		std::unique_ptr<Generator> generator;
+		Function function{ nullptr };
+		std::size_t codeSize{ 0 };
+	};
+}
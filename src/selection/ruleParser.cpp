@@ -0,0 +1,448 @@
+#include "selection/ruleParser.h"
+
+#include "selection/intensity.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <fstream>
+#include <json/json.h>
+#include <limits>
+
+namespace Selection
+{
+	namespace
+	{
+		// newMusic is either a single form, or an array of forms and {"music", "weight"} objects.
+		bool ParseMusic(const Json::Value& a_value, std::vector<MusicDefinition>& a_pool, std::string& a_error)
+		{
+			if (a_value.isString()) {
+				a_pool.push_back(MusicDefinition{ a_value.asString(), 1.0f });
+				return true;
+			}
+			if (!a_value.isArray() || a_value.empty()) {
+				a_error = "Missing, or not a string or a non-empty array.";
+				return false;
+			}
+
+			for (const auto& entry : a_value) {
+				if (entry.isString()) {
+					a_pool.push_back(MusicDefinition{ entry.asString(), 1.0f });
+					continue;
+				}
+
+				const auto& music = entry.isObject() ? entry["music"] : Json::Value::nullSingleton();
+				const auto& weight = entry.isObject() ? entry["weight"] : Json::Value::nullSingleton();
+				if (!music || !music.isString() || (weight && !weight.isNumeric())) {
+					a_error = "Pool entries must be strings, or objects with a \"music\" string and an optional \"weight\" number.";
+					return false;
+				}
+				const auto value = weight ? weight.asFloat() : 1.0f;
+				if (!(value > 0.0f) || !std::isfinite(value)) {
+					a_error = "Weight of <" + music.asString() + "> must be positive.";
+					return false;
+				}
+				a_pool.push_back(MusicDefinition{ music.asString(), value });
+			}
+			return true;
+		}
+
+		// Parse order of the condition keys. Rules keep their conditions in type order regardless.
+		constexpr std::array PARSE_ORDER{
+			ConditionType::kWorldspace,
+			ConditionType::kCombatTarget,
+			ConditionType::kCombatTargetKeyword,
+			ConditionType::kCell,
+			ConditionType::kLocation,
+			ConditionType::kLocationKeyword,
+			ConditionType::kCombatant,
+			ConditionType::kCombatantKeyword,
+			ConditionType::kIntensity
+		};
+
+		std::optional<ConditionType> FindConditionType(std::string_view a_key)
+		{
+			for (const auto type : PARSE_ORDER) {
+				if (GetConditionKey(type) == a_key) {
+					return type;
+				}
+			}
+			return std::nullopt;
+		}
+
+		std::optional<Quantity> FindQuantity(std::string_view a_key)
+		{
+			for (std::size_t i = 0; i < TOTAL_QUANTITIES; ++i) {
+				if (GetQuantityKey(static_cast<Quantity>(i)) == a_key) {
+					return static_cast<Quantity>(i);
+				}
+			}
+			return std::nullopt;
+		}
+
+		// "min" and "max" are both optional and default to the ends of what the quantity can be.
+		bool ParseRange(const Json::Value& a_value, Quantity a_quantity, RangeDefinition& a_definition, std::string& a_error)
+		{
+			const auto& AND = a_value["AND"];
+			const auto& min = a_value["min"];
+			const auto& max = a_value["max"];
+			if (!a_value.isObject() || !AND.isBool() || (min && !min.isNumeric()) || (max && !max.isNumeric()) || (!min && !max)) {
+				a_error = "Condition needs \"AND\" and a \"min\" or \"max\" number.";
+				return false;
+			}
+
+			Range bounds{};
+			switch (a_quantity) {
+			case Quantity::kHealth:
+				bounds = Range{ 0.0f, 100.0f };
+				break;
+			case Quantity::kGameHour:
+				bounds = Range{ 0.0f, 24.0f };
+				break;
+			default:
+				bounds = Range{ 1.0f, std::numeric_limits<float>::infinity() };
+				break;
+			}
+			a_definition = RangeDefinition{ a_quantity, AND.asBool(), Range{ min ? min.asFloat() : bounds.low, max ? max.asFloat() : bounds.high } };
+			const auto& range = a_definition.range;
+			if (!bounds.Contains(range.low) || !bounds.Contains(range.high)) {
+				a_error = a_quantity == Quantity::kHealth   ? "Health is a percentage from 0 to 100." :
+				          a_quantity == Quantity::kGameHour ? "Hours run from 0 to 24." :
+				                                              "Levels start at 1.";
+				return false;
+			}
+			// Only hours come around again, so 22 to 4 means the night.
+			if (range.low > range.high && a_quantity != Quantity::kGameHour) {
+				a_error = "\"min\" is above \"max\".";
+				return false;
+			}
+			return true;
+		}
+
+		// Every node is an object with one key: "all" or "any" with an array of nodes, "not" with a node, or
+		// a condition key with an array of forms. Returns the node's position in a_definition.
+		std::optional<std::uint32_t> ParseExpression(const Json::Value& a_value, std::size_t a_depth, ExpressionDefinition& a_definition, std::string& a_error)
+		{
+			if (a_depth > MAX_EXPRESSION_DEPTH) {
+				a_error = "Nested deeper than " + std::to_string(MAX_EXPRESSION_DEPTH) + " levels.";
+				return std::nullopt;
+			}
+			if (a_definition.nodes.size() >= MAX_EXPRESSION_NODES) {
+				a_error = "Has more than " + std::to_string(MAX_EXPRESSION_NODES) + " nodes.";
+				return std::nullopt;
+			}
+			if (!a_value.isObject() || a_value.size() != 1) {
+				a_error = "Every node must be an object with exactly one key: \"all\", \"any\", \"not\" or a condition key.";
+				return std::nullopt;
+			}
+
+			const auto key = a_value.getMemberNames().front();
+			const auto& body = a_value[key];
+			const auto position = static_cast<std::uint32_t>(a_definition.nodes.size());
+			a_definition.nodes.emplace_back();
+			if (key == "all" || key == "any") {
+				if (!body.isArray() || body.empty()) {
+					a_error = "\"" + key + "\" needs a non-empty array of nodes.";
+					return std::nullopt;
+				}
+				a_definition.nodes[position].kind = key == "all" ? ExpressionNode::Kind::kAll : ExpressionNode::Kind::kAny;
+				for (const auto& entry : body) {
+					const auto child = ParseExpression(entry, a_depth + 1, a_definition, a_error);
+					if (!child) {
+						return std::nullopt;
+					}
+					a_definition.nodes[position].children.push_back(*child);
+				}
+				return position;
+			}
+			if (key == "not") {
+				a_definition.nodes[position].kind = ExpressionNode::Kind::kNot;
+				const auto child = ParseExpression(body, a_depth + 1, a_definition, a_error);
+				if (!child) {
+					return std::nullopt;
+				}
+				a_definition.nodes[position].children.push_back(*child);
+				return position;
+			}
+
+			const auto type = FindConditionType(key);
+			if (!type) {
+				a_error = "Unknown key <" + key + ">.";
+				return std::nullopt;
+			}
+			if (!body.isArray() || body.empty()) {
+				a_error = "\"" + key + "\" needs a non-empty array of forms.";
+				return std::nullopt;
+			}
+			auto& node = a_definition.nodes[position];
+			node.kind = ExpressionNode::Kind::kTest;
+			node.type = *type;
+			for (const auto& form : body) {
+				if (!form.isString()) {
+					a_error = "\"" + key + "\" contains a form that is not a string.";
+					return std::nullopt;
+				}
+				if (type == ConditionType::kIntensity && !FindIntensityTier(form.asString())) {
+					a_error = "Unknown tier <" + form.asString() + ">, expected low, medium, high or extreme.";
+					return std::nullopt;
+				}
+				node.forms.push_back(form.asString());
+			}
+			return position;
+		}
+	}
+
+	std::string ParseIssue::ToString() const
+	{
+		std::string response = "<" + file + ">";
+		if (rule) {
+			response += " rule #" + std::to_string(*rule);
+		}
+		if (!field.empty()) {
+			response += " -> " + field;
+		}
+		return response + ": " + message;
+	}
+
+	std::string_view GetConditionKey(ConditionType a_type)
+	{
+		switch (a_type) {
+		case ConditionType::kWorldspace:
+			return "worldspaces";
+		case ConditionType::kCell:
+			return "cells";
+		case ConditionType::kLocation:
+			return "locations";
+		case ConditionType::kLocationKeyword:
+			return "locationKeywords";
+		case ConditionType::kCombatTarget:
+			return "combatTarget";
+		case ConditionType::kCombatTargetKeyword:
+			return "combatTargetKeywords";
+		case ConditionType::kCombatant:
+			return "combatants";
+		case ConditionType::kCombatantKeyword:
+			return "combatantKeywords";
+		case ConditionType::kIntensity:
+			return "intensity";
+		default:
+			return "unknown";
+		}
+	}
+
+	std::string_view GetQuantityKey(Quantity a_quantity)
+	{
+		switch (a_quantity) {
+		case Quantity::kTargetLevel:
+			return "targetLevel";
+		case Quantity::kPlayerLevel:
+			return "playerLevel";
+		case Quantity::kHealth:
+			return "playerHealth";
+		case Quantity::kGameHour:
+			return "gameHour";
+		default:
+			return "unknown";
+		}
+	}
+
+	bool IsReservedKey(std::string_view a_key)
+	{
+		constexpr std::array FIELDS{ "newMusic", "category", "isCombatMusic", "expression", "all", "any", "not" };
+		return FindConditionType(a_key).has_value() || FindQuantity(a_key).has_value() || std::ranges::find(FIELDS, a_key) != FIELDS.end();
+	}
+
+	bool SplitFormReference(std::string_view a_reference, std::string_view& a_plugin, FormID& a_formID)
+	{
+		const auto separator = a_reference.find('|');
+		if (separator == std::string_view::npos || a_reference.find('|', separator + 1) != std::string_view::npos) {
+			return false;
+		}
+
+		const auto plugin = a_reference.substr(0, separator);
+		auto number = a_reference.substr(separator + 1);
+		if (plugin.empty() || number.size() <= 2 || number[0] != '0' || (number[1] != 'x' && number[1] != 'X')) {
+			return false;
+		}
+		number.remove_prefix(2);
+
+		FormID formID = 0;
+		const auto [end, error] = std::from_chars(number.data(), number.data() + number.size(), formID, 16);
+		if (error != std::errc{} || end != number.data() + number.size()) {
+			return false;
+		}
+
+		a_plugin = plugin;
+		a_formID = formID;
+		return true;
+	}
+
+	bool ParseRuleFile(const std::string& a_path, RuleFile& a_file, std::vector<ParseIssue>& a_issues)
+	{
+		a_file.path = a_path;
+		Json::Reader JSONReader;
+		Json::Value JSONFile;
+		try {
+			std::ifstream rawJSON(a_path);
+			if (!JSONReader.parse(rawJSON, JSONFile)) {
+				a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", JSONReader.getFormattedErrorMessages() });
+				return false;
+			}
+		}
+		catch (const Json::Exception& e) {
+			a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", std::string("Caught ") + e.what() + " while reading file." });
+			return false;
+		}
+		catch (const std::exception& e) {
+			a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", std::string("Caught unhandled exception ") + e.what() + " while reading file." });
+			return false;
+		}
+		return ParseRules(JSONFile, a_file, a_issues);
+	}
+
+	bool ParseRules(const Json::Value& a_root, RuleFile& a_file, std::vector<ParseIssue>& a_issues)
+	{
+		const auto& path = a_file.path;
+		if (!a_root.isObject()) {
+			a_issues.push_back(ParseIssue{ path, std::nullopt, "", "File is not an object and will be ignored." });
+			return false;
+		}
+
+		const auto& combatMusic = a_root["combatMusic"];
+		if (!combatMusic || !combatMusic.isArray()) {
+			a_issues.push_back(ParseIssue{ path, std::nullopt, "combatMusic", "Missing, or not an array." });
+			return false;
+		}
+
+		a_file.rules.reserve(a_file.rules.size() + combatMusic.size());
+		for (Json::ArrayIndex index = 0; index < combatMusic.size(); ++index) {
+			const auto& entry = combatMusic[index];
+			const auto issue = [&](std::string_view a_field, std::string a_message) {
+				a_issues.push_back(ParseIssue{ path, index, std::string(a_field), std::move(a_message) });
+			};
+			if (!entry.isObject()) {
+				issue("", "Entry is not an object and will be ignored.");
+				continue;
+			}
+
+			RuleDefinition rule{};
+			rule.index = index;
+			bool errorOccured = false;
+			for (const auto type : PARSE_ORDER) {
+				const auto key = GetConditionKey(type);
+				const auto& entryCondition = entry[std::string(key)];
+				if (!entryCondition) {
+					continue;
+				}
+				if (!entryCondition.isObject()) {
+					issue(key, "Condition is not an object.");
+					errorOccured = true;
+					break;
+				}
+
+				const auto& conditionArray = entryCondition["forms"];
+				const auto& conditionAND = entryCondition["AND"];
+				if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
+					issue(key, "Condition is missing \"forms\" or \"AND\", or has incorrect setup.");
+					errorOccured = true;
+					break;
+				}
+
+				ConditionDefinition condition{ type, conditionAND.asBool(), {} };
+				for (const auto& form : conditionArray) {
+					if (!form.isString()) {
+						issue(key, "Contains a form that is not a string.");
+						errorOccured = true;
+						continue;
+					}
+					// Intensity conditions name tiers instead of forms.
+					if (type == ConditionType::kIntensity && !FindIntensityTier(form.asString())) {
+						issue(key, "Unknown tier <" + form.asString() + ">, expected low, medium, high or extreme.");
+						errorOccured = true;
+						continue;
+					}
+					condition.forms.push_back(form.asString());
+				}
+				if (!condition.forms.empty()) {
+					rule.conditions.push_back(std::move(condition));
+				}
+			}
+			for (std::size_t i = 0; i < TOTAL_QUANTITIES && !errorOccured; ++i) {
+				const auto quantity = static_cast<Quantity>(i);
+				const auto key = GetQuantityKey(quantity);
+				const auto& entryRange = entry[std::string(key)];
+				if (!entryRange) {
+					continue;
+				}
+				RangeDefinition range{};
+				std::string rangeError{};
+				if (!ParseRange(entryRange, quantity, range, rangeError)) {
+					issue(key, std::move(rangeError));
+					errorOccured = true;
+					break;
+				}
+				rule.ranges.push_back(range);
+			}
+			if (errorOccured) {
+				continue;
+			}
+
+			// Objects with an AND under any other key are conditions of kinds other plugins may register.
+			Json::StreamWriterBuilder writer{};
+			writer["indentation"] = "";
+			for (const auto& key : entry.getMemberNames()) {
+				const auto& value = entry[key];
+				if (IsReservedKey(key) || !value.isObject() || !value["AND"].isBool()) {
+					continue;
+				}
+				rule.extensions.push_back(ExtensionDefinition{ key, value["AND"].asBool(), Json::writeString(writer, value) });
+			}
+
+			if (const auto& entryExpression = entry["expression"]) {
+				ExpressionDefinition expression{};
+				std::string expressionError{};
+				if (!ParseExpression(entryExpression, 1, expression, expressionError)) {
+					issue("expression", std::move(expressionError));
+					continue;
+				}
+				rule.expression = std::move(expression);
+			}
+
+			// isCombatMusic predates categories, and still picks between the first two.
+			const auto& entryCategory = entry["category"];
+			const auto& entryIsCombatMusic = entry["isCombatMusic"];
+			if (entryCategory && entryIsCombatMusic) {
+				issue("category", "Set either \"category\" or \"isCombatMusic\", not both.");
+				continue;
+			}
+			if (entryCategory) {
+				const auto category = entryCategory.isString() ? FindCategory(entryCategory.asString()) : std::nullopt;
+				if (!category) {
+					issue("category", "Not a known category.");
+					continue;
+				}
+				rule.category = *category;
+			}
+			else {
+				if (!entryIsCombatMusic || !entryIsCombatMusic.isBool()) {
+					issue("isCombatMusic", "Missing, or not a bool.");
+					continue;
+				}
+				rule.category = entryIsCombatMusic.asBool() ? MusicCategory::kCombat : MusicCategory::kDungeonCleared;
+			}
+
+			std::string musicError{};
+			if (!ParseMusic(entry["newMusic"], rule.newMusic, musicError)) {
+				issue("newMusic", std::move(musicError));
+				continue;
+			}
+
+			std::sort(rule.conditions.begin(), rule.conditions.end(), [](const auto& a_left, const auto& a_right) {
+				return a_left.type < a_right.type;
+			});
+			a_file.rules.push_back(std::move(rule));
+		}
+		return true;
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "selection/context.h"
+#include "selection/expression.h"
+#include "selection/musicCategory.h"
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Json
+{
+	class Value;
+}
+
+namespace Selection
+{
+	// A condition as written in the configuration. Forms are unresolved references.
+	struct ConditionDefinition {
+		ConditionType type;
+		bool AND;
+		std::vector<std::string> forms;
+	};
+
+	// A numeric condition as written in the configuration. Holds if the quantity is within the range.
+	struct RangeDefinition {
+		Quantity quantity;
+		bool AND;
+		Range range;
+	};
+
+	// A condition under a key that is not built in, kept as written for the plugin that registers the key.
+	struct ExtensionDefinition {
+		std::string key;
+		bool AND;
+		// The condition's object as compact JSON.
+		std::string json;
+	};
+
+	// One entry of a rule's music pool.
+	struct MusicDefinition {
+		std::string form;
+		// Positive. Chance of being picked is weight over the pool's total.
+		float weight{ 1.0f };
+	};
+
+	// A rule as written in the configuration. Conditions are ordered by type.
+	struct RuleDefinition {
+		// Position in the file's combatMusic array.
+		std::size_t index{ 0 };
+		MusicCategory category{ MusicCategory::kCombat };
+		// Never empty.
+		std::vector<MusicDefinition> newMusic{};
+		std::vector<ConditionDefinition> conditions{};
+		// Must also be true for the rule to match, and adds to the score like the conditions it tests.
+		std::optional<ExpressionDefinition> expression{};
+		// Ordered by quantity.
+		std::vector<RangeDefinition> ranges{};
+		// Ordered by key.
+		std::vector<ExtensionDefinition> extensions{};
+	};
+
+	struct RuleFile {
+		std::string path{};
+		std::vector<RuleDefinition> rules{};
+	};
+
+	// A problem found while reading rules. Rules with issues are left out of the result.
+	struct ParseIssue {
+		std::string file;
+		std::optional<std::size_t> rule;
+		std::string field;
+		std::string message;
+
+		std::string ToString() const;
+	};
+
+	// JSON key of a condition type, e.g. "worldspaces".
+	std::string_view GetConditionKey(ConditionType a_type);
+
+	// JSON key of a quantity, e.g. "targetLevel".
+	std::string_view GetQuantityKey(Quantity a_quantity);
+
+	// True for the keys of built-in conditions and rule fields, which other plugins cannot register.
+	bool IsReservedKey(std::string_view a_key);
+
+	// Splits a "Plugin.esp|0x123" reference. Returns false for anything else, which is treated as an EditorID.
+	bool SplitFormReference(std::string_view a_reference, std::string_view& a_plugin, FormID& a_formID);
+
+	// Reads and parses a JSON rule file. Returns false if the whole file had to be ignored.
+	bool ParseRuleFile(const std::string& a_path, RuleFile& a_file, std::vector<ParseIssue>& a_issues);
+	bool ParseRules(const Json::Value& a_root, RuleFile& a_file, std::vector<ParseIssue>& a_issues);
+}
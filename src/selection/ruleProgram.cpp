@@ -0,0 +1,150 @@
+#include "selection/ruleProgram.h"
+
+namespace Selection
+{
+	namespace
+	{
+		// Value slot of a single valued type.
+		constexpr std::uint32_t GetValueSlot(ConditionType a_type)
+		{
+			switch (a_type) {
+			case ConditionType::kWorldspace:
+				return 0;
+			case ConditionType::kCell:
+				return 1;
+			case ConditionType::kCombatTarget:
+				return 2;
+			case ConditionType::kIntensity:
+			default:
+				return 3;
+			}
+		}
+
+		constexpr ConditionType SLOT_TYPES[RuleProgram::VALUE_SLOTS]{
+			ConditionType::kWorldspace,
+			ConditionType::kCell,
+			ConditionType::kCombatTarget,
+			ConditionType::kIntensity
+		};
+
+		constexpr ConditionType SET_TYPES[]{
+			ConditionType::kLocation,
+			ConditionType::kLocationKeyword,
+			ConditionType::kCombatTargetKeyword,
+			ConditionType::kCombatant,
+			ConditionType::kCombatantKeyword
+		};
+	}
+
+	std::uint64_t RuleProgram::GetAtomKey(ConditionType a_type, FormID a_form)
+	{
+		return (static_cast<std::uint64_t>(a_type) << 32) | a_form;
+	}
+
+	void RuleProgram::Build(const std::vector<RuleShape>& a_rules)
+	{
+		Clear();
+		for (const auto& shape : a_rules) {
+			Rule rule{ static_cast<std::uint32_t>(conditions.size()), 0, false };
+			for (const auto& shapeCondition : shape) {
+				Condition condition{ static_cast<std::uint32_t>(tests.size()), 0, shapeCondition.AND, IsHighPriority(shapeCondition.type) };
+				for (const auto form : shapeCondition.forms) {
+					if (!IsSingleValued(shapeCondition.type)) {
+						const auto [it, inserted] = atoms.try_emplace(GetAtomKey(shapeCondition.type, form), static_cast<std::uint32_t>(atomCount));
+						atomCount += inserted ? 1 : 0;
+						tests.push_back(Test{ it->second, 0, true });
+					}
+					// A missing value is 0 and matches nothing, so a 0 in a condition never passes.
+					else if (form != 0) {
+						tests.push_back(Test{ GetValueSlot(shapeCondition.type), form, false });
+					}
+				}
+				condition.testCount = static_cast<std::uint32_t>(tests.size()) - condition.firstTest;
+				rule.hasOR |= !condition.AND;
+				conditions.push_back(condition);
+			}
+			rule.conditionCount = static_cast<std::uint32_t>(conditions.size()) - rule.firstCondition;
+			rules.push_back(rule);
+		}
+		built = true;
+	}
+
+	void RuleProgram::Prepare(const Context& a_context, Input& a_input) const
+	{
+		for (std::size_t slot = 0; slot < VALUE_SLOTS; ++slot) {
+			a_input.values[slot] = a_context.GetValue(SLOT_TYPES[slot]);
+		}
+		a_input.atoms.assign((atomCount + 63) / 64, 0);
+		for (const auto type : SET_TYPES) {
+			for (const auto form : a_context.GetSet(type)) {
+				if (const auto it = atoms.find(GetAtomKey(type, form)); it != atoms.end()) {
+					a_input.atoms[it->second / 64] |= std::uint64_t{ 1 } << (it->second % 64);
+				}
+			}
+		}
+	}
+
+	std::int32_t RuleProgram::Run(const Input& a_input) const
+	{
+		const auto passes = [&](const Test& a_test) {
+			return a_test.set ? ((a_input.atoms[a_test.operand / 64] >> (a_test.operand % 64)) & 1) != 0 : a_input.values[a_test.operand] == a_test.form;
+		};
+
+		std::int32_t response = -1;
+		Match best{};
+		for (std::int32_t i = 0; i < static_cast<std::int32_t>(rules.size()); ++i) {
+			const auto& rule = rules[i];
+			Match candidate{};
+			bool matchedOR = false;
+			bool failed = false;
+			for (auto c = rule.firstCondition; c < rule.firstCondition + rule.conditionCount; ++c) {
+				const auto& condition = conditions[c];
+				bool hit = false;
+				for (auto t = condition.firstTest; !hit && t < condition.firstTest + condition.testCount; ++t) {
+					hit = passes(tests[t]);
+				}
+				if (!hit) {
+					if (condition.AND) {
+						failed = true;
+						break;
+					}
+					continue;
+				}
+				if (condition.AND) {
+					candidate.score++;
+				}
+				else if (!matchedOR) {
+					matchedOR = true;
+					candidate.score++;
+				}
+				candidate.high |= condition.high;
+			}
+			if (failed || (rule.hasOR && !matchedOR) || candidate.score == 0 || (best.high && !candidate.high)) {
+				continue;
+			}
+			if ((candidate.high && !best.high) || candidate.score > best.score) {
+				best = candidate;
+				response = i;
+			}
+		}
+		return response;
+	}
+
+	void RuleProgram::Clear()
+	{
+		tests.clear();
+		conditions.clear();
+		rules.clear();
+		atoms.clear();
+		atomCount = 0;
+		built = false;
+	}
+
+	std::size_t RuleProgram::GetMemoryUsage() const
+	{
+		return tests.size() * sizeof(Test) +
+			conditions.size() * sizeof(Condition) +
+			rules.size() * sizeof(Rule) +
+			atoms.size() * (sizeof(std::uint64_t) + sizeof(std::uint32_t));
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "selection/ruleShape.h"
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Selection
+{
+	/*
+	* Rule set flattened into arrays of tests in rule order, so scoring it is one pass over contiguous
+	* memory, and so it can be translated to native code one test at a time (see RuleJit).
+	* 
+	* Single valued conditions compare one of the context's values against constants. Set valued ones
+	* test one bit each: every form some rule looks for in a set is an atom, and a context is prepared
+	* into the bits of the atoms it holds before running the program.
+	*/
+	class RuleProgram
+	{
+	public:
+		// Slots of the single values, in the order Prepare writes them.
+		static constexpr std::size_t VALUE_SLOTS{ 4 };
+
+		struct Input {
+			std::array<FormID, VALUE_SLOTS> values{};
+			// Bit i is set if the context holds atom i.
+			std::vector<std::uint64_t> atoms{};
+		};
+
+		struct Test {
+			// Value slot of single valued tests, atom of set valued ones.
+			std::uint32_t operand{ 0 };
+			// Compared value of single valued tests.
+			FormID form{ 0 };
+			bool set{ false };
+		};
+
+		struct Condition {
+			std::uint32_t firstTest{ 0 };
+			std::uint32_t testCount{ 0 };
+			bool AND{ true };
+			bool high{ false };
+		};
+
+		struct Rule {
+			std::uint32_t firstCondition{ 0 };
+			std::uint32_t conditionCount{ 0 };
+			bool hasOR{ false };
+		};
+
+		void Build(const std::vector<RuleShape>& a_rules);
+		// a_input is reused between calls, so preparing only allocates the first time.
+		void Prepare(const Context& a_context, Input& a_input) const;
+		// Position of the rule the MatchDegree loop picks for the prepared context, or -1 if none match.
+		std::int32_t Run(const Input& a_input) const;
+		void Clear();
+
+		bool IsBuilt() const { return built; }
+		const std::vector<Test>& GetTests() const { return tests; }
+		const std::vector<Condition>& GetConditions() const { return conditions; }
+		const std::vector<Rule>& GetRules() const { return rules; }
+		std::size_t GetAtomCount() const { return atomCount; }
+		std::size_t GetMemoryUsage() const;
+
+	private:
+		static std::uint64_t GetAtomKey(ConditionType a_type, FormID a_form);
+
+		std::vector<Test> tests;
+		std::vector<Condition> conditions;
+		std::vector<Rule> rules;
+		// Atom of each (type, form) the rules look for in a set.
+		std::unordered_map<std::uint64_t, std::uint32_t> atoms;
+		std::size_t atomCount{ 0 };
+		bool built{ false };
+	};
+}
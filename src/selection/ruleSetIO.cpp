@@ -0,0 +1,278 @@
+#include "selection/ruleSetIO.h"
+
+#include "selection/binaryIO.h"
+
+#include <bit>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <span>
+
+namespace Selection
+{
+	namespace
+	{
+		bool ReadRule(BinaryReader& a_reader, RuleDefinition& a_rule)
+		{
+			std::uint32_t index = 0;
+			std::uint32_t category = 0;
+			std::uint32_t musicCount = 0;
+			if (!a_reader.Read(index) || !a_reader.Read(category) || !a_reader.Read(musicCount)) {
+				return false;
+			}
+			if (category >= TOTAL_MUSIC_CATEGORIES || musicCount == 0 || !a_reader.Plausible(musicCount)) {
+				return false;
+			}
+			a_rule.newMusic.resize(musicCount);
+			for (auto& music : a_rule.newMusic) {
+				std::uint32_t weight = 0;
+				if (!a_reader.Read(music.form) || !a_reader.Read(weight)) {
+					return false;
+				}
+				music.weight = std::bit_cast<float>(weight);
+				if (!(music.weight > 0.0f) || !std::isfinite(music.weight)) {
+					return false;
+				}
+			}
+
+			std::uint32_t conditionCount = 0;
+			if (!a_reader.Read(conditionCount) || conditionCount > TOTAL_CONDITION_TYPES) {
+				return false;
+			}
+			a_rule.index = index;
+			a_rule.category = static_cast<MusicCategory>(category);
+
+			a_rule.conditions.resize(conditionCount);
+			for (auto& condition : a_rule.conditions) {
+				std::uint32_t type = 0;
+				std::uint32_t AND = 0;
+				std::uint32_t formCount = 0;
+				if (!a_reader.Read(type) || !a_reader.Read(AND) || !a_reader.Read(formCount)) {
+					return false;
+				}
+				if (type >= TOTAL_CONDITION_TYPES || AND > 1 || formCount == 0 || !a_reader.Plausible(formCount)) {
+					return false;
+				}
+				condition.type = static_cast<ConditionType>(type);
+				condition.AND = AND != 0;
+				condition.forms.resize(formCount);
+				for (auto& form : condition.forms) {
+					if (!a_reader.Read(form)) {
+						return false;
+					}
+				}
+			}
+			std::uint32_t nodeCount = 0;
+			if (!a_reader.Read(nodeCount) || nodeCount > MAX_EXPRESSION_NODES) {
+				return false;
+			}
+			if (nodeCount > 0) {
+				auto& expression = a_rule.expression.emplace();
+				expression.nodes.resize(nodeCount);
+				for (auto& node : expression.nodes) {
+					std::uint32_t kind = 0;
+					std::uint32_t type = 0;
+					std::uint32_t formCount = 0;
+					std::uint32_t childCount = 0;
+					if (!a_reader.Read(kind) || !a_reader.Read(type) || !a_reader.Read(formCount) || !a_reader.Plausible(formCount)) {
+						return false;
+					}
+					if (kind > static_cast<std::uint32_t>(ExpressionNode::Kind::kTest) || type >= TOTAL_CONDITION_TYPES) {
+						return false;
+					}
+					node.kind = static_cast<ExpressionNode::Kind>(kind);
+					node.type = static_cast<ConditionType>(type);
+					node.forms.resize(formCount);
+					for (auto& form : node.forms) {
+						if (!a_reader.Read(form)) {
+							return false;
+						}
+					}
+					if (!a_reader.Read(childCount) || childCount > nodeCount) {
+						return false;
+					}
+					node.children.resize(childCount);
+					for (auto& child : node.children) {
+						if (!a_reader.Read(child)) {
+							return false;
+						}
+					}
+				}
+				if (!expression.IsValid()) {
+					return false;
+				}
+			}
+
+			std::uint32_t rangeCount = 0;
+			if (!a_reader.Read(rangeCount) || rangeCount > TOTAL_QUANTITIES) {
+				return false;
+			}
+			a_rule.ranges.resize(rangeCount);
+			for (auto& range : a_rule.ranges) {
+				std::uint32_t quantity = 0;
+				std::uint32_t AND = 0;
+				std::uint32_t low = 0;
+				std::uint32_t high = 0;
+				if (!a_reader.Read(quantity) || !a_reader.Read(AND) || !a_reader.Read(low) || !a_reader.Read(high) ||
+					quantity >= TOTAL_QUANTITIES || AND > 1) {
+					return false;
+				}
+				range = RangeDefinition{ static_cast<Quantity>(quantity), AND != 0, Range{ std::bit_cast<float>(low), std::bit_cast<float>(high) } };
+			}
+			const auto unordered = std::adjacent_find(a_rule.ranges.begin(), a_rule.ranges.end(), [](const auto& a_left, const auto& a_right) {
+				return a_left.quantity >= a_right.quantity;
+			});
+			if (unordered != a_rule.ranges.end()) {
+				return false;
+			}
+
+			std::uint32_t extensionCount = 0;
+			if (!a_reader.Read(extensionCount) || !a_reader.Plausible(extensionCount)) {
+				return false;
+			}
+			a_rule.extensions.resize(extensionCount);
+			for (auto& extension : a_rule.extensions) {
+				std::uint32_t AND = 0;
+				if (!a_reader.Read(extension.key) || !a_reader.Read(AND) || !a_reader.Read(extension.json) || AND > 1 || IsReservedKey(extension.key)) {
+					return false;
+				}
+				extension.AND = AND != 0;
+			}
+
+			// Conditions are stored in type order, at most one per type.
+			return std::adjacent_find(a_rule.conditions.begin(), a_rule.conditions.end(), [](const auto& a_left, const auto& a_right) {
+				return a_left.type >= a_right.type;
+			}) == a_rule.conditions.end();
+		}
+	}
+
+	bool WriteCompiledRules(const std::string& a_path, const std::vector<RuleFile>& a_files, std::string& a_error)
+	{
+		BinaryWriter writer{};
+		writer.Write(COMPILED_RULES_MAGIC);
+		writer.Write(COMPILED_RULES_VERSION);
+		writer.Write(static_cast<std::uint32_t>(a_files.size()));
+		for (const auto& file : a_files) {
+			writer.Write(file.path);
+			writer.Write(static_cast<std::uint32_t>(file.rules.size()));
+			for (const auto& rule : file.rules) {
+				writer.Write(static_cast<std::uint32_t>(rule.index));
+				writer.Write(static_cast<std::uint32_t>(rule.category));
+				writer.Write(static_cast<std::uint32_t>(rule.newMusic.size()));
+				for (const auto& music : rule.newMusic) {
+					writer.Write(music.form);
+					writer.Write(std::bit_cast<std::uint32_t>(music.weight));
+				}
+				writer.Write(static_cast<std::uint32_t>(rule.conditions.size()));
+				for (const auto& condition : rule.conditions) {
+					writer.Write(static_cast<std::uint32_t>(condition.type));
+					writer.Write(condition.AND ? 1u : 0u);
+					writer.Write(static_cast<std::uint32_t>(condition.forms.size()));
+					for (const auto& form : condition.forms) {
+						writer.Write(form);
+					}
+				}
+				// A rule without an expression is stored as one with no nodes.
+				writer.Write(static_cast<std::uint32_t>(rule.expression ? rule.expression->nodes.size() : 0));
+				for (const auto& node : rule.expression ? rule.expression->nodes : std::span<const ExpressionNode>{}) {
+					writer.Write(static_cast<std::uint32_t>(node.kind));
+					writer.Write(static_cast<std::uint32_t>(node.type));
+					writer.Write(static_cast<std::uint32_t>(node.forms.size()));
+					for (const auto& form : node.forms) {
+						writer.Write(form);
+					}
+					writer.Write(static_cast<std::uint32_t>(node.children.size()));
+					for (const auto child : node.children) {
+						writer.Write(child);
+					}
+				}
+				writer.Write(static_cast<std::uint32_t>(rule.ranges.size()));
+				for (const auto& range : rule.ranges) {
+					writer.Write(static_cast<std::uint32_t>(range.quantity));
+					writer.Write(range.AND ? 1u : 0u);
+					writer.Write(std::bit_cast<std::uint32_t>(range.range.low));
+					writer.Write(std::bit_cast<std::uint32_t>(range.range.high));
+				}
+				writer.Write(static_cast<std::uint32_t>(rule.extensions.size()));
+				for (const auto& extension : rule.extensions) {
+					writer.Write(extension.key);
+					writer.Write(extension.AND ? 1u : 0u);
+					writer.Write(extension.json);
+				}
+			}
+		}
+
+		std::ofstream output(a_path, std::ios::binary | std::ios::trunc);
+		if (!output) {
+			a_error = "Could not open file for writing.";
+			return false;
+		}
+		output.write(writer.buffer.data(), static_cast<std::streamsize>(writer.buffer.size()));
+		if (!output) {
+			a_error = "Failed to write file.";
+			return false;
+		}
+		return true;
+	}
+
+	bool ReadCompiledRules(const std::string& a_path, std::vector<RuleFile>& a_files, std::vector<ParseIssue>& a_issues)
+	{
+		std::string data{};
+		try {
+			std::ifstream input(a_path, std::ios::binary);
+			if (!input) {
+				a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", "Could not open file." });
+				return false;
+			}
+			data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		}
+		catch (const std::exception& e) {
+			a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", std::string("Caught ") + e.what() + " while reading file." });
+			return false;
+		}
+
+		BinaryReader reader(data);
+		std::uint32_t magic = 0;
+		std::uint32_t version = 0;
+		std::uint32_t fileCount = 0;
+		if (!reader.Read(magic) || magic != COMPILED_RULES_MAGIC) {
+			a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", "Not a compiled rule set." });
+			return false;
+		}
+		if (!reader.Read(version) || version != COMPILED_RULES_VERSION) {
+			a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", "Compiled with an unsupported version (" + std::to_string(version) + "), recompile it." });
+			return false;
+		}
+
+		// Either the whole set loads or nothing does, since a partial read means the file is damaged.
+		std::vector<RuleFile> files{};
+		bool valid = reader.Read(fileCount) && reader.Plausible(fileCount);
+		if (valid) {
+			files.resize(fileCount);
+		}
+		for (std::size_t i = 0; valid && i < files.size(); ++i) {
+			auto& file = files[i];
+			std::uint32_t ruleCount = 0;
+			valid = reader.Read(file.path) && reader.Read(ruleCount) && reader.Plausible(ruleCount);
+			if (!valid) {
+				break;
+			}
+			file.rules.resize(ruleCount);
+			for (auto& rule : file.rules) {
+				if (!ReadRule(reader, rule)) {
+					valid = false;
+					break;
+				}
+			}
+		}
+		if (!valid || !reader.AtEnd()) {
+			a_issues.push_back(ParseIssue{ a_path, std::nullopt, "", "File is truncated or damaged and will be ignored." });
+			return false;
+		}
+
+		for (auto& file : files) {
+			a_files.push_back(std::move(file));
+		}
+		return true;
+	}
+}
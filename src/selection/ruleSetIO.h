@@ -0,0 +1,15 @@
+#pragma once
+
+#include "selection/ruleParser.h"
+
+namespace Selection
+{
+	// Compiled rule sets are a flat binary dump of already validated rule files. Loading one skips the
+	// JSON parse, and form references may already be rewritten to "Plugin|0xID" by the offline tool.
+	inline constexpr std::string_view COMPILED_RULES_EXTENSION = ".cmrules";
+	inline constexpr std::uint32_t COMPILED_RULES_MAGIC = 0x53524D43;  // "CMRS"
+	inline constexpr std::uint32_t COMPILED_RULES_VERSION = 6;
+
+	bool WriteCompiledRules(const std::string& a_path, const std::vector<RuleFile>& a_files, std::string& a_error);
+	bool ReadCompiledRules(const std::string& a_path, std::vector<RuleFile>& a_files, std::vector<ParseIssue>& a_issues);
+}
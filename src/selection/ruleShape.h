@@ -0,0 +1,69 @@
+#pragma once
+
+#include "selection/context.h"
+
+namespace Selection
+{
+	// Flat description of a condition. Forms are sorted and unique.
+	struct ConditionShape {
+		ConditionType type;
+		bool AND;
+		std::vector<FormID> forms;
+	};
+
+	// Flat description of a rule. Holds at most one condition per type.
+	using RuleShape = std::vector<ConditionShape>;
+
+	struct Match {
+		bool high{ false };
+		// 0 if the rule does not match.
+		int score{ 0 };
+	};
+
+	// Same result as ConditionalBattleMusic::MatchDegree, for code that only has the shapes.
+	inline Match MatchRule(const RuleShape& a_rule, const Context& a_context)
+	{
+		Match response{};
+		bool hasOR = false;
+		bool matchedOR = false;
+		for (const auto& condition : a_rule) {
+			hasOR |= !condition.AND;
+			if (!a_context.HasAny(condition.type, condition.forms)) {
+				if (condition.AND) {
+					return Match{};
+				}
+				continue;
+			}
+			if (condition.AND) {
+				response.score++;
+			}
+			else if (!matchedOR) {
+				matchedOR = true;
+				response.score++;
+			}
+			response.high |= IsHighPriority(condition.type);
+		}
+		if (hasOR && !matchedOR) {
+			return Match{};
+		}
+		return response;
+	}
+
+	// Position of the rule the MatchDegree loop picks, or -1 if none match.
+	inline std::int32_t SelectRule(const std::vector<RuleShape>& a_rules, const Context& a_context)
+	{
+		std::int32_t response = -1;
+		Match best{};
+		for (std::int32_t i = 0; i < static_cast<std::int32_t>(a_rules.size()); ++i) {
+			const auto candidate = MatchRule(a_rules[i], a_context);
+			if (candidate.score == 0 || (best.high && !candidate.high)) {
+				continue;
+			}
+			if ((candidate.high && !best.high) || candidate.score > best.score) {
+				best = candidate;
+				response = i;
+			}
+		}
+		return response;
+	}
+}
@@ -0,0 +1,69 @@
+#include "selection/speculation.h"
+
+#include <algorithm>
+
+namespace Selection
+{
+	bool AgreesOn(const Context& a_left, const Context& a_right, TypeMask a_types)
+	{
+		for (std::size_t i = 0; i < TOTAL_CONDITION_TYPES; ++i) {
+			if (((a_types >> i) & 1) == 0) {
+				continue;
+			}
+			const auto type = static_cast<ConditionType>(i);
+			if (IsSingleValued(type) ? a_left.GetValue(type) != a_right.GetValue(type) : a_left.GetSet(type) != a_right.GetSet(type)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void SpeculationTable::SetTestedTypes(TypeMask a_types)
+	{
+		tested = a_types;
+		entries.clear();
+	}
+
+	void SpeculationTable::Store(FormID a_base, const Context& a_context, std::int32_t a_winner, std::size_t a_capacity)
+	{
+		if (!entries.contains(a_base) && entries.size() >= std::max<std::size_t>(a_capacity, 1)) {
+			const auto oldest = std::min_element(entries.begin(), entries.end(), [](const auto& a_left, const auto& a_right) {
+				return a_left.second.stamp < a_right.second.stamp;
+			});
+			entries.erase(oldest);
+		}
+		auto& entry = entries[a_base];
+		entry.context = a_context;
+		entry.winner = a_winner;
+		entry.stamp = ++clock;
+	}
+
+	std::optional<std::int32_t> SpeculationTable::Confirm(const Context& a_context, Outcome& a_outcome)
+	{
+		const auto it = entries.find(a_context.target);
+		if (a_context.target == 0 || it == entries.end()) {
+			a_outcome = Outcome::kMissing;
+		}
+		else {
+			a_outcome = AgreesOn(it->second.context, a_context, tested) ? Outcome::kHit : Outcome::kMispredicted;
+		}
+		counts[static_cast<std::size_t>(a_outcome)]++;
+		if (a_outcome != Outcome::kHit) {
+			return std::nullopt;
+		}
+		const auto winner = it->second.winner;
+		entries.erase(it);
+		return winner;
+	}
+
+	void SpeculationTable::Clear()
+	{
+		entries.clear();
+	}
+
+	double SpeculationTable::GetHitRate() const
+	{
+		const auto total = counts[0] + counts[1] + counts[2];
+		return total > 0 ? static_cast<double>(counts[0]) / static_cast<double>(total) : 0.0;
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "selection/context.h"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+namespace Selection
+{
+	// Bit i stands for ConditionType i.
+	using TypeMask = std::uint32_t;
+
+	// True if the contexts hold the same values for every condition type in a_types, so every rule that only
+	// tests those types matches both the same way.
+	bool AgreesOn(const Context& a_left, const Context& a_right, TypeMask a_types);
+
+	/*
+	* Winners picked ahead of time, for the context expected once an enemy starts fighting the player, keyed
+	* by the enemy's base. A stored winner is only handed out if the real context agrees with the expected one
+	* on every type the rules test, so a confirmed winner is always the rule the rules would pick.
+	*/
+	class SpeculationTable
+	{
+	public:
+		enum class Outcome {
+			kHit,
+			// A winner was stored for the target, but the context changed since.
+			kMispredicted,
+			// Nothing was stored for the target.
+			kMissing
+		};
+
+		// Types the rules test. Forgets every stored winner.
+		void SetTestedTypes(TypeMask a_types);
+		// Replaces the winner stored for a_base. Keeps at most a_capacity winners, dropping the oldest.
+		void Store(FormID a_base, const Context& a_context, std::int32_t a_winner, std::size_t a_capacity = 32);
+		// Takes the winner stored for the context's target and counts the outcome. Empty unless it is a hit.
+		std::optional<std::int32_t> Confirm(const Context& a_context, Outcome& a_outcome);
+		void Clear();
+
+		std::size_t GetSize() const { return entries.size(); }
+		std::uint64_t GetCount(Outcome a_outcome) const { return counts[static_cast<std::size_t>(a_outcome)]; }
+		// Fraction of the confirmations that were hits, or 0 before the first.
+		double GetHitRate() const;
+
+	private:
+		struct Entry {
+			Context context{};
+			std::int32_t winner{ -1 };
+			std::uint64_t stamp{ 0 };
+		};
+
+		std::unordered_map<FormID, Entry> entries;
+		TypeMask tested{ 0 };
+		std::uint64_t clock{ 0 };
+		std::uint64_t counts[3]{};
+	};
+}
@@ -0,0 +1,147 @@
+#include "selection/startupTrace.h"
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace Selection
+{
+	namespace
+	{
+		struct Event {
+			const char* name;
+			std::string detail;
+			std::uint32_t thread;
+			StartupTracer::Clock::time_point start;
+			StartupTracer::Clock::time_point end;
+		};
+
+		struct State {
+			std::mutex lock;
+			StartupTracer::Clock::time_point origin{};
+			bool started{ false };
+			std::vector<Event> events;
+			// Thread number and name, for the metadata events.
+			std::vector<std::pair<std::uint32_t, std::string>> threadNames;
+		};
+
+		State& GetState()
+		{
+			static State state{};
+			return state;
+		}
+
+		// Small, stable numbers read better in a trace viewer than hashed thread ids.
+		std::uint32_t GetThreadNumber()
+		{
+			static std::atomic<std::uint32_t> next{ 1 };
+			thread_local const std::uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+			return number;
+		}
+
+		void WriteString(std::ostream& a_stream, std::string_view a_value)
+		{
+			a_stream << '"';
+			for (const auto character : a_value) {
+				switch (character) {
+				case '"':
+					a_stream << "\\\"";
+					break;
+				case '\\':
+					a_stream << "\\\\";
+					break;
+				case '\n':
+					a_stream << "\\n";
+					break;
+				default:
+					if (static_cast<unsigned char>(character) < 0x20) {
+						a_stream << ' ';
+					}
+					else {
+						a_stream << character;
+					}
+				}
+			}
+			a_stream << '"';
+		}
+	}
+
+	void StartupTracer::Enable()
+	{
+		auto& state = GetState();
+		{
+			std::lock_guard lock{ state.lock };
+			if (!state.started) {
+				state.origin = Clock::now();
+				state.started = true;
+			}
+		}
+		enabled.store(true, std::memory_order_relaxed);
+	}
+
+	void StartupTracer::NameThread(std::string_view a_name)
+	{
+		if (!IsEnabled()) {
+			return;
+		}
+		auto& state = GetState();
+		std::lock_guard lock{ state.lock };
+		state.threadNames.emplace_back(GetThreadNumber(), std::string(a_name));
+	}
+
+	void StartupTracer::Record(const char* a_name, std::string a_detail, Clock::time_point a_start, Clock::time_point a_end)
+	{
+		const auto thread = GetThreadNumber();
+		auto& state = GetState();
+		std::lock_guard lock{ state.lock };
+		state.events.push_back(Event{ a_name, std::move(a_detail), thread, a_start, a_end });
+	}
+
+	bool StartupTracer::Write(const std::string& a_path, std::string& a_error)
+	{
+		enabled.store(false, std::memory_order_relaxed);
+		auto& state = GetState();
+		std::lock_guard lock{ state.lock };
+		const auto microseconds = [&](Clock::duration a_duration) {
+			return std::chrono::duration<double, std::micro>(a_duration).count();
+		};
+
+		// Complete ("X") events carry their own duration, so nesting follows from the times alone.
+		std::ostringstream stream{};
+		stream.precision(3);
+		stream << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		for (const auto& [thread, name] : state.threadNames) {
+			stream << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":";
+			WriteString(stream, name);
+			stream << "}}";
+			first = false;
+		}
+		for (const auto& event : state.events) {
+			stream << (first ? "" : ",") << "\n{\"name\":";
+			WriteString(stream, event.name);
+			stream << ",\"cat\":\"startup\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+				   << ",\"ts\":" << microseconds(event.start - state.origin)
+				   << ",\"dur\":" << microseconds(event.end - event.start);
+			if (!event.detail.empty()) {
+				stream << ",\"args\":{\"detail\":";
+				WriteString(stream, event.detail);
+				stream << "}";
+			}
+			stream << "}";
+			first = false;
+		}
+		stream << "\n]}\n";
+		state.events.clear();
+		state.threadNames.clear();
+
+		std::ofstream file(a_path, std::ios::binary | std::ios::trunc);
+		if (!file || !(file << stream.str())) {
+			a_error = "Could not write the file.";
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace Selection
+{
+	/*
+	* Records how long each startup phase takes, on which thread, and writes it as Chrome trace-event
+	* JSON for chrome://tracing or Perfetto. Spans are kept in memory until Write. While the tracer is
+	* disabled, a span costs one flag check and records nothing.
+	*/
+	class StartupTracer
+	{
+	public:
+		using Clock = std::chrono::steady_clock;
+
+		// Starts recording. Times in the trace count from the first call.
+		static void Enable();
+		static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+		// Names the calling thread in the trace viewer.
+		static void NameThread(std::string_view a_name);
+		// a_name must outlive the tracer, like a string literal. a_detail is shown with the span.
+		static void Record(const char* a_name, std::string a_detail, Clock::time_point a_start, Clock::time_point a_end);
+		// Writes everything recorded so far and stops recording. Returns false with a_error set if the file
+		// could not be written.
+		static bool Write(const std::string& a_path, std::string& a_error);
+
+	private:
+		inline static std::atomic_bool enabled{ false };
+	};
+
+	// Records the time from construction to destruction as one span of the calling thread.
+	class StartupSpan
+	{
+	public:
+		explicit StartupSpan(const char* a_name) :
+			name(a_name),
+			active(StartupTracer::IsEnabled())
+		{
+			if (active) {
+				start = StartupTracer::Clock::now();
+			}
+		}
+
+		StartupSpan(const char* a_name, std::string_view a_detail) :
+			StartupSpan(a_name)
+		{
+			if (active) {
+				detail = a_detail;
+			}
+		}
+
+		~StartupSpan()
+		{
+			if (active) {
+				StartupTracer::Record(name, std::move(detail), start, StartupTracer::Clock::now());
+			}
+		}
+
+		StartupSpan(const StartupSpan&) = delete;
+		StartupSpan& operator=(const StartupSpan&) = delete;
+
+	private:
+		const char* name;
+		std::string detail{};
+		StartupTracer::Clock::time_point start{};
+		bool active;
+	};
+}
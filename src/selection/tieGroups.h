@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <span>
+#include <vector>
+
+namespace Selection
+{
+	/*
+	* Sets of rules that match a context equally well, for engines that answer many contexts with one entry.
+	* Equal sets are stored once, so a diagram leaf or a table cell only keeps the number of its set.
+	*/
+	class TieGroups
+	{
+	public:
+		// a_rules must be sorted, winner first.
+		std::uint32_t Intern(const std::vector<std::uint32_t>& a_rules)
+		{
+			const auto [it, inserted] = known.emplace(a_rules, static_cast<std::uint32_t>(starts.size() - 1));
+			if (inserted) {
+				rules.insert(rules.end(), a_rules.begin(), a_rules.end());
+				starts.push_back(static_cast<std::uint32_t>(rules.size()));
+			}
+			return it->second;
+		}
+
+		std::span<const std::uint32_t> Get(std::uint32_t a_group) const
+		{
+			return std::span{ rules }.subspan(starts[a_group], starts[a_group + 1] - starts[a_group]);
+		}
+
+		std::size_t GetCount() const { return starts.size() - 1; }
+		std::size_t GetMemoryUsage() const { return (rules.capacity() + starts.capacity()) * sizeof(std::uint32_t); }
+
+		void Clear()
+		{
+			known.clear();
+			rules.clear();
+			starts.assign(1, 0);
+		}
+
+	private:
+		std::map<std::vector<std::uint32_t>, std::uint32_t> known{};
+		// Rules of group g are rules[starts[g]] up to rules[starts[g + 1]].
+		std::vector<std::uint32_t> rules{};
+		std::vector<std::uint32_t> starts{ 0 };
+	};
+}
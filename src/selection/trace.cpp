@@ -0,0 +1,277 @@
+#include "selection/trace.h"
+
+#include "selection/binaryIO.h"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace Selection
+{
+	namespace
+	{
+		// Caps that keep an encoded record within TraceBuffer::SLOT_SIZE.
+		constexpr std::size_t MAX_TRACED_LOCATIONS = 16;
+		constexpr std::size_t MAX_TRACED_KEYWORDS = 48;
+		constexpr std::size_t MAX_TRACED_COMBATANTS = 32;
+		constexpr std::size_t FIXED_RECORD_SIZE = 4 * 15;
+		static_assert(FIXED_RECORD_SIZE + 4 * (MAX_TRACED_LOCATIONS + 3 * MAX_TRACED_KEYWORDS + MAX_TRACED_COMBATANTS) <= TraceBuffer::SLOT_SIZE);
+
+		void WriteSet(BinaryWriter& a_writer, const std::vector<FormID>& a_set, std::size_t a_limit)
+		{
+			const auto count = std::min(a_set.size(), a_limit);
+			a_writer.Write(static_cast<std::uint32_t>(count));
+			for (std::size_t i = 0; i < count; ++i) {
+				a_writer.Write(a_set[i]);
+			}
+		}
+
+		bool ReadSet(BinaryReader& a_reader, std::vector<FormID>& a_set)
+		{
+			std::uint32_t count = 0;
+			if (!a_reader.Read(count) || !a_reader.Plausible(count)) {
+				return false;
+			}
+			a_set.resize(count);
+			for (auto& form : a_set) {
+				if (!a_reader.Read(form)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Record body without the size prefix.
+		void EncodeBody(BinaryWriter& a_writer, const TraceRecord& a_record)
+		{
+			const auto& context = a_record.context;
+			const bool truncated = a_record.truncated ||
+				context.locations.size() > MAX_TRACED_LOCATIONS ||
+				context.locationKeywords.size() > MAX_TRACED_KEYWORDS ||
+				context.targetKeywords.size() > MAX_TRACED_KEYWORDS ||
+				context.combatants.size() > MAX_TRACED_COMBATANTS ||
+				context.combatantKeywords.size() > MAX_TRACED_KEYWORDS;
+
+			a_writer.Write(a_record.timestamp);
+			a_writer.Write(static_cast<std::uint32_t>(a_record.hook) |
+						   (a_record.selected ? 1u << 8 : 0u) |
+						   (truncated ? 1u << 9 : 0u));
+			a_writer.Write(static_cast<std::uint32_t>(a_record.rule));
+			a_writer.Write(a_record.original);
+			a_writer.Write(a_record.chosen);
+			a_writer.Write(context.worldspace);
+			a_writer.Write(context.cell);
+			a_writer.Write(context.target);
+			a_writer.Write(context.intensity);
+			WriteSet(a_writer, context.locations, MAX_TRACED_LOCATIONS);
+			WriteSet(a_writer, context.locationKeywords, MAX_TRACED_KEYWORDS);
+			WriteSet(a_writer, context.targetKeywords, MAX_TRACED_KEYWORDS);
+			WriteSet(a_writer, context.combatants, MAX_TRACED_COMBATANTS);
+			WriteSet(a_writer, context.combatantKeywords, MAX_TRACED_KEYWORDS);
+		}
+
+		bool DecodeBody(BinaryReader& a_reader, TraceRecord& a_record)
+		{
+			std::uint32_t flags = 0;
+			std::uint32_t rule = 0;
+			auto& context = a_record.context;
+			if (!a_reader.Read(a_record.timestamp) || !a_reader.Read(flags) || !a_reader.Read(rule) ||
+				!a_reader.Read(a_record.original) || !a_reader.Read(a_record.chosen) ||
+				!a_reader.Read(context.worldspace) || !a_reader.Read(context.cell) || !a_reader.Read(context.target) ||
+				!a_reader.Read(context.intensity) ||
+				!ReadSet(a_reader, context.locations) || !ReadSet(a_reader, context.locationKeywords) || !ReadSet(a_reader, context.targetKeywords) ||
+				!ReadSet(a_reader, context.combatants) || !ReadSet(a_reader, context.combatantKeywords)) {
+				return false;
+			}
+			if ((flags & 0xFF) >= static_cast<std::uint32_t>(TraceHook::kTotal)) {
+				return false;
+			}
+			a_record.hook = static_cast<TraceHook>(flags & 0xFF);
+			a_record.selected = (flags & (1u << 8)) != 0;
+			a_record.truncated = (flags & (1u << 9)) != 0;
+			a_record.rule = static_cast<std::int32_t>(rule);
+			return true;
+		}
+
+		void WriteRuleSet(BinaryWriter& a_writer, const TraceRuleSet& a_set)
+		{
+			a_writer.Write(static_cast<std::uint32_t>(a_set.rules.size()));
+			for (std::size_t i = 0; i < a_set.rules.size(); ++i) {
+				a_writer.Write(i < a_set.music.size() ? a_set.music[i] : 0);
+				a_writer.Write(static_cast<std::uint32_t>(a_set.rules[i].size()));
+				for (const auto& condition : a_set.rules[i]) {
+					a_writer.Write(static_cast<std::uint32_t>(condition.type));
+					a_writer.Write(condition.AND ? 1u : 0u);
+					WriteSet(a_writer, condition.forms, condition.forms.size());
+				}
+			}
+		}
+
+		bool ReadRuleSet(BinaryReader& a_reader, TraceRuleSet& a_set)
+		{
+			std::uint32_t count = 0;
+			if (!a_reader.Read(count) || !a_reader.Plausible(count)) {
+				return false;
+			}
+			a_set.rules.resize(count);
+			a_set.music.resize(count);
+			for (std::size_t i = 0; i < count; ++i) {
+				std::uint32_t conditionCount = 0;
+				if (!a_reader.Read(a_set.music[i]) || !a_reader.Read(conditionCount) || conditionCount > TOTAL_CONDITION_TYPES) {
+					return false;
+				}
+				a_set.rules[i].resize(conditionCount);
+				for (auto& condition : a_set.rules[i]) {
+					std::uint32_t type = 0;
+					std::uint32_t AND = 0;
+					if (!a_reader.Read(type) || !a_reader.Read(AND) || type >= TOTAL_CONDITION_TYPES || AND > 1 || !ReadSet(a_reader, condition.forms)) {
+						return false;
+					}
+					condition.type = static_cast<ConditionType>(type);
+					condition.AND = AND != 0;
+				}
+			}
+			return true;
+		}
+	}
+
+	std::string_view GetTraceHookName(TraceHook a_hook)
+	{
+		switch (a_hook) {
+		case TraceHook::kStartCombat:
+			return "StartCombatMusic";
+		case TraceHook::kLoadCombat:
+			return "LoadCombatMusic";
+		case TraceHook::kEndCombat:
+			return "EndCombatMusic";
+		case TraceHook::kClearLocation:
+			return "ClearLocation";
+		case TraceHook::kDiscovery:
+			return "DiscoveryMusic";
+		default:
+			return "Unknown";
+		}
+	}
+
+	MusicCategory GetTraceCategory(TraceHook a_hook)
+	{
+		return a_hook == TraceHook::kClearLocation ? MusicCategory::kDungeonCleared : MusicCategory::kCombat;
+	}
+
+	TraceBuffer::TraceBuffer(std::size_t a_capacity) :
+		slots(std::make_unique<Slot[]>(std::bit_ceil(std::max<std::size_t>(a_capacity, 2)))),
+		mask(std::bit_ceil(std::max<std::size_t>(a_capacity, 2)) - 1)
+	{
+		for (std::size_t i = 0; i <= mask; ++i) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool TraceBuffer::TryPush(const TraceRecord& a_record)
+	{
+		// Reused per thread, so encoding only allocates the first time.
+		thread_local BinaryWriter writer{};
+		writer.buffer.clear();
+		EncodeBody(writer, a_record);
+
+		auto position = head.load(std::memory_order_relaxed);
+		Slot* slot = nullptr;
+		for (;;) {
+			slot = std::addressof(slots[position & mask]);
+			const auto sequence = slot->sequence.load(std::memory_order_acquire);
+			const auto difference = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+			if (difference == 0) {
+				if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (difference < 0) {
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else {
+				position = head.load(std::memory_order_relaxed);
+			}
+		}
+
+		std::memcpy(slot->data.data(), writer.buffer.data(), writer.buffer.size());
+		slot->size = static_cast<std::uint32_t>(writer.buffer.size());
+		slot->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	std::string EncodeTraceHeader(const TraceHeader& a_header)
+	{
+		BinaryWriter writer{};
+		writer.Write(TRACE_MAGIC);
+		writer.Write(TRACE_VERSION);
+		writer.Write(static_cast<std::uint32_t>(a_header.categories.size()));
+		for (const auto& set : a_header.categories) {
+			WriteRuleSet(writer, set);
+		}
+		return std::move(writer.buffer);
+	}
+
+	void AppendTraceRecord(std::string& a_output, std::string_view a_encoded)
+	{
+		BinaryWriter writer{};
+		writer.buffer = std::move(a_output);
+		writer.Write(static_cast<std::uint32_t>(a_encoded.size()));
+		writer.buffer.append(a_encoded);
+		a_output = std::move(writer.buffer);
+	}
+
+	bool ReadTrace(const std::string& a_path, TraceHeader& a_header, std::vector<TraceRecord>& a_records, bool& a_truncated, std::string& a_error)
+	{
+		std::string data{};
+		{
+			std::ifstream input(a_path, std::ios::binary);
+			if (!input) {
+				a_error = "Could not open file.";
+				return false;
+			}
+			data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+		}
+
+		BinaryReader reader(data);
+		std::uint32_t magic = 0;
+		std::uint32_t version = 0;
+		if (!reader.Read(magic) || magic != TRACE_MAGIC) {
+			a_error = "Not a trace file.";
+			return false;
+		}
+		if (!reader.Read(version) || version != TRACE_VERSION) {
+			a_error = "Unsupported trace version " + std::to_string(version) + ".";
+			return false;
+		}
+		std::uint32_t categoryCount = 0;
+		if (!reader.Read(categoryCount) || categoryCount != a_header.categories.size()) {
+			a_error = "Trace was recorded with different music categories.";
+			return false;
+		}
+		for (auto& set : a_header.categories) {
+			if (!ReadRuleSet(reader, set)) {
+				a_error = "Trace header is damaged.";
+				return false;
+			}
+		}
+
+		a_truncated = false;
+		std::string body{};
+		while (!reader.AtEnd()) {
+			if (!reader.Read(body)) {
+				a_truncated = true;
+				break;
+			}
+			BinaryReader bodyReader(body);
+			TraceRecord record{};
+			if (!DecodeBody(bodyReader, record) || !bodyReader.AtEnd()) {
+				a_error = "Record " + std::to_string(a_records.size()) + " is damaged.";
+				return false;
+			}
+			a_records.push_back(std::move(record));
+		}
+		return true;
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "selection/musicCategory.h"
+#include "selection/ruleShape.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace Selection
+{
+	// Hooks that are recorded. Stored in trace files, so only ever append.
+	enum class TraceHook : std::uint8_t {
+		kStartCombat,
+		kLoadCombat,
+		kEndCombat,
+		kClearLocation,
+		kDiscovery,
+
+		kTotal
+	};
+
+	std::string_view GetTraceHookName(TraceHook a_hook);
+	// Category whose rules a hook selects from.
+	MusicCategory GetTraceCategory(TraceHook a_hook);
+
+	struct TraceRecord {
+		// Nanoseconds since recording started.
+		std::uint64_t timestamp{ 0 };
+		TraceHook hook{ TraceHook::kStartCombat };
+		// True if a rule set was evaluated during the call.
+		bool selected{ false };
+		// True if context lists were cut to fit a buffer slot.
+		bool truncated{ false };
+		// Position of the chosen rule in the rule set of the hook's category, or -1.
+		std::int32_t rule{ -1 };
+		// Music the game asked for (0 if it was never asked), and the music returned to it.
+		FormID original{ 0 };
+		FormID chosen{ 0 };
+		Context context{};
+	};
+
+	struct TraceRuleSet {
+		std::vector<RuleShape> rules{};
+		// Music FormID of every rule.
+		std::vector<FormID> music{};
+	};
+
+	// The rules as loaded, so traces can be replayed without the game or its load order.
+	struct TraceHeader {
+		// By MusicCategory.
+		std::array<TraceRuleSet, TOTAL_MUSIC_CATEGORIES> categories{};
+	};
+
+	inline constexpr std::uint32_t TRACE_MAGIC = 0x52544D43;  // "CMTR"
+	inline constexpr std::uint32_t TRACE_VERSION = 4;
+
+	/*
+	* Bounded multi producer, single consumer queue of encoded records.
+	* 
+	* Producers never block or allocate once warmed up: a slot is claimed with a compare exchange and
+	* published with a sequence number. Records that find the queue full are dropped and counted.
+	*/
+	class TraceBuffer
+	{
+	public:
+		static constexpr std::size_t SLOT_SIZE{ 1024 };
+
+		// a_capacity is rounded up to a power of two.
+		explicit TraceBuffer(std::size_t a_capacity);
+
+		bool TryPush(const TraceRecord& a_record);
+
+		// Single consumer. Hands every published record to a_sink in order and returns how many there were.
+		template <class F>
+		std::size_t Drain(F&& a_sink)
+		{
+			std::size_t count = 0;
+			for (;;) {
+				auto& slot = slots[tail & mask];
+				if (slot.sequence.load(std::memory_order_acquire) != tail + 1) {
+					return count;
+				}
+				a_sink(std::string_view(slot.data.data(), slot.size));
+				slot.sequence.store(tail + mask + 1, std::memory_order_release);
+				++tail;
+				++count;
+			}
+		}
+
+		std::uint64_t GetDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	private:
+		struct Slot {
+			std::atomic<std::size_t> sequence{ 0 };
+			std::uint32_t size{ 0 };
+			std::array<char, SLOT_SIZE> data{};
+		};
+
+		std::unique_ptr<Slot[]> slots;
+		std::size_t mask;
+		alignas(64) std::atomic<std::size_t> head{ 0 };
+		alignas(64) std::size_t tail{ 0 };
+		std::atomic<std::uint64_t> dropped{ 0 };
+	};
+
+	// File layout: the encoded header, then one size prefixed record after another until the end of the file.
+	std::string EncodeTraceHeader(const TraceHeader& a_header);
+	// Appends a record drained from a TraceBuffer to a_output, size prefixed as stored in the file.
+	void AppendTraceRecord(std::string& a_output, std::string_view a_encoded);
+
+	// A truncated final record, as left by a game that closed mid write, is ignored and flagged in a_truncated.
+	bool ReadTrace(const std::string& a_path, TraceHeader& a_header, std::vector<TraceRecord>& a_records, bool& a_truncated, std::string& a_error);
+}
@@ -0,0 +1,53 @@
+#include "selection/warmSet.h"
+
+#include <algorithm>
+
+namespace Selection
+{
+	void WarmSet::SetCapacity(std::size_t a_capacity)
+	{
+		capacity = std::max<std::size_t>(a_capacity, 1);
+		if (entries.size() > capacity) {
+			entries.resize(capacity);
+		}
+	}
+
+	bool WarmSet::Touch(FormID a_music)
+	{
+		const auto it = std::find(entries.begin(), entries.end(), a_music);
+		if (it != entries.end()) {
+			std::rotate(entries.begin(), it, it + 1);
+			return false;
+		}
+		if (entries.size() >= capacity) {
+			entries.pop_back();
+		}
+		entries.insert(entries.begin(), a_music);
+		return true;
+	}
+
+	bool WarmSet::Contains(FormID a_music) const
+	{
+		return std::find(entries.begin(), entries.end(), a_music) != entries.end();
+	}
+
+	bool WarmSet::RecordStart(FormID a_music)
+	{
+		starts++;
+		const bool hit = Contains(a_music);
+		if (hit) {
+			hits++;
+		}
+		return hit;
+	}
+
+	void WarmSet::Clear()
+	{
+		entries.clear();
+	}
+
+	double WarmSet::GetHitRate() const
+	{
+		return starts > 0 ? static_cast<double>(hits) / static_cast<double>(starts) : 0.0;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "selection/context.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace Selection
+{
+	/*
+	* The music most recently predicted to play next, up to a fixed count, most recent first. Predicting
+	* music that is already warm only moves it to the front, so its audio is read once per stay in the set.
+	* Counts how many of the music starts were predicted.
+	*/
+	class WarmSet
+	{
+	public:
+		// Drops the least recently predicted music beyond a_capacity.
+		void SetCapacity(std::size_t a_capacity);
+		// Marks the music as the most recently predicted. Returns true if it was not warm yet.
+		bool Touch(FormID a_music);
+		bool Contains(FormID a_music) const;
+		// Counts a start, and a hit if the music was warm. Returns whether it was.
+		bool RecordStart(FormID a_music);
+		void Clear();
+
+		std::size_t GetSize() const { return entries.size(); }
+		std::uint64_t GetStarts() const { return starts; }
+		std::uint64_t GetHits() const { return hits; }
+		// Fraction of the starts that were predicted, or 0 before the first start.
+		double GetHitRate() const;
+
+	private:
+		// A handful of entries, so a linear search beats any index.
+		std::vector<FormID> entries;
+		std::size_t capacity{ 8 };
+		std::uint64_t starts{ 0 };
+		std::uint64_t hits{ 0 };
+	};
+}
@@ -0,0 +1,87 @@
+#include "serialization/serialization.h"
+
+#include "events/combatEvent.h"
+#include "hooks/hooks.h"
+
+namespace Serialization
+{
+	namespace
+	{
+		void SaveCallback(SKSE::SerializationInterface* a_intfc)
+		{
+			const auto calls = Hooks::CombatMusicCalls::GetSingleton();
+			const auto selection = calls->GetStoredSelection();
+			if (!selection) {
+				return;
+			}
+
+			const std::uint64_t hash = calls->GetRuleSetHash();
+			const auto category = static_cast<std::uint32_t>(selection->category);
+			const RE::FormID music = selection->music->GetFormID();
+			if (!a_intfc->OpenRecord(MUSIC_RECORD, MUSIC_VERSION) ||
+				!a_intfc->WriteRecordData(hash) ||
+				!a_intfc->WriteRecordData(category) ||
+				!a_intfc->WriteRecordData(music)) {
+				logger::error("Failed to save the current music.");
+			}
+		}
+
+		void LoadMusic(SKSE::SerializationInterface* a_intfc)
+		{
+			std::uint64_t hash = 0;
+			std::uint32_t category = 0;
+			RE::FormID music = 0;
+			if (a_intfc->ReadRecordData(hash) != sizeof(hash) ||
+				a_intfc->ReadRecordData(category) != sizeof(category) ||
+				a_intfc->ReadRecordData(music) != sizeof(music)) {
+				logger::warn("Saved music record is damaged, music will be picked again.");
+				return;
+			}
+
+			RE::FormID resolved = 0;
+			if (category >= Selection::TOTAL_MUSIC_CATEGORIES || !a_intfc->ResolveFormID(music, resolved)) {
+				logger::info("Saved music is no longer available, music will be picked again.");
+				return;
+			}
+			const auto form = RE::TESForm::LookupByID<RE::BGSMusicType>(resolved);
+			if (!form) {
+				logger::info("Saved music is no longer available, music will be picked again.");
+				return;
+			}
+			// The rules may still be loading, so the load hook compares the rule set.
+			Hooks::CombatMusicCalls::GetSingleton()->SetRestoredSelection({ static_cast<Selection::MusicCategory>(category), form }, hash);
+		}
+
+		void LoadCallback(SKSE::SerializationInterface* a_intfc)
+		{
+			std::uint32_t type = 0;
+			std::uint32_t version = 0;
+			std::uint32_t length = 0;
+			while (a_intfc->GetNextRecordInfo(type, version, length)) {
+				if (type != MUSIC_RECORD) {
+					continue;
+				}
+				if (version != MUSIC_VERSION) {
+					logger::warn("Saved music record has an unsupported version ({}), music will be picked again.", version);
+					continue;
+				}
+				LoadMusic(a_intfc);
+			}
+		}
+
+		void RevertCallback(SKSE::SerializationInterface*)
+		{
+			Hooks::CombatMusicCalls::GetSingleton()->ClearRestoredSelection();
+			Events::CombatEvent::GetSingleton()->ClearCombatants();
+		}
+	}
+
+	void Install()
+	{
+		const auto serialization = SKSE::GetSerializationInterface();
+		serialization->SetUniqueID(ID);
+		serialization->SetSaveCallback(&SaveCallback);
+		serialization->SetLoadCallback(&LoadCallback);
+		serialization->SetRevertCallback(&RevertCallback);
+	}
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+namespace Serialization
+{
+	inline constexpr std::uint32_t ID = 0x4353434D;            // "MCSC"
+	inline constexpr std::uint32_t MUSIC_RECORD = 0x4353554D;  // "MUSC"
+	inline constexpr std::uint32_t MUSIC_VERSION = 1;
+
+	// Registers the co-save callbacks that keep the picked music across saving and loading.
+	void Install();
+}
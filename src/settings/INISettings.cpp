@@ -1,11 +1,27 @@
 #include "settings/INISettings.h"
 
 #include "events/combatEvent.h"
+#include "hooks/hooks.h"
+#include "preload/musicPreloader.h"
+#include "settings/JSONSettings.h"
+#include "trace/traceRecorder.h"
 #include <SimpleIni.h>
 
 namespace INISettings
 {
+	void ReadEarly() {
+		::CSimpleIniA ini{};
+		ini.SetUnicode();
+		ini.LoadFile(fmt::format(R"(.\Data\SKSE\Plugins\{}.ini)", Plugin::NAME).c_str());
+
+		if (ini.GetBoolValue("Trace", "bStartup", false)) {
+			Selection::StartupTracer::Enable();
+			Selection::StartupTracer::NameThread("Main");
+		}
+	}
+
 	void Read() {
+		Selection::StartupSpan span{ "INISettings::Read" };
 		//Adapted from Exit-9B (Parapets)
 		::CSimpleIniA ini{};
 		ini.SetUnicode();
@@ -15,5 +31,46 @@ namespace INISettings
 		const auto combatMusicFixTimeSpanSeconds = ini.GetLongValue("General", "iCombatMusicFixWait", 10);
 		Events::CombatEvent::GetSingleton()->SetWaitTime(combatMusicFixTimeSpanSeconds);
 		Events::CombatEvent::GetSingleton()->SetShouldWait(combatMusicFixShouldWait);
+
+		const auto compileRules = ini.GetBoolValue("Selection", "bCompileRules", false);
+		Hooks::CombatMusicCalls::GetSingleton()->SetCompileRules(compileRules);
+		const auto shadowRate = ini.GetDoubleValue("Selection", "fShadowRate", 0.0);
+		Hooks::CombatMusicCalls::GetSingleton()->SetShadowRate(static_cast<float>(shadowRate));
+		const auto poolTies = ini.GetBoolValue("Selection", "bPoolTies", false);
+		Hooks::CombatMusicCalls::GetSingleton()->SetPoolTies(poolTies);
+		const auto musicSeed = ini.GetLongValue("Selection", "iMusicSeed", 0);
+		Hooks::CombatMusicCalls::GetSingleton()->SetMusicSeed(static_cast<std::uint64_t>(musicSeed));
+		const auto adaptiveOrder = ini.GetBoolValue("Selection", "bAdaptiveOrder", false);
+		Hooks::CombatMusicCalls::GetSingleton()->SetAdaptiveOrder(adaptiveOrder);
+		const auto parallelThreshold = std::max(ini.GetLongValue("Selection", "iParallelThreshold", 0), 0l);
+		const auto parallelThreads = std::max(ini.GetLongValue("Selection", "iParallelThreads", 0), 0l);
+		Hooks::CombatMusicCalls::GetSingleton()->SetParallelScoring(static_cast<std::size_t>(parallelThreshold), static_cast<std::size_t>(parallelThreads));
+		const auto ruleProgram = ini.GetBoolValue("Selection", "bRuleProgram", false);
+		const auto nativeRules = ini.GetBoolValue("Selection", "bNativeRules", false);
+		Hooks::CombatMusicCalls::GetSingleton()->SetRuleProgram(ruleProgram, nativeRules);
+		const auto speculate = ini.GetBoolValue("Selection", "bSpeculate", false);
+		Hooks::CombatMusicCalls::GetSingleton()->SetSpeculation(speculate);
+
+		Selection::IntensitySettings intensity{};
+		intensity.thresholds[0] = static_cast<std::uint32_t>(std::max(ini.GetLongValue("Intensity", "iMediumThreat", 40), 0l));
+		intensity.thresholds[1] = static_cast<std::uint32_t>(std::max(ini.GetLongValue("Intensity", "iHighThreat", 100), 0l));
+		intensity.thresholds[2] = static_cast<std::uint32_t>(std::max(ini.GetLongValue("Intensity", "iExtremeThreat", 200), 0l));
+		intensity.bossWeight = static_cast<std::uint32_t>(std::max(ini.GetLongValue("Intensity", "iBossWeight", 3), 1l));
+		Events::CombatEvent::GetSingleton()->SetIntensitySettings(intensity);
+
+		const auto backgroundLoading = ini.GetBoolValue("Loading", "bBackground", true);
+		JSONSettings::SetBackgroundLoading(backgroundLoading);
+		const auto waitForRules = ini.GetBoolValue("Loading", "bWaitForRules", false);
+		const auto waitTimeout = ini.GetLongValue("Loading", "iWaitTimeout", 2000);
+		Hooks::CombatMusicCalls::GetSingleton()->SetReadyTimeout(std::chrono::milliseconds(waitForRules ? waitTimeout : 0));
+
+		const auto preload = ini.GetBoolValue("Preload", "bPredict", false);
+		const auto preloadTracks = std::max(ini.GetLongValue("Preload", "iTracks", 8), 1l);
+		const auto preloadKilobytes = std::max(ini.GetLongValue("Preload", "iReadKB", 512), 4l);
+		Preload::MusicPreloader::GetSingleton()->SetEnabled(preload);
+		Preload::MusicPreloader::GetSingleton()->SetLimits(static_cast<std::size_t>(preloadTracks), static_cast<std::size_t>(preloadKilobytes) * 1024);
+
+		const auto recordTrace = ini.GetBoolValue("Trace", "bRecord", false);
+		Trace::Recorder::GetSingleton()->SetEnabled(recordTrace);
 	}
 }
\ No newline at end of file
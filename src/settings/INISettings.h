@@ -2,5 +2,7 @@
 
 namespace INISettings
 {
+	// Settings needed before the game data is loaded. Call on SKSEPlugin_Load.
+	void ReadEarly();
 	void Read();
 }
\ No newline at end of file
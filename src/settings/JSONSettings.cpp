@@ -1,16 +1,26 @@
 #include "settings/JSONSettings.h"
 
+#include "api/api.h"
 #include "hooks/hooks.h"
+#include "selection/pluginSet.h"
+#include "selection/ruleSetIO.h"
+#include "trace/backgroundQueue.h"
 #include "utilities/utilities.h"
 
 namespace JSONSettings
 {
+	static bool backgroundLoading{ true };
+
 	static std::vector<std::string> findJsonFiles()
 	{
 		static constexpr std::string_view directory = R"(Data/SKSE/Plugins/CombatMusic)";
 		std::vector<std::string> jsonFilePaths;
 		for (const auto& entry : std::filesystem::directory_iterator(directory)) {
-			if (entry.is_regular_file() && entry.path().extension() == ".json") {
+			if (!entry.is_regular_file()) {
+				continue;
+			}
+			const auto extension = entry.path().extension();
+			if (extension == ".json" || extension == Selection::COMPILED_RULES_EXTENSION) {
 				jsonFilePaths.push_back(entry.path().string());
 			}
 		}
@@ -19,355 +29,455 @@ namespace JSONSettings
 		return jsonFilePaths;
 	}
 
-	void Read() {
-		logger::info("Reading configuration files...");
-		std::vector<std::string> paths{};
-		try {
-			paths = findJsonFiles();
-		}
-		catch (const std::exception& e) {
-			logger::warn("Caught {} while reading files.", e.what());
-			return;
+	// Full and light plugins that are active. Inactive plugins in the data folder are not included.
+	static Selection::PluginSet GetActivePlugins()
+	{
+		Selection::PluginSet response{};
+		const auto& collection = RE::TESDataHandler::GetSingleton()->compiledFileCollection;
+		for (const auto* file : collection.files) {
+			if (file) {
+				response.Add(file->GetFilename());
+			}
 		}
-		if (paths.empty()) {
-			logger::info("No settings found");
-			return;
+		for (const auto* file : collection.smallFiles) {
+			if (file) {
+				response.Add(file->GetFilename());
+			}
 		}
+		return response;
+	}
 
-		logger::info("Found {} files.", paths.size());
-		for (const auto& path : paths) {
-			logger::info("Reading <{}>:", path);
-			Json::Reader JSONReader;
-			Json::Value JSONFile;
-			try {
-				std::ifstream rawJSON(path);
-				JSONReader.parse(rawJSON, JSONFile);
+	template <class T, class C>
+	static bool ResolveCondition(const Selection::RuleFile& a_file, const Selection::RuleDefinition& a_rule, const Selection::ConditionDefinition& a_definition,
+		std::vector<T*> C::*a_forms, Hooks::CombatMusicCalls::ConditionalBattleMusic& a_music)
+	{
+		auto condition = std::make_unique<C>();
+		condition->AND = a_definition.AND;
+		for (const auto& form : a_definition.forms) {
+			const auto found = Utilities::Forms::GetFormFromString<T>(form);
+			if (!found) {
+				logger::warn("<{}> rule #{} -> {}: <{}> could not resolve form.", a_file.path, a_rule.index, Selection::GetConditionKey(a_definition.type), form);
+				return false;
 			}
-			catch (const Json::Exception& e) {
-				logger::warn("Caught {} while reading files.", e.what());
-				continue;
+			((*condition).*a_forms).push_back(found);
+		}
+		a_music.conditions.push_back(std::move(condition));
+		return true;
+	}
+
+	// Intensity conditions name tiers, which the parser already checked.
+	static bool ResolveIntensityCondition(const Selection::ConditionDefinition& a_definition, Hooks::CombatMusicCalls::ConditionalBattleMusic& a_music)
+	{
+		auto condition = std::make_unique<Hooks::CombatMusicCalls::IntensityCondition>();
+		condition->AND = a_definition.AND;
+		for (const auto& name : a_definition.forms) {
+			const auto tier = Selection::FindIntensityTier(name);
+			if (!tier) {
+				return false;
 			}
-			catch (const std::exception& e) {
-				logger::error("Caught unhandled exception {} while reading files.", e.what());
-				continue;
+			condition->tiers.push_back(*tier);
+		}
+		a_music.conditions.push_back(std::move(condition));
+		return true;
+	}
+
+	static bool ResolveCondition(const Selection::RuleFile& a_file, const Selection::RuleDefinition& a_rule, const Selection::ConditionDefinition& a_definition,
+		Hooks::CombatMusicCalls::ConditionalBattleMusic& a_music)
+	{
+		using Calls = Hooks::CombatMusicCalls;
+		using Type = Selection::ConditionType;
+		switch (a_definition.type) {
+		case Type::kWorldspace:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::WorldspaceCondition::worldspaces, a_music);
+		case Type::kCell:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::CellCondition::cells, a_music);
+		case Type::kLocation:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::LocationCondition::locations, a_music);
+		case Type::kLocationKeyword:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::LocationKeywordCondition::keywords, a_music);
+		case Type::kCombatTarget:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::CombatTargetCondition::targets, a_music);
+		case Type::kCombatTargetKeyword:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::CombatTargetKeywordCondition::keywords, a_music);
+		case Type::kCombatant:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::CombatantCondition::combatants, a_music);
+		case Type::kCombatantKeyword:
+			return ResolveCondition(a_file, a_rule, a_definition, &Calls::CombatantKeywordCondition::keywords, a_music);
+		case Type::kIntensity:
+			return ResolveIntensityCondition(a_definition, a_music);
+		default:
+			return false;
+		}
+	}
+
+	template <class T>
+	static std::optional<RE::FormID> ResolveFormID(const std::string& a_reference)
+	{
+		const auto* form = Utilities::Forms::GetFormFromString<T>(a_reference);
+		return form ? std::optional<RE::FormID>(form->GetFormID()) : std::nullopt;
+	}
+
+	// Expressions only keep FormIDs, resolved as the condition of the same type would resolve them.
+	static std::optional<RE::FormID> ResolveExpressionForm(Selection::ConditionType a_type, const std::string& a_reference)
+	{
+		using Type = Selection::ConditionType;
+		switch (a_type) {
+		case Type::kWorldspace:
+			return ResolveFormID<RE::TESWorldSpace>(a_reference);
+		case Type::kCell:
+			return ResolveFormID<RE::TESObjectCELL>(a_reference);
+		case Type::kLocation:
+			return ResolveFormID<RE::BGSLocation>(a_reference);
+		case Type::kCombatTarget:
+		case Type::kCombatant:
+			return ResolveFormID<RE::TESNPC>(a_reference);
+		case Type::kLocationKeyword:
+		case Type::kCombatTargetKeyword:
+		case Type::kCombatantKeyword:
+			return ResolveFormID<RE::BGSKeyword>(a_reference);
+		case Type::kIntensity:
+			if (const auto tier = Selection::FindIntensityTier(a_reference)) {
+				return static_cast<RE::FormID>(*tier);
 			}
+			return std::nullopt;
+		default:
+			return std::nullopt;
+		}
+	}
 
-			if (!JSONFile.isObject()) {
-				logger::warn("Warning: <{}> is not an object. File will be ignored.", path);
-				continue;
+	static void LogCondition(const Hooks::CombatMusicCalls::Condition& a_condition)
+	{
+		using Type = Selection::ConditionType;
+		const auto formIDs = a_condition.GetFormIDs();
+		switch (a_condition.type) {
+		case Type::kWorldspace:
+			logger::info("  >Music will apply to these worldspaces ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kCell:
+			logger::info("  >Music will apply to these cells ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kLocation:
+			logger::info("  >Music will apply to these locations (PO3's Tweaks must be enabled to view) ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kLocationKeyword:
+			logger::info("  >Music will apply to locations with these keywords ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kCombatTarget:
+			logger::info("  >Music will apply to these combat targets ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kCombatTargetKeyword:
+			logger::info("  >Music will apply to combat targets with these keywords ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kCombatant:
+			logger::info("  >Music will apply when fighting any of these actors ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kCombatantKeyword:
+			logger::info("  >Music will apply when fighting any actor with these keywords ({}):", a_condition.AND ? "AND" : "OR");
+			break;
+		case Type::kRange:
+			{
+				const auto& ranged = static_cast<const Hooks::CombatMusicCalls::RangeCondition&>(a_condition);
+				logger::info("  >Music will apply when {} is from {} to {} ({}).",
+					Selection::GetQuantityKey(ranged.quantity),
+					ranged.range.low,
+					ranged.range.high,
+					a_condition.AND ? "AND" : "OR");
+				return;
 			}
+		case Type::kExtension:
+			logger::info("  >Music will apply when the registered condition <{}> holds ({}).",
+				static_cast<const Hooks::CombatMusicCalls::ExtensionCondition&>(a_condition).key,
+				a_condition.AND ? "AND" : "OR");
+			return;
+		case Type::kIntensity:
+			logger::info("  >Music will apply to fights of these intensities ({}):", a_condition.AND ? "AND" : "OR");
+			for (const auto tier : formIDs) {
+				logger::info("    [{}]", Selection::GetIntensityTierName(static_cast<Selection::IntensityTier>(tier)));
+			}
+			return;
+		default:
+			return;
+		}
 
-			const auto& combatMusic = JSONFile["combatMusic"];
-			if (!combatMusic || !combatMusic.isArray()) {
-				logger::warn("<{}> is missing conditional music, or conditional music is not an array.", path);
+		for (const auto formID : formIDs) {
+			const auto* form = RE::TESForm::LookupByID(formID);
+			if (!form) {
 				continue;
 			}
+			const bool isActor = a_condition.type == Type::kCombatTarget || a_condition.type == Type::kCombatant;
+			const auto message = isActor ? std::string(form->GetName()) : Utilities::EDID::GetEditorID(form);
+			if (!message.empty()) {
+				logger::info("    [{}]", message);
+			}
+		}
+	}
 
-			for (const auto& entry : combatMusic) {
-				if (!entry.isObject()) {
-					logger::warn("<{}> has a non-object entry in conditionalMusic. Said entry will be ignored.", path);
-					continue;
-				}
-
-				bool errorOccured = false;
+	// Unregistered kinds are skipped like any other unknown key, but a payload the owning plugin rejects drops the rule.
+	static bool ResolveExtension(const Selection::RuleFile& a_file,
+		const Selection::RuleDefinition& a_rule,
+		const Selection::ExtensionDefinition& a_extension,
+		Hooks::CombatMusicCalls::ConditionalBattleMusic& a_music)
+	{
+		const auto kind = API::Interface::GetSingleton()->FindConditionKind(a_extension.key);
+		if (!kind) {
+			logger::warn("<{}> rule #{} -> {}: no plugin registered this condition, ignoring it.", a_file.path, a_rule.index, a_extension.key);
+			return true;
+		}
 
-				auto entryWorldspaceCondition = Hooks::CombatMusicCalls::WorldspaceCondition();
-				const auto& entryWorldspaces = entry["worldspaces"];
-				if (entryWorldspaces && entryWorldspaces.isObject()) {
-					const auto& conditionArray = entryWorldspaces["forms"];
-					const auto& conditionAND = entryWorldspaces["AND"];
-					if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
-						logger::warn("<{}> contains a worldspace condition that is missing or has incorrect setup.", path);
-						continue;
-					}
-					for (const auto& entryWorldspace : conditionArray) {
-						if (!entryWorldspace.isString()) {
-							logger::warn("<{}> contains a worldspace condition that is not a string.", path);
-							errorOccured = true;
-							continue;
-						}
+		auto condition = std::make_unique<Hooks::CombatMusicCalls::ExtensionCondition>();
+		if (!kind->parse(a_extension.json.c_str(), std::addressof(condition->payload), kind->user)) {
+			logger::warn("<{}> rule #{} -> {}: the registering plugin rejected the condition.", a_file.path, a_rule.index, a_extension.key);
+			return false;
+		}
+		condition->key = kind->key;
+		condition->kind = kind->index;
+		condition->evaluate = kind->evaluate;
+		condition->evaluateV2 = kind->evaluateV2;
+		condition->user = kind->user;
+		condition->inputs = kind->inputs;
+		condition->cost = kind->cost;
+		condition->AND = a_extension.AND;
+		a_music.conditions.push_back(std::move(condition));
+		return true;
+	}
 
-						const auto foundWorldspace = Utilities::Forms::GetFormFromString<RE::TESWorldSpace>(entryWorldspace.asString());
-						if (!foundWorldspace) {
-							logger::warn("<{}> -> <{}> could not resolve form.", path, entryWorldspace.asString());
-							errorOccured = true;
-							continue;
-						}
-						entryWorldspaceCondition.worldspaces.push_back(foundWorldspace);
-						entryWorldspaceCondition.AND = conditionAND.asBool();
-					}
-				}
-				else if (entryWorldspaces) {
-					logger::warn("<{}> contains worldspaces, but it is not an object.", path);
-					continue;
-				}
-				if (errorOccured) {
-					continue;
+	static void CreateRule(const Selection::RuleFile& a_file, const Selection::RuleDefinition& a_rule)
+	{
+		Selection::StartupSpan span{ "Create rule" };
+		std::vector<RE::BGSMusicType*> pool{};
+		{
+			Selection::StartupSpan resolveSpan{ "Resolve music" };
+			for (const auto& music : a_rule.newMusic) {
+				const auto entryMusicForm = Utilities::Forms::GetFormFromString<RE::BGSMusicType>(music.form);
+				if (!entryMusicForm) {
+					logger::warn("<{}> rule #{} -> newMusic: <{}> could not resolve form.", a_file.path, a_rule.index, music.form);
+					return;
 				}
+				pool.push_back(entryMusicForm);
+			}
+		}
 
-				auto entryCombatTargetCondition = Hooks::CombatMusicCalls::CombatTargetCondition();
-				const auto& entryCombatTarget = entry["combatTarget"];
-				if (entryCombatTarget && entryCombatTarget.isObject()) {
-					const auto& conditionArray = entryCombatTarget["forms"];
-					const auto& conditionAND = entryCombatTarget["AND"];
-					if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
-						logger::warn("<{}> contains a combatTarget condition that is missing or has incorrect setup.", path);
-						continue;
-					}
-					for (const auto& combatTarget : conditionArray) {
-						if (!combatTarget.isString()) {
-							logger::warn("<{}> contains a combatTarget condition that is not a string.", path);
-							errorOccured = true;
-							continue;
-						}
-
-						const auto foundActor = Utilities::Forms::GetFormFromString<RE::TESNPC>(combatTarget.asString());
-						if (!foundActor) {
-							logger::warn("<{}> -> <{}> could not resolve form.", path, combatTarget.asString());
-							errorOccured = true;
-							continue;
-						}
-						entryCombatTargetCondition.AND = conditionAND.asBool();
-						entryCombatTargetCondition.targets.push_back(foundActor);
-					}
+		auto newCombatMusic = Hooks::CombatMusicCalls::ConditionalBattleMusic(pool.front(), a_rule.newMusic.front().weight);
+		for (std::size_t i = 1; i < pool.size(); ++i) {
+			newCombatMusic.AddMusic(pool[i], a_rule.newMusic[i].weight);
+		}
+		newCombatMusic.source = a_file.path;
+		newCombatMusic.index = a_rule.index;
+		{
+			Selection::StartupSpan resolveSpan{ "Resolve conditions" };
+			for (const auto& condition : a_rule.conditions) {
+				if (!ResolveCondition(a_file, a_rule, condition, newCombatMusic)) {
+					return;
 				}
-				else if (entryCombatTarget) {
-					logger::warn("<{}> contains combatTarget, but it is not an object.", path);
-					continue;
+			}
+			for (const auto& definition : a_rule.ranges) {
+				auto condition = std::make_unique<Hooks::CombatMusicCalls::RangeCondition>();
+				condition->quantity = definition.quantity;
+				condition->range = definition.range;
+				condition->AND = definition.AND;
+				newCombatMusic.conditions.push_back(std::move(condition));
+			}
+			for (const auto& extension : a_rule.extensions) {
+				if (!ResolveExtension(a_file, a_rule, extension, newCombatMusic)) {
+					return;
 				}
-				if (errorOccured) {
-					continue;
+			}
+			if (a_rule.expression) {
+				std::string error{};
+				auto& expression = newCombatMusic.expression.emplace();
+				if (!expression.Compile(*a_rule.expression, ResolveExpressionForm, error)) {
+					logger::warn("<{}> rule #{} -> expression: {}", a_file.path, a_rule.index, error);
+					return;
 				}
+			}
+		}
 
-				auto entryCombatTargetKeywordsCondition = Hooks::CombatMusicCalls::CombatTargetKeywordCondition();
-				const auto& entryTargetKeywords = entry["combatTargetKeywords"];
-				if (entryTargetKeywords && entryTargetKeywords.isObject()) {
-					const auto& conditionArray = entryTargetKeywords["forms"];
-					const auto& conditionAND = entryTargetKeywords["AND"];
-					if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
-						logger::warn("<{}> contains a combatTarget condition that is missing or has incorrect setup.", path);
-						continue;
-					}
-
-					for (const auto& targetKeyword : conditionArray) {
-						if (!targetKeyword.isString()) {
-							logger::warn("<{}> contains a combatTargetKeywords condition that is not a string.", path);
-							errorOccured = true;
-							continue;
-						}
-
-						const auto foundKeyword = Utilities::Forms::GetFormFromString<RE::BGSKeyword>(targetKeyword.asString());
-						if (!foundKeyword) {
-							logger::warn("<{}> -> <{}> could not resolve form.", path, targetKeyword.asString());
-							errorOccured = true;
-							continue;
-						}
-						entryCombatTargetKeywordsCondition.keywords.push_back(foundKeyword);
-						entryCombatTargetKeywordsCondition.AND = conditionAND.asBool();
-					}
-				}
-				else if (entryTargetKeywords) {
-					logger::warn("<{}> contains combatTargetKeywords, but it is not an object.", path);
-					continue;
-				}
-				if (errorOccured) {
-					continue;
-				}
+		Selection::StartupSpan logSpan{ "Log rule" };
+		logger::info("Created new {} music: ", Selection::GetCategoryName(a_rule.category));
+		if (pool.size() > 1) {
+			const auto total = newCombatMusic.GetTotalWeight();
+			logger::info("  >Music will be picked from this pool:");
+			for (std::size_t i = 0; i < pool.size(); ++i) {
+				logger::info("    [{}] ({:.1f}%)", Utilities::EDID::GetEditorID(pool[i]), 100.0f * newCombatMusic.weights[i] / total);
+			}
+		}
+		for (const auto& condition : newCombatMusic.conditions) {
+			LogCondition(*condition);
+		}
+		if (a_rule.expression) {
+			logger::info("  >Music will only apply when {} ({} instructions).", a_rule.expression->Describe(), newCombatMusic.expression->GetCode().size());
+		}
+		logger::info("---------------------------------------------------");
 
-				auto entryCellCondition = Hooks::CombatMusicCalls::CellCondition();
-				const auto& entryCells = entry["cells"]; 
-				if (entryCells && entryCells.isObject()) {
-					const auto& conditionArray = entryCells["forms"];
-					const auto& conditionAND = entryCells["AND"];
-					if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
-						logger::warn("<{}> contains a combatTarget condition that is missing or has incorrect setup.", path);
-						continue;
-					}
+		Hooks::CombatMusicCalls::GetSingleton()->PushNewMusic(a_rule.category, std::move(newCombatMusic));
+	}
 
-					for (const auto& entryCell : conditionArray) {
-						if (!entryCell.isString()) {
-							logger::warn("<{}> contains a cell condition that is not a string.", path);
-							errorOccured = true;
-							continue;
-						}
+	namespace
+	{
+		// One rule file as read from disk, before any form in it is looked up.
+		struct ParsedFile {
+			std::string path;
+			std::vector<Selection::RuleFile> files;
+			std::vector<Selection::ParseIssue> issues;
+		};
+	}
 
-						const auto foundCell = Utilities::Forms::GetFormFromString<RE::TESObjectCELL>(entryCell.asString());
-						if (!foundCell) {
-							logger::warn("<{}> -> <{}> could not resolve form.", path, entryCell.asString());
-							errorOccured = true;
-							continue;
-						}
-						entryCellCondition.cells.push_back(foundCell);
-						entryCellCondition.AND = conditionAND.asBool();
-					}
-				}
-				else if (entryCells) {
-					logger::warn("<{}> contains cells, but it is not an object.", path);
-					continue;
-				}
-				if (errorOccured) {
-					continue;
-				}
+	// Scans the rule folder and parses every file. Looks nothing up in the game, so it may run on any thread.
+	static std::vector<ParsedFile> Parse()
+	{
+		Selection::StartupSpan span{ "Parse rule files" };
+		logger::info("Reading configuration files...");
+		std::vector<std::string> paths{};
+		try {
+			Selection::StartupSpan scanSpan{ "Scan rule folder" };
+			paths = findJsonFiles();
+		}
+		catch (const std::exception& e) {
+			logger::warn("Caught {} while reading files.", e.what());
+			return {};
+		}
+		if (paths.empty()) {
+			logger::info("No settings found");
+			return {};
+		}
 
-				auto entryLocationCondition = Hooks::CombatMusicCalls::LocationCondition();
-				const auto& entryLocations = entry["locations"];
-				if (entryLocations && entryLocations.isObject()) {
-					const auto& conditionArray = entryLocations["forms"];
-					const auto& conditionAND = entryLocations["AND"];
-					if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
-						logger::warn("<{}> contains a combatTarget condition that is missing or has incorrect setup.", path);
-						continue;
-					}
+		logger::info("Found {} files.", paths.size());
+		std::vector<ParsedFile> response{};
+		for (const auto& path : paths) {
+			Selection::StartupSpan parseSpan{ "Parse", path };
+			auto& parsed = response.emplace_back();
+			parsed.path = path;
+			if (std::filesystem::path(path).extension() == Selection::COMPILED_RULES_EXTENSION) {
+				Selection::ReadCompiledRules(path, parsed.files, parsed.issues);
+			}
+			else {
+				Selection::ParseRuleFile(path, parsed.files.emplace_back(), parsed.issues);
+			}
+		}
+		return response;
+	}
 
-					for (const auto& entryLocation : conditionArray) {
-						if (!entryLocation.isString()) {
-							logger::warn("<{}> contains a cell condition that is not a string.", path);
-							errorOccured = true;
-							continue;
-						}
+	// Looks up the forms of the parsed rules and compiles them. Main thread only, since it reads the game's forms,
+	// plugins and locations.
+	static void Resolve(const std::vector<ParsedFile>& a_parsed)
+	{
+		Selection::StartupSpan span{ "Resolve rules" };
+		// Rules hold on to the registered kinds, so no more can be added from here on.
+		API::Interface::GetSingleton()->CloseConditionKinds();
+		if (a_parsed.empty()) {
+			return;
+		}
 
-						const auto foundLocation = Utilities::Forms::GetFormFromString<RE::BGSLocation>(entryLocation.asString());
-						if (!foundLocation) {
-							logger::warn("<{}> -> <{}> could not resolve form.", path, entryLocation.asString());
-							errorOccured = true;
-							continue;
+		// Rules for plugins that are not loaded are dropped on their references alone, before any lookup.
+		const auto activePlugins = GetActivePlugins();
+		std::map<std::string, std::size_t, std::less<>> skippedRules{};
+		for (const auto& parsed : a_parsed) {
+			Selection::StartupSpan fileSpan{ "Read file", parsed.path };
+			logger::info("Reading <{}>:", parsed.path);
+			for (const auto& issue : parsed.issues) {
+				logger::warn("{}", issue.ToString());
+			}
+			for (const auto& file : parsed.files) {
+				for (const auto& rule : file.rules) {
+					if (const auto missing = activePlugins.FindMissing(rule); !missing.empty()) {
+						logger::debug("<{}> rule #{} needs {}, which is not loaded. Skipping it.", file.path, rule.index, missing);
+						auto found = skippedRules.find(missing);
+						if (found == skippedRules.end()) {
+							found = skippedRules.emplace(std::string(missing), 0).first;
 						}
-						entryLocationCondition.locations.push_back(foundLocation);
-						entryLocationCondition.AND = conditionAND.asBool();
+						found->second++;
+						continue;
 					}
+					CreateRule(file, rule);
 				}
-				else if (entryLocations) {
-					logger::warn("<{}> contains locations, but it is not an object.", path);
-					continue;
-				}
-				if (errorOccured) {
-					continue;
-				}
+			}
+			logger::info("Finished!");
+			logger::info("___________________________________________________");
+		}
 
-				auto entryLocationKeywordCondition = Hooks::CombatMusicCalls::LocationKeywordCondition();
-				const auto& entryLocationKeywords = entry["locationKeywords"];
-				if (entryLocationKeywords && entryLocationKeywords.isObject()) {
-					const auto& conditionArray = entryLocationKeywords["forms"];
-					const auto& conditionAND = entryLocationKeywords["AND"];
-					if (!conditionArray || !conditionArray.isArray() || !conditionAND || !conditionAND.isBool()) {
-						logger::warn("<{}> contains a entryLocationKeywords condition that is missing or has incorrect setup.", path);
-						continue;
-					}
+		if (!skippedRules.empty()) {
+			logger::info("Skipped rules for plugins that are not loaded:");
+			for (const auto& [plugin, count] : skippedRules) {
+				logger::info("  >{}: {} rules", plugin, count);
+			}
+			logger::info("___________________________________________________");
+		}
 
-					for (const auto& entryKeyword : conditionArray) {
-						if (!entryKeyword.isString()) {
-							logger::warn("<{}> contains a cell condition that is not a string.", path);
-							errorOccured = true;
-							continue;
-						}
+		{
+			Selection::StartupSpan pruneSpan{ "Prune rules" };
+			Hooks::CombatMusicCalls::GetSingleton()->PruneUnreachableRules();
+		}
+		{
+			Selection::StartupSpan compileSpan{ "Compile rules" };
+			Hooks::CombatMusicCalls::GetSingleton()->CompileRules();
+		}
+		{
+			Selection::StartupSpan statsSpan{ "Load condition statistics" };
+			Hooks::CombatMusicCalls::GetSingleton()->LoadConditionStats();
+		}
+		API::Interface::GetSingleton()->PublishRuleSet(Hooks::CombatMusicCalls::GetSingleton()->GetRuleSetHash());
+	}
 
-						const auto foundKeyword = Utilities::Forms::GetFormFromString<RE::BGSKeyword>(entryKeyword.asString());
-						if (!foundKeyword) {
-							logger::warn("<{}> -> <{}> could not resolve form.", path, entryKeyword.asString());
-							errorOccured = true;
-							continue;
-						}
-						entryLocationKeywordCondition.keywords.push_back(foundKeyword);
-						entryLocationKeywordCondition.AND = conditionAND.asBool();
-					}
-				}
-				else if (entryLocationKeywords) {
-					logger::warn("<{}> contains locationKeywords, but it is not an object", path);
-					continue;
-				}
-				if (errorOccured) {
-					continue;
-				}
+	void Read()
+	{
+		Selection::StartupSpan span{ "JSONSettings::Read" };
+		Resolve(Parse());
+	}
 
-				const auto& entryIsCombatMusic = entry["isCombatMusic"];
-				if (!entryIsCombatMusic || !entryIsCombatMusic.isBool()) {
-					logger::warn("<{}> is either missing musicType or it is not a bool.", path);
-					continue;
-				}
-				bool isCombatMusic = entryIsCombatMusic.asBool();
+	// Startup is over once the rules are ready, so the spans recorded so far are the whole trace.
+	static void WriteStartupTrace()
+	{
+		if (!Selection::StartupTracer::IsEnabled()) {
+			return;
+		}
+		auto path = logger::log_directory();
+		if (!path) {
+			logger::warn("Could not find the log directory, the startup trace is not written.");
+			return;
+		}
+		*path /= fmt::format("{}.startup.json"sv, Plugin::NAME);
+		std::string error{};
+		if (!Selection::StartupTracer::Write(path->string(), error)) {
+			logger::warn("Could not write the startup trace to <{}>: {}", path->string(), error);
+			return;
+		}
+		logger::info("Wrote the startup trace to <{}>.", path->string());
+	}
 
-				const auto& entryNewMusic = entry["newMusic"];
-				if (!entryNewMusic || !entryNewMusic.isString()) {
-					logger::warn("<{}> is either missing newMusic or it is not a string.", path);
-					continue;
-				}
-				const auto entryMusicForm = Utilities::Forms::GetFormFromString<RE::BGSMusicType>(entryNewMusic.asString());
-				if (!entryMusicForm) {
-					logger::warn("<{}> -> <{}> could not resolve form.", path, entryNewMusic.asString());
-					continue;
-				}
-				
-				auto newCombatMusic = Hooks::CombatMusicCalls::ConditionalBattleMusic(entryMusicForm);
-				if (!entryWorldspaceCondition.worldspaces.empty()) {
-					newCombatMusic.conditions.push_back(std::make_unique<Hooks::CombatMusicCalls::WorldspaceCondition>(entryWorldspaceCondition));
-				}
-				if (!entryCellCondition.cells.empty()) {
-					newCombatMusic.conditions.push_back(std::make_unique<Hooks::CombatMusicCalls::CellCondition>(entryCellCondition));
-				}
-				if (!entryLocationCondition.locations.empty()) {
-					newCombatMusic.conditions.push_back(std::make_unique<Hooks::CombatMusicCalls::LocationCondition>(entryLocationCondition));
-				}
-				if (!entryLocationKeywordCondition.keywords.empty()) {
-					newCombatMusic.conditions.push_back(std::make_unique<Hooks::CombatMusicCalls::LocationKeywordCondition>(entryLocationKeywordCondition));
-				}
-				if (!entryCombatTargetCondition.targets.empty()) {
-					newCombatMusic.conditions.push_back(std::make_unique<Hooks::CombatMusicCalls::CombatTargetCondition>(entryCombatTargetCondition));
-				}
-				if (!entryCombatTargetKeywordsCondition.keywords.empty()) {
-					newCombatMusic.conditions.push_back(std::make_unique<Hooks::CombatMusicCalls::CombatTargetKeywordCondition>(entryCombatTargetKeywordsCondition));
-				}
+	void Load()
+	{
+		// Timed from kDataLoaded, which the main menu waits on. In the background, this is the time the menu
+		// no longer waits for.
+		const auto start = std::chrono::steady_clock::now();
+		const auto finish = [start, background = backgroundLoading](const std::vector<ParsedFile>& a_parsed) {
+			Resolve(a_parsed);
+			const auto calls = Hooks::CombatMusicCalls::GetSingleton();
+			calls->StartTrace();
+			calls->MarkReady();
+			const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			logger::info("Rules are ready {:.1f}ms after the data loaded{}.", elapsed, background ? ", parsed in the background" : "");
+			WriteStartupTrace();
+		};
 
-				if (isCombatMusic) {
-					Hooks::CombatMusicCalls::GetSingleton()->PushNewCombatMusic(std::move(newCombatMusic));
-				}
-				else {
-					Hooks::CombatMusicCalls::GetSingleton()->PushNewClearedMusic(std::move(newCombatMusic));
-				}
-				
-				logger::info("Created new {} music: ", isCombatMusic ? "combat" : "dungeon cleared");
-				if (!entryWorldspaceCondition.worldspaces.empty()) {
-					logger::info("  >Music will apply to these worldspaces ({}):", entryWorldspaceCondition.AND ? "AND" : "OR");
-					for (const auto& string : entryWorldspaceCondition.worldspaces) {
-						logger::info("    [{}]", string->GetFormEditorID());
-					}
-				}
-				if (!entryCellCondition.cells.empty()) {
-					logger::info("  >Music will apply to these cells: ({}):", entryCellCondition.AND ? "AND" : "OR");
-					for (const auto& string : entryCellCondition.cells) {
-						logger::info("    [{}]", string->GetFormEditorID());
-					}
-				}
-				if (!entryLocationCondition.locations.empty()) {
-					logger::info("  >Music will apply to these locations: (PO3's Tweaks must be enabled to view) ({}):", entryLocationCondition.AND ? "AND" : "OR");
-					for (const auto& string : entryLocationCondition.locations) {
-						auto message = Utilities::EDID::GetEditorID(string);
-						if (!message.empty()) {
-							logger::info("    [{}]", message);
-						}
-					}
-				}
-				if (!entryLocationKeywordCondition.keywords.empty()) {
-					logger::info("  >Music will apply to locations with this keywords: ({}):", entryLocationCondition.AND ? "AND" : "OR");
-					for (const auto& string : entryLocationKeywordCondition.keywords) {
-						logger::info("    [{}]", string->GetFormEditorID());
-					}
-				}
-				if (!entryCombatTargetKeywordsCondition.keywords.empty()) {
-					logger::info("  >Music will apply to these locations: ({}):", entryCombatTargetKeywordsCondition.AND ? "AND" : "OR");
-					for (const auto& string : entryCombatTargetKeywordsCondition.keywords) {
-						logger::info("    [{}]", string->GetFormEditorID());
-					}
-				}
-				if (!entryCombatTargetCondition.targets.empty()) {
-					logger::info("  >Music will apply to these combat targets: ({}):", entryCombatTargetCondition.AND ? "AND" : "OR");
-					for (const auto& string : entryCombatTargetCondition.targets) {
-						logger::info("    [{}]", string->GetName());
-					}
-				}
-				logger::info("---------------------------------------------------");
-			}
-			logger::info("Finished!");
-			logger::info("___________________________________________________");;
+		if (!backgroundLoading) {
+			Selection::StartupSpan span{ "JSONSettings::Read" };
+			finish(Parse());
+			return;
 		}
+		// Only parsing leaves the main thread. Form lookups, the plugin list and the location walks of
+		// CompileRules are not safe while the game runs, so the rest is queued back to the main thread.
+		logger::info("Reading the rules in the background...");
+		Trace::BackgroundQueue::GetSingleton()->Post([finish]() {
+			Selection::StartupSpan span{ "JSONSettings::Parse" };
+			auto parsed = std::make_shared<const std::vector<ParsedFile>>(Parse());
+			const auto calls = Hooks::CombatMusicCalls::GetSingleton();
+			calls->SetPendingLoad([finish, parsed]() { finish(*parsed); });
+			SKSE::GetTaskInterface()->AddTask([calls]() { calls->RunPendingLoad(); });
+		});
+	}
+
+	void SetBackgroundLoading(bool a_background)
+	{
+		backgroundLoading = a_background;
 	}
-}
\ No newline at end of file
+}
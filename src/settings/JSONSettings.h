@@ -5,4 +5,8 @@
 namespace JSONSettings
 {
 	void Read();
+	// Reads the rules like Read, then starts the trace and lets the hooks use them. With background loading, only
+	// parsing runs on another thread, and the rest is queued back to the main thread. Call on kDataLoaded.
+	void Load();
+	void SetBackgroundLoading(bool a_background);
 }
\ No newline at end of file
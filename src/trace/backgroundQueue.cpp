@@ -0,0 +1,43 @@
+#include "trace/backgroundQueue.h"
+
+#include "selection/startupTrace.h"
+
+namespace Trace
+{
+	void BackgroundQueue::Post(Task a_task)
+	{
+		PostAfter(std::chrono::milliseconds::zero(), std::move(a_task));
+	}
+
+	void BackgroundQueue::PostAfter(std::chrono::milliseconds a_delay, Task a_task)
+	{
+		std::unique_lock guard{ lock };
+		tasks.emplace(std::make_pair(Clock::now() + a_delay, posted++), std::move(a_task));
+		// Never joined: the process exits without unloading plugins, and joining from a static destructor
+		// would run under the loader lock. Whatever is still queued then is dropped.
+		if (!std::exchange(running, true)) {
+			std::thread([this]() { Loop(); }).detach();
+		}
+		guard.unlock();
+		wake.notify_one();
+	}
+
+	void BackgroundQueue::Loop()
+	{
+		Selection::StartupTracer::NameThread("Background");
+		for (;;) {
+			std::unique_lock guard{ lock };
+			wake.wait(guard, [this]() { return !tasks.empty(); });
+			const auto first = tasks.begin();
+			if (first->first.first > Clock::now()) {
+				// Until it is due, or until a task that may be due sooner is posted.
+				wake.wait_until(guard, first->first.first);
+				continue;
+			}
+			auto task = std::move(first->second);
+			tasks.erase(first);
+			guard.unlock();
+			task();
+		}
+	}
+}
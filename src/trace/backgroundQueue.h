@@ -0,0 +1,37 @@
+#pragma once
+
+#include "utilities/utilities.h"
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+
+namespace Trace
+{
+	/*
+	* The plugin's one background thread. Work that must not hold up the game, like writing the trace, parsing
+	* the rules, reading music ahead of time or scoring a fight early, is posted here and runs in order.
+	*/
+	class BackgroundQueue : public Utilities::Singleton::ISingleton<BackgroundQueue>
+	{
+	public:
+		using Task = std::function<void()>;
+
+		// Runs a_task after everything posted before it that is already due.
+		void Post(Task a_task);
+		// Runs a_task once a_delay passed.
+		void PostAfter(std::chrono::milliseconds a_delay, Task a_task);
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		void Loop();
+
+		std::mutex lock;
+		std::condition_variable wake;
+		// Guarded by lock. By due time, then by posting order.
+		std::map<std::pair<Clock::time_point, std::uint64_t>, Task> tasks;
+		std::uint64_t posted{ 0 };
+		bool running{ false };
+	};
+}
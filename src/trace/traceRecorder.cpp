@@ -0,0 +1,63 @@
+#include "trace/traceRecorder.h"
+
+#include "trace/backgroundQueue.h"
+
+namespace Trace
+{
+	void Recorder::SetEnabled(bool a_enabled)
+	{
+		enabled = a_enabled;
+	}
+
+	void Recorder::Start(const Selection::TraceHeader& a_header)
+	{
+		if (!enabled || recording) {
+			return;
+		}
+
+		auto path = logger::log_directory();
+		if (!path) {
+			logger::warn("Could not find the log directory, hook calls will not be recorded.");
+			return;
+		}
+		*path /= fmt::format("{}.trace"sv, Plugin::NAME);
+
+		output.open(*path, std::ios::binary | std::ios::trunc);
+		if (!output) {
+			logger::warn("Could not open <{}>, hook calls will not be recorded.", path->string());
+			return;
+		}
+		const auto header = Selection::EncodeTraceHeader(a_header);
+		output.write(header.data(), static_cast<std::streamsize>(header.size()));
+		output.flush();
+
+		start = std::chrono::steady_clock::now();
+		recording = true;
+		// At most the last few hundred milliseconds are lost at exit.
+		BackgroundQueue::GetSingleton()->PostAfter(250ms, [this]() { Flush(); });
+		logger::info("Recording hook calls to <{}>.", path->string());
+	}
+
+	void Recorder::Record(Selection::TraceRecord& a_record)
+	{
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		a_record.timestamp = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		buffer.TryPush(a_record);
+	}
+
+	void Recorder::Flush()
+	{
+		pending.clear();
+		buffer.Drain([&](std::string_view a_record) { Selection::AppendTraceRecord(pending, a_record); });
+		if (!pending.empty()) {
+			output.write(pending.data(), static_cast<std::streamsize>(pending.size()));
+			output.flush();
+		}
+
+		if (const auto dropped = buffer.GetDropped(); dropped != reportedDrops) {
+			logger::warn("Trace buffer overflowed, {} hook calls were not recorded so far.", dropped);
+			reportedDrops = dropped;
+		}
+		BackgroundQueue::GetSingleton()->PostAfter(250ms, [this]() { Flush(); });
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "selection/trace.h"
+#include "utilities/utilities.h"
+
+namespace Trace
+{
+	// Records every music hook call to a trace file next to the log, for offline replay.
+	class Recorder : public Utilities::Singleton::ISingleton<Recorder>
+	{
+	public:
+		void SetEnabled(bool a_enabled);
+		// Opens the trace and starts writing it from the background queue. Call once the rules are final.
+		void Start(const Selection::TraceHeader& a_header);
+
+		bool IsRecording() const { return recording.load(std::memory_order_relaxed); }
+		// Stamps and queues a record. Never blocks; drops the record if the writer fell behind.
+		void Record(Selection::TraceRecord& a_record);
+
+	private:
+		// Writes the queued records, then posts itself again.
+		void Flush();
+
+		bool enabled{ false };
+		std::atomic_bool recording{ false };
+		std::chrono::steady_clock::time_point start{};
+		Selection::TraceBuffer buffer{ 1024 };
+		std::ofstream output{};
+		// Only used by Flush.
+		std::string pending{};
+		std::uint64_t reportedDrops{ 0 };
+	};
+}